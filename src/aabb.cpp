@@ -41,3 +41,28 @@ glm::vec3 AABB::Extents()
 {
     return (max - min) * 0.5f;
 }
+
+AABB AABB::Transformed(const glm::mat4& transform) const
+{
+    glm::vec3 center = glm::vec3(transform * glm::vec4((min + max) * 0.5f, 1.f));
+    glm::vec3 extent = (max - min) * 0.5f;
+
+    glm::mat3 absolute;
+    for (int column = 0; column < 3; column++)
+    {
+        absolute[column] = glm::abs(glm::vec3(transform[column]));
+    }
+    extent = absolute * extent;
+    return AABB(center - extent, center + extent);
+}
+
+AABB AABB::Union(const AABB& other) const
+{
+    return AABB(glm::min(min, other.min), glm::max(max, other.max));
+}
+
+float AABB::SurfaceArea() const
+{
+    glm::vec3 size = glm::max(max - min, glm::vec3(0.f));
+    return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
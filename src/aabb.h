@@ -12,4 +12,8 @@ struct AABB
 
     bool ViewFrustumIntersect(glm::mat4 viewProjection);
     glm::vec3 Extents();
+    // Smallest AABB around this box transformed by the matrix
+    AABB Transformed(const glm::mat4& transform) const;
+    AABB Union(const AABB& other) const;
+    float SurfaceArea() const;
 };
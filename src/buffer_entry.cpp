@@ -1,9 +1,9 @@
 #include "buffer_entry.h"
 
 BufferEntry::BufferEntry(const char *attributeName, int vectorElementCount, GLenum glType,
-        int vectorElementSize, bool normalized)
+        int vectorElementSize, bool normalized, int stream)
     : attributeName(attributeName), vectorElementCount(vectorElementCount), glType(glType), 
-      vectorElementSize(vectorElementSize), normalized(normalized),
+      vectorElementSize(vectorElementSize), normalized(normalized), stream(stream),
       size(vectorElementCount * vectorElementSize)
 {
 }
@@ -9,11 +9,14 @@ struct BufferEntry
     int vectorElementCount;
     GLenum glType;
     int vectorElementSize;
+    // Integer types are read as floats in [0, 1] (unsigned) or [-1, 1] (signed) instead of their value
     bool normalized;
+    // Vertex buffer the attribute is read from, entries of a stream are interleaved
+    int stream;
     int size;
 
     BufferEntry(const char *attributeName, int vectorSize, GLenum glType, int vectorElementSize,
-            bool normalized = false);
+            bool normalized = false, int stream = 0);
 };
 
 #endif
@@ -8,19 +8,25 @@ BufferLayout::BufferLayout()
 BufferLayout::BufferLayout(std::initializer_list<BufferEntry> entries)
     : entries(entries)
 {
-    int cumulativeOffset = 0;
     for (std::vector<BufferEntry>::const_iterator it = Begin(); it != End(); it++) 
     {
-        offsets.push_back(cumulativeOffset);
-        cumulativeOffset += it->vectorElementCount * it->vectorElementSize;
+        if (it->stream >= strides.size())
+        {
+            strides.resize(it->stream + 1, 0);
+        }
+        offsets.push_back(strides[it->stream]);
+        strides[it->stream] += it->vectorElementCount * it->vectorElementSize;
     }
+}
 
-    stride = cumulativeOffset;
+int BufferLayout::StreamCount() const
+{
+    return strides.size();
 }
 
-int BufferLayout::Stride() const 
+int BufferLayout::Stride(int stream) const 
 {
-    return stride;
+    return stream < strides.size() ? strides[stream] : 0;
 }
 
 int BufferLayout::Offset(int index) const
@@ -14,7 +14,10 @@ public:
     BufferLayout();
     BufferLayout(std::initializer_list<BufferEntry> entries);
 
-    int Stride() const;
+    // Streams are numbered from 0, each is interleaved in a vertex buffer of its own
+    int StreamCount() const;
+    int Stride(int stream = 0) const;
+    // Within the entry's stream
     int Offset(int index) const;
 
     ConstIterator Begin() const;
@@ -23,7 +26,7 @@ public:
 private:
     std::vector<BufferEntry> entries;
 
-    int stride;
+    std::vector<int> strides;
     std::vector<int> offsets;
 };
 
@@ -0,0 +1,370 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <float.h>
+
+#include "log.h"
+
+// Relative to testing an item's bounds
+#define BVH_TRAVERSAL_COST 1.f
+
+enum VolumeOverlap
+{
+    OUTSIDE,
+    INTERSECTING,
+    INSIDE,
+};
+
+static AABB EmptyBounds()
+{
+    return AABB(glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX));
+}
+
+static VolumeOverlap Overlap(const FrustumPlanes& frustum, const AABB& bounds)
+{
+    glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+    glm::vec3 extent = (bounds.max - bounds.min) * 0.5f;
+
+    VolumeOverlap overlap = INSIDE;
+    for (int p = 0; p < 6; p++)
+    {
+        glm::vec3 normal = glm::vec3(frustum.planes[p]);
+        float distance = glm::dot(normal, center) + frustum.planes[p].w;
+        float radius = glm::dot(glm::abs(normal), extent);
+        if (distance + radius < 0.f)
+        {
+            return OUTSIDE;
+        }
+        if (distance - radius < 0.f)
+        {
+            overlap = INTERSECTING;
+        }
+    }
+    return overlap;
+}
+
+static VolumeOverlap Overlap(glm::vec3 center, float radius, const AABB& bounds)
+{
+    glm::vec3 nearest = glm::max(glm::max(bounds.min - center, center - bounds.max), glm::vec3(0.f));
+    if (glm::dot(nearest, nearest) > radius * radius)
+    {
+        return OUTSIDE;
+    }
+
+    glm::vec3 furthest = glm::max(glm::abs(bounds.min - center), glm::abs(bounds.max - center));
+    return glm::dot(furthest, furthest) <= radius * radius ? INSIDE : INTERSECTING;
+}
+
+BVH::BVH() : buildCost(0.f), visitedNodeCount(0)
+{
+}
+
+void BVH::Build(const std::vector<AABB>& bounds)
+{
+    int count = bounds.size();
+    nodes.clear();
+    movedLeaves.clear();
+    itemBounds = bounds;
+    itemOrder.resize(count);
+    itemLeaves.assign(count, -1);
+    for (int i = 0; i < count; i++)
+    {
+        itemOrder[i] = i;
+    }
+    if (count == 0)
+    {
+        buildCost = 0.f;
+        return;
+    }
+
+    std::vector<glm::vec3> centroids(count);
+    for (int i = 0; i < count; i++)
+    {
+        centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+    }
+
+    nodes.reserve(2 * count);
+    nodes.push_back({ EmptyBounds(), -1, -1, 0, count });
+    std::vector<int> pending(1, 0);
+    while (!pending.empty())
+    {
+        int node = pending.back();
+        pending.pop_back();
+        Subdivide(node, centroids);
+        if (nodes[node].left != -1)
+        {
+            pending.push_back(nodes[node].left);
+            pending.push_back(nodes[node].left + 1);
+        }
+    }
+
+    RefitAll();
+    buildCost = Cost();
+}
+
+void BVH::Subdivide(int node, std::vector<glm::vec3>& centroids)
+{
+    int first = nodes[node].firstItem;
+    int count = nodes[node].itemCount;
+    if (count <= BVH_MAX_LEAF_ITEMS)
+    {
+        return;
+    }
+
+    AABB bounds = EmptyBounds();
+    AABB centroidBounds = EmptyBounds();
+    for (int i = first; i < first + count; i++)
+    {
+        bounds = bounds.Union(itemBounds[itemOrder[i]]);
+        centroidBounds = centroidBounds.Union(AABB(centroids[itemOrder[i]], centroids[itemOrder[i]]));
+    }
+
+    struct Bin
+    {
+        AABB bounds;
+        int count;
+    };
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = FLT_MAX;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float axisMin = centroidBounds.min[axis];
+        float axisExtent = centroidBounds.max[axis] - axisMin;
+        if (axisExtent <= 0.f)
+        {
+            continue;
+        }
+
+        Bin bins[BVH_SAH_BINS];
+        for (Bin& bin : bins)
+        {
+            bin = { EmptyBounds(), 0 };
+        }
+        float binScale = BVH_SAH_BINS / axisExtent;
+        for (int i = first; i < first + count; i++)
+        {
+            int bin = std::min((int)((centroids[itemOrder[i]][axis] - axisMin) * binScale), BVH_SAH_BINS - 1);
+            bins[bin].bounds = bins[bin].bounds.Union(itemBounds[itemOrder[i]]);
+            bins[bin].count++;
+        }
+
+        // Cost of splitting after bin i, right sides swept first
+        float rightCosts[BVH_SAH_BINS];
+        AABB sweptBounds = EmptyBounds();
+        int sweptCount = 0;
+        for (int i = BVH_SAH_BINS - 1; i > 0; i--)
+        {
+            sweptBounds = sweptBounds.Union(bins[i].bounds);
+            sweptCount += bins[i].count;
+            rightCosts[i - 1] = sweptBounds.SurfaceArea() * sweptCount;
+        }
+        sweptBounds = EmptyBounds();
+        sweptCount = 0;
+        for (int i = 0; i < BVH_SAH_BINS - 1; i++)
+        {
+            sweptBounds = sweptBounds.Union(bins[i].bounds);
+            sweptCount += bins[i].count;
+            float cost = sweptBounds.SurfaceArea() * sweptCount + rightCosts[i];
+            if (sweptCount > 0 && sweptCount < count && cost < bestCost)
+            {
+                bestAxis = axis;
+                bestSplit = i;
+                bestCost = cost;
+            }
+        }
+    }
+
+    // All centroids in one spot, or testing the items directly is cheaper
+    float leafCost = bounds.SurfaceArea() * count;
+    if (bestAxis == -1 || (leafCost > 0.f && BVH_TRAVERSAL_COST * bounds.SurfaceArea() + bestCost >= leafCost))
+    {
+        return;
+    }
+
+    float axisMin = centroidBounds.min[bestAxis];
+    float binScale = BVH_SAH_BINS / (centroidBounds.max[bestAxis] - axisMin);
+    int* middle = std::partition(&itemOrder[first], &itemOrder[first] + count, [&](int item)
+    {
+        return std::min((int)((centroids[item][bestAxis] - axisMin) * binScale), BVH_SAH_BINS - 1) <= bestSplit;
+    });
+    int leftCount = middle - &itemOrder[first];
+
+    int left = nodes.size();
+    nodes[node].left = left;
+    nodes.push_back({ EmptyBounds(), -1, node, first, leftCount });
+    nodes.push_back({ EmptyBounds(), -1, node, first + leftCount, count - leftCount });
+}
+
+void BVH::UpdateLeaf(int leaf)
+{
+    Node& node = nodes[leaf];
+    node.bounds = EmptyBounds();
+    for (int i = node.firstItem; i < node.firstItem + node.itemCount; i++)
+    {
+        node.bounds = node.bounds.Union(itemBounds[itemOrder[i]]);
+        itemLeaves[itemOrder[i]] = leaf;
+    }
+}
+
+void BVH::RefitAll()
+{
+    // Children come after their parents, so bounds can be gathered bottom up in reverse
+    for (int node = nodes.size() - 1; node >= 0; node--)
+    {
+        if (nodes[node].left == -1)
+        {
+            UpdateLeaf(node);
+        }
+        else
+        {
+            nodes[node].bounds = nodes[nodes[node].left].bounds.Union(nodes[nodes[node].left + 1].bounds);
+        }
+    }
+}
+
+void BVH::SetItemBounds(int item, const AABB& bounds)
+{
+    ASSERT(item < itemBounds.size());
+    itemBounds[item] = bounds;
+    movedLeaves.push_back(itemLeaves[item]);
+}
+
+void BVH::Refit()
+{
+    if (movedLeaves.empty())
+    {
+        return;
+    }
+
+    // Walking up from every leaf revisits the top of the tree, a full bottom up pass is cheaper when most moved
+    if (movedLeaves.size() * 4 > nodes.size())
+    {
+        RefitAll();
+        movedLeaves.clear();
+        return;
+    }
+
+    for (int leaf : movedLeaves)
+    {
+        UpdateLeaf(leaf);
+        // Ancestors above one that didn't change are already up to date
+        for (int node = nodes[leaf].parent; node != -1; node = nodes[node].parent)
+        {
+            AABB bounds = nodes[nodes[node].left].bounds.Union(nodes[nodes[node].left + 1].bounds);
+            if (bounds.min == nodes[node].bounds.min && bounds.max == nodes[node].bounds.max)
+            {
+                break;
+            }
+            nodes[node].bounds = bounds;
+        }
+    }
+    movedLeaves.clear();
+}
+
+float BVH::Cost() const
+{
+    if (nodes.empty() || nodes[0].bounds.SurfaceArea() <= 0.f)
+    {
+        return 0.f;
+    }
+
+    float cost = 0.f;
+    for (const Node& node : nodes)
+    {
+        cost += node.bounds.SurfaceArea() * (node.left == -1 ? node.itemCount : BVH_TRAVERSAL_COST);
+    }
+    return cost / nodes[0].bounds.SurfaceArea();
+}
+
+bool BVH::NeedsRebuild() const
+{
+    return Cost() > buildCost * BVH_REBUILD_COST_RATIO;
+}
+
+int BVH::ItemCount() const
+{
+    return itemBounds.size();
+}
+
+void BVH::AppendSubtree(int node, std::vector<int>& items) const
+{
+    const Node& subtree = nodes[node];
+    items.insert(items.end(), itemOrder.begin() + subtree.firstItem, itemOrder.begin() + subtree.firstItem + subtree.itemCount);
+}
+
+void BVH::Query(const FrustumPlanes& frustum, std::vector<int>& items) const
+{
+    visitedNodeCount = 0;
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    std::vector<int> pending(1, 0);
+    while (!pending.empty())
+    {
+        int node = pending.back();
+        pending.pop_back();
+        visitedNodeCount++;
+
+        VolumeOverlap overlap = Overlap(frustum, nodes[node].bounds);
+        if (overlap == INSIDE)
+        {
+            AppendSubtree(node, items);
+        }
+        else if (overlap == INTERSECTING && nodes[node].left != -1)
+        {
+            pending.push_back(nodes[node].left);
+            pending.push_back(nodes[node].left + 1);
+        }
+        else if (overlap == INTERSECTING)
+        {
+            for (int i = nodes[node].firstItem; i < nodes[node].firstItem + nodes[node].itemCount; i++)
+            {
+                if (Overlap(frustum, itemBounds[itemOrder[i]]) != OUTSIDE)
+                {
+                    items.push_back(itemOrder[i]);
+                }
+            }
+        }
+    }
+}
+
+void BVH::Query(glm::vec3 center, float radius, std::vector<int>& items) const
+{
+    visitedNodeCount = 0;
+    if (nodes.empty())
+    {
+        return;
+    }
+
+    std::vector<int> pending(1, 0);
+    while (!pending.empty())
+    {
+        int node = pending.back();
+        pending.pop_back();
+        visitedNodeCount++;
+
+        VolumeOverlap overlap = Overlap(center, radius, nodes[node].bounds);
+        if (overlap == INSIDE)
+        {
+            AppendSubtree(node, items);
+        }
+        else if (overlap == INTERSECTING && nodes[node].left != -1)
+        {
+            pending.push_back(nodes[node].left);
+            pending.push_back(nodes[node].left + 1);
+        }
+        else if (overlap == INTERSECTING)
+        {
+            for (int i = nodes[node].firstItem; i < nodes[node].firstItem + nodes[node].itemCount; i++)
+            {
+                if (Overlap(center, radius, itemBounds[itemOrder[i]]) != OUTSIDE)
+                {
+                    items.push_back(itemOrder[i]);
+                }
+            }
+        }
+    }
+}
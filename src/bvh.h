@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "aabb.h"
+#include "frustum_cull.h"
+
+#define BVH_MAX_LEAF_ITEMS 4
+#define BVH_SAH_BINS 16
+// Refits only move node bounds, so trees get looser as items move. Rebuilt once the SAH cost grew by this factor.
+#define BVH_REBUILD_COST_RATIO 2.f
+
+// Bounding volume hierarchy over world space AABBs of items 0..N-1. Built top down with binned SAH, moved items
+// refit the bounds of their ancestors without changing the topology. Queries reject subtrees outside the volume
+// and take subtrees fully inside it without testing their items.
+struct BVH
+{
+    struct Node
+    {
+        AABB bounds;
+        // Right child is left + 1, -1 for leaves
+        int left;
+        int parent;
+        // Items of the whole subtree, a range of itemOrder
+        int firstItem;
+        int itemCount;
+    };
+
+    std::vector<Node> nodes;
+    // Item indices, every subtree owns a contiguous range
+    std::vector<int> itemOrder;
+    std::vector<AABB> itemBounds;
+    // Leaf node of each item
+    std::vector<int> itemLeaves;
+    // SAH cost after the last Build
+    float buildCost;
+    // Nodes visited by the last query
+    mutable int visitedNodeCount;
+
+    BVH();
+
+    void Build(const std::vector<AABB>& bounds);
+    // Moves an item, the tree is out of date until Refit
+    void SetItemBounds(int item, const AABB& bounds);
+    // Brings the ancestors of moved items up to date
+    void Refit();
+    // Expected cost of a random ray/volume query relative to testing the root, lower is tighter
+    float Cost() const;
+    bool NeedsRebuild() const;
+    int ItemCount() const;
+
+    // Append the items that intersect the volume, in no particular order
+    void Query(const FrustumPlanes& frustum, std::vector<int>& items) const;
+    void Query(glm::vec3 center, float radius, std::vector<int>& items) const;
+
+private:
+    std::vector<int> movedLeaves;
+
+    void UpdateLeaf(int leaf);
+    void RefitAll();
+    // Splits a node in two unless it is small enough or testing its items directly is cheaper
+    void Subdivide(int node, std::vector<glm::vec3>& centroids);
+    void AppendSubtree(int node, std::vector<int>& items) const;
+};
@@ -0,0 +1,112 @@
+#include "camera_path.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#include "log.h"
+
+/*static*/ CameraPath CameraPath::DefaultPath()
+{
+    CameraPath path;
+    path.keys = {
+        { 0.f, glm::vec3(-2000.f,  300.f,   0.f), glm::vec3(2000.f,  400.f,    0.f) },
+        { 1.f, glm::vec3(    0.f,  500.f, 300.f), glm::vec3(2500.f,  200.f, -600.f) },
+        { 2.f, glm::vec3( 1500.f,  800.f, 100.f), glm::vec3(-2500.f, 200.f,  100.f) },
+        { 3.f, glm::vec3(  500.f, 2500.f,   0.f), glm::vec3(-2000.f, 300.f,    0.f) },
+        { 4.f, glm::vec3(-2000.f,  300.f, 200.f), glm::vec3(2000.f, 1200.f,    0.f) },
+    };
+    return path;
+}
+
+bool CameraPath::Load(const char* path)
+{
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        LOG_ERROR("Camera path", "Cannot open %s", path);
+        return false;
+    }
+
+    std::vector<Key> loadedKeys;
+    char line[512];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        lineNumber++;
+        char* comment = strchr(line, '#');
+        if (comment != nullptr)
+        {
+            *comment = '\0';
+        }
+
+        Key key;
+        int parsed = sscanf(line, "%f %f %f %f %f %f %f", &key.time, &key.pos.x, &key.pos.y, &key.pos.z,
+                &key.target.x, &key.target.y, &key.target.z);
+        if (parsed == EOF || parsed == 0)
+        {
+            continue;
+        }
+        if (parsed != 7)
+        {
+            LOG_WARN("Camera path", "%s:%d: expected \"time px py pz tx ty tz\", skipping", path, lineNumber);
+            continue;
+        }
+        loadedKeys.push_back(key);
+    }
+    fclose(file);
+
+    if (loadedKeys.empty())
+    {
+        LOG_ERROR("Camera path", "%s has no keys", path);
+        return false;
+    }
+
+    std::stable_sort(loadedKeys.begin(), loadedKeys.end(), [](const Key& a, const Key& b) { return a.time < b.time; });
+    keys = loadedKeys;
+    LOG_INFO("Camera path", "Loaded %lu keys from %s", keys.size(), path);
+    return true;
+}
+
+float CameraPath::Duration() const
+{
+    return keys.empty() ? 0.f : keys.back().time - keys.front().time;
+}
+
+void CameraPath::Apply(float t, Camera& camera) const
+{
+    if (keys.empty())
+    {
+        return;
+    }
+
+    glm::vec3 pos = keys.back().pos;
+    glm::vec3 target = keys.back().target;
+    if (t <= keys.front().time)
+    {
+        pos = keys.front().pos;
+        target = keys.front().target;
+    }
+    else
+    {
+        for (int i = 0; i + 1 < keys.size(); i++)
+        {
+            const Key& a = keys[i];
+            const Key& b = keys[i + 1];
+            if (t <= b.time)
+            {
+                float alpha = b.time > a.time ? (t - a.time) / (b.time - a.time) : 1.f;
+                pos = glm::mix(a.pos, b.pos, alpha);
+                target = glm::mix(a.target, b.target, alpha);
+                break;
+            }
+        }
+    }
+
+    camera.transform.pos = pos;
+    glm::vec3 direction = target - pos;
+    if (glm::length(direction) > 1e-4f)
+    {
+        camera.transform.rot = glm::quatLookAt(glm::normalize(direction), glm::vec3(0.f, 1.f, 0.f));
+    }
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "camera.h"
+
+// Scripted camera motion for reproducible runs (headless captures, benchmarks). Keys are linearly
+// interpolated by time, the camera always looks at the interpolated target.
+struct CameraPath
+{
+    struct Key
+    {
+        float time;
+        glm::vec3 pos;
+        glm::vec3 target;
+    };
+
+    // Sorted by time
+    std::vector<Key> keys;
+
+    // Flythrough of the test scene's Sponza atrium
+    static CameraPath DefaultPath();
+
+    // Text file with one "time px py pz tx ty tz" key per line, '#' starts a comment
+    bool Load(const char* path);
+
+    float Duration() const;
+    // t is in the path's time units, clamped to the first/last key
+    void Apply(float t, Camera& camera) const;
+};
@@ -0,0 +1,187 @@
+#include "compressed_texture.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "log.h"
+
+#define COMPRESSED_TEXTURE_MAGIC "IGCT"
+#define COMPRESSED_TEXTURE_VERSION 1
+// Full mip chain of a 32768x32768 texture
+#define COMPRESSED_TEXTURE_MAX_LEVELS 16
+
+struct CompressedTextureHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    uint64_t dataSize;
+};
+
+int BlockSize(BlockFormat format)
+{
+    return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+const char* ToString(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        return "BC1";
+    case BlockFormat::BC3:
+        return "BC3";
+    case BlockFormat::BC5:
+        return "BC5";
+    }
+    return "unknown";
+}
+
+/*static*/ std::string CompressedTexture::ContainerPath(const char* sourcePath)
+{
+    return std::string(sourcePath) + ".ctex";
+}
+
+/*static*/ bool CompressedTexture::HasUpToDateContainer(const char* sourcePath)
+{
+    struct stat sourceStat;
+    struct stat containerStat;
+    if (stat(sourcePath, &sourceStat) != 0 || stat(ContainerPath(sourcePath).c_str(), &containerStat) != 0)
+    {
+        return false;
+    }
+
+    return containerStat.st_mtime >= sourceStat.st_mtime;
+}
+
+/*static*/ uint64_t CompressedTexture::LevelSize(BlockFormat format, uint32_t width, uint32_t height)
+{
+    return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * BlockSize(format);
+}
+
+static uint32_t MaxLevelCount(uint32_t width, uint32_t height)
+{
+    uint32_t levelCount = 1;
+    for (uint32_t size = width > height ? width : height; size > 1; size /= 2)
+    {
+        levelCount++;
+    }
+    return levelCount < COMPRESSED_TEXTURE_MAX_LEVELS ? levelCount : COMPRESSED_TEXTURE_MAX_LEVELS;
+}
+
+// Leaves the file right after the header. Closes it on failure.
+static bool ReadValidHeader(FILE* file, const char* path, CompressedTextureHeader& header)
+{
+    struct stat fileStat;
+    bool valid = fstat(fileno(file), &fileStat) == 0 &&
+        fread(&header, sizeof(header), 1, file) == 1 &&
+        memcmp(header.magic, COMPRESSED_TEXTURE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == COMPRESSED_TEXTURE_VERSION &&
+        header.format <= (uint32_t)BlockFormat::BC5 && header.width > 0 && header.height > 0 &&
+        header.levelCount > 0 && header.levelCount <= MaxLevelCount(header.width, header.height);
+    if (!valid)
+    {
+        LOG_WARN("Compressed texture", "\"%s\" is not a valid texture container", path);
+        fclose(file);
+        return false;
+    }
+
+    // Checked before allocating anything, a corrupt header must not turn into a huge allocation
+    uint64_t levelsEnd = sizeof(header) + (uint64_t)header.levelCount * sizeof(CompressedMipLevel);
+    if ((uint64_t)fileStat.st_size < levelsEnd || header.dataSize > (uint64_t)fileStat.st_size - levelsEnd)
+    {
+        LOG_WARN("Compressed texture", "\"%s\" is truncated", path);
+        fclose(file);
+        return false;
+    }
+
+    return true;
+}
+
+bool CompressedTexture::ReadHeader(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    CompressedTextureHeader header;
+    if (file == nullptr || !ReadValidHeader(file, path, header))
+    {
+        return false;
+    }
+    fclose(file);
+
+    format = (BlockFormat)header.format;
+    width = header.width;
+    height = header.height;
+    levels.assign(header.levelCount, CompressedMipLevel());
+    data.clear();
+    return true;
+}
+
+bool CompressedTexture::Read(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    CompressedTextureHeader header;
+    if (file == nullptr || !ReadValidHeader(file, path, header))
+    {
+        return false;
+    }
+
+    format = (BlockFormat)header.format;
+    width = header.width;
+    height = header.height;
+    levels.resize(header.levelCount);
+    data.resize(header.dataSize);
+
+    bool valid = fread(levels.data(), sizeof(CompressedMipLevel), levels.size(), file) == levels.size() &&
+        fread(data.data(), 1, data.size(), file) == data.size();
+    for (CompressedMipLevel& level : levels)
+    {
+        // Separately, so that a huge offset can't wrap around
+        valid &= level.size <= data.size() && level.offset <= data.size() - level.size;
+    }
+    fclose(file);
+
+    if (!valid)
+    {
+        LOG_WARN("Compressed texture", "\"%s\" is truncated", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool CompressedTexture::Write(const char* path) const
+{
+    CompressedTextureHeader header;
+    memcpy(header.magic, COMPRESSED_TEXTURE_MAGIC, sizeof(header.magic));
+    header.version = COMPRESSED_TEXTURE_VERSION;
+    header.format = (uint32_t)format;
+    header.width = width;
+    header.height = height;
+    header.levelCount = levels.size();
+    header.dataSize = data.size();
+
+    // Temporary file + rename so that a running instance never picks up a half written container
+    std::string tmpPath = std::string(path) + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+        fwrite(levels.data(), sizeof(CompressedMipLevel), levels.size(), file) == levels.size() &&
+        fwrite(data.data(), 1, data.size(), file) == data.size();
+    written &= fclose(file) == 0;
+
+    if (!written || rename(tmpPath.c_str(), path) != 0)
+    {
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    return true;
+}
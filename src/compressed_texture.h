@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// GPU ready texture container (<source>.ctex) produced by the texture_baker tool: block compressed
+// data with the whole mip chain precomputed, so loading is a file read and one upload per level.
+enum class BlockFormat : uint32_t
+{
+    // RGB, 1-bit alpha unused, 8 bytes per 4x4 block
+    BC1,
+    // RGBA, 16 bytes per 4x4 block
+    BC3,
+    // Two channel, used for normal maps storing xy only, 16 bytes per 4x4 block
+    BC5,
+};
+
+int BlockSize(BlockFormat format);
+const char* ToString(BlockFormat format);
+
+struct CompressedMipLevel
+{
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct CompressedTexture
+{
+    BlockFormat format;
+    uint32_t width;
+    uint32_t height;
+    std::vector<CompressedMipLevel> levels;
+    // All levels back to back, CompressedMipLevel::offset is relative to the start of this
+    std::vector<unsigned char> data;
+
+    static std::string ContainerPath(const char* sourcePath);
+    // True if a container exists for the source and was baked after the source was last modified
+    static bool HasUpToDateContainer(const char* sourcePath);
+    static uint64_t LevelSize(BlockFormat format, uint32_t width, uint32_t height);
+
+    bool Read(const char* path);
+    // Only the header, levels gets the level count without any of their contents
+    bool ReadHeader(const char* path);
+    bool Write(const char* path) const;
+};
@@ -0,0 +1,50 @@
+#include "depth_pyramid.h"
+
+#include <math.h>
+
+#include "log.h"
+
+DepthPyramid::DepthPyramid(glm::ivec2 depthSize)
+    : attachment("depth_pyramid", AttachmentFormat::FLOAT_2), viewProjection(1.f), built(false)
+{
+    size = glm::max(depthSize / 2, glm::ivec2(1));
+    levelCount = (int)log2f((float)glm::max(size.x, size.y)) + 1;
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &attachment.id);
+    glTextureStorage2D(attachment.id, levelCount, ToGLInternalFormat(attachment.format), size.x, size.y);
+    glTextureParameteri(attachment.id, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTextureParameteri(attachment.id, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureParameteri(attachment.id, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(attachment.id, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    LOG_INFO("DepthPyramid", "%dx%d with %d levels", size.x, size.y, levelCount);
+}
+
+void DepthPyramid::Build(Shader& shader, const glm::mat4& cameraViewProjection)
+{
+    int sourceBinding = shader.GetBinding("sourceLevel");
+    int destinationBinding = shader.GetBinding("destinationLevel");
+    ASSERT(sourceBinding != INVALID_BINDING && destinationBinding != INVALID_BINDING);
+
+    GLenum format = ToGLInternalFormat(attachment.format);
+    glm::ivec2 levelSize = size;
+    for (int level = 0; level < levelCount; level++)
+    {
+        // Level 0 reads the depth textures instead
+        shader.SetUniform("level", level);
+        if (level > 0)
+        {
+            glBindImageTexture(sourceBinding, attachment.id, level - 1, GL_FALSE, 0, GL_READ_ONLY, format);
+        }
+        glBindImageTexture(destinationBinding, attachment.id, level, GL_FALSE, 0, GL_WRITE_ONLY, format);
+
+        glDispatchCompute((levelSize.x + DEPTH_PYRAMID_WORK_GROUP_SIZE - 1) / DEPTH_PYRAMID_WORK_GROUP_SIZE,
+                (levelSize.y + DEPTH_PYRAMID_WORK_GROUP_SIZE - 1) / DEPTH_PYRAMID_WORK_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        levelSize = glm::max(levelSize / 2, glm::ivec2(1));
+    }
+    // Read through samplers by the light tile culling and the next frame's culling pass
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    viewProjection = cameraViewProjection;
+    built = true;
+}
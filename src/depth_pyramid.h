@@ -0,0 +1,28 @@
+#pragma once
+
+#include "glm/glm.hpp"
+
+#include "render_pipeline.h"
+#include "shader.h"
+
+#define DEPTH_PYRAMID_WORK_GROUP_SIZE 8
+
+// Hierarchical depth ("Hi-Z") of the last frame, a GL_RG32F mip chain with min depth in x and max depth in y. Level 0
+// is half the depth attachment's resolution, every texel holds the min/max of the 2x2 texels below it (3 wide along
+// odd edges, so nothing is dropped). Min also takes the proxy geometry's min depth, max is opaque depth only.
+struct DepthPyramid
+{
+    // "depth_pyramid", not owned by any renderpass. id is the pyramid texture.
+    RenderpassAttachment attachment;
+    glm::ivec2 size;
+    int levelCount;
+
+    // Camera of the frame the pyramid was built in, for reprojecting into it
+    glm::mat4 viewProjection;
+    bool built;
+
+    DepthPyramid(glm::ivec2 depthSize);
+
+    // Dispatches depth_pyramid.comp once per level. Expects the shader in use, with its depth samplers bound.
+    void Build(Shader& shader, const glm::mat4& cameraViewProjection);
+};
@@ -0,0 +1,155 @@
+#include "frame_ring_buffer.h"
+
+#include <cstring>
+
+#include "gl_state_cache.h"
+#include "log.h"
+
+// Smallest range handed out, GL rejects empty ranges
+#define FRAME_RING_BUFFER_MIN_ALLOCATION_SIZE 16
+#define FRAME_RING_BUFFER_WAIT_TIMEOUT_NS 1000000000
+
+FrameRingBuffer::FrameRingBuffer()
+    : buffer(0), mapped(nullptr), regionSize(0), region(FRAME_RING_BUFFER_REGION_COUNT - 1), regionUsed(0), stallCount(0)
+{
+    GLint uniformAlignment;
+    GLint storageAlignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+    alignment = uniformAlignment > storageAlignment ? uniformAlignment : storageAlignment;
+
+    for (int i = 0; i < FRAME_RING_BUFFER_REGION_COUNT; i++)
+    {
+        fences[i] = nullptr;
+    }
+
+    CreateBuffer(FRAME_RING_BUFFER_INITIAL_REGION_SIZE);
+}
+
+void FrameRingBuffer::CreateBuffer(GLsizeiptr newRegionSize)
+{
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    glCreateBuffers(1, &buffer);
+    glNamedBufferStorage(buffer, newRegionSize * FRAME_RING_BUFFER_REGION_COUNT, nullptr, flags);
+    mapped = (char*) glMapNamedBufferRange(buffer, 0, newRegionSize * FRAME_RING_BUFFER_REGION_COUNT, flags);
+    ASSERT(mapped != nullptr);
+    regionSize = newRegionSize;
+
+    LOG_INFO("FrameRingBuffer", "%d regions of %ld bytes", FRAME_RING_BUFFER_REGION_COUNT, (long) regionSize);
+}
+
+void FrameRingBuffer::Grow(GLsizeiptr minRegionSize)
+{
+    GLsizeiptr newRegionSize = regionSize * 2;
+    while (newRegionSize < minRegionSize)
+    {
+        newRegionSize *= 2;
+    }
+
+    // Allocations already made this frame keep pointing into the old buffer, it is deleted once the GPU is done
+    // with the frame. The new buffer has never been used, so none of the regions need waiting on.
+    retiredBuffers.push_back({ buffer, nullptr });
+    for (int i = 0; i < FRAME_RING_BUFFER_REGION_COUNT; i++)
+    {
+        if (fences[i] != nullptr)
+        {
+            glDeleteSync(fences[i]);
+            fences[i] = nullptr;
+        }
+    }
+
+    CreateBuffer(newRegionSize);
+    regionUsed = 0;
+}
+
+void FrameRingBuffer::BeginFrame()
+{
+    region = (region + 1) % FRAME_RING_BUFFER_REGION_COUNT;
+    regionUsed = 0;
+
+    if (fences[region] != nullptr)
+    {
+        GLenum status = glClientWaitSync(fences[region], 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+        {
+            stallCount++;
+            do
+            {
+                status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, FRAME_RING_BUFFER_WAIT_TIMEOUT_NS);
+            } while (status == GL_TIMEOUT_EXPIRED);
+        }
+        if (status == GL_WAIT_FAILED)
+        {
+            LOG_ERROR("FrameRingBuffer", "Waiting for region %d failed", region);
+        }
+        glDeleteSync(fences[region]);
+        fences[region] = nullptr;
+    }
+
+    for (int i = retiredBuffers.size() - 1; i >= 0; i--)
+    {
+        RetiredBuffer& retired = retiredBuffers[i];
+        if (retired.fence == nullptr || glClientWaitSync(retired.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            continue;
+        }
+        glDeleteSync(retired.fence);
+        // Unmaps it as well
+        glDeleteBuffers(1, &retired.buffer);
+        retiredBuffers.erase(retiredBuffers.begin() + i);
+    }
+}
+
+void FrameRingBuffer::EndFrame()
+{
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    for (RetiredBuffer& retired : retiredBuffers)
+    {
+        if (retired.fence == nullptr)
+        {
+            retired.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+}
+
+FrameRingBuffer::Allocation FrameRingBuffer::Allocate(GLsizeiptr size)
+{
+    GLsizeiptr paddedSize = size > FRAME_RING_BUFFER_MIN_ALLOCATION_SIZE ? size : FRAME_RING_BUFFER_MIN_ALLOCATION_SIZE;
+    GLsizeiptr offset = (regionUsed + alignment - 1) / alignment * alignment;
+    if (offset + paddedSize > regionSize)
+    {
+        Grow(offset + paddedSize);
+        offset = 0;
+    }
+    regionUsed = offset + paddedSize;
+
+    Allocation allocation;
+    allocation.buffer = buffer;
+    allocation.offset = region * regionSize + offset;
+    allocation.size = paddedSize;
+    allocation.data = mapped + allocation.offset;
+    return allocation;
+}
+
+FrameRingBuffer::Allocation FrameRingBuffer::Upload(const void* data, GLsizeiptr size)
+{
+    Allocation allocation = Allocate(size);
+    if (size > 0)
+    {
+        memcpy(allocation.data, data, size);
+    }
+    return allocation;
+}
+
+/*static*/ void FrameRingBuffer::BindRange(GLenum target, GLuint index, const Allocation& allocation)
+{
+    GLStateCache::Get().BindBufferRange(target, index, allocation.buffer, allocation.offset, allocation.size);
+}
+
+/*static*/ FrameRingBuffer& FrameRingBuffer::Get()
+{
+    // Created on first use, which is after the GL context
+    static FrameRingBuffer ringBuffer;
+    return ringBuffer;
+}
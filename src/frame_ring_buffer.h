@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+
+// Regions in flight - one written by the CPU while the GPU may still read the previous two
+#define FRAME_RING_BUFFER_REGION_COUNT 3
+#define FRAME_RING_BUFFER_INITIAL_REGION_SIZE (4 << 20)
+
+// Per frame uniform and storage data, written straight into a persistently mapped buffer instead of
+// re-specifying buffers with glBufferData every frame. The buffer is split into FRAME_RING_BUFFER_REGION_COUNT
+// regions, a frame allocates from one region and fences it at the end, the region is only reused once its fence
+// has signaled. A frame that does not fit its region grows the buffer, the old one is kept alive until the GPU is
+// done with it.
+struct FrameRingBuffer
+{
+    struct Allocation
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+        // Write-only, coherent
+        void* data;
+    };
+
+    // Moves on to the next region, waiting for the GPU if it still reads it
+    void BeginFrame();
+    // Fences everything allocated since BeginFrame
+    void EndFrame();
+
+    // Valid until EndFrame. Offsets satisfy both the uniform and the storage buffer offset alignment. Empty
+    // allocations still get a few bytes, GL rejects empty ranges.
+    Allocation Allocate(GLsizeiptr size);
+    Allocation Upload(const void* data, GLsizeiptr size);
+    // Binds the allocation to an indexed uniform or storage buffer binding point through GLStateCache
+    static void BindRange(GLenum target, GLuint index, const Allocation& allocation);
+
+    static FrameRingBuffer& Get();
+
+    GLuint buffer;
+    char* mapped;
+    GLsizeiptr regionSize;
+    GLint alignment;
+
+    int region;
+    GLsizeiptr regionUsed;
+    GLsync fences[FRAME_RING_BUFFER_REGION_COUNT];
+
+    // Frames BeginFrame had to wait on the GPU for
+    int stallCount;
+
+private:
+    struct RetiredBuffer
+    {
+        GLuint buffer;
+        // Null until the frame that retired it ends
+        GLsync fence;
+    };
+    std::vector<RetiredBuffer> retiredBuffers;
+
+    FrameRingBuffer();
+    // Replaces the buffer with one whose regions hold at least minRegionSize, allocations continue in it
+    void Grow(GLsizeiptr minRegionSize);
+    void CreateBuffer(GLsizeiptr newRegionSize);
+};
@@ -0,0 +1,246 @@
+#include "frustum_cull.h"
+
+#include <math.h>
+
+#include "thread_pool.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define FRUSTUM_CULL_X86 1
+#else
+#define FRUSTUM_CULL_X86 0
+#endif
+
+void BoundsSoA::Clear()
+{
+    centerX.clear();
+    centerY.clear();
+    centerZ.clear();
+    extentX.clear();
+    extentY.clear();
+    extentZ.clear();
+}
+
+void BoundsSoA::Reserve(int count)
+{
+    centerX.reserve(count);
+    centerY.reserve(count);
+    centerZ.reserve(count);
+    extentX.reserve(count);
+    extentY.reserve(count);
+    extentZ.reserve(count);
+}
+
+void BoundsSoA::Add(glm::vec3 center, glm::vec3 extent)
+{
+    centerX.push_back(center.x);
+    centerY.push_back(center.y);
+    centerZ.push_back(center.z);
+    extentX.push_back(extent.x);
+    extentY.push_back(extent.y);
+    extentZ.push_back(extent.z);
+}
+
+void BoundsSoA::Add(const AABB& modelSpace, const glm::mat4& model)
+{
+    AABB world = modelSpace.Transformed(model);
+    Add((world.min + world.max) * 0.5f, (world.max - world.min) * 0.5f);
+}
+
+int BoundsSoA::Count() const
+{
+    return centerX.size();
+}
+
+FrustumPlanes::FrustumPlanes(const glm::mat4& viewProjection, bool fullDepthRange)
+{
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+
+    planes[0] = rows[3] + rows[0];
+    planes[1] = rows[3] - rows[0];
+    planes[2] = rows[3] + rows[1];
+    planes[3] = rows[3] - rows[1];
+    // z >= 0 like AABB::ViewFrustumIntersect rather than z >= -w
+    planes[4] = fullDepthRange ? rows[3] + rows[2] : rows[2];
+    planes[5] = rows[3] - rows[2];
+}
+
+static void CullScalar(const FrustumPlanes& frustum, const BoundsSoA& bounds, int begin, int end, uint8_t* visible)
+{
+    for (int i = begin; i < end; i++)
+    {
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++)
+        {
+            const glm::vec4& plane = frustum.planes[p];
+            float distance = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w;
+            float radius = fabsf(plane.x) * bounds.extentX[i] + fabsf(plane.y) * bounds.extentY[i] + fabsf(plane.z) * bounds.extentZ[i];
+            inside = distance + radius >= 0.f;
+        }
+        visible[i] = inside ? 1 : 0;
+    }
+}
+
+#if FRUSTUM_CULL_X86
+static void CullSse(const FrustumPlanes& frustum, const BoundsSoA& bounds, int begin, int end, uint8_t* visible)
+{
+    __m128 normals[6][3];
+    __m128 absNormals[6][3];
+    __m128 offsets[6];
+    for (int p = 0; p < 6; p++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            normals[p][axis] = _mm_set1_ps(frustum.planes[p][axis]);
+            absNormals[p][axis] = _mm_set1_ps(fabsf(frustum.planes[p][axis]));
+        }
+        offsets[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+    __m128 zero = _mm_setzero_ps();
+
+    int i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        __m128 centerX = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 centerY = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 centerZ = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 extentX = _mm_loadu_ps(&bounds.extentX[i]);
+        __m128 extentY = _mm_loadu_ps(&bounds.extentY[i]);
+        __m128 extentZ = _mm_loadu_ps(&bounds.extentZ[i]);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normals[p][0], centerX), _mm_mul_ps(normals[p][1], centerY)),
+                    _mm_add_ps(_mm_mul_ps(normals[p][2], centerZ), offsets[p]));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absNormals[p][0], extentX), _mm_mul_ps(absNormals[p][1], extentY)),
+                    _mm_mul_ps(absNormals[p][2], extentZ));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; lane++)
+        {
+            visible[i + lane] = (mask >> lane) & 1;
+        }
+    }
+    CullScalar(frustum, bounds, i, end, visible);
+}
+
+__attribute__((target("avx2,fma")))
+static void CullAvx2(const FrustumPlanes& frustum, const BoundsSoA& bounds, int begin, int end, uint8_t* visible)
+{
+    __m256 normals[6][3];
+    __m256 absNormals[6][3];
+    __m256 offsets[6];
+    for (int p = 0; p < 6; p++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            normals[p][axis] = _mm256_set1_ps(frustum.planes[p][axis]);
+            absNormals[p][axis] = _mm256_set1_ps(fabsf(frustum.planes[p][axis]));
+        }
+        offsets[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+    __m256 zero = _mm256_setzero_ps();
+
+    int i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256 centerX = _mm256_loadu_ps(&bounds.centerX[i]);
+        __m256 centerY = _mm256_loadu_ps(&bounds.centerY[i]);
+        __m256 centerZ = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 extentX = _mm256_loadu_ps(&bounds.extentX[i]);
+        __m256 extentY = _mm256_loadu_ps(&bounds.extentY[i]);
+        __m256 extentZ = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (int p = 0; p < 6; p++)
+        {
+            __m256 distance = _mm256_fmadd_ps(normals[p][0], centerX, _mm256_fmadd_ps(normals[p][1], centerY,
+                        _mm256_fmadd_ps(normals[p][2], centerZ, offsets[p])));
+            __m256 radius = _mm256_fmadd_ps(absNormals[p][0], extentX, _mm256_fmadd_ps(absNormals[p][1], extentY,
+                        _mm256_mul_ps(absNormals[p][2], extentZ)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for (int lane = 0; lane < 8; lane++)
+        {
+            visible[i + lane] = (mask >> lane) & 1;
+        }
+    }
+    CullScalar(frustum, bounds, i, end, visible);
+}
+#endif
+
+CullKernel BestCullKernel()
+{
+#if FRUSTUM_CULL_X86
+    static CullKernel best = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? CullKernel::AVX2 : CullKernel::SSE;
+    return best;
+#else
+    return CullKernel::SCALAR;
+#endif
+}
+
+const char* CullKernelName(CullKernel kernel)
+{
+    switch (kernel)
+    {
+        case CullKernel::AUTO:
+            return CullKernelName(BestCullKernel());
+        case CullKernel::SCALAR:
+            return "scalar";
+        case CullKernel::SSE:
+            return "SSE";
+        case CullKernel::AVX2:
+            return "AVX2";
+    }
+    return "unknown";
+}
+
+static void CullRange(const FrustumPlanes& frustum, const BoundsSoA& bounds, int begin, int end, uint8_t* visible, CullKernel kernel)
+{
+    switch (kernel)
+    {
+#if FRUSTUM_CULL_X86
+        case CullKernel::SSE:
+            CullSse(frustum, bounds, begin, end, visible);
+            return;
+        case CullKernel::AVX2:
+            CullAvx2(frustum, bounds, begin, end, visible);
+            return;
+#endif
+        default:
+            CullScalar(frustum, bounds, begin, end, visible);
+            return;
+    }
+}
+
+void FrustumCull(const FrustumPlanes& frustum, const BoundsSoA& bounds, uint8_t* visible, CullKernel kernel, bool allowParallel)
+{
+    if (kernel == CullKernel::AUTO || (kernel == CullKernel::AVX2 && BestCullKernel() != CullKernel::AVX2))
+    {
+        kernel = BestCullKernel();
+    }
+
+    int count = bounds.Count();
+    if (!allowParallel || count < FRUSTUM_CULL_PARALLEL_THRESHOLD)
+    {
+        CullRange(frustum, bounds, 0, count, visible, kernel);
+        return;
+    }
+
+    int chunkCount = (count + FRUSTUM_CULL_CHUNK_SIZE - 1) / FRUSTUM_CULL_CHUNK_SIZE;
+    ThreadPool::Shared().ParallelFor(chunkCount, [&](int chunk)
+    {
+        int begin = chunk * FRUSTUM_CULL_CHUNK_SIZE;
+        int end = begin + FRUSTUM_CULL_CHUNK_SIZE < count ? begin + FRUSTUM_CULL_CHUNK_SIZE : count;
+        CullRange(frustum, bounds, begin, end, visible, kernel);
+    });
+}
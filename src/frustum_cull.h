@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "aabb.h"
+
+// Object counts from which FrustumCull splits the work across ThreadPool::Shared(), in chunks of this size
+#define FRUSTUM_CULL_PARALLEL_THRESHOLD 32768
+#define FRUSTUM_CULL_CHUNK_SIZE 16384
+
+// World space bounds of many objects as structure of arrays, so that the culling kernels load 4 or 8 boxes at once
+struct BoundsSoA
+{
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> extentX;
+    std::vector<float> extentY;
+    std::vector<float> extentZ;
+
+    void Clear();
+    void Reserve(int count);
+    void Add(glm::vec3 center, glm::vec3 extent);
+    // World space AABB around the transformed model space box
+    void Add(const AABB& modelSpace, const glm::mat4& model);
+    int Count() const;
+};
+
+// Clip planes of a view projection matrix, a point is inside if dot(plane.xyz, point) + plane.w >= 0 for all of them.
+// Same bounds as AABB::ViewFrustumIntersect, including its near plane at clip space z = 0, unless fullDepthRange puts
+// it at z = -w like GL clipping does (e.g. for orthographic light frusta, where z = 0 is halfway through).
+struct FrustumPlanes
+{
+    glm::vec4 planes[6];
+
+    FrustumPlanes(const glm::mat4& viewProjection, bool fullDepthRange = false);
+};
+
+enum class CullKernel
+{
+    // Widest one the CPU supports
+    AUTO,
+    SCALAR,
+    SSE,
+    AVX2,
+};
+CullKernel BestCullKernel();
+const char* CullKernelName(CullKernel kernel);
+
+// visible[i] becomes 1 if box i intersects the frustum, 0 if it's fully outside one of the planes. Holds bounds.Count()
+// entries. A box is outside a plane if its corner furthest along the plane normal is, i.e. the same result as testing
+// the 8 corners in clip space.
+void FrustumCull(const FrustumPlanes& frustum, const BoundsSoA& bounds, uint8_t* visible, CullKernel kernel = CullKernel::AUTO,
+        bool allowParallel = true);
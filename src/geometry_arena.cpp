@@ -0,0 +1,284 @@
+#include "geometry_arena.h"
+
+#include <math.h>
+#include <vector>
+
+#include "glm/gtc/packing.hpp"
+
+#include "gl_state_cache.h"
+#include "log.h"
+#include "mesh_cache.h"
+
+#define GEOMETRY_ARENA_INITIAL_VERTEX_CAPACITY (1 << 18)
+#define GEOMETRY_ARENA_INITIAL_INDEX_BYTE_CAPACITY (1 << 22)
+#define GEOMETRY_ARENA_INITIAL_MESHLET_CAPACITY (1 << 14)
+
+// Maps the unit sphere onto the [-1, 1] square, the lower hemisphere folded over the diagonals
+static glm::vec2 OctahedralEncode(glm::vec3 v)
+{
+    float length = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+    if (length <= 0.f)
+    {
+        return glm::vec2(0.f);
+    }
+    v /= length;
+    if (v.z >= 0.f)
+    {
+        return glm::vec2(v.x, v.y);
+    }
+    return glm::vec2((1.f - fabsf(v.y)) * (v.x >= 0.f ? 1.f : -1.f), (1.f - fabsf(v.x)) * (v.y >= 0.f ? 1.f : -1.f));
+}
+
+static int16_t PackSnorm16(float value)
+{
+    return (int16_t) roundf(glm::clamp(value, -1.f, 1.f) * 32767.f);
+}
+
+static uint16_t PackUnorm16(float value)
+{
+    return (uint16_t) roundf(glm::clamp(value, 0.f, 1.f) * 65535.f);
+}
+
+long GeometryArena::Allocation::IndexByteOffset() const
+{
+    return (long) firstIndex * IndexSize(indexType);
+}
+
+glm::mat4 GeometryArena::Allocation::PositionDequantization() const
+{
+    glm::mat4 dequantization(1.f);
+    dequantization[0][0] = positionScale.x;
+    dequantization[1][1] = positionScale.y;
+    dequantization[2][2] = positionScale.z;
+    dequantization[3] = glm::vec4(positionOffset, 1.f);
+    return dequantization;
+}
+
+GeometryArena::GeometryArena()
+    : indexBuffer(0), vertexCount(0), vertexCapacity(0), indexBytes(0), indexByteCapacity(0), meshletBuffer(0), meshletCount(0),
+    meshletCapacity(0)
+{
+    vertexBuffers[POSITION_STREAM] = 0;
+    vertexBuffers[ATTRIBUTE_STREAM] = 0;
+    layout = BufferLayout({
+            { "pos", 4, GL_UNSIGNED_SHORT, sizeof(uint16_t), true, POSITION_STREAM },
+            { "normalTangent", 4, GL_SHORT, sizeof(int16_t), true, ATTRIBUTE_STREAM },
+            { "uv", 2, GL_HALF_FLOAT, sizeof(uint16_t), false, ATTRIBUTE_STREAM }});
+    ASSERT(layout.Stride(POSITION_STREAM) == sizeof(PackedPosition));
+    ASSERT(layout.Stride(ATTRIBUTE_STREAM) == sizeof(PackedAttributes));
+
+    glCreateVertexArrays(1, &vao);
+    glCreateVertexArrays(1, &positionsOnlyVao);
+    int attributeIndex = 0;
+    for (BufferLayout::ConstIterator it = layout.Begin(); it != layout.End(); it++)
+    {
+        glEnableVertexArrayAttrib(vao, attributeIndex);
+        glVertexArrayAttribFormat(vao, attributeIndex, it->vectorElementCount, it->glType,
+                it->normalized ? GL_TRUE : GL_FALSE, layout.Offset(attributeIndex));
+        glVertexArrayAttribBinding(vao, attributeIndex, it->stream);
+        if (it->stream == POSITION_STREAM)
+        {
+            glEnableVertexArrayAttrib(positionsOnlyVao, attributeIndex);
+            glVertexArrayAttribFormat(positionsOnlyVao, attributeIndex, it->vectorElementCount, it->glType,
+                    it->normalized ? GL_TRUE : GL_FALSE, layout.Offset(attributeIndex));
+            glVertexArrayAttribBinding(positionsOnlyVao, attributeIndex, it->stream);
+        }
+
+        attributeIndex++;
+    }
+
+    Reserve(GEOMETRY_ARENA_INITIAL_VERTEX_CAPACITY, GEOMETRY_ARENA_INITIAL_INDEX_BYTE_CAPACITY);
+}
+
+void GeometryArena::Reserve(int minVertexCapacity, long minIndexByteCapacity)
+{
+    int newVertexCapacity = vertexCapacity > 0 ? vertexCapacity : minVertexCapacity;
+    while (newVertexCapacity < minVertexCapacity)
+    {
+        newVertexCapacity *= 2;
+    }
+    long newIndexByteCapacity = indexByteCapacity > 0 ? indexByteCapacity : minIndexByteCapacity;
+    while (newIndexByteCapacity < minIndexByteCapacity)
+    {
+        newIndexByteCapacity *= 2;
+    }
+
+    if (newVertexCapacity != vertexCapacity)
+    {
+        for (int stream = 0; stream < layout.StreamCount(); stream++)
+        {
+            GLuint newVertexBuffer;
+            glCreateBuffers(1, &newVertexBuffer);
+            glNamedBufferData(newVertexBuffer, (GLsizeiptr) newVertexCapacity * layout.Stride(stream), nullptr, GL_STATIC_DRAW);
+            if (vertexBuffers[stream] != 0)
+            {
+                glCopyNamedBufferSubData(vertexBuffers[stream], newVertexBuffer, 0, 0, (GLsizeiptr) vertexCount * layout.Stride(stream));
+                glDeleteBuffers(1, &vertexBuffers[stream]);
+            }
+            vertexBuffers[stream] = newVertexBuffer;
+            glVertexArrayVertexBuffer(vao, stream, newVertexBuffer, 0, layout.Stride(stream));
+        }
+        glVertexArrayVertexBuffer(positionsOnlyVao, POSITION_STREAM, vertexBuffers[POSITION_STREAM], 0, layout.Stride(POSITION_STREAM));
+        vertexCapacity = newVertexCapacity;
+    }
+
+    if (newIndexByteCapacity != indexByteCapacity)
+    {
+        GLuint newIndexBuffer;
+        glCreateBuffers(1, &newIndexBuffer);
+        glNamedBufferData(newIndexBuffer, (GLsizeiptr) newIndexByteCapacity, nullptr, GL_STATIC_DRAW);
+        if (indexBuffer != 0)
+        {
+            glCopyNamedBufferSubData(indexBuffer, newIndexBuffer, 0, 0, (GLsizeiptr) indexBytes);
+            glDeleteBuffers(1, &indexBuffer);
+        }
+        indexBuffer = newIndexBuffer;
+        indexByteCapacity = newIndexByteCapacity;
+        glVertexArrayElementBuffer(vao, indexBuffer);
+        glVertexArrayElementBuffer(positionsOnlyVao, indexBuffer);
+    }
+
+    LOG_INFO("GeometryArena", "Capacity: %d vertices, %d index bytes", vertexCapacity, indexByteCapacity);
+}
+
+GeometryArena::Allocation GeometryArena::Allocate(const float* vertices, int newVertexCount, const unsigned int* indices, int newIndexCount)
+{
+    Allocation allocation;
+    allocation.baseVertex = vertexCount;
+    allocation.indexCount = newIndexCount;
+    allocation.indexType = newVertexCount <= (1 << 16) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    // Quantization bounds, from the vertices themselves so that they always cover them
+    glm::vec3 positionMin(0.f);
+    glm::vec3 positionMax(0.f);
+    for (int i = 0; i < newVertexCount; i++)
+    {
+        glm::vec3 pos(vertices[i * MESH_VERTEX_ELEMENT_COUNT + 0], vertices[i * MESH_VERTEX_ELEMENT_COUNT + 1],
+                vertices[i * MESH_VERTEX_ELEMENT_COUNT + 2]);
+        positionMin = i == 0 ? pos : glm::min(positionMin, pos);
+        positionMax = i == 0 ? pos : glm::max(positionMax, pos);
+    }
+    allocation.positionOffset = positionMin;
+    allocation.positionScale = positionMax - positionMin;
+
+    std::vector<PackedPosition> positions(newVertexCount);
+    std::vector<PackedAttributes> attributes(newVertexCount);
+    for (int i = 0; i < newVertexCount; i++)
+    {
+        // pos3, normal3, tangent4 (w - bitangent sign), uv2
+        const float* vertex = vertices + i * MESH_VERTEX_ELEMENT_COUNT;
+        glm::vec3 pos(vertex[0], vertex[1], vertex[2]);
+        glm::vec3 normalizedPos;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            normalizedPos[axis] = allocation.positionScale[axis] > 0.f ? (pos[axis] - positionMin[axis]) / allocation.positionScale[axis] : 0.f;
+        }
+        positions[i] = { PackUnorm16(normalizedPos.x), PackUnorm16(normalizedPos.y), PackUnorm16(normalizedPos.z), 0 };
+
+        glm::vec2 normal = OctahedralEncode(glm::vec3(vertex[3], vertex[4], vertex[5]));
+        glm::vec2 tangent = OctahedralEncode(glm::vec3(vertex[6], vertex[7], vertex[8]));
+        // Never 0, which would lose the sign
+        float signCarrier = glm::max(tangent.x * 0.5f + 0.5f, 1.f / 32767.f);
+        PackedAttributes& packed = attributes[i];
+        packed.normal[0] = PackSnorm16(normal.x);
+        packed.normal[1] = PackSnorm16(normal.y);
+        packed.tangent[0] = PackSnorm16(vertex[9] < 0.f ? -signCarrier : signCarrier);
+        packed.tangent[1] = PackSnorm16(tangent.y);
+        packed.uv[0] = glm::packHalf1x16(vertex[10]);
+        packed.uv[1] = glm::packHalf1x16(vertex[11]);
+    }
+
+    int indexSize = IndexSize(allocation.indexType);
+    long firstIndexByte = (indexBytes + indexSize - 1) / indexSize * indexSize;
+    long newIndexBytes = (long) newIndexCount * indexSize;
+    if (vertexCount + newVertexCount > vertexCapacity || firstIndexByte + newIndexBytes > indexByteCapacity)
+    {
+        Reserve(vertexCount + newVertexCount, firstIndexByte + newIndexBytes);
+    }
+    allocation.firstIndex = (int) (firstIndexByte / indexSize);
+
+    glNamedBufferSubData(vertexBuffers[POSITION_STREAM], (GLintptr) vertexCount * sizeof(PackedPosition),
+            (GLsizeiptr) newVertexCount * sizeof(PackedPosition), positions.data());
+    glNamedBufferSubData(vertexBuffers[ATTRIBUTE_STREAM], (GLintptr) vertexCount * sizeof(PackedAttributes),
+            (GLsizeiptr) newVertexCount * sizeof(PackedAttributes), attributes.data());
+    if (allocation.indexType == GL_UNSIGNED_SHORT)
+    {
+        std::vector<uint16_t> shortIndices(indices, indices + newIndexCount);
+        glNamedBufferSubData(indexBuffer, (GLintptr) firstIndexByte, (GLsizeiptr) newIndexCount * indexSize, shortIndices.data());
+    }
+    else
+    {
+        glNamedBufferSubData(indexBuffer, (GLintptr) firstIndexByte, (GLsizeiptr) newIndexCount * indexSize, indices);
+    }
+    vertexCount += newVertexCount;
+    indexBytes = firstIndexByte + newIndexBytes;
+
+    return allocation;
+}
+
+int GeometryArena::AddMeshlets(const Allocation& allocation, const Meshlet* meshlets, int count)
+{
+    if (meshletCount + count > meshletCapacity)
+    {
+        int newMeshletCapacity = meshletCapacity > 0 ? meshletCapacity : GEOMETRY_ARENA_INITIAL_MESHLET_CAPACITY;
+        while (newMeshletCapacity < meshletCount + count)
+        {
+            newMeshletCapacity *= 2;
+        }
+
+        GLuint newMeshletBuffer;
+        glCreateBuffers(1, &newMeshletBuffer);
+        glNamedBufferData(newMeshletBuffer, (GLsizeiptr) newMeshletCapacity * sizeof(GpuMeshlet), nullptr, GL_STATIC_DRAW);
+        if (meshletBuffer != 0)
+        {
+            glCopyNamedBufferSubData(meshletBuffer, newMeshletBuffer, 0, 0, (GLsizeiptr) meshletCount * sizeof(GpuMeshlet));
+            glDeleteBuffers(1, &meshletBuffer);
+        }
+        meshletBuffer = newMeshletBuffer;
+        meshletCapacity = newMeshletCapacity;
+        LOG_INFO("GeometryArena", "Capacity: %d meshlets", meshletCapacity);
+    }
+
+    std::vector<GpuMeshlet> gpuMeshlets(count);
+    for (int i = 0; i < count; i++)
+    {
+        const Meshlet& meshlet = meshlets[i];
+        gpuMeshlets[i].sphere = glm::vec4(meshlet.center, meshlet.radius);
+        gpuMeshlets[i].cone = glm::vec4(meshlet.coneAxis, meshlet.coneCutoff);
+        gpuMeshlets[i].indexRange = glm::uvec4(allocation.firstIndex + meshlet.firstIndex, meshlet.indexCount, 0, 0);
+    }
+    glNamedBufferSubData(meshletBuffer, (GLintptr) meshletCount * sizeof(GpuMeshlet), (GLsizeiptr) count * sizeof(GpuMeshlet),
+            gpuMeshlets.data());
+
+    int firstMeshlet = meshletCount;
+    meshletCount += count;
+    return firstMeshlet;
+}
+
+/*static*/ GeometryArena::DrawElementsIndirectCommand GeometryArena::Command(const Allocation& allocation, int instanceCount, int baseInstance)
+{
+    DrawElementsIndirectCommand command;
+    command.count = allocation.indexCount;
+    command.instanceCount = instanceCount;
+    command.firstIndex = allocation.firstIndex;
+    command.baseVertex = allocation.baseVertex;
+    command.baseInstance = baseInstance;
+    return command;
+}
+
+/*static*/ int GeometryArena::IndexSize(GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+void GeometryArena::Bind(bool positionsOnly)
+{
+    GLStateCache::Get().BindVertexArray(positionsOnly ? positionsOnlyVao : vao);
+}
+
+/*static*/ GeometryArena& GeometryArena::Get()
+{
+    // Created on first use, which is after the GL context
+    static GeometryArena arena;
+    return arena;
+}
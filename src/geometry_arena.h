@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <GL/glew.h>
+#include "glm/glm.hpp"
+
+#include "buffer_layout.h"
+
+struct Meshlet;
+
+// All mesh geometry, sub-allocated from two vertex buffers and one index buffer behind a single VAO. Draws of
+// different meshes only differ in their offsets, so they can be submitted together with glMultiDrawElementsIndirect.
+// Vertices come in as the interleaved MESH_VERTEX_ELEMENT_COUNT floats and are stored packed, split into a position
+// stream and an attribute stream so that depth only passes fetch just the positions. Allocations are never freed.
+struct GeometryArena
+{
+    // Position stream, 16 bit unorm over the mesh's bounds. The fourth component only pads to 8 bytes.
+    struct PackedPosition
+    {
+        uint16_t x, y, z, w;
+    };
+    // Attribute stream. Normal and tangent are octahedral encoded snorm16. The tangent's first component is remapped
+    // to [0, 1] and carries the bitangent sign in its own sign, UVs are half floats.
+    struct PackedAttributes
+    {
+        int16_t normal[2];
+        int16_t tangent[2];
+        uint16_t uv[2];
+    };
+    enum Stream
+    {
+        POSITION_STREAM = 0,
+        ATTRIBUTE_STREAM = 1
+    };
+
+    struct Allocation
+    {
+        int baseVertex;
+        // In units of indexType
+        int firstIndex;
+        int indexCount;
+        // GL_UNSIGNED_SHORT when all of the mesh's vertices are reachable from baseVertex with 16 bits
+        GLenum indexType;
+        // Model space position = positionOffset + positionScale * the unorm position
+        glm::vec3 positionOffset;
+        glm::vec3 positionScale;
+
+        // Unlike firstIndex unique per index range whatever the index type
+        long IndexByteOffset() const;
+        // Maps unorm positions to model space, goes to the right of the model matrix
+        glm::mat4 PositionDequantization() const;
+    };
+
+    // GL_DRAW_INDIRECT_BUFFER layout expected by glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    // "Meshlets" in meshlet_culling.comp. Bounds are in the mesh's model space, before quantization.
+    struct GpuMeshlet
+    {
+        // xyz - center, w - radius
+        glm::vec4 sphere;
+        // xyz - axis, w - sine of the cone's half angle, 1 if it never culls
+        glm::vec4 cone;
+        // x - first index in units of the mesh's index type, from the start of the index buffer, y - index count
+        glm::uvec4 indexRange;
+    };
+
+    Allocation Allocate(const float* vertices, int vertexCount, const unsigned int* indices, int indexCount);
+    // Meshlets of an allocated mesh, their index ranges relative to the allocation's firstIndex. Returns the first
+    // one's index in meshletBuffer.
+    int AddMeshlets(const Allocation& allocation, const Meshlet* meshlets, int count);
+    static DrawElementsIndirectCommand Command(const Allocation& allocation, int instanceCount, int baseInstance);
+    static int IndexSize(GLenum indexType);
+
+    // The positions only VAO leaves out the attribute stream, for shaders that read nothing but the position
+    void Bind(bool positionsOnly = false);
+
+    static GeometryArena& Get();
+
+    GLuint vao;
+    GLuint positionsOnlyVao;
+    GLuint vertexBuffers[2];
+    GLuint indexBuffer;
+    BufferLayout layout;
+
+    int vertexCount;
+    int vertexCapacity;
+    // In bytes, 16 and 32 bit index ranges share the buffer
+    long indexBytes;
+    long indexByteCapacity;
+
+    // Meshlets of all meshes that have them, GpuMeshlets
+    GLuint meshletBuffer;
+    int meshletCount;
+    int meshletCapacity;
+
+private:
+    GeometryArena();
+    // Grows the buffers, copying over the existing geometry
+    void Reserve(int minVertexCapacity, long minIndexByteCapacity);
+};
@@ -0,0 +1,246 @@
+#include "gl_state_cache.h"
+
+#include <algorithm>
+
+void GLStateCache::Invalidate()
+{
+    // Caps stay in the map so that SetEnabledCaps still disables them
+    for (auto& cap : enabledCaps)
+    {
+        cap.second.known = false;
+    }
+    cullFace.known = false;
+    depthMask.known = false;
+    depthFunc.known = false;
+    blendEquation.known = false;
+    for (auto& factors : blendFactors)
+    {
+        factors.known = false;
+    }
+    clearColor.known = false;
+
+    framebuffer.known = false;
+    drawBuffers.clear();
+
+    program.known = false;
+    vertexArray.known = false;
+    bufferBindings.clear();
+    activeTextureUnit.known = false;
+    for (auto& texture : textures)
+    {
+        texture.known = false;
+    }
+}
+
+void GLStateCache::BeginFrame()
+{
+    Invalidate();
+    lastFrameStats = frameStats;
+    frameStats = Stats();
+}
+
+void GLStateCache::Enable(GLenum cap)
+{
+    if (enabledCaps[cap].Set(true, frameStats))
+    {
+        glEnable(cap);
+    }
+}
+
+void GLStateCache::Disable(GLenum cap)
+{
+    if (enabledCaps[cap].Set(false, frameStats))
+    {
+        glDisable(cap);
+    }
+}
+
+void GLStateCache::SetEnabledCaps(const std::vector<GLenum>& caps)
+{
+    for (GLenum cap : caps)
+    {
+        Enable(cap);
+    }
+    DisableCapsExcept(caps);
+}
+
+void GLStateCache::DisableCapsExcept(const std::vector<GLenum>& caps)
+{
+    for (auto& cap : enabledCaps)
+    {
+        if (std::find(caps.begin(), caps.end(), cap.first) == caps.end() && cap.second.Set(false, frameStats))
+        {
+            glDisable(cap.first);
+        }
+    }
+}
+
+void GLStateCache::CullFace(GLenum face)
+{
+    if (cullFace.Set(face, frameStats))
+    {
+        glCullFace(face);
+    }
+}
+
+void GLStateCache::DepthMask(GLboolean mask)
+{
+    if (depthMask.Set(mask, frameStats))
+    {
+        glDepthMask(mask);
+    }
+}
+
+void GLStateCache::DepthFunc(GLenum func)
+{
+    if (depthFunc.Set(func, frameStats))
+    {
+        glDepthFunc(func);
+    }
+}
+
+void GLStateCache::BlendEquation(GLenum equation)
+{
+    if (blendEquation.Set(equation, frameStats))
+    {
+        glBlendEquation(equation);
+    }
+}
+
+void GLStateCache::BlendFunc(GLenum srcFactor, GLenum dstFactor)
+{
+    BlendFuncSeparate(srcFactor, dstFactor, srcFactor, dstFactor);
+}
+
+void GLStateCache::BlendFunci(GLuint drawBuffer, GLenum srcFactor, GLenum dstFactor)
+{
+    BlendFactors factors = { srcFactor, dstFactor, srcFactor, dstFactor };
+    if (drawBuffer >= GL_STATE_CACHE_MAX_DRAW_BUFFERS || blendFactors[drawBuffer].Set(factors, frameStats))
+    {
+        glBlendFunci(drawBuffer, srcFactor, dstFactor);
+    }
+}
+
+void GLStateCache::BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+    // Sets the factors of every draw buffer
+    BlendFactors factors = { srcRGB, dstRGB, srcAlpha, dstAlpha };
+    bool changed = false;
+    for (auto& drawBufferFactors : blendFactors)
+    {
+        changed |= !drawBufferFactors.known || !(drawBufferFactors.value == factors);
+        drawBufferFactors.known = true;
+        drawBufferFactors.value = factors;
+    }
+
+    if (changed)
+    {
+        frameStats.issuedCalls++;
+        glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+    }
+    else
+    {
+        frameStats.savedCalls++;
+    }
+}
+
+void GLStateCache::ClearColor(float r, float g, float b, float a)
+{
+    if (clearColor.Set(glm::vec4(r, g, b, a), frameStats))
+    {
+        glClearColor(r, g, b, a);
+    }
+}
+
+void GLStateCache::BindFramebuffer(GLuint fbo)
+{
+    if (framebuffer.Set(fbo, frameStats))
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    }
+}
+
+void GLStateCache::DrawBuffers(int count, const GLenum* buffers)
+{
+    if (!framebuffer.known || framebuffer.value == 0)
+    {
+        return;
+    }
+
+    std::vector<GLenum>& current = drawBuffers[framebuffer.value];
+    if (current.size() == count && std::equal(current.begin(), current.end(), buffers))
+    {
+        frameStats.savedCalls++;
+        return;
+    }
+
+    current.assign(buffers, buffers + count);
+    frameStats.issuedCalls++;
+    glDrawBuffers(count, buffers);
+}
+
+void GLStateCache::UseProgram(GLuint id)
+{
+    if (program.Set(id, frameStats))
+    {
+        glUseProgram(id);
+    }
+}
+
+void GLStateCache::BindVertexArray(GLuint vao)
+{
+    if (vertexArray.Set(vao, frameStats))
+    {
+        glBindVertexArray(vao);
+    }
+}
+
+void GLStateCache::BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    if (bufferBindings[((unsigned long)target << 32) | index].Set({ buffer, 0, -1 }, frameStats))
+    {
+        glBindBufferBase(target, index, buffer);
+    }
+}
+
+void GLStateCache::BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    if (bufferBindings[((unsigned long)target << 32) | index].Set({ buffer, offset, size }, frameStats))
+    {
+        glBindBufferRange(target, index, buffer, offset, size);
+    }
+}
+
+void GLStateCache::BindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    // Only 2D textures are shadowed
+    if (target != GL_TEXTURE_2D || unit >= GL_STATE_CACHE_MAX_TEXTURE_UNITS)
+    {
+        if (activeTextureUnit.Set(unit, frameStats))
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+        frameStats.issuedCalls++;
+        glBindTexture(target, texture);
+        return;
+    }
+
+    if (textures[unit].known && textures[unit].value == texture)
+    {
+        frameStats.savedCalls++;
+        return;
+    }
+
+    if (activeTextureUnit.Set(unit, frameStats))
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    textures[unit].Set(texture, frameStats);
+    glBindTexture(target, texture);
+}
+
+/*static*/ GLStateCache& GLStateCache::Get()
+{
+    static GLStateCache cache;
+    return cache;
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "glm/glm.hpp"
+
+#define GL_STATE_CACHE_MAX_DRAW_BUFFERS 8
+#define GL_STATE_CACHE_MAX_TEXTURE_UNITS 32
+
+// Shadow copy of the GL state touched while executing a RenderPipeline. Every setter compares
+// against the shadow and only calls GL when the value changes. Code outside the pipeline still calls
+// GL directly, so the shadow is invalidated at the start of every RenderPipeline::Render.
+struct GLStateCache
+{
+    struct Stats
+    {
+        int issuedCalls = 0;
+        // Calls skipped because the state was already set
+        int savedCalls = 0;
+    };
+
+    Stats frameStats;
+    Stats lastFrameStats;
+
+    // Forgets all shadowed values, so that the next call of every setter goes to GL
+    void Invalidate();
+    // Invalidate() and roll over the per frame stats
+    void BeginFrame();
+
+    void Enable(GLenum cap);
+    void Disable(GLenum cap);
+    // Enables caps and disables every other cap ever enabled through the cache
+    void SetEnabledCaps(const std::vector<GLenum>& caps);
+    void DisableCapsExcept(const std::vector<GLenum>& caps);
+
+    void CullFace(GLenum face);
+    void DepthMask(GLboolean mask);
+    void DepthFunc(GLenum func);
+    void BlendEquation(GLenum equation);
+    void BlendFunc(GLenum srcFactor, GLenum dstFactor);
+    void BlendFunci(GLuint drawBuffer, GLenum srcFactor, GLenum dstFactor);
+    void BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+    void ClearColor(float r, float g, float b, float a);
+
+    void BindFramebuffer(GLuint fbo);
+    // For the currently bound framebuffer, ignored for the default framebuffer
+    void DrawBuffers(int count, const GLenum* buffers);
+
+    void UseProgram(GLuint program);
+    void BindVertexArray(GLuint vao);
+    // GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER or GL_ATOMIC_COUNTER_BUFFER binding points
+    void BindBufferBase(GLenum target, GLuint index, GLuint buffer);
+    void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    void BindTexture(GLuint unit, GLenum target, GLuint texture);
+
+    static GLStateCache& Get();
+
+    // Unknown means GL has to be called regardless of the value
+    template<typename T>
+    struct Shadowed
+    {
+        bool known = false;
+        T value;
+
+        // True if GL needs to be called, i.e. value changed or was unknown
+        bool Set(T newValue, Stats& stats)
+        {
+            if (known && value == newValue)
+            {
+                stats.savedCalls++;
+                return false;
+            }
+            known = true;
+            value = newValue;
+            stats.issuedCalls++;
+            return true;
+        }
+    };
+
+    struct BlendFactors
+    {
+        GLenum srcRGB;
+        GLenum dstRGB;
+        GLenum srcAlpha;
+        GLenum dstAlpha;
+
+        bool operator==(const BlendFactors& other) const
+        {
+            return srcRGB == other.srcRGB && dstRGB == other.dstRGB && srcAlpha == other.srcAlpha && dstAlpha == other.dstAlpha;
+        }
+    };
+
+    struct BufferRange
+    {
+        GLuint buffer;
+        GLintptr offset;
+        // -1 for the whole buffer, i.e. glBindBufferBase
+        GLsizeiptr size;
+
+        bool operator==(const BufferRange& other) const
+        {
+            return buffer == other.buffer && offset == other.offset && size == other.size;
+        }
+    };
+
+    std::unordered_map<GLenum, Shadowed<bool>> enabledCaps;
+    Shadowed<GLenum> cullFace;
+    Shadowed<GLboolean> depthMask;
+    Shadowed<GLenum> depthFunc;
+    Shadowed<GLenum> blendEquation;
+    Shadowed<BlendFactors> blendFactors[GL_STATE_CACHE_MAX_DRAW_BUFFERS];
+    Shadowed<glm::vec4> clearColor;
+
+    Shadowed<GLuint> framebuffer;
+    // Draw buffers are framebuffer state
+    std::unordered_map<GLuint, std::vector<GLenum>> drawBuffers;
+
+    Shadowed<GLuint> program;
+    Shadowed<GLuint> vertexArray;
+    // Keyed by target << 32 | index
+    std::unordered_map<unsigned long, Shadowed<BufferRange>> bufferBindings;
+    Shadowed<GLuint> activeTextureUnit;
+    Shadowed<GLuint> textures[GL_STATE_CACHE_MAX_TEXTURE_UNITS];
+};
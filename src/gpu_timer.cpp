@@ -0,0 +1,81 @@
+#include "gpu_timer.h"
+
+#include "trace.h"
+
+bool GpuTimer::Resolve(Frame& frame, bool wait)
+{
+    if (frame.ranges.empty())
+    {
+        return true;
+    }
+
+    // Timestamps complete in submission order, the last one being available implies all are
+    if (!wait)
+    {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(frame.queries[frame.usedQueryCount - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE)
+        {
+            return false;
+        }
+    }
+
+    std::vector<GLuint64> timestamps(frame.usedQueryCount);
+    for (int i = 0; i < frame.usedQueryCount; i++)
+    {
+        glGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &timestamps[i]);
+    }
+
+    for (Range& range : frame.ranges)
+    {
+        double durationMs = (double)(timestamps[range.endQuery] - timestamps[range.beginQuery]) / 1000000.0;
+        range.target->AddFrametime(durationMs);
+        AddGpuTraceEvent(range.name, timestamps[range.beginQuery], timestamps[range.endQuery]);
+    }
+
+    frame.ranges.clear();
+    frame.usedQueryCount = 0;
+    return true;
+}
+
+void GpuTimer::BeginFrame()
+{
+    // The slot being reused is the oldest one. Only stalls if the GPU is more than GPU_TIMER_FRAMES_IN_FLIGHT frames behind.
+    currentFrame = (currentFrame + 1) % GPU_TIMER_FRAMES_IN_FLIGHT;
+    Resolve(frames[currentFrame], true);
+
+    // Oldest to newest so that every FrametimePerfData gets its samples in frame order
+    for (int i = 1; i < GPU_TIMER_FRAMES_IN_FLIGHT; i++)
+    {
+        if (!Resolve(frames[(currentFrame + i) % GPU_TIMER_FRAMES_IN_FLIGHT], false))
+        {
+            break;
+        }
+    }
+}
+
+void GpuTimer::Drain()
+{
+    for (int i = 1; i <= GPU_TIMER_FRAMES_IN_FLIGHT; i++)
+    {
+        Resolve(frames[(currentFrame + i) % GPU_TIMER_FRAMES_IN_FLIGHT], true);
+    }
+}
+
+int GpuTimer::Timestamp()
+{
+    Frame& frame = frames[currentFrame];
+    if (frame.usedQueryCount == frame.queries.size())
+    {
+        frame.queries.push_back(0);
+        glGenQueries(1, &frame.queries.back());
+    }
+
+    glQueryCounter(frame.queries[frame.usedQueryCount], GL_TIMESTAMP);
+    return frame.usedQueryCount++;
+}
+
+void GpuTimer::AddRange(FrametimePerfData* target, const char* name, int beginQuery, int endQuery)
+{
+    frames[currentFrame].ranges.push_back({ target, name, beginQuery, endQuery });
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "perf_data.h"
+
+// Frames a GPU timing result may lag behind before reading it stalls the CPU
+#define GPU_TIMER_FRAMES_IN_FLIGHT 4
+
+// GL_TIMESTAMP queries recorded into a ring of per frame slots. Ranges between two timestamps are
+// resolved into their FrametimePerfData once the GPU has passed them, GPU_TIMER_FRAMES_IN_FLIGHT
+// frames later at the latest, so timing never waits on the GPU mid frame.
+struct GpuTimer
+{
+    struct Range
+    {
+        FrametimePerfData* target;
+        // Trace event name
+        const char* name;
+        int beginQuery;
+        int endQuery;
+    };
+
+    struct Frame
+    {
+        std::vector<GLuint> queries;
+        int usedQueryCount = 0;
+        std::vector<Range> ranges;
+    };
+
+    Frame frames[GPU_TIMER_FRAMES_IN_FLIGHT];
+    int currentFrame = 0;
+
+    // Resolves whatever finished since the last frame and reuses the oldest slot
+    void BeginFrame();
+    // Records a timestamp at this point of the command stream, returns its query index for AddRange
+    int Timestamp();
+    // target gets end - begin once both timestamps are available, also traced while recording
+    void AddRange(FrametimePerfData* target, const char* name, int beginQuery, int endQuery);
+
+    // Waits for and resolves every frame recorded so far, the current one included, oldest first. For benchmark and
+    // headless runs, whose per frame samples have to belong to the frame just rendered.
+    void Drain();
+
+    // Returns false if the frame's queries are not available yet and wait is false
+    bool Resolve(Frame& frame, bool wait);
+};
@@ -14,3 +14,13 @@ inline unsigned long Djb2(const unsigned char* str, unsigned long hash = 5381)
 
     return hash;
 }
+
+inline unsigned long Djb2Bytes(const unsigned char* data, unsigned long size, unsigned long hash = 5381)
+{
+    for (unsigned long i = 0; i < size; i++)
+    {
+        hash = Djb2Byte(data[i], hash);
+    }
+
+    return hash;
+}
@@ -0,0 +1,318 @@
+#include "headless.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <GL/glew.h>
+
+#include "stb_image.h"
+
+#include "log.h"
+#include "png_writer.h"
+#include "random.h"
+#include "texture_pool.h"
+#include "trace.h"
+
+// Fixed step so that the simulation does not depend on how fast the frames render
+#define HEADLESS_FRAME_DELTA_TIME 0.016f
+
+bool ParseHeadlessOptions(int argc, char** argv, HeadlessOptions& options)
+{
+    bool headless = false;
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && hasValue)
+            options.frameCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--output") == 0 && hasValue)
+            options.outputDir = argv[++i];
+        else if (strcmp(argv[i], "--pipeline") == 0 && hasValue)
+            options.pipelineFilters.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--camera-path") == 0 && hasValue)
+            options.cameraPath = argv[++i];
+        else if (strcmp(argv[i], "--reference") == 0 && hasValue)
+            options.referenceDir = argv[++i];
+        else if (strcmp(argv[i], "--trace") == 0)
+            options.trace = true;
+        else if (strcmp(argv[i], "--no-images") == 0)
+            options.writeImages = false;
+        else if (strcmp(argv[i], "--egl") == 0)
+            options.useEgl = true;
+        else
+            LOG_WARN("Headless", "Ignoring unknown argument \"%s\"", argv[i]);
+    }
+
+    if (options.frameCount < 1)
+    {
+        options.frameCount = 1;
+    }
+
+    return headless;
+}
+
+static std::string SanitizedName(const char* name)
+{
+    std::string sanitized = name;
+    for (char& c : sanitized)
+    {
+        bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-';
+        c = allowed ? c : '_';
+    }
+    return sanitized;
+}
+
+static bool SelectedPipeline(const HeadlessOptions& options, const char* name)
+{
+    if (options.pipelineFilters.empty())
+    {
+        return true;
+    }
+
+    for (const std::string& filter : options.pipelineFilters)
+    {
+        if (strstr(name, filter.c_str()) != nullptr)
+            return true;
+    }
+    return false;
+}
+
+// Root mean square error over all channels, in 0-255 units. Negative if the reference is missing or differs in size.
+static float CompareWithReference(const char* referencePath, int width, int height, const unsigned char* rgba)
+{
+    int referenceWidth;
+    int referenceHeight;
+    int componentNum;
+    stbi_set_flip_vertically_on_load_thread(false);
+    unsigned char* reference = stbi_load(referencePath, &referenceWidth, &referenceHeight, &componentNum, 4);
+    if (reference == nullptr)
+    {
+        return -1.f;
+    }
+
+    float rmse = -1.f;
+    if (referenceWidth == width && referenceHeight == height)
+    {
+        double sum = 0.0;
+        long count = (long)width * height * 4;
+        for (long i = 0; i < count; i++)
+        {
+            double d = (double)rgba[i] - reference[i];
+            sum += d * d;
+        }
+        rmse = sqrt(sum / count);
+    }
+
+    stbi_image_free(reference);
+    return rmse;
+}
+
+bool OffscreenTarget::Init(int width, int height)
+{
+    glGenTextures(1, &color);
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return complete;
+}
+
+void OffscreenTarget::Deinit()
+{
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteTextures(1, &color);
+}
+
+void OffscreenTarget::Read(int width, int height, std::vector<unsigned char>& rgba)
+{
+    std::vector<unsigned char> flipped((long)width * height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, flipped.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    long rowSize = (long)width * 4;
+    rgba.resize(flipped.size());
+    for (int y = 0; y < height; y++)
+    {
+        memcpy(rgba.data() + y * rowSize, flipped.data() + (height - 1 - y) * rowSize, rowSize);
+    }
+}
+
+void SceneSnapshot::Capture(Scene& scene)
+{
+    lights.reset(new Scene::Lights(scene.lights));
+    meshes = scene.meshes;
+}
+
+void SceneSnapshot::Restore(Scene& scene, unsigned int seed)
+{
+    SeedRandom(seed);
+    scene.lights = *lights;
+    // Assigned in place, particles keep references to the meshes
+    for (auto& tagMeshes : meshes)
+    {
+        scene.meshes[tagMeshes.first] = tagMeshes.second;
+    }
+    for (ParticleSys& particleSys : scene.particleSystems)
+    {
+        for (ParticleData& particle : particleSys.particles)
+        {
+            particle.lifetime = 0.f;
+        }
+    }
+}
+
+void WarmUpPipeline(NamedPipeline& namedPipeline, Scene& scene, ShaderPool& shaders, const CameraPath& cameraPath)
+{
+    cameraPath.Apply(cameraPath.keys.front().time, scene.camera);
+    scene.Update(0.f);
+    namedPipeline.pipeline.Render(scene, shaders);
+    FlushTexturePool();
+    // Nothing of the warm up may reach the next run's samples
+    namedPipeline.pipeline.gpuTimer.Drain();
+}
+
+int RunHeadless(const HeadlessOptions& options)
+{
+    CameraPath cameraPath = CameraPath::DefaultPath();
+    if (!options.cameraPath.empty() && !cameraPath.Load(options.cameraPath.c_str()))
+    {
+        return 1;
+    }
+
+    if (mkdir(options.outputDir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        LOG_ERROR("Headless", "Cannot create output directory %s", options.outputDir.c_str());
+        return 1;
+    }
+
+    std::string timingsPath = options.outputDir + "/timings.csv";
+    FILE* timings = fopen(timingsPath.c_str(), "w");
+    if (timings == nullptr)
+    {
+        LOG_ERROR("Headless", "Cannot open %s", timingsPath.c_str());
+        return 1;
+    }
+    fprintf(timings, "pipeline,frame,cpu_ms,gpu_ms%s\n", options.referenceDir.empty() ? "" : ",rmse");
+
+    if (options.trace)
+    {
+        StartTrace((options.outputDir + "/trace.json").c_str());
+    }
+
+    SeedRandom(options.seed);
+    ShaderPool shaders;
+    Scene scene = TestScene();
+    std::vector<NamedPipeline> pipelines = TestPipelines(scene.globalAttachments, shaders);
+
+    int width = scene.sceneParams.viewportWidth;
+    int height = scene.sceneParams.viewportHeight;
+    OffscreenTarget target;
+    if (!target.Init(width, height))
+    {
+        LOG_ERROR("Headless", "Offscreen framebuffer is incomplete");
+        fclose(timings);
+        return 1;
+    }
+    RenderPipeline::outputFramebuffer = target.fbo;
+
+    // Every pipeline starts from the same state, whatever ran before it
+    SceneSnapshot initialState;
+    initialState.Capture(scene);
+
+    int failedFrames = 0;
+    std::vector<unsigned char> rgba;
+    for (NamedPipeline& namedPipeline : pipelines)
+    {
+        if (!SelectedPipeline(options, namedPipeline.name))
+        {
+            continue;
+        }
+        LOG_INFO("Headless", "Rendering %d frames of \"%s\"", options.frameCount, namedPipeline.name);
+        std::string pipelineName = SanitizedName(namedPipeline.name);
+
+        WarmUpPipeline(namedPipeline, scene, shaders, cameraPath);
+        initialState.Restore(scene, options.seed);
+
+        for (int frame = 0; frame < options.frameCount; frame++)
+        {
+            TraceFrameBoundary();
+            TraceScope frameTraceScope("frame", "Frame");
+
+            float t = options.frameCount > 1 ? (float)frame / (options.frameCount - 1) : 0.f;
+            cameraPath.Apply(cameraPath.keys.front().time + t * cameraPath.Duration(), scene.camera);
+            scene.Update(HEADLESS_FRAME_DELTA_TIME);
+            UpdateTransparentMeshOrder(namedPipeline, scene);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            namedPipeline.pipeline.Render(scene, shaders);
+            // Blocks, so that the GPU time below is this frame's rather than one from a few frames back
+            namedPipeline.pipeline.gpuTimer.Drain();
+
+            char frameName[32];
+            snprintf(frameName, sizeof(frameName), "_%04d.png", frame);
+            std::string imageName = pipelineName + frameName;
+
+            FrametimePerfData& cpu = namedPipeline.pipeline.perfData.cpu;
+            FrametimePerfData& gpu = namedPipeline.pipeline.perfData.gpu;
+            fprintf(timings, "\"%s\",%d,%.4f,%.4f", namedPipeline.name, frame, cpu.data[cpu.latestIndex], gpu.data[gpu.latestIndex]);
+
+            if (options.writeImages || !options.referenceDir.empty())
+            {
+                target.Read(width, height, rgba);
+            }
+
+            if (options.writeImages)
+            {
+                std::string imagePath = options.outputDir + "/" + imageName;
+                if (!WritePng(imagePath.c_str(), width, height, 4, rgba.data()))
+                {
+                    LOG_ERROR("Headless", "Failed writing %s", imagePath.c_str());
+                    failedFrames++;
+                }
+            }
+
+            if (!options.referenceDir.empty())
+            {
+                std::string referencePath = options.referenceDir + "/" + imageName;
+                float rmse = CompareWithReference(referencePath.c_str(), width, height, rgba.data());
+                if (rmse < 0.f)
+                {
+                    LOG_WARN("Headless", "No comparable reference %s", referencePath.c_str());
+                }
+                fprintf(timings, ",%.4f", rmse);
+            }
+            fprintf(timings, "\n");
+        }
+        fflush(timings);
+    }
+
+    fclose(timings);
+    StopTrace();
+    FlushTrace();
+    RenderPipeline::outputFramebuffer = 0;
+    target.Deinit();
+
+    LOG_INFO("Headless", "Captures and timings written to %s", options.outputDir.c_str());
+    return failedFrames > 0 ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "camera_path.h"
+#include "scene.h"
+#include "shader.h"
+#include "test_structures.h"
+
+// Offscreen runs without user input: every selected TestPipelines entry renders a fixed number of
+// frames along a scripted camera path into an offscreen framebuffer. Each frame is read back to
+// <outputDir>/<pipeline>_<frame>.png and per frame timings go to <outputDir>/timings.csv, so that
+// images and timings can be diffed between builds.
+struct HeadlessOptions
+{
+    int frameCount = 60;
+    unsigned int seed = 1337;
+    std::string outputDir = "headless_output";
+    // Case sensitive substrings of pipeline names, empty runs every pipeline
+    std::vector<std::string> pipelineFilters;
+    // Empty uses CameraPath::DefaultPath()
+    std::string cameraPath;
+    // Directory with captures of a previous run, frames are compared against it
+    std::string referenceDir;
+    bool writeImages = true;
+    // Records a Chrome trace of the whole run to <outputDir>/trace.json
+    bool trace = false;
+    // Create the context through EGL instead of GLX, e.g. for surfaceless Mesa drivers
+    bool useEgl = false;
+};
+
+// Returns true if --headless was passed. Unknown arguments are reported and ignored.
+bool ParseHeadlessOptions(int argc, char** argv, HeadlessOptions& options);
+
+// Expects a current GL context. Returns the process exit code.
+int RunHeadless(const HeadlessOptions& options);
+
+// Color + depth framebuffer the output pass is redirected to with RenderPipeline::outputFramebuffer
+struct OffscreenTarget
+{
+    unsigned int fbo = 0;
+    unsigned int color = 0;
+    unsigned int depth = 0;
+
+    bool Init(int width, int height);
+    void Deinit();
+    // RGBA8, rows top to bottom
+    void Read(int width, int height, std::vector<unsigned char>& rgba);
+};
+
+// Scene state that scripted runs mutate, restored so that every pipeline starts from the same state
+struct SceneSnapshot
+{
+    std::unique_ptr<Scene::Lights> lights;
+    std::unordered_map<MeshTag, std::vector<MeshWithMaterial>> meshes;
+
+    void Capture(Scene& scene);
+    // Also reseeds the random engine and respawns all particles
+    void Restore(Scene& scene, unsigned int seed);
+};
+
+// Renders one frame at the start of the path and waits until every texture it requested is resident
+void WarmUpPipeline(NamedPipeline& namedPipeline, Scene& scene, ShaderPool& shaders, const CameraPath& cameraPath);
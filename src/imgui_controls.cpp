@@ -8,9 +8,12 @@
 
 #include "imgui.h"
 
+#include "gl_state_cache.h"
 #include "render_pipeline.h"
 #include "scene.h"
 #include "test_structures.h"
+#include "trace.h"
+#include "transform_store.h"
 
 void ShowInfo(Scene& scene, NamedPipeline& pipeline, bool* open)
 {
@@ -75,6 +78,32 @@ void ShowPerfMetrics(RenderPipeline& pipeline, bool* open)
     {
         PerfWidget(pipeline.perfData);
         ImGui::Text("Frames: %d", pipeline.perfData.cpu.lifetimeDatapointCount);
+        GLStateCache::Stats& stateStats = GLStateCache::Get().lastFrameStats;
+        ImGui::Text("GL state calls: %d issued, %d saved by the state cache", stateStats.issuedCalls, stateStats.savedCalls);
+        int drawGroupCount = 0;
+        for (auto& tagGroups : pipeline.drawGroups)
+        {
+            drawGroupCount += tagGroups.second.size();
+        }
+        ImGui::Text("Draw groups: %d, indirect commands: %d", drawGroupCount, pipeline.drawCommandCount);
+        ImGui::Text("Meshes culled on the CPU: %d, tested on the GPU: %d", pipeline.culledMeshCount, pipeline.cullObjectCount);
+        ImGui::Text("Meshlets tested on the GPU: %d", pipeline.meshletCullItemCount);
+        ImGui::Text("Transforms recomputed: %d", TransformStore::Get().lastUpdateCount);
+        FrameRingBuffer& ringBuffer = FrameRingBuffer::Get();
+        ImGui::Text("Frame ring buffer: %ld KB per region, waits on the GPU: %d", (long) ringBuffer.regionSize / 1024, ringBuffer.stallCount);
+        ImGui::Separator();
+
+        static int traceFrameCount = 120;
+        ImGui::InputInt("Trace frames (0 until stopped)", &traceFrameCount);
+        traceFrameCount = traceFrameCount < 0 ? 0 : traceFrameCount;
+        if (!IsTraceRecording() && ImGui::Button("Record trace"))
+        {
+            StartTrace("ignoramus_trace.json", traceFrameCount);
+        }
+        if (IsTraceRecording() && ImGui::Button("Stop trace"))
+        {
+            StopTrace();
+        }
         ImGui::Separator();
         ImGui::Separator();
 
@@ -91,6 +120,9 @@ void ShowPerfMetrics(RenderPipeline& pipeline, bool* open)
                     if (ImGui::TreeNodeEx(subpassLabel))
                     {
                         PerfWidget(subpass->perfData);
+                        Subpass::RenderQueueStats& queueStats = subpass->renderQueueStats;
+                        ImGui::Text("Draw packets: %d, binds avoided: %d texture sets, %d vertex arrays", queueStats.drawPackets,
+                                queueStats.textureSetBindsAvoided, queueStats.vertexArrayBindsAvoided);
                         ImGui::TreePop();
                     }
                 }
@@ -162,6 +194,33 @@ void ShowPipelineResources(NamedPipeline& namedPipeline, bool* open)
     ImGui::End();
 }
 
+void ShowPipelineSettings(RenderPipeline& pipeline, bool* open)
+{
+    if (ImGui::Begin("Pipeline settings", open))
+    {
+        if (pipeline.cullingPass != nullptr && pipeline.depthPyramid != nullptr)
+        {
+            ImGui::Checkbox("Occlusion culling against last frame's depth pyramid", &pipeline.occlusionCulling);
+        }
+        if (pipeline.cullingPass != nullptr)
+        {
+            ImGui::Checkbox("Meshlet culling", &pipeline.meshletCulling);
+        }
+        if (pipeline.depthPrepassSubpass != nullptr)
+        {
+            ImGui::Checkbox("Depth prepass", &pipeline.depthPrepass);
+        }
+        ImGui::SliderFloat("LOD error (pixels)", &pipeline.lodErrorPixels, 0.f, 8.f);
+        ImGui::Text("Meshes per LOD:");
+        for (int i = 0; i < MESH_MAX_LODS; i++)
+        {
+            ImGui::SameLine();
+            ImGui::Text("%d", pipeline.lodMeshCounts[i]);
+        }
+    }
+    ImGui::End();
+}
+
 void ShowSceneSettings(Scene& scene, bool* open)
 {
     if (ImGui::Begin("Scene settings", open))
@@ -229,6 +288,11 @@ void ShowControls(GLFWwindow* window, std::vector<NamedPipeline>& pipelines, int
         ShowPipelineResources(pipelines[activePipelineIndex], &showPipelineResources);
     }
 
+    if (showPipelineSettings)
+    {
+        ShowPipelineSettings(pipelines[activePipelineIndex].pipeline, &showPipelineSettings);
+    }
+
     if (showSceneSettings)
     {
         ShowSceneSettings(scene, &showSceneSettings);
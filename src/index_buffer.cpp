@@ -10,7 +10,7 @@ IndexBuffer::IndexBuffer()
 {
 }
 
-IndexBuffer::IndexBuffer(unsigned int *indices, int size)
+IndexBuffer::IndexBuffer(const unsigned int *indices, int size)
     : size(size), loaded(true)
 {
     glGenBuffers(1, &id);
@@ -22,7 +22,7 @@ IndexBuffer::IndexBuffer(unsigned int *indices, int size)
         printf("[post index buffer buffer data] OpenGL error: %04x\n", err);
 }
 
-IndexBuffer::IndexBuffer(unsigned int *indices, int size, unsigned int id)
+IndexBuffer::IndexBuffer(const unsigned int *indices, int size, unsigned int id)
     : id(id), size(size), loaded(true)
 {
     Bind();
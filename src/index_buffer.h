@@ -5,8 +5,8 @@ class IndexBuffer
 {
 public:
     IndexBuffer();
-    IndexBuffer(unsigned int *indices, int size);
-    IndexBuffer(unsigned int *indices, int size, unsigned int id);
+    IndexBuffer(const unsigned int *indices, int size);
+    IndexBuffer(const unsigned int *indices, int size, unsigned int id);
 
     void Bind() const;
     void Unbind() const;
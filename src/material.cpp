@@ -1,25 +1,59 @@
 #include "material.h"
 
+#include <string.h>
+
+#include "log.h"
+
+/*static*/ std::vector<Material*> MaterialTable::materials;
+/*static*/ bool MaterialTable::dirty = false;
+/*static*/ unsigned int MaterialTable::ssbo = 0;
+
 Material::Material(unsigned int structSize, unsigned int materialId, void *data)
 {
     nonResourceData.size = structSize;
     nonResourceData.materialId = materialId;
     nonResourceData.data = data;
 
-    glGenBuffers(1, &nonResourceData.uboId);
-    glBindBufferBase(GL_UNIFORM_BUFFER, Shader::materialParamBindingPoint, nonResourceData.uboId);
+    if (nonResourceData.size > MATERIAL_TABLE_SLOT_SIZE)
+    {
+        LOG_ERROR("Material", "Material 0x%X is %u bytes, doesn't fit in a %u byte material table slot. Truncating",
+                materialId, structSize, (unsigned int) MATERIAL_TABLE_SLOT_SIZE);
+        nonResourceData.size = MATERIAL_TABLE_SLOT_SIZE;
+    }
+
+    nonResourceData.tableIndex = MaterialTable::materials.size();
+    MaterialTable::materials.push_back(this);
     UpdateData();
 }
 
 void Material::UpdateData()
 {
-    // TODO: maybe ignore hwen size == 0
-    glBindBuffer(GL_UNIFORM_BUFFER, nonResourceData.uboId);
-    glBufferData(GL_UNIFORM_BUFFER, nonResourceData.size, nonResourceData.data, GL_STATIC_DRAW);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    MaterialTable::dirty = true;
 }
 
-void Material::Bind()
+/*static*/ void MaterialTable::Upload()
 {
-    glBindBufferBase(GL_UNIFORM_BUFFER, Shader::materialParamBindingPoint, nonResourceData.uboId);
+    if (!dirty)
+    {
+        return;
+    }
+
+    std::vector<char> tableData(materials.size() * MATERIAL_TABLE_SLOT_SIZE, 0);
+    for (int i = 0; i < materials.size(); i++)
+    {
+        if (materials[i]->nonResourceData.data != nullptr)
+        {
+            memcpy(tableData.data() + i * MATERIAL_TABLE_SLOT_SIZE, materials[i]->nonResourceData.data, materials[i]->nonResourceData.size);
+        }
+    }
+
+    if (ssbo == 0)
+    {
+        glGenBuffers(1, &ssbo);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, tableData.size(), tableData.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    dirty = false;
 }
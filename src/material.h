@@ -3,6 +3,7 @@
 #include <GL/glew.h>
 #include <unordered_map>
 #include <string>
+#include <vector>
 
 #include "shader.h"
 
@@ -13,18 +14,32 @@ struct Material
         unsigned int materialId;
 
         std::unordered_map<std::string, std::string> textures;
-        unsigned int uboId;
+        // Slot in the material table, what instances reference
+        unsigned int tableIndex;
         unsigned int size;
         void *data;
     } nonResourceData;
 
+    // Marks the material table for re-upload, call after changing resourceData
     void UpdateData();
-    void Bind();
 
 protected:
     Material(unsigned int structSize, unsigned int materialId, void *data);
 };
 
+// All materials' resourceData packed into one SSBO ("Materials" in shaders), indexed by Material::nonResourceData.tableIndex.
+// Every slot is MATERIAL_TABLE_SLOT_SIZE bytes, so instances of different material types can share draws.
+#define MATERIAL_TABLE_SLOT_SIZE (2 * sizeof(glm::vec4))
+struct MaterialTable
+{
+    static std::vector<Material*> materials;
+    static bool dirty;
+    static unsigned int ssbo;
+
+    // Re-uploads the whole table if any material changed since the last call
+    static void Upload();
+};
+
 //TODO: constexpr
 static unsigned int globalIdentifiableIdCounter = 0;
 template<typename T>
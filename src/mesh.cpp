@@ -2,8 +2,14 @@
 
 #include "log.h"
 #include "mesh.h"
+#include "mesh_lod.h"
+#include "mesh_optimizer.h"
+#include "meshlets.h"
+#include "gl_state_cache.h"
+#include "hash.h"
 
 #include "texture_pool.h"
+#include "texture_residency.h"
 
 glm::fvec3 ToVec3(objl::Vector3 vec)
 {
@@ -15,9 +21,10 @@ glm::fvec2 ToVec2(objl::Vector2 vec)
     return glm::fvec2(vec.X, vec.Y);
 }
 
-Mesh::Mesh(objl::Mesh &mesh, MeshTag tag, std::vector<std::pair<std::string, std::string>> overrideTexturesWithPaths)
+MeshData BuildMeshData(objl::Mesh &mesh)
 {
-    meshTag = tag;
+    MeshData data;
+    data.name = mesh.MeshName;
 
     glm::fvec4 *tangents = (glm::fvec4*) malloc(sizeof(glm::fvec4) * mesh.Vertices.size());
     glm::fvec4 *bitangents = (glm::fvec4*) malloc(sizeof(glm::fvec4) * mesh.Vertices.size());
@@ -92,12 +99,12 @@ Mesh::Mesh(objl::Mesh &mesh, MeshTag tag, std::vector<std::pair<std::string, std
         tangents[i].w = (glm::dot(glm::cross(glm::vec3(bitangents[i]), glm::vec3(tangents[i])), ToVec3(mesh.Vertices[i].Normal))) < 0.f ? -1.f : 1.f;
     }
 
-    const int convertedVerticesElementCount = 3 + 3 + 4 + 2;
-    float *convertedVertices = (float *) malloc(sizeof(float) * convertedVerticesElementCount * mesh.Vertices.size());
-    assert(convertedVertices != nullptr);
+    data.vertexCount = mesh.Vertices.size();
+    data.ownedVertices.resize(MESH_VERTEX_ELEMENT_COUNT * mesh.Vertices.size());
+    float *convertedVertices = data.ownedVertices.data();
     for (int i = 0; i < mesh.Vertices.size(); i++)
     {
-        int idx = i * convertedVerticesElementCount;
+        int idx = i * MESH_VERTEX_ELEMENT_COUNT;
         convertedVertices[idx+ 0] = mesh.Vertices[i].Position.X;
         convertedVertices[idx+ 1] = mesh.Vertices[i].Position.Y;
         convertedVertices[idx+ 2] = mesh.Vertices[i].Position.Z;
@@ -115,27 +122,54 @@ Mesh::Mesh(objl::Mesh &mesh, MeshTag tag, std::vector<std::pair<std::string, std
         convertedVertices[idx+10] = mesh.Vertices[i].TextureCoordinate.X;
         convertedVertices[idx+11] = mesh.Vertices[i].TextureCoordinate.Y;
 
-        aabbModelSpace.min = glm::vec3(glm::min(aabbModelSpace.min.x, mesh.Vertices[i].Position.X),
-                glm::min(aabbModelSpace.min.y, mesh.Vertices[i].Position.Y),
-                glm::min(aabbModelSpace.min.z, mesh.Vertices[i].Position.Z));
-        aabbModelSpace.max = glm::vec3(glm::max(aabbModelSpace.max.x, mesh.Vertices[i].Position.X),
-                glm::max(aabbModelSpace.max.y, mesh.Vertices[i].Position.Y),
-                glm::max(aabbModelSpace.max.z, mesh.Vertices[i].Position.Z));
+        data.aabbModelSpace.min = glm::vec3(glm::min(data.aabbModelSpace.min.x, mesh.Vertices[i].Position.X),
+                glm::min(data.aabbModelSpace.min.y, mesh.Vertices[i].Position.Y),
+                glm::min(data.aabbModelSpace.min.z, mesh.Vertices[i].Position.Z));
+        data.aabbModelSpace.max = glm::vec3(glm::max(data.aabbModelSpace.max.x, mesh.Vertices[i].Position.X),
+                glm::max(data.aabbModelSpace.max.y, mesh.Vertices[i].Position.Y),
+                glm::max(data.aabbModelSpace.max.z, mesh.Vertices[i].Position.Z));
     }
 
-    VertexBuffer vertexBuffer (convertedVertices, convertedVerticesElementCount * mesh.Vertices.size());
-    IndexBuffer indexBuffer (mesh.Indices.data(), mesh.Indices.size());
-    BufferLayout bufferLayout ({
-            { "pos", 3, GL_FLOAT, sizeof(float) },
-            { "normal", 3, GL_FLOAT, sizeof(float) },
-            { "tangent", 4, GL_FLOAT, sizeof(float) },
-            { "uv", 2, GL_FLOAT, sizeof(float) }});
-    
-    vertexArray = VertexArray(vertexBuffer, indexBuffer, bufferLayout);
+    data.indexCount = mesh.Indices.size();
+    data.ownedIndices = mesh.Indices;
+    BuildMeshLods(data);
+    OptimizeMeshData(data);
+    BuildMeshlets(data);
 
     free(tangents);
     free(bitangents);
-    free(convertedVertices);
+
+    if (!mesh.MeshMaterial.map_Kd.empty())
+        data.textures.push_back(std::make_pair("tex_diffuse", mesh.MeshMaterial.map_Kd));
+    if (!mesh.MeshMaterial.map_bump.empty())
+        data.textures.push_back(std::make_pair("tex_normal", mesh.MeshMaterial.map_bump));
+    if (!mesh.MeshMaterial.map_Ks.empty())
+        data.textures.push_back(std::make_pair("tex_specular", mesh.MeshMaterial.map_Ks));
+
+    return data;
+}
+
+Mesh::Mesh(objl::Mesh &mesh, MeshTag tag, std::vector<std::pair<std::string, std::string>> overrideTexturesWithPaths)
+    : Mesh(BuildMeshData(mesh), tag, overrideTexturesWithPaths)
+{
+}
+
+Mesh::Mesh(const MeshData &data, MeshTag tag, std::vector<std::pair<std::string, std::string>> overrideTexturesWithPaths)
+    : residentTextureSet(-1)
+{
+    meshTag = tag;
+    SetModelSpaceBounds(data.aabbModelSpace);
+
+    geometry = GeometryArena::Get().Allocate(data.Vertices(), data.vertexCount, data.Indices(), data.indexCount);
+    lods = data.lods;
+    if (lods.empty())
+    {
+        lods.push_back({ 0, data.indexCount, 0.f });
+    }
+    // The coarser LODs' indices follow, only drawn through LodGeometry
+    geometry.indexCount = lods[0].indexCount;
+    meshletCount = data.meshlets.size();
+    firstMeshlet = meshletCount > 0 ? GeometryArena::Get().AddMeshlets(geometry, data.meshlets.data(), meshletCount) : 0;
 
     for (int i = 0; i < overrideTexturesWithPaths.size(); i++)
     {
@@ -147,77 +181,131 @@ Mesh::Mesh(objl::Mesh &mesh, MeshTag tag, std::vector<std::pair<std::string, std
         textures[overrideTexturesWithPaths[i].first] = path;
     }
 
-    if (textures.find("tex_diffuse") == textures.end() && !mesh.MeshMaterial.map_Kd.empty())
+    // Material textures only fill in what wasn't overriden
+    for (auto& nameToPath : data.textures)
     {
-        std::string path = "../assets/" + mesh.MeshMaterial.map_Kd;
+        if (textures.find(nameToPath.first) != textures.end())
+            continue;
+
+        std::string path = "../assets/" + nameToPath.second;
         GetTexture(path);
-        textures["tex_diffuse"] = path;
+        textures[nameToPath.first] = path;
     }
-    if (textures.find("tex_normal") == textures.end() && !mesh.MeshMaterial.map_bump.empty())
+}
+
+unsigned long TexturesHash(const std::unordered_map<std::string, std::string>& textures)
+{
+    unsigned long hash = 0;
+    for (auto& nameToPath : textures)
     {
-        std::string path = "../assets/" + mesh.MeshMaterial.map_bump;
-        GetTexture(path);
-        textures["tex_normal"] = path;
+        hash += Djb2((const unsigned char*) nameToPath.second.c_str(), Djb2((const unsigned char*) nameToPath.first.c_str()));
     }
-    if (textures.find("tex_specular") == textures.end() && !mesh.MeshMaterial.map_Ks.empty())
+    return hash;
+}
+
+unsigned int Mesh::ResidentTextureSet()
+{
+    if (residentTextureSet < 0)
     {
-        std::string path = "../assets/" + mesh.MeshMaterial.map_Ks;
-        GetTexture(path);
-        textures["tex_specular"] = path;
+        residentTextureSet = TextureResidency::Get().TextureSetIndex(textures);
     }
+    return residentTextureSet;
 }
 
-void Mesh::Render(Shader &shader)
+GeometryArena::Allocation Mesh::LodGeometry(int lod) const
 {
-    int i = 0;
-    // Hmm, there should be some sort of communication between the shader and model here.
-    // Shader dictates what textures it needs, the model provides them
-    bool usingNormalMap = false;
+    ASSERT(lod >= 0 && lod < lods.size());
+    GeometryArena::Allocation lodGeometry = geometry;
+    lodGeometry.firstIndex += lods[lod].firstIndex;
+    lodGeometry.indexCount = lods[lod].indexCount;
+    return lodGeometry;
+}
 
-    // TEMP: quick lookup if the texture needs to be bound
-    std::unordered_set<std::string> textureUniformNames;
-    {
-        int unused;
-        GLenum type;
-        char uniformName[128];
-        int count = 0;
-        glGetProgramiv(shader.id, GL_ACTIVE_UNIFORMS, &count);
+const Transform& Mesh::LocalTransform() const
+{
+    return TransformStore::Get().Local(transform.id);
+}
 
-        for (int i = 0; i < count; i++)
-        {
-            glGetActiveUniform(shader.id, i, sizeof(uniformName), &unused, &unused, &type, uniformName);
+void Mesh::SetLocalTransform(const Transform& local)
+{
+    TransformStore::Get().SetLocal(transform.id, local);
+}
 
-            bool isTexture = type == GL_SAMPLER_1D || type == GL_SAMPLER_2D || type == GL_SAMPLER_3D;
-            if (!isTexture)
-            {
-                continue;
-            }
+void Mesh::SetModelSpaceBounds(const AABB& bounds)
+{
+    aabbModelSpace = bounds;
+    TransformStore::Get().SetModelSpaceBounds(transform.id, bounds);
+}
+
+const glm::mat4& Mesh::Model() const
+{
+    return TransformStore::Get().Model(transform.id);
+}
+
+const glm::mat3x4& Mesh::NormalMatrix() const
+{
+    return TransformStore::Get().NormalMatrix(transform.id);
+}
+
+const AABB& Mesh::WorldBounds() const
+{
+    return TransformStore::Get().WorldBounds(transform.id);
+}
 
-            textureUniformNames.insert(std::string(uniformName));
+Mesh::ShaderTextureBindings& Mesh::TextureBindingsFor(Shader& shader)
+{
+    for (ShaderTextureBindings& bindings : shaderTextureBindings)
+    {
+        if (bindings.reflectionId == shader.reflectionId)
+        {
+            return bindings;
         }
     }
 
-    for (std::pair<std::string, std::string> nameToPath : textures)
+    // Hmm, there should be some sort of communication between the shader and model here.
+    // Shader dictates what textures it needs, the model provides them
+    ShaderTextureBindings bindings;
+    bindings.reflectionId = shader.reflectionId;
+    bindings.usingNormalMap = false;
+    for (auto& nameToPath : textures)
     {
-        if (!usingNormalMap && nameToPath.first.compare("tex_normal") == 0)
-            usingNormalMap = true;
+        if (nameToPath.first.compare("tex_normal") == 0)
+            bindings.usingNormalMap = true;
 
-        if (textureUniformNames.find(nameToPath.first) == textureUniformNames.end())
+        int uniform = shader.FindUniform(nameToPath.first.c_str());
+        if (uniform == INVALID_UNIFORM || shader.uniforms[uniform].samplerIndex < 0)
         {
             continue;
         }
+        bindings.textures.push_back(std::make_pair(uniform, nameToPath.second));
+    }
+    bindings.usingNormalMapUniform = shader.FindUniform("usingNormalMap");
 
-        Texture *t = GetTexture(nameToPath.second);
+    shaderTextureBindings.push_back(bindings);
+    return shaderTextureBindings.back();
+}
+
+void Mesh::BindTextures(Shader &shader)
+{
+    ShaderTextureBindings& bindings = TextureBindingsFor(shader);
+    for (int i = 0; i < bindings.textures.size(); i++)
+    {
+        Texture *t = GetTexture(bindings.textures[i].second);
 
-        glActiveTexture(GL_TEXTURE0 + i);
-        shader.SetUniform(nameToPath.first.c_str(), i++);
-        t->Bind();
+        GLStateCache::Get().BindTexture(i, GL_TEXTURE_2D, t->id);
+        shader.SetUniform(bindings.textures[i].first, i);
     }
-    shader.SetUniform("usingNormalMap", usingNormalMap);
+    shader.SetUniform(bindings.usingNormalMapUniform, bindings.usingNormalMap);
+}
+
+void Mesh::Render(Shader &shader, int instanceCount, int baseInstance)
+{
+    BindTextures(shader);
 
-    vertexArray.Bind();
-    glDrawElements(GL_TRIANGLES, vertexArray.GetIndexCount(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    // Left bound, RenderPipeline::Render unbinds once at the end
+    GeometryArena::Get().Bind();
+    glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, geometry.indexCount, geometry.indexType,
+            (void*) (intptr_t) geometry.IndexByteOffset(), instanceCount, geometry.baseVertex, baseInstance);
 }
 
 /*static*/ Mesh Mesh::ScreenQuadMesh()
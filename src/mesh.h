@@ -6,9 +6,11 @@
 
 #include "shader.h"
 #include "texture.h"
-#include "vertex_array.h"
+#include "geometry_arena.h"
 #include "transform.h"
+#include "transform_store.h"
 #include "aabb.h"
+#include "mesh_cache.h"
 
 enum MeshTag
 {
@@ -26,19 +28,59 @@ enum MeshTag
     ALL             = -1
 };
 
+// Generates tangents, the model space AABB and the interleaved vertex data for an OBJ mesh
+MeshData BuildMeshData(objl::Mesh &mesh);
+
+// Order independent hash of a texture name to path map
+unsigned long TexturesHash(const std::unordered_map<std::string, std::string>& textures);
+
 struct Mesh
 {
     MeshTag meshTag;
-    VertexArray vertexArray;
+    // Copies of a mesh share the geometry. Covers LOD 0 only.
+    GeometryArena::Allocation geometry;
+    // Index ranges into geometry, lods[0] is the full detail mesh
+    std::vector<MeshLod> lods;
+    GeometryArena::Allocation LodGeometry(int lod) const;
+    // Range of GeometryArena::meshletBuffer splitting up LOD 0, empty for meshes too small to split
+    int firstMeshlet;
+    int meshletCount;
+    // Set through SetModelSpaceBounds, so that the cached world bounds follow
     AABB aabbModelSpace;
 
     Mesh(objl::Mesh &mesh, MeshTag tag = OPAQUE, std::vector<std::pair<std::string, std::string>> overrideTexturesWithPaths = std::vector<std::pair<std::string, std::string>>());
-    void Render(Shader &shader);
+    Mesh(const MeshData &data, MeshTag tag = OPAQUE, std::vector<std::pair<std::string, std::string>> overrideTexturesWithPaths = std::vector<std::pair<std::string, std::string>>());
+    // Instances are read from the "Instances" SSBO starting at baseInstance
+    void Render(Shader &shader, int instanceCount = 1, int baseInstance = 0);
+    // Render() without the draw, for indirect draws of meshes that share textures
+    void BindTextures(Shader &shader);
 
     std::unordered_map<std::string, std::string> textures;
 
-    // TMP: should reference the model's transform
-    Transform transform;
+    // Sampler handles of the textures above, resolved once per shader reflection. Clear after changing textures.
+    struct ShaderTextureBindings
+    {
+        unsigned int reflectionId;
+        std::vector<std::pair<int, std::string>> textures;
+        int usingNormalMapUniform;
+        bool usingNormalMap;
+    };
+    std::vector<ShaderTextureBindings> shaderTextureBindings;
+    ShaderTextureBindings& TextureBindingsFor(Shader& shader);
+
+    // TextureResidency slot of the textures above, -1 until first needed. Reset after changing textures.
+    int residentTextureSet;
+    unsigned int ResidentTextureSet();
+
+    // TransformStore slot of the mesh's transform. Writes go through SetLocalTransform, the model matrix and world
+    // space bounds are cached there and only recomputed after a change.
+    TransformHandle transform;
+    const Transform& LocalTransform() const;
+    void SetLocalTransform(const Transform& local);
+    void SetModelSpaceBounds(const AABB& bounds);
+    const glm::mat4& Model() const;
+    const glm::mat3x4& NormalMatrix() const;
+    const AABB& WorldBounds() const;
 
     static Mesh ScreenQuadMesh();
 };
@@ -0,0 +1,549 @@
+#include "mesh_cache.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hash.h"
+#include "log.h"
+
+#define MESH_CACHE_MAGIC "IGMC"
+// Bump whenever the layout below or the vertex format changes
+#define MESH_CACHE_VERSION 5
+#define MESH_CACHE_DATA_ALIGNMENT 16
+// Recorded for a dependency that did not exist when the cache was written
+#define MESH_CACHE_MISSING_MTIME -1
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+
+    int64_t sourceMtime;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+
+    uint32_t meshCount;
+    uint32_t textureCount;
+    uint32_t dependencyCount;
+    uint64_t stringTableOffset;
+    uint64_t stringTableSize;
+};
+
+struct MeshCacheEntry
+{
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    float aabbMin[3];
+    float aabbMax[3];
+
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t firstTexture;
+    uint32_t textureCount;
+
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+
+    // indexCount covers all LODs, see MeshLod
+    uint32_t lodCount;
+    uint32_t lodFirstIndex[MESH_MAX_LODS];
+    uint32_t lodIndexCount[MESH_MAX_LODS];
+    float lodError[MESH_MAX_LODS];
+
+    // MeshVertexCacheStats, so that cached loads report them without re-simulating
+    float acmrBefore;
+    float acmrAfter;
+    float atvrBefore;
+    float atvrAfter;
+
+    uint64_t meshletOffset;
+    uint32_t meshletCount;
+};
+
+struct MeshCacheMeshlet
+{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float center[3];
+    float radius;
+    float coneAxis[3];
+    float coneCutoff;
+};
+
+struct MeshCacheTexture
+{
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+// Another file the meshes were built from, e.g. a material library the texture bindings come from
+struct MeshCacheDependency
+{
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    int64_t mtime;
+    uint64_t size;
+    uint64_t hash;
+};
+
+struct SourceInfo
+{
+    int64_t mtime;
+    uint64_t size;
+};
+
+static bool GetSourceInfo(const char* path, SourceInfo& info)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return false;
+    }
+
+    info.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+    info.size = st.st_size;
+    return true;
+}
+
+static bool HashSource(const char* path, uint64_t& hash)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    hash = 5381;
+    if (st.st_size > 0)
+    {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        hash = Djb2Bytes((const unsigned char*)data, st.st_size);
+        munmap(data, st.st_size);
+    }
+    close(fd);
+
+    return true;
+}
+
+// Cheap check first, only hashes the file if it has been touched. touched is set when just the mtime changed.
+static bool MatchesFile(const char* path, int64_t mtime, uint64_t size, uint64_t hash, SourceInfo& info, bool& touched)
+{
+    touched = false;
+    if (!GetSourceInfo(path, info))
+    {
+        return mtime == MESH_CACHE_MISSING_MTIME;
+    }
+    if (mtime == MESH_CACHE_MISSING_MTIME || info.size != size)
+    {
+        return false;
+    }
+    if (info.mtime == mtime)
+    {
+        return true;
+    }
+
+    uint64_t currentHash;
+    touched = HashSource(path, currentHash) && currentHash == hash;
+    return touched;
+}
+
+static bool InStringTable(const MeshCacheHeader& header, uint32_t offset, uint32_t length)
+{
+    return (uint64_t)offset + length <= header.stringTableSize;
+}
+
+// Files that were touched but whose content is unchanged, their new mtimes are recorded so that later launches skip
+// hashing them. Pairs of the mtime's offset in the cache file and the mtime.
+static void UpdateCachedMtimes(const std::string& cachePath, const std::vector<std::pair<uint64_t, int64_t>>& mtimes)
+{
+    int fd = open(cachePath.c_str(), O_WRONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    for (const std::pair<uint64_t, int64_t>& mtime : mtimes)
+    {
+        if (pwrite(fd, &mtime.second, sizeof(mtime.second), mtime.first) != sizeof(mtime.second))
+        {
+            LOG_WARN("Mesh cache", "Failed updating the source mtimes of \"%s\"", cachePath.c_str());
+            break;
+        }
+    }
+    close(fd);
+}
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// -------------------------------------------------------------------------------------------------
+
+MeshCache::MeshCache() : mapping(nullptr), mappingSize(0)
+{
+}
+
+MeshCache::~MeshCache()
+{
+    Unmap();
+}
+
+/*static*/ std::string MeshCache::CachePath(const char* sourcePath)
+{
+    return std::string(sourcePath) + ".meshcache";
+}
+
+bool MeshCache::IsMapped() const
+{
+    return mapping != nullptr;
+}
+
+void MeshCache::Unmap()
+{
+    meshes.clear();
+    if (mapping != nullptr)
+    {
+        munmap(mapping, mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+    }
+}
+
+bool MeshCache::Map(const char* sourcePath)
+{
+    Unmap();
+
+    SourceInfo sourceInfo;
+    if (!GetSourceInfo(sourcePath, sourceInfo))
+    {
+        LOG_WARN("Mesh cache", "Cannot stat source \"%s\"", sourcePath);
+        return false;
+    }
+
+    std::string cachePath = CachePath(sourcePath);
+    int fd = open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MeshCacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        LOG_WARN("Mesh cache", "Failed mapping \"%s\"", cachePath.c_str());
+        return false;
+    }
+    mapping = data;
+    mappingSize = st.st_size;
+
+    const char* bytes = (const char*)mapping;
+    const MeshCacheHeader* header = (const MeshCacheHeader*)bytes;
+    if (memcmp(header->magic, MESH_CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != MESH_CACHE_VERSION)
+    {
+        LOG_INFO("Mesh cache", "\"%s\" has an incompatible format, rebuilding", cachePath.c_str());
+        Unmap();
+        return false;
+    }
+
+    uint64_t entriesEnd = sizeof(MeshCacheHeader) + (uint64_t)header->meshCount * sizeof(MeshCacheEntry);
+    uint64_t texturesEnd = entriesEnd + (uint64_t)header->textureCount * sizeof(MeshCacheTexture);
+    uint64_t dependenciesEnd = texturesEnd + (uint64_t)header->dependencyCount * sizeof(MeshCacheDependency);
+    if (dependenciesEnd > mappingSize || header->stringTableOffset > mappingSize ||
+            header->stringTableSize > mappingSize - header->stringTableOffset)
+    {
+        LOG_WARN("Mesh cache", "\"%s\" is truncated", cachePath.c_str());
+        Unmap();
+        return false;
+    }
+
+    const MeshCacheEntry* entries = (const MeshCacheEntry*)(bytes + sizeof(MeshCacheHeader));
+    const MeshCacheTexture* textures = (const MeshCacheTexture*)(bytes + entriesEnd);
+    const MeshCacheDependency* dependencies = (const MeshCacheDependency*)(bytes + texturesEnd);
+    const char* strings = bytes + header->stringTableOffset;
+
+    // The source and every file the meshes were built from have to match
+    std::vector<std::pair<uint64_t, int64_t>> touchedMtimes;
+    bool touched;
+    bool upToDate = MatchesFile(sourcePath, header->sourceMtime, header->sourceSize, header->sourceHash, sourceInfo, touched);
+    if (touched)
+    {
+        touchedMtimes.push_back(std::make_pair(offsetof(MeshCacheHeader, sourceMtime), sourceInfo.mtime));
+    }
+    for (unsigned int i = 0; i < header->dependencyCount && upToDate; i++)
+    {
+        const MeshCacheDependency& dependency = dependencies[i];
+        if (!InStringTable(*header, dependency.pathOffset, dependency.pathLength))
+        {
+            LOG_WARN("Mesh cache", "\"%s\" is corrupted", cachePath.c_str());
+            Unmap();
+            return false;
+        }
+
+        std::string dependencyPath(strings + dependency.pathOffset, dependency.pathLength);
+        SourceInfo dependencyInfo;
+        upToDate = MatchesFile(dependencyPath.c_str(), dependency.mtime, dependency.size, dependency.hash, dependencyInfo, touched);
+        if (touched)
+        {
+            touchedMtimes.push_back(std::make_pair(texturesEnd + i * sizeof(MeshCacheDependency) + offsetof(MeshCacheDependency, mtime),
+                        dependencyInfo.mtime));
+        }
+    }
+    if (!upToDate)
+    {
+        LOG_INFO("Mesh cache", "\"%s\" is stale, rebuilding", cachePath.c_str());
+        Unmap();
+        return false;
+    }
+
+    meshes.resize(header->meshCount);
+    for (unsigned int i = 0; i < header->meshCount; i++)
+    {
+        const MeshCacheEntry& entry = entries[i];
+        bool inBounds = entry.vertexOffset + (uint64_t)entry.vertexCount * MESH_VERTEX_ELEMENT_COUNT * sizeof(float) <= mappingSize &&
+            entry.indexOffset + (uint64_t)entry.indexCount * sizeof(unsigned int) <= mappingSize &&
+            entry.meshletOffset + (uint64_t)entry.meshletCount * sizeof(MeshCacheMeshlet) <= mappingSize &&
+            (uint64_t)entry.firstTexture + entry.textureCount <= header->textureCount &&
+            InStringTable(*header, entry.nameOffset, entry.nameLength) &&
+            entry.lodCount >= 1 && entry.lodCount <= MESH_MAX_LODS;
+        for (unsigned int j = 0; j < entry.textureCount && inBounds; j++)
+        {
+            const MeshCacheTexture& texture = textures[entry.firstTexture + j];
+            inBounds = InStringTable(*header, texture.nameOffset, texture.nameLength) &&
+                InStringTable(*header, texture.pathOffset, texture.pathLength);
+        }
+        for (unsigned int j = 0; j < entry.lodCount && inBounds; j++)
+        {
+            inBounds = (uint64_t)entry.lodFirstIndex[j] + entry.lodIndexCount[j] <= entry.indexCount;
+        }
+        if (!inBounds)
+        {
+            LOG_WARN("Mesh cache", "\"%s\" is corrupted", cachePath.c_str());
+            Unmap();
+            return false;
+        }
+
+        MeshData& mesh = meshes[i];
+        mesh.name = std::string(strings + entry.nameOffset, entry.nameLength);
+        mesh.aabbModelSpace = AABB(glm::vec3(entry.aabbMin[0], entry.aabbMin[1], entry.aabbMin[2]),
+                glm::vec3(entry.aabbMax[0], entry.aabbMax[1], entry.aabbMax[2]));
+        for (unsigned int j = 0; j < entry.textureCount; j++)
+        {
+            const MeshCacheTexture& texture = textures[entry.firstTexture + j];
+            mesh.textures.push_back(std::make_pair(std::string(strings + texture.nameOffset, texture.nameLength),
+                        std::string(strings + texture.pathOffset, texture.pathLength)));
+        }
+
+        mesh.vertexCount = entry.vertexCount;
+        mesh.indexCount = entry.indexCount;
+        for (unsigned int j = 0; j < entry.lodCount; j++)
+        {
+            mesh.lods.push_back({ (int)entry.lodFirstIndex[j], (int)entry.lodIndexCount[j], entry.lodError[j] });
+        }
+        mesh.vertexCacheStats = { entry.acmrBefore, entry.acmrAfter, entry.atvrBefore, entry.atvrAfter };
+        // Small enough to copy out of the mapping
+        const MeshCacheMeshlet* meshlets = (const MeshCacheMeshlet*)(bytes + entry.meshletOffset);
+        for (unsigned int j = 0; j < entry.meshletCount; j++)
+        {
+            const MeshCacheMeshlet& meshlet = meshlets[j];
+            if ((uint64_t)meshlet.firstIndex + meshlet.indexCount > entry.indexCount)
+            {
+                LOG_WARN("Mesh cache", "\"%s\" is corrupted", cachePath.c_str());
+                Unmap();
+                return false;
+            }
+            mesh.meshlets.push_back({ (int)meshlet.firstIndex, (int)meshlet.indexCount,
+                    glm::vec3(meshlet.center[0], meshlet.center[1], meshlet.center[2]), meshlet.radius,
+                    glm::vec3(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2]), meshlet.coneCutoff });
+        }
+        mesh.mappedVertices = (const float*)(bytes + entry.vertexOffset);
+        mesh.mappedIndices = (const unsigned int*)(bytes + entry.indexOffset);
+    }
+
+    if (!touchedMtimes.empty())
+    {
+        UpdateCachedMtimes(cachePath, touchedMtimes);
+    }
+    return true;
+}
+
+/*static*/ bool MeshCache::Write(const char* sourcePath, const std::vector<MeshData>& meshes,
+        const std::vector<std::string>& dependencyPaths)
+{
+    SourceInfo sourceInfo;
+    uint64_t sourceHash;
+    if (!GetSourceInfo(sourcePath, sourceInfo) || !HashSource(sourcePath, sourceHash))
+    {
+        return false;
+    }
+
+    // Lay everything out up front so that the data can be streamed out in one go
+    std::vector<MeshCacheEntry> entries(meshes.size());
+    std::vector<MeshCacheTexture> textures;
+    std::string strings;
+    for (int i = 0; i < meshes.size(); i++)
+    {
+        const MeshData& mesh = meshes[i];
+        MeshCacheEntry& entry = entries[i];
+        // Padding included, nothing uninitialized ends up in the file
+        memset(&entry, 0, sizeof(entry));
+
+        entry.vertexCount = mesh.vertexCount;
+        entry.indexCount = mesh.indexCount;
+        entry.lodCount = mesh.lods.empty() ? 1 : mesh.lods.size();
+        entry.lodIndexCount[0] = mesh.indexCount;
+        for (int j = 0; j < mesh.lods.size(); j++)
+        {
+            entry.lodFirstIndex[j] = mesh.lods[j].firstIndex;
+            entry.lodIndexCount[j] = mesh.lods[j].indexCount;
+            entry.lodError[j] = mesh.lods[j].error;
+        }
+        entry.acmrBefore = mesh.vertexCacheStats.acmrBefore;
+        entry.acmrAfter = mesh.vertexCacheStats.acmrAfter;
+        entry.atvrBefore = mesh.vertexCacheStats.atvrBefore;
+        entry.atvrAfter = mesh.vertexCacheStats.atvrAfter;
+        entry.meshletCount = mesh.meshlets.size();
+        for (int j = 0; j < 3; j++)
+        {
+            entry.aabbMin[j] = mesh.aabbModelSpace.min[j];
+            entry.aabbMax[j] = mesh.aabbModelSpace.max[j];
+        }
+
+        entry.nameOffset = strings.size();
+        entry.nameLength = mesh.name.size();
+        strings += mesh.name;
+
+        entry.firstTexture = textures.size();
+        entry.textureCount = mesh.textures.size();
+        for (auto& nameToPath : mesh.textures)
+        {
+            MeshCacheTexture texture;
+            memset(&texture, 0, sizeof(texture));
+            texture.nameOffset = strings.size();
+            texture.nameLength = nameToPath.first.size();
+            strings += nameToPath.first;
+            texture.pathOffset = strings.size();
+            texture.pathLength = nameToPath.second.size();
+            strings += nameToPath.second;
+            textures.push_back(texture);
+        }
+    }
+
+    std::vector<MeshCacheDependency> dependencies(dependencyPaths.size());
+    for (int i = 0; i < dependencyPaths.size(); i++)
+    {
+        MeshCacheDependency& dependency = dependencies[i];
+        memset(&dependency, 0, sizeof(dependency));
+        dependency.pathOffset = strings.size();
+        dependency.pathLength = dependencyPaths[i].size();
+        strings += dependencyPaths[i];
+
+        SourceInfo dependencyInfo;
+        if (GetSourceInfo(dependencyPaths[i].c_str(), dependencyInfo) && HashSource(dependencyPaths[i].c_str(), dependency.hash))
+        {
+            dependency.mtime = dependencyInfo.mtime;
+            dependency.size = dependencyInfo.size;
+        }
+        else
+        {
+            dependency.mtime = MESH_CACHE_MISSING_MTIME;
+        }
+    }
+
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MESH_CACHE_VERSION;
+    header.sourceMtime = sourceInfo.mtime;
+    header.sourceSize = sourceInfo.size;
+    header.sourceHash = sourceHash;
+    header.meshCount = entries.size();
+    header.textureCount = textures.size();
+    header.dependencyCount = dependencies.size();
+    header.stringTableOffset = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry) + textures.size() * sizeof(MeshCacheTexture) +
+        dependencies.size() * sizeof(MeshCacheDependency);
+    header.stringTableSize = strings.size();
+
+    uint64_t dataOffset = AlignUp(header.stringTableOffset + header.stringTableSize, MESH_CACHE_DATA_ALIGNMENT);
+    for (int i = 0; i < meshes.size(); i++)
+    {
+        entries[i].vertexOffset = dataOffset;
+        dataOffset = AlignUp(dataOffset + (uint64_t)meshes[i].vertexCount * MESH_VERTEX_ELEMENT_COUNT * sizeof(float), MESH_CACHE_DATA_ALIGNMENT);
+        entries[i].indexOffset = dataOffset;
+        dataOffset = AlignUp(dataOffset + (uint64_t)meshes[i].indexCount * sizeof(unsigned int), MESH_CACHE_DATA_ALIGNMENT);
+        entries[i].meshletOffset = dataOffset;
+        dataOffset = AlignUp(dataOffset + (uint64_t)meshes[i].meshlets.size() * sizeof(MeshCacheMeshlet), MESH_CACHE_DATA_ALIGNMENT);
+    }
+
+    // Write to a temporary file and rename, so that a crash never leaves a half written cache behind
+    std::string cachePath = CachePath(sourcePath);
+    std::string tmpPath = cachePath + ".tmp";
+    FILE* file = fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr)
+    {
+        LOG_WARN("Mesh cache", "Cannot open \"%s\" for writing", tmpPath.c_str());
+        return false;
+    }
+
+    static const char padding[MESH_CACHE_DATA_ALIGNMENT] = {};
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    written &= entries.empty() || fwrite(entries.data(), sizeof(MeshCacheEntry), entries.size(), file) == entries.size();
+    written &= textures.empty() || fwrite(textures.data(), sizeof(MeshCacheTexture), textures.size(), file) == textures.size();
+    written &= dependencies.empty() ||
+        fwrite(dependencies.data(), sizeof(MeshCacheDependency), dependencies.size(), file) == dependencies.size();
+    written &= strings.empty() || fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+    for (int i = 0; i < meshes.size() && written; i++)
+    {
+        long position = ftell(file);
+        written &= fwrite(padding, 1, entries[i].vertexOffset - position, file) == entries[i].vertexOffset - position;
+        written &= fwrite(meshes[i].Vertices(), sizeof(float) * MESH_VERTEX_ELEMENT_COUNT, meshes[i].vertexCount, file) == meshes[i].vertexCount;
+
+        position = ftell(file);
+        written &= fwrite(padding, 1, entries[i].indexOffset - position, file) == entries[i].indexOffset - position;
+        written &= fwrite(meshes[i].Indices(), sizeof(unsigned int), meshes[i].indexCount, file) == meshes[i].indexCount;
+
+        position = ftell(file);
+        written &= fwrite(padding, 1, entries[i].meshletOffset - position, file) == entries[i].meshletOffset - position;
+        for (const Meshlet& meshlet : meshes[i].meshlets)
+        {
+            MeshCacheMeshlet cached = { (uint32_t)meshlet.firstIndex, (uint32_t)meshlet.indexCount,
+                { meshlet.center.x, meshlet.center.y, meshlet.center.z }, meshlet.radius,
+                { meshlet.coneAxis.x, meshlet.coneAxis.y, meshlet.coneAxis.z }, meshlet.coneCutoff };
+            written &= fwrite(&cached, sizeof(cached), 1, file) == 1;
+        }
+    }
+    written &= fclose(file) == 0;
+
+    if (!written || rename(tmpPath.c_str(), cachePath.c_str()) != 0)
+    {
+        LOG_WARN("Mesh cache", "Failed writing \"%s\"", cachePath.c_str());
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    LOG_INFO("Mesh cache", "Wrote \"%s\" (%lu meshes, %.2f MB)", cachePath.c_str(), meshes.size(), dataOffset / (1024.f * 1024.f));
+    return true;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "aabb.h"
+
+// Interleaved vertex layout shared by the loader, the mesh cache and the GPU: pos(3), normal(3), tangent(4), uv(2)
+#define MESH_VERTEX_ELEMENT_COUNT (3 + 3 + 4 + 2)
+
+// Full detail and at most this many - 1 simplified LODs per mesh, see BuildMeshLods
+#define MESH_MAX_LODS 5
+
+// Index range of one level of detail, relative to the mesh's first index
+struct MeshLod
+{
+    int firstIndex;
+    int indexCount;
+    // Furthest model space distance of the LOD's surface from the full detail one, 0 for LOD 0
+    float error;
+};
+
+// Contiguous run of the full detail LOD's triangles, culled on its own by the GPU culling pass, see BuildMeshlets
+struct Meshlet
+{
+    // Relative to the mesh's first index, within lods[0]
+    int firstIndex;
+    int indexCount;
+    // Model space bounding sphere
+    glm::vec3 center;
+    float radius;
+    // All triangle normals are within the cone around coneAxis. coneCutoff is the sine of its half angle, 1 if the
+    // cone is too wide for the meshlet to ever be entirely back facing.
+    glm::vec3 coneAxis;
+    float coneCutoff;
+};
+
+// Post-transform vertex cache efficiency of the full detail LOD, before and after OptimizeMeshData. ACMR is cache
+// misses per triangle (0.5 at best, 3 at worst), ATVR misses per referenced vertex (1 at best).
+struct MeshVertexCacheStats
+{
+    float acmrBefore;
+    float acmrAfter;
+    float atvrBefore;
+    float atvrAfter;
+};
+
+// CPU side mesh data ready for upload. Either owns its buffers (freshly built from a source asset)
+// or points straight into a mapped mesh cache.
+struct MeshData
+{
+    std::string name;
+    AABB aabbModelSpace;
+    // Uniform name -> asset relative texture path, as referenced by the source material
+    std::vector<std::pair<std::string, std::string>> textures;
+
+    int vertexCount = 0;
+    // All LODs, their indices follow each other
+    int indexCount = 0;
+    // lods[0] is the full detail mesh. Never empty once built or mapped.
+    std::vector<MeshLod> lods;
+    MeshVertexCacheStats vertexCacheStats = {};
+    // Empty for meshes too small to split
+    std::vector<Meshlet> meshlets;
+
+    std::vector<float> ownedVertices;
+    std::vector<unsigned int> ownedIndices;
+
+    const float* mappedVertices = nullptr;
+    const unsigned int* mappedIndices = nullptr;
+
+    const float* Vertices() const { return mappedVertices != nullptr ? mappedVertices : ownedVertices.data(); }
+    const unsigned int* Indices() const { return mappedIndices != nullptr ? mappedIndices : ownedIndices.data(); }
+};
+
+// Compact binary mesh format written next to the source asset (<asset>.meshcache). Invalidated
+// when the source or any of its dependencies change, memory-mapped on load so the vertex/index
+// data is uploaded straight from the mapping.
+class MeshCache
+{
+public:
+    MeshCache();
+    ~MeshCache();
+
+    MeshCache(const MeshCache&) = delete;
+    MeshCache& operator=(const MeshCache&) = delete;
+
+    // Maps the cache belonging to sourcePath. Fails if there's no cache or it's stale
+    bool Map(const char* sourcePath);
+    void Unmap();
+    bool IsMapped() const;
+
+    // dependencyPaths are the other files the meshes were built from, e.g. the OBJ's material libraries
+    static bool Write(const char* sourcePath, const std::vector<MeshData>& meshes, const std::vector<std::string>& dependencyPaths);
+    static std::string CachePath(const char* sourcePath);
+
+    // Views into the mapping, only valid while mapped
+    std::vector<MeshData> meshes;
+
+private:
+    void* mapping;
+    size_t mappingSize;
+};
@@ -0,0 +1,524 @@
+#include "mesh_lod.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+#include "glm/glm.hpp"
+
+#include "log.h"
+
+// Cosine of the largest rotation a collapse may give a remaining triangle, stops folds and flips
+#define MESH_LOD_MIN_NORMAL_COS 0.25
+
+// Symmetric 4x4 matrix of summed plane equations, its error at a point is the sum of squared distances to the planes
+struct Quadric
+{
+    double a2, b2, c2, d2;
+    double ab, ac, ad, bc, bd, cd;
+};
+
+static Quadric PlaneQuadric(glm::dvec3 normal, double distance)
+{
+    Quadric quadric;
+    quadric.a2 = normal.x * normal.x;
+    quadric.b2 = normal.y * normal.y;
+    quadric.c2 = normal.z * normal.z;
+    quadric.d2 = distance * distance;
+    quadric.ab = normal.x * normal.y;
+    quadric.ac = normal.x * normal.z;
+    quadric.ad = normal.x * distance;
+    quadric.bc = normal.y * normal.z;
+    quadric.bd = normal.y * distance;
+    quadric.cd = normal.z * distance;
+    return quadric;
+}
+
+static void AddQuadric(Quadric& quadric, const Quadric& other)
+{
+    quadric.a2 += other.a2;
+    quadric.b2 += other.b2;
+    quadric.c2 += other.c2;
+    quadric.d2 += other.d2;
+    quadric.ab += other.ab;
+    quadric.ac += other.ac;
+    quadric.ad += other.ad;
+    quadric.bc += other.bc;
+    quadric.bd += other.bd;
+    quadric.cd += other.cd;
+}
+
+static double QuadricError(const Quadric& quadric, glm::dvec3 p)
+{
+    double error = quadric.a2 * p.x * p.x + quadric.b2 * p.y * p.y + quadric.c2 * p.z * p.z + quadric.d2 +
+        2.0 * (quadric.ab * p.x * p.y + quadric.ac * p.x * p.z + quadric.bc * p.y * p.z) +
+        2.0 * (quadric.ad * p.x + quadric.bd * p.y + quadric.cd * p.z);
+    // Rounding can take it slightly below 0
+    return error > 0.0 ? error : 0.0;
+}
+
+static uint64_t EdgeKey(int a, int b)
+{
+    return a < b ? ((uint64_t)a << 32) | (uint32_t)b : ((uint64_t)b << 32) | (uint32_t)a;
+}
+
+// Edge collapse state of one mesh. Works on position groups (vertices welded by position), indices keep
+// referencing the original vertices.
+struct LodBuilder
+{
+    std::vector<int> vertexGroups;
+    // Vertices of group g are groupVertices[groupFirstVertex[g]..groupFirstVertex[g + 1])
+    std::vector<int> groupVertices;
+    std::vector<int> groupFirstVertex;
+    std::vector<glm::dvec3> groupPositions;
+    std::vector<Quadric> groupQuadrics;
+    // On an open border, only collapsed along it
+    std::vector<uint8_t> groupBorder;
+    // On a non-manifold edge, never collapsed
+    std::vector<uint8_t> groupPinned;
+
+    // Triangles of the current LOD
+    std::vector<unsigned int> indices;
+    // Largest collapse error so far
+    double error;
+
+    // Scratch of CollapsePass
+    struct Collapse
+    {
+        double cost;
+        int from;
+        int to;
+    };
+    struct Wedge
+    {
+        int vertex;
+        int neighbourGroup;
+        int neighbourVertex;
+    };
+    std::vector<uint64_t> edges;
+    std::vector<int> edgeCounts;
+    std::vector<int> groupFirstTriangle;
+    std::vector<int> groupTriangles;
+    std::vector<Wedge> wedges;
+    std::vector<Collapse> collapses;
+    std::vector<uint8_t> groupLocked;
+    std::vector<int> vertexRemap;
+    std::vector<int> fromNeighbours;
+    std::vector<int> toNeighbours;
+
+    LodBuilder(const MeshData& data);
+
+    // Vertex of the neighbour group that shares a triangle with the vertex, -1 if there is none. Used vertices only.
+    int Neighbour(int vertex, int neighbourGroup) const;
+    bool Used(int vertex) const;
+    // Every used copy of the group has a copy of the other group next to it
+    bool WedgesMatch(int group, int other) const;
+    // Would any of the group's triangles that remain fold over or flip
+    bool Folds(int from, int to) const;
+    // The groups only share the neighbours opposite their shared edge, otherwise the collapse pinches the surface
+    bool LinkConditionHolds(int from, int to);
+    // One round of collapses that don't touch each other's neighbourhoods, cheapest first. Returns the collapse count.
+    int CollapsePass(double maxCost, int targetTriangleCount);
+};
+
+static bool PositionLess(const float* a, const float* b)
+{
+    if (a[0] != b[0])
+        return a[0] < b[0];
+    if (a[1] != b[1])
+        return a[1] < b[1];
+    return a[2] < b[2];
+}
+
+LodBuilder::LodBuilder(const MeshData& data)
+    : indices(data.Indices(), data.Indices() + data.indexCount), error(0.0)
+{
+    const float* vertices = data.Vertices();
+    std::vector<int> sorted(data.vertexCount);
+    for (int i = 0; i < data.vertexCount; i++)
+    {
+        sorted[i] = i;
+    }
+    std::sort(sorted.begin(), sorted.end(), [vertices](int a, int b)
+    {
+        return PositionLess(vertices + a * MESH_VERTEX_ELEMENT_COUNT, vertices + b * MESH_VERTEX_ELEMENT_COUNT);
+    });
+
+    // Equal positions end up next to each other
+    vertexGroups.resize(data.vertexCount);
+    for (int i = 0; i < sorted.size(); i++)
+    {
+        const float* position = vertices + sorted[i] * MESH_VERTEX_ELEMENT_COUNT;
+        if (i == 0 || PositionLess(vertices + sorted[i - 1] * MESH_VERTEX_ELEMENT_COUNT, position))
+        {
+            groupFirstVertex.push_back(i);
+            groupPositions.push_back(glm::dvec3(position[0], position[1], position[2]));
+        }
+        vertexGroups[sorted[i]] = groupPositions.size() - 1;
+    }
+    groupFirstVertex.push_back(sorted.size());
+    groupVertices = sorted;
+
+    int groupCount = groupPositions.size();
+    groupQuadrics.assign(groupCount, PlaneQuadric(glm::dvec3(0.0), 0.0));
+    groupBorder.assign(groupCount, 0);
+    groupPinned.assign(groupCount, 0);
+
+    std::vector<uint64_t> triangleEdges;
+    for (int i = 0; i < indices.size(); i += 3)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            triangleEdges.push_back(EdgeKey(vertexGroups[indices[i + j]], vertexGroups[indices[i + (j + 1) % 3]]));
+        }
+    }
+    std::sort(triangleEdges.begin(), triangleEdges.end());
+
+    for (int i = 0; i < indices.size(); i += 3)
+    {
+        int groups[3] = { vertexGroups[indices[i]], vertexGroups[indices[i + 1]], vertexGroups[indices[i + 2]] };
+        glm::dvec3 normal = glm::cross(groupPositions[groups[1]] - groupPositions[groups[0]],
+                groupPositions[groups[2]] - groupPositions[groups[0]]);
+        double length = glm::length(normal);
+        if (length == 0.0)
+        {
+            continue;
+        }
+        normal /= length;
+
+        Quadric quadric = PlaneQuadric(normal, -glm::dot(normal, groupPositions[groups[0]]));
+        for (int j = 0; j < 3; j++)
+        {
+            AddQuadric(groupQuadrics[groups[j]], quadric);
+        }
+
+        for (int j = 0; j < 3; j++)
+        {
+            int a = groups[j];
+            int b = groups[(j + 1) % 3];
+            uint64_t key = EdgeKey(a, b);
+            int count = std::upper_bound(triangleEdges.begin(), triangleEdges.end(), key) -
+                std::lower_bound(triangleEdges.begin(), triangleEdges.end(), key);
+            if (count > 2)
+            {
+                groupPinned[a] = groupPinned[b] = 1;
+            }
+            if (count != 1)
+            {
+                continue;
+            }
+
+            // Plane through the border edge, perpendicular to the triangle, holds the border in place
+            glm::dvec3 borderNormal = glm::cross(groupPositions[b] - groupPositions[a], normal);
+            double borderLength = glm::length(borderNormal);
+            if (borderLength > 0.0)
+            {
+                borderNormal /= borderLength;
+                Quadric borderQuadric = PlaneQuadric(borderNormal, -glm::dot(borderNormal, groupPositions[a]));
+                AddQuadric(groupQuadrics[a], borderQuadric);
+                AddQuadric(groupQuadrics[b], borderQuadric);
+            }
+            groupBorder[a] = groupBorder[b] = 1;
+        }
+    }
+}
+
+static bool WedgeLess(const LodBuilder::Wedge& a, const LodBuilder::Wedge& b)
+{
+    return a.vertex != b.vertex ? a.vertex < b.vertex : a.neighbourGroup < b.neighbourGroup;
+}
+
+int LodBuilder::Neighbour(int vertex, int neighbourGroup) const
+{
+    Wedge key = { vertex, neighbourGroup, -1 };
+    std::vector<Wedge>::const_iterator wedge = std::lower_bound(wedges.begin(), wedges.end(), key, WedgeLess);
+    return wedge != wedges.end() && wedge->vertex == vertex && wedge->neighbourGroup == neighbourGroup ?
+        wedge->neighbourVertex : -1;
+}
+
+bool LodBuilder::Used(int vertex) const
+{
+    Wedge key = { vertex, -1, -1 };
+    std::vector<Wedge>::const_iterator wedge = std::lower_bound(wedges.begin(), wedges.end(), key, WedgeLess);
+    return wedge != wedges.end() && wedge->vertex == vertex;
+}
+
+bool LodBuilder::WedgesMatch(int group, int other) const
+{
+    for (int i = groupFirstVertex[group]; i < groupFirstVertex[group + 1]; i++)
+    {
+        int vertex = groupVertices[i];
+        if (Used(vertex) && Neighbour(vertex, other) == -1)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LodBuilder::Folds(int from, int to) const
+{
+    for (int i = groupFirstTriangle[from]; i < groupFirstTriangle[from + 1]; i++)
+    {
+        int triangle = groupTriangles[i];
+        glm::dvec3 corners[3];
+        glm::dvec3 movedCorners[3];
+        bool collapses = false;
+        for (int j = 0; j < 3; j++)
+        {
+            int group = vertexGroups[indices[triangle * 3 + j]];
+            collapses |= group == to;
+            corners[j] = groupPositions[group];
+            movedCorners[j] = group == from ? groupPositions[to] : corners[j];
+        }
+        // Removed by the collapse
+        if (collapses)
+        {
+            continue;
+        }
+
+        glm::dvec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+        glm::dvec3 movedNormal = glm::cross(movedCorners[1] - movedCorners[0], movedCorners[2] - movedCorners[0]);
+        double lengths = glm::length(normal) * glm::length(movedNormal);
+        if (glm::dot(normal, movedNormal) <= MESH_LOD_MIN_NORMAL_COS * lengths)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LodBuilder::LinkConditionHolds(int from, int to)
+{
+    int sharedTriangleCount = 0;
+    fromNeighbours.clear();
+    for (int i = groupFirstTriangle[from]; i < groupFirstTriangle[from + 1]; i++)
+    {
+        int triangle = groupTriangles[i];
+        bool shared = false;
+        for (int j = 0; j < 3; j++)
+        {
+            int group = vertexGroups[indices[triangle * 3 + j]];
+            shared |= group == to;
+            if (group != from && group != to)
+            {
+                fromNeighbours.push_back(group);
+            }
+        }
+        sharedTriangleCount += shared ? 1 : 0;
+    }
+    toNeighbours.clear();
+    for (int i = groupFirstTriangle[to]; i < groupFirstTriangle[to + 1]; i++)
+    {
+        int triangle = groupTriangles[i];
+        for (int j = 0; j < 3; j++)
+        {
+            int group = vertexGroups[indices[triangle * 3 + j]];
+            if (group != from && group != to)
+            {
+                toNeighbours.push_back(group);
+            }
+        }
+    }
+    std::sort(fromNeighbours.begin(), fromNeighbours.end());
+    fromNeighbours.erase(std::unique(fromNeighbours.begin(), fromNeighbours.end()), fromNeighbours.end());
+    std::sort(toNeighbours.begin(), toNeighbours.end());
+    toNeighbours.erase(std::unique(toNeighbours.begin(), toNeighbours.end()), toNeighbours.end());
+
+    int sharedNeighbourCount = 0;
+    for (int neighbour : fromNeighbours)
+    {
+        sharedNeighbourCount += std::binary_search(toNeighbours.begin(), toNeighbours.end(), neighbour) ? 1 : 0;
+    }
+    return sharedNeighbourCount == sharedTriangleCount;
+}
+
+int LodBuilder::CollapsePass(double maxCost, int targetTriangleCount)
+{
+    int groupCount = groupPositions.size();
+    int triangleCount = indices.size() / 3;
+
+    // Edges of the current triangles with the number of triangles using them
+    std::vector<uint64_t> triangleEdges;
+    triangleEdges.reserve(indices.size());
+    for (int i = 0; i < indices.size(); i += 3)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            triangleEdges.push_back(EdgeKey(vertexGroups[indices[i + j]], vertexGroups[indices[i + (j + 1) % 3]]));
+        }
+    }
+    std::sort(triangleEdges.begin(), triangleEdges.end());
+    edges.clear();
+    edgeCounts.clear();
+    for (uint64_t edge : triangleEdges)
+    {
+        if (edges.empty() || edges.back() != edge)
+        {
+            edges.push_back(edge);
+            edgeCounts.push_back(0);
+        }
+        edgeCounts.back()++;
+    }
+
+    // Triangles around every group, counting sort
+    groupFirstTriangle.assign(groupCount + 1, 0);
+    for (unsigned int index : indices)
+    {
+        groupFirstTriangle[vertexGroups[index] + 1]++;
+    }
+    for (int i = 0; i < groupCount; i++)
+    {
+        groupFirstTriangle[i + 1] += groupFirstTriangle[i];
+    }
+    groupTriangles.resize(indices.size());
+    std::vector<int> groupFill(groupFirstTriangle.begin(), groupFirstTriangle.end() - 1);
+    for (int i = 0; i < indices.size(); i++)
+    {
+        groupTriangles[groupFill[vertexGroups[indices[i]]]++] = i / 3;
+    }
+
+    wedges.clear();
+    for (int i = 0; i < indices.size(); i += 3)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            for (int k = 1; k < 3; k++)
+            {
+                int neighbour = indices[i + (j + k) % 3];
+                wedges.push_back({ (int)indices[i + j], vertexGroups[neighbour], neighbour });
+            }
+        }
+    }
+    std::sort(wedges.begin(), wedges.end(), WedgeLess);
+
+    collapses.clear();
+    for (int i = 0; i < edges.size(); i++)
+    {
+        int groups[2] = { (int)(edges[i] >> 32), (int)(edges[i] & 0xffffffffu) };
+        for (int j = 0; j < 2; j++)
+        {
+            int from = groups[j];
+            int to = groups[1 - j];
+            // Borders may only slide along themselves
+            if (groupPinned[from] || edgeCounts[i] > 2 || (groupBorder[from] && edgeCounts[i] != 1))
+            {
+                continue;
+            }
+
+            double cost = QuadricError(groupQuadrics[from], groupPositions[to]) +
+                QuadricError(groupQuadrics[to], groupPositions[to]);
+            if (cost > maxCost || !WedgesMatch(from, to))
+            {
+                continue;
+            }
+            collapses.push_back({ cost, from, to });
+        }
+    }
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+    groupLocked.assign(groupCount, 0);
+    vertexRemap.resize(vertexGroups.size());
+    for (int i = 0; i < vertexRemap.size(); i++)
+    {
+        vertexRemap[i] = i;
+    }
+
+    int collapseCount = 0;
+    for (Collapse& collapse : collapses)
+    {
+        if (triangleCount <= targetTriangleCount)
+        {
+            break;
+        }
+        if (groupLocked[collapse.from] || groupLocked[collapse.to] || Folds(collapse.from, collapse.to) ||
+                !LinkConditionHolds(collapse.from, collapse.to))
+        {
+            continue;
+        }
+
+        for (int i = groupFirstVertex[collapse.from]; i < groupFirstVertex[collapse.from + 1]; i++)
+        {
+            int vertex = groupVertices[i];
+            if (Used(vertex))
+            {
+                vertexRemap[vertex] = Neighbour(vertex, collapse.to);
+            }
+        }
+        AddQuadric(groupQuadrics[collapse.to], groupQuadrics[collapse.from]);
+        error = std::max(error, sqrt(collapse.cost));
+
+        // The neighbourhood's triangles change, collapses next to it wait for the next pass. Triangles around both
+        // groups were current when this pass started.
+        for (int i = groupFirstTriangle[collapse.from]; i < groupFirstTriangle[collapse.from + 1]; i++)
+        {
+            int triangle = groupTriangles[i];
+            bool removed = false;
+            for (int j = 0; j < 3; j++)
+            {
+                int group = vertexGroups[indices[triangle * 3 + j]];
+                groupLocked[group] = 1;
+                removed |= group == collapse.to;
+            }
+            triangleCount -= removed ? 1 : 0;
+        }
+        groupLocked[collapse.to] = 1;
+        collapseCount++;
+    }
+
+    // Apply the remap, triangles with two corners at the same position are gone
+    int writeIndex = 0;
+    for (int i = 0; i < indices.size(); i += 3)
+    {
+        unsigned int triangle[3] = { (unsigned int)vertexRemap[indices[i]], (unsigned int)vertexRemap[indices[i + 1]],
+            (unsigned int)vertexRemap[indices[i + 2]] };
+        int groups[3] = { vertexGroups[triangle[0]], vertexGroups[triangle[1]], vertexGroups[triangle[2]] };
+        if (groups[0] == groups[1] || groups[1] == groups[2] || groups[0] == groups[2])
+        {
+            continue;
+        }
+        for (int j = 0; j < 3; j++)
+        {
+            indices[writeIndex++] = triangle[j];
+        }
+    }
+    indices.resize(writeIndex);
+
+    return collapseCount;
+}
+
+void BuildMeshLods(MeshData& data)
+{
+    data.lods.clear();
+    data.lods.push_back({ 0, data.indexCount, 0.f });
+
+    glm::vec3 diagonal = data.aabbModelSpace.max - data.aabbModelSpace.min;
+    double maxError = MESH_LOD_MAX_RELATIVE_ERROR * glm::length(diagonal);
+    if (data.indexCount < MESH_LOD_MIN_INDEX_COUNT || maxError <= 0.0)
+    {
+        return;
+    }
+    // Appended to, has to be the mesh's own
+    ASSERT(data.mappedIndices == nullptr);
+
+    LodBuilder builder(data);
+    for (int lod = 1; lod < MESH_MAX_LODS; lod++)
+    {
+        int previousTriangleCount = builder.indices.size() / 3;
+        int targetTriangleCount = previousTriangleCount * MESH_LOD_REDUCTION;
+        while (builder.indices.size() / 3 > targetTriangleCount &&
+                builder.CollapsePass(maxError * maxError, targetTriangleCount) > 0)
+        {
+        }
+
+        int triangleCount = builder.indices.size() / 3;
+        if (triangleCount == 0 || triangleCount > previousTriangleCount * MESH_LOD_MIN_REDUCTION)
+        {
+            break;
+        }
+
+        data.lods.push_back({ (int)data.ownedIndices.size(), (int)builder.indices.size(), (float)builder.error });
+        data.ownedIndices.insert(data.ownedIndices.end(), builder.indices.begin(), builder.indices.end());
+    }
+    data.indexCount = data.ownedIndices.size();
+}
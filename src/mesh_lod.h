@@ -0,0 +1,19 @@
+#pragma once
+
+#include "mesh_cache.h"
+
+// Meshes with fewer indices keep just their full detail LOD
+#define MESH_LOD_MIN_INDEX_COUNT 384
+// Every LOD aims for this fraction of the previous one's triangles
+#define MESH_LOD_REDUCTION 0.5f
+// A LOD is dropped if it doesn't get below this fraction of the previous one's triangles, the chain ends there
+#define MESH_LOD_MIN_REDUCTION 0.85f
+// Collapses stop once their error exceeds this fraction of the model space AABB diagonal
+#define MESH_LOD_MAX_RELATIVE_ERROR 0.05f
+
+// Appends coarser LODs of lods[0] to the mesh's indices with quadric error metric edge collapses (Garland and
+// Heckbert). Collapses are half edge, vertices only ever move onto existing ones, so every LOD indexes the same
+// vertices. Vertices at the same position are collapsed together and only along edges that all of their copies
+// share, which keeps UV and normal seams intact. Open borders only collapse along themselves. Each LOD records the
+// largest collapse error it includes, a model space distance that LOD selection projects to the screen.
+void BuildMeshLods(MeshData& data);
@@ -0,0 +1,336 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <stdint.h>
+
+#include "glm/glm.hpp"
+
+#include "log.h"
+
+void MeasureVertexCache(const unsigned int* indices, int indexCount, int vertexCount, int cacheSize, float* acmr, float* atvr)
+{
+    // Time a vertex entered the cache, it's still in there while fewer than cacheSize misses came after it
+    std::vector<int> cachedAt(vertexCount, -1);
+    std::vector<uint8_t> referenced(vertexCount, 0);
+    int misses = 0;
+    int referencedCount = 0;
+    for (int i = 0; i < indexCount; i++)
+    {
+        unsigned int vertex = indices[i];
+        if (cachedAt[vertex] < 0 || misses - cachedAt[vertex] >= cacheSize)
+        {
+            cachedAt[vertex] = misses++;
+        }
+        if (!referenced[vertex])
+        {
+            referenced[vertex] = 1;
+            referencedCount++;
+        }
+    }
+
+    if (acmr != nullptr)
+    {
+        *acmr = indexCount > 0 ? misses / (indexCount / 3.f) : 0.f;
+    }
+    if (atvr != nullptr)
+    {
+        *atvr = referencedCount > 0 ? misses / (float) referencedCount : 0.f;
+    }
+}
+
+// Tipsify over one LOD's triangles, fanning around the vertex that's expected to stay in the cache the longest.
+// Also records the triangles after its dead ends, where the cache locality is broken anyway.
+static void Tipsify(const unsigned int* indices, int indexCount, int vertexCount, std::vector<unsigned int>& ordered,
+        std::vector<int>& deadEndStarts)
+{
+    int triangleCount = indexCount / 3;
+
+    // Triangles around each vertex
+    std::vector<int> firstTriangle(vertexCount + 1, 0);
+    for (int i = 0; i < indexCount; i++)
+    {
+        firstTriangle[indices[i] + 1]++;
+    }
+    for (int v = 0; v < vertexCount; v++)
+    {
+        firstTriangle[v + 1] += firstTriangle[v];
+    }
+    std::vector<int> vertexTriangles(indexCount);
+    std::vector<int> liveTriangles(vertexCount);
+    for (int v = 0; v < vertexCount; v++)
+    {
+        liveTriangles[v] = firstTriangle[v + 1] - firstTriangle[v];
+    }
+    {
+        std::vector<int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (int i = 0; i < indexCount; i++)
+        {
+            vertexTriangles[fill[indices[i]]++] = i / 3;
+        }
+    }
+
+    std::vector<int> cacheTime(vertexCount, 0);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<int> deadEnds;
+    std::vector<int> candidates;
+    int time = MESH_VERTEX_CACHE_SIZE + 1;
+    int cursor = 0;
+    int fanning = triangleCount > 0 ? indices[0] : -1;
+    bool deadEnd = true;
+
+    ordered.clear();
+    deadEndStarts.clear();
+    while (fanning >= 0)
+    {
+        if (deadEnd)
+        {
+            deadEndStarts.push_back(ordered.size() / 3);
+            deadEnd = false;
+        }
+
+        candidates.clear();
+        for (int i = firstTriangle[fanning]; i < firstTriangle[fanning + 1]; i++)
+        {
+            int triangle = vertexTriangles[i];
+            if (emitted[triangle])
+            {
+                continue;
+            }
+            emitted[triangle] = 1;
+
+            for (int corner = 0; corner < 3; corner++)
+            {
+                int vertex = indices[triangle * 3 + corner];
+                ordered.push_back(vertex);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                liveTriangles[vertex]--;
+                if (time - cacheTime[vertex] > MESH_VERTEX_CACHE_SIZE)
+                {
+                    cacheTime[vertex] = time++;
+                }
+            }
+        }
+
+        // Candidate that stays in the cache while all of its remaining triangles are fanned, the oldest such
+        int next = -1;
+        int bestPriority = -1;
+        for (int vertex : candidates)
+        {
+            if (liveTriangles[vertex] <= 0)
+            {
+                continue;
+            }
+            int priority = 0;
+            if (time - cacheTime[vertex] + 2 * liveTriangles[vertex] <= MESH_VERTEX_CACHE_SIZE)
+            {
+                priority = time - cacheTime[vertex];
+            }
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next = vertex;
+            }
+        }
+
+        if (next == -1)
+        {
+            // Dead end, back to a recently emitted vertex with triangles left or else the next unfinished one
+            while (!deadEnds.empty() && next == -1)
+            {
+                int vertex = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[vertex] > 0)
+                {
+                    next = vertex;
+                }
+            }
+            while (next == -1 && cursor < indexCount)
+            {
+                int vertex = indices[cursor++];
+                if (liveTriangles[vertex] > 0)
+                {
+                    next = vertex;
+                }
+            }
+            deadEnd = true;
+        }
+        fanning = next;
+    }
+    ASSERT(ordered.size() == indexCount);
+}
+
+// Splits the ordered triangles into clusters at Tipsify's dead ends, and wherever a cluster's ACMR from a cold cache
+// gets within MESH_OVERDRAW_CLUSTER_THRESHOLD of the whole LOD's. Clusters can then be reordered without costing
+// much more than that.
+static void SplitClusters(const std::vector<unsigned int>& ordered, int vertexCount, const std::vector<int>& deadEndStarts,
+        std::vector<int>& clusterStarts)
+{
+    int triangleCount = ordered.size() / 3;
+    float acmr;
+    MeasureVertexCache(ordered.data(), ordered.size(), vertexCount, MESH_VERTEX_CACHE_SIZE, &acmr, nullptr);
+
+    // Misses count up over all clusters, a vertex cached before its cluster began is as good as not cached
+    std::vector<int> cachedAt(vertexCount, -1);
+    int misses = 0;
+    clusterStarts.clear();
+    for (int i = 0; i < deadEndStarts.size(); i++)
+    {
+        int end = i + 1 < deadEndStarts.size() ? deadEndStarts[i + 1] : triangleCount;
+        int clusterStart = deadEndStarts[i];
+        int clusterFirstMiss = misses;
+        clusterStarts.push_back(clusterStart);
+        for (int triangle = clusterStart; triangle < end; triangle++)
+        {
+            for (int corner = 0; corner < 3; corner++)
+            {
+                unsigned int vertex = ordered[triangle * 3 + corner];
+                if (cachedAt[vertex] < clusterFirstMiss || misses - cachedAt[vertex] >= MESH_VERTEX_CACHE_SIZE)
+                {
+                    cachedAt[vertex] = misses++;
+                }
+            }
+
+            float clusterAcmr = (misses - clusterFirstMiss) / (float) (triangle + 1 - clusterStart);
+            if (triangle + 1 < end && clusterAcmr <= MESH_OVERDRAW_CLUSTER_THRESHOLD * acmr)
+            {
+                clusterStart = triangle + 1;
+                clusterFirstMiss = misses;
+                clusterStarts.push_back(clusterStart);
+            }
+        }
+    }
+}
+
+// Orders clusters by how far out they face: the dot of the direction from the LOD's centroid to the cluster's with
+// the cluster's normal, largest first. Outward facing clusters on the outside come first and occlude the rest.
+static void SortClusters(const float* vertices, std::vector<unsigned int>& ordered, const std::vector<int>& clusterStarts)
+{
+    int triangleCount = ordered.size() / 3;
+    int clusterCount = clusterStarts.size();
+    if (clusterCount <= 1)
+    {
+        return;
+    }
+
+    // Area weighted, the cross product's length is twice the area
+    std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.f));
+    std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.f));
+    std::vector<float> clusterAreas(clusterCount, 0.f);
+    glm::vec3 meshCentroid(0.f);
+    float meshArea = 0.f;
+    for (int cluster = 0; cluster < clusterCount; cluster++)
+    {
+        int end = cluster + 1 < clusterCount ? clusterStarts[cluster + 1] : triangleCount;
+        for (int triangle = clusterStarts[cluster]; triangle < end; triangle++)
+        {
+            glm::vec3 corners[3];
+            for (int corner = 0; corner < 3; corner++)
+            {
+                const float* vertex = vertices + ordered[triangle * 3 + corner] * MESH_VERTEX_ELEMENT_COUNT;
+                corners[corner] = glm::vec3(vertex[0], vertex[1], vertex[2]);
+            }
+            glm::vec3 normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+            float area = glm::length(normal);
+            glm::vec3 centroid = (corners[0] + corners[1] + corners[2]) / 3.f;
+
+            clusterCentroids[cluster] += centroid * area;
+            clusterNormals[cluster] += normal;
+            clusterAreas[cluster] += area;
+            meshCentroid += centroid * area;
+            meshArea += area;
+        }
+    }
+    if (meshArea <= 0.f)
+    {
+        return;
+    }
+    meshCentroid /= meshArea;
+
+    std::vector<float> outwardness(clusterCount, 0.f);
+    std::vector<int> clusterOrder(clusterCount);
+    for (int cluster = 0; cluster < clusterCount; cluster++)
+    {
+        clusterOrder[cluster] = cluster;
+        float normalLength = glm::length(clusterNormals[cluster]);
+        if (clusterAreas[cluster] > 0.f && normalLength > 0.f)
+        {
+            glm::vec3 centroid = clusterCentroids[cluster] / clusterAreas[cluster];
+            outwardness[cluster] = glm::dot(centroid - meshCentroid, clusterNormals[cluster] / normalLength);
+        }
+    }
+    // Stable, so that ties keep their vertex cache friendly order
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&outwardness](int a, int b)
+    {
+        return outwardness[a] > outwardness[b];
+    });
+
+    std::vector<unsigned int> sorted;
+    sorted.reserve(ordered.size());
+    for (int cluster : clusterOrder)
+    {
+        int end = cluster + 1 < clusterCount ? clusterStarts[cluster + 1] : triangleCount;
+        sorted.insert(sorted.end(), ordered.begin() + clusterStarts[cluster] * 3, ordered.begin() + end * 3);
+    }
+    ordered.swap(sorted);
+}
+
+void OptimizeMeshData(MeshData& data)
+{
+    ASSERT(data.mappedVertices == nullptr && data.mappedIndices == nullptr);
+    MeshLod fullDetail = data.lods.empty() ? MeshLod{ 0, data.indexCount, 0.f } : data.lods[0];
+    unsigned int* indices = data.ownedIndices.data();
+    MeasureVertexCache(indices + fullDetail.firstIndex, fullDetail.indexCount, data.vertexCount, MESH_VERTEX_CACHE_SIZE,
+            &data.vertexCacheStats.acmrBefore, &data.vertexCacheStats.atvrBefore);
+
+    // Every LOD on its own, they're drawn on their own
+    std::vector<MeshLod> lods = data.lods;
+    if (lods.empty())
+    {
+        lods.push_back(fullDetail);
+    }
+    std::vector<unsigned int> ordered;
+    std::vector<int> deadEndStarts;
+    std::vector<int> clusterStarts;
+    for (const MeshLod& lod : lods)
+    {
+        Tipsify(indices + lod.firstIndex, lod.indexCount, data.vertexCount, ordered, deadEndStarts);
+        SplitClusters(ordered, data.vertexCount, deadEndStarts, clusterStarts);
+        SortClusters(data.ownedVertices.data(), ordered, clusterStarts);
+        std::copy(ordered.begin(), ordered.end(), indices + lod.firstIndex);
+    }
+
+    // Coarser LODs only reference vertices of the full detail one, its order decides the vertex order. Vertices no
+    // index references go last.
+    std::vector<int> remap(data.vertexCount, -1);
+    int nextVertex = 0;
+    for (int i = 0; i < data.indexCount; i++)
+    {
+        if (remap[indices[i]] < 0)
+        {
+            remap[indices[i]] = nextVertex++;
+        }
+    }
+    for (int v = 0; v < data.vertexCount; v++)
+    {
+        if (remap[v] < 0)
+        {
+            remap[v] = nextVertex++;
+        }
+    }
+
+    std::vector<float> vertices(data.ownedVertices.size());
+    for (int v = 0; v < data.vertexCount; v++)
+    {
+        std::copy(data.ownedVertices.begin() + v * MESH_VERTEX_ELEMENT_COUNT, data.ownedVertices.begin() + (v + 1) * MESH_VERTEX_ELEMENT_COUNT,
+                vertices.begin() + remap[v] * MESH_VERTEX_ELEMENT_COUNT);
+    }
+    data.ownedVertices.swap(vertices);
+    for (int i = 0; i < data.indexCount; i++)
+    {
+        indices[i] = remap[indices[i]];
+    }
+
+    MeasureVertexCache(indices + fullDetail.firstIndex, fullDetail.indexCount, data.vertexCount, MESH_VERTEX_CACHE_SIZE,
+            &data.vertexCacheStats.acmrAfter, &data.vertexCacheStats.atvrAfter);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "mesh_cache.h"
+
+// FIFO post-transform cache size that triangle order is optimized for and ACMR/ATVR are measured with
+#define MESH_VERTEX_CACHE_SIZE 16
+// Clusters are split wherever their ACMR so far is within this factor of the whole LOD's, more clusters give
+// the overdraw sort more freedom at the cost of vertex cache misses across their boundaries
+#define MESH_OVERDRAW_CLUSTER_THRESHOLD 1.05f
+
+// Simulates a FIFO vertex cache of cacheSize over triangles. Either output may be null.
+void MeasureVertexCache(const unsigned int* indices, int indexCount, int vertexCount, int cacheSize, float* acmr, float* atvr);
+
+// Reorders a freshly built mesh for the GPU, run after BuildMeshLods:
+// 1. Triangles of every LOD for vertex cache locality (Tipsify, Sander et al. 2007).
+// 2. Tipsify's clusters of triangles front to back from the outside in, so that they tend to occlude each other's
+//    later fragments whatever the view (Sander et al. 2007, view independent overdraw).
+// 3. Vertices in the order the indices first reference them, for vertex fetch locality.
+// Fills in vertexCacheStats.
+void OptimizeMeshData(MeshData& data);
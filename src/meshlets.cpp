@@ -0,0 +1,122 @@
+#include "meshlets.h"
+
+#include <math.h>
+
+#include "glm/glm.hpp"
+
+static glm::vec3 VertexPosition(const MeshData& data, unsigned int vertex)
+{
+    const float* position = data.Vertices() + vertex * MESH_VERTEX_ELEMENT_COUNT;
+    return glm::vec3(position[0], position[1], position[2]);
+}
+
+static Meshlet FinishMeshlet(const MeshData& data, int firstIndex, int indexCount)
+{
+    const unsigned int* indices = data.Indices();
+    Meshlet meshlet;
+    meshlet.firstIndex = firstIndex;
+    meshlet.indexCount = indexCount;
+
+    glm::vec3 min = VertexPosition(data, indices[firstIndex]);
+    glm::vec3 max = min;
+    for (int i = firstIndex; i < firstIndex + indexCount; i++)
+    {
+        glm::vec3 position = VertexPosition(data, indices[i]);
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+    meshlet.center = (min + max) * 0.5f;
+    meshlet.radius = 0.f;
+    for (int i = firstIndex; i < firstIndex + indexCount; i++)
+    {
+        meshlet.radius = glm::max(meshlet.radius, glm::length(VertexPosition(data, indices[i]) - meshlet.center));
+    }
+
+    // Area weighted average normal, then the widest angle any triangle's normal makes with it
+    glm::vec3 normalSum(0.f);
+    for (int i = firstIndex; i < firstIndex + indexCount; i += 3)
+    {
+        glm::vec3 p0 = VertexPosition(data, indices[i]);
+        normalSum += glm::cross(VertexPosition(data, indices[i + 1]) - p0, VertexPosition(data, indices[i + 2]) - p0);
+    }
+    float normalSumLength = glm::length(normalSum);
+    meshlet.coneAxis = normalSumLength > 0.f ? normalSum / normalSumLength : glm::vec3(0.f, 0.f, 1.f);
+    meshlet.coneCutoff = 1.f;
+    if (normalSumLength <= 0.f)
+    {
+        return meshlet;
+    }
+
+    float minCos = 1.f;
+    for (int i = firstIndex; i < firstIndex + indexCount; i += 3)
+    {
+        glm::vec3 p0 = VertexPosition(data, indices[i]);
+        glm::vec3 normal = glm::cross(VertexPosition(data, indices[i + 1]) - p0, VertexPosition(data, indices[i + 2]) - p0);
+        float length = glm::length(normal);
+        // Degenerate triangles never rasterize, they can face anywhere
+        if (length > 0.f)
+        {
+            minCos = glm::min(minCos, glm::dot(normal / length, meshlet.coneAxis));
+        }
+    }
+    // Past 90 degrees some triangle always faces the camera
+    if (minCos > 0.f)
+    {
+        meshlet.coneCutoff = sqrtf(1.f - minCos * minCos);
+    }
+    return meshlet;
+}
+
+void BuildMeshlets(MeshData& data)
+{
+    data.meshlets.clear();
+    int firstIndex = data.lods.empty() ? 0 : data.lods[0].firstIndex;
+    int indexCount = data.lods.empty() ? data.indexCount : data.lods[0].indexCount;
+    if (indexCount == 0)
+    {
+        return;
+    }
+
+    const unsigned int* indices = data.Indices();
+    // Meshlet a vertex was last added to, so that unique vertices are counted without clearing a set
+    std::vector<int> vertexMeshlet(data.vertexCount, -1);
+    int meshletFirstIndex = firstIndex;
+    int meshletVertexCount = 0;
+    for (int i = firstIndex; i < firstIndex + indexCount; i += 3)
+    {
+        int meshlet = data.meshlets.size();
+        int newVertexCount = 0;
+        for (int corner = 0; corner < 3; corner++)
+        {
+            unsigned int vertex = indices[i + corner];
+            // A triangle may repeat a vertex, only count it once
+            bool repeated = (corner > 0 && indices[i] == vertex) || (corner > 1 && indices[i + 1] == vertex);
+            newVertexCount += vertexMeshlet[vertex] != meshlet && !repeated ? 1 : 0;
+        }
+
+        int meshletTriangleCount = (i - meshletFirstIndex) / 3;
+        if (meshletVertexCount + newVertexCount > MESHLET_MAX_VERTICES || meshletTriangleCount == MESHLET_MAX_TRIANGLES)
+        {
+            data.meshlets.push_back(FinishMeshlet(data, meshletFirstIndex, i - meshletFirstIndex));
+            meshlet++;
+            meshletFirstIndex = i;
+            meshletVertexCount = 0;
+        }
+
+        for (int corner = 0; corner < 3; corner++)
+        {
+            unsigned int vertex = indices[i + corner];
+            if (vertexMeshlet[vertex] != meshlet)
+            {
+                vertexMeshlet[vertex] = meshlet;
+                meshletVertexCount++;
+            }
+        }
+    }
+    data.meshlets.push_back(FinishMeshlet(data, meshletFirstIndex, firstIndex + indexCount - meshletFirstIndex));
+
+    if (data.meshlets.size() < MESHLET_MIN_COUNT)
+    {
+        data.meshlets.clear();
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "mesh_cache.h"
+
+// Meshlet size limits, sized for a 64 thread work group's worth of vertices
+#define MESHLET_MAX_VERTICES 64
+#define MESHLET_MAX_TRIANGLES 124
+// Meshes that would get fewer meshlets are culled as a whole only
+#define MESHLET_MIN_COUNT 4
+
+// Splits the full detail LOD into meshlets of at most MESHLET_MAX_VERTICES unique vertices and MESHLET_MAX_TRIANGLES
+// triangles, each a contiguous index range so that a surviving meshlet is a single indirect command. Triangles are
+// taken in order, run after OptimizeMeshData so that its locality carries over. Each meshlet gets a bounding sphere
+// and a normal cone for backface culling.
+void BuildMeshlets(MeshData& data);
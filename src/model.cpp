@@ -1,19 +1,63 @@
+#include <chrono>
 #include <limits>
 
+#include "log.h"
+#include "mesh_cache.h"
 #include "model.h"
+#include "obj_loader.h"
+#include "thread_pool.h"
 
 Model::Model(const char *filepath, std::vector<std::pair<std::string, std::string>> texturesWithPaths)
 {
-    objl::Loader loader;
-    loader.LoadFile(filepath);
+    // Uploads straight from the mapped cache when it's up to date, only parses the OBJ otherwise
+    MeshCache cache;
+    std::vector<MeshData> builtMeshes;
+    std::vector<std::string> materialLibraries;
+    if (cache.Map(filepath))
+    {
+        LOG_INFO("Model", "Loading \"%s\" from mesh cache", filepath);
+    }
+    else if (LoadObj(filepath, ThreadPool::Shared(), builtMeshes, nullptr, &materialLibraries))
+    {
+        std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+        MeshCache::Write(filepath, builtMeshes, materialLibraries);
+        LOG_INFO("Model", "Cache write for \"%s\" took %.2fms", filepath,
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - writeStart).count());
+    }
+    const std::vector<MeshData>& meshData = cache.IsMapped() ? cache.meshes : builtMeshes;
+
+    // Measured by OptimizeMeshData when the meshes were built, cached along with them
+    double triangleTotal = 0.0;
+    double missesBefore = 0.0;
+    double missesAfter = 0.0;
+    for (const MeshData& mesh : meshData)
+    {
+        const MeshVertexCacheStats& stats = mesh.vertexCacheStats;
+        LOG_INFO("Model", "\"%s\": ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", mesh.name.c_str(),
+                stats.acmrBefore, stats.acmrAfter, stats.atvrBefore, stats.atvrAfter);
+        int triangleCount = (mesh.lods.empty() ? mesh.indexCount : mesh.lods[0].indexCount) / 3;
+        triangleTotal += triangleCount;
+        missesBefore += stats.acmrBefore * triangleCount;
+        missesAfter += stats.acmrAfter * triangleCount;
+    }
+    if (triangleTotal > 0.0)
+    {
+        LOG_INFO("Model", "\"%s\": ACMR %.3f -> %.3f over all meshes", filepath,
+                missesBefore / triangleTotal, missesAfter / triangleTotal);
+    }
+
+    // GL upload has to stay on the context thread
+    std::chrono::steady_clock::time_point uploadStart = std::chrono::steady_clock::now();
 
     aabbModelSpace = AABB(glm::vec3(std::numeric_limits<float>::max()), glm::vec3(std::numeric_limits<float>::min()));
-    for (int i = 0; i < loader.LoadedMeshes.size(); i++)
+    for (int i = 0; i < meshData.size(); i++)
     {
-        meshes.push_back(Mesh(loader.LoadedMeshes[i], OPAQUE, texturesWithPaths));
+        meshes.push_back(Mesh(meshData[i], OPAQUE, texturesWithPaths));
         aabbModelSpace.min = glm::min(aabbModelSpace.min, meshes[i].aabbModelSpace.min);
         aabbModelSpace.max = glm::max(aabbModelSpace.max, meshes[i].aabbModelSpace.max);
     }
+    LOG_INFO("Model", "GL upload for \"%s\" (%lu meshes) took %.2fms", filepath, meshes.size(),
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploadStart).count());
 }
 
 Model::Model(objl::Mesh mesh, std::vector<std::pair<std::string, std::string>> texturesWithPaths)
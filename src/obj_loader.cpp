@@ -0,0 +1,537 @@
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unordered_map>
+
+#include "OBJ_Loader.h"
+
+#include "log.h"
+#include "mesh.h"
+#include "obj_loader.h"
+#include "thread_pool.h"
+
+// Chunks smaller than this aren't worth the scheduling overhead
+#define OBJ_MIN_CHUNK_SIZE (64 * 1024)
+#define OBJ_CHUNKS_PER_THREAD 4
+
+struct ObjAttributeCounts
+{
+    int positions;
+    int texCoords;
+    int normals;
+};
+
+static ObjAttributeCounts operator+(ObjAttributeCounts a, ObjAttributeCounts b)
+{
+    return { a.positions + b.positions, a.texCoords + b.texCoords, a.normals + b.normals };
+}
+
+struct ObjEvent
+{
+    enum Type
+    {
+        GROUP,
+        MATERIAL,
+        MATERIAL_LIB,
+    };
+
+    Type type;
+    std::string value;
+    const char* line;
+    // Chunk local attribute counts preceding this line
+    ObjAttributeCounts countsBefore;
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+
+    ObjAttributeCounts counts;
+    ObjAttributeCounts offsets;
+    std::vector<ObjEvent> events;
+};
+
+// A run of lines sharing the same group and material, ends up as a single mesh
+struct ObjSegment
+{
+    std::string name;
+    std::string material;
+    const char* begin;
+    const char* end;
+    ObjAttributeCounts countsAtBegin;
+};
+
+struct ObjVertexKey
+{
+    int position;
+    int texCoord;
+    int normal;
+
+    bool operator==(const ObjVertexKey& other) const
+    {
+        return position == other.position && texCoord == other.texCoord && normal == other.normal;
+    }
+};
+
+struct ObjVertexKeyHash
+{
+    size_t operator()(const ObjVertexKey& key) const
+    {
+        size_t hash = key.position;
+        hash = hash * 31 + key.texCoord;
+        hash = hash * 31 + key.normal;
+        return hash;
+    }
+};
+
+static double MsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* SkipSpaces(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+static const char* FindLineEnd(const char* p, const char* end)
+{
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline != nullptr ? newline : end;
+}
+
+static bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Keyword followed by whitespace or the end of the line
+static bool StartsWithToken(const char* p, const char* lineEnd, const char* token)
+{
+    int length = strlen(token);
+    return lineEnd - p >= length && strncmp(p, token, length) == 0 && (p + length == lineEnd || IsSpace(p[length]));
+}
+
+static std::string Tail(const char* p, const char* lineEnd, int tokenLength)
+{
+    p = SkipSpaces(p + tokenLength, lineEnd);
+    while (lineEnd > p && IsSpace(lineEnd[-1]))
+        lineEnd--;
+    return std::string(p, lineEnd);
+}
+
+// Never reads past the line, strtof would happily skip over the newline otherwise
+static float ParseFloat(const char*& p, const char* lineEnd, float fallback)
+{
+    p = SkipSpaces(p, lineEnd);
+    if (p >= lineEnd)
+        return fallback;
+
+    char* parsedEnd;
+    float value = strtof(p, &parsedEnd);
+    if (parsedEnd == p)
+        return fallback;
+
+    p = parsedEnd;
+    return value;
+}
+
+// Resolves 1-based and negative (relative) OBJ indices into 0-based ones, -1 if missing or invalid
+static int ParseIndex(const char*& p, const char* lineEnd, int count)
+{
+    if (p >= lineEnd || !(*p == '-' || (*p >= '0' && *p <= '9')))
+        return -1;
+
+    char* parsedEnd;
+    long index = strtol(p, &parsedEnd, 10);
+    p = parsedEnd;
+
+    int resolved = index > 0 ? index - 1 : count + index;
+    return (index == 0 || resolved < 0 || resolved >= count) ? -1 : resolved;
+}
+
+static void ScanChunk(ObjChunk& chunk)
+{
+    chunk.counts = { 0, 0, 0 };
+    for (const char* line = chunk.begin; line < chunk.end;)
+    {
+        const char* lineEnd = FindLineEnd(line, chunk.end);
+        const char* p = SkipSpaces(line, lineEnd);
+
+        if (StartsWithToken(p, lineEnd, "v"))
+            chunk.counts.positions++;
+        else if (StartsWithToken(p, lineEnd, "vt"))
+            chunk.counts.texCoords++;
+        else if (StartsWithToken(p, lineEnd, "vn"))
+            chunk.counts.normals++;
+        else if (StartsWithToken(p, lineEnd, "o") || StartsWithToken(p, lineEnd, "g"))
+            chunk.events.push_back({ ObjEvent::GROUP, Tail(p, lineEnd, 1), line, chunk.counts });
+        else if (StartsWithToken(p, lineEnd, "usemtl"))
+            chunk.events.push_back({ ObjEvent::MATERIAL, Tail(p, lineEnd, 6), line, chunk.counts });
+        else if (StartsWithToken(p, lineEnd, "mtllib"))
+            chunk.events.push_back({ ObjEvent::MATERIAL_LIB, Tail(p, lineEnd, 6), line, chunk.counts });
+
+        line = lineEnd + 1;
+    }
+}
+
+static void ParseChunkAttributes(const ObjChunk& chunk, std::vector<objl::Vector3>& positions,
+        std::vector<objl::Vector2>& texCoords, std::vector<objl::Vector3>& normals)
+{
+    ObjAttributeCounts next = chunk.offsets;
+    for (const char* line = chunk.begin; line < chunk.end;)
+    {
+        const char* lineEnd = FindLineEnd(line, chunk.end);
+        const char* p = SkipSpaces(line, lineEnd);
+
+        if (StartsWithToken(p, lineEnd, "v"))
+        {
+            p += 1;
+            objl::Vector3& position = positions[next.positions++];
+            position.X = ParseFloat(p, lineEnd, 0.f);
+            position.Y = ParseFloat(p, lineEnd, 0.f);
+            position.Z = ParseFloat(p, lineEnd, 0.f);
+        }
+        else if (StartsWithToken(p, lineEnd, "vt"))
+        {
+            p += 2;
+            objl::Vector2& texCoord = texCoords[next.texCoords++];
+            texCoord.X = ParseFloat(p, lineEnd, 0.f);
+            texCoord.Y = ParseFloat(p, lineEnd, 0.f);
+        }
+        else if (StartsWithToken(p, lineEnd, "vn"))
+        {
+            p += 2;
+            objl::Vector3& normal = normals[next.normals++];
+            normal.X = ParseFloat(p, lineEnd, 0.f);
+            normal.Y = ParseFloat(p, lineEnd, 0.f);
+            normal.Z = ParseFloat(p, lineEnd, 0.f);
+        }
+
+        line = lineEnd + 1;
+    }
+}
+
+static void ParseSegmentFaces(const ObjSegment& segment, const std::vector<objl::Vector3>& positions,
+        const std::vector<objl::Vector2>& texCoords, const std::vector<objl::Vector3>& normals, objl::Mesh& mesh)
+{
+    // Welds identical v/vt/vn tuples, objl emits a separate vertex for every face corner
+    std::unordered_map<ObjVertexKey, unsigned int, ObjVertexKeyHash> welded;
+    std::vector<ObjVertexKey> corners;
+
+    ObjAttributeCounts counts = segment.countsAtBegin;
+    for (const char* line = segment.begin; line < segment.end;)
+    {
+        const char* lineEnd = FindLineEnd(line, segment.end);
+        const char* p = SkipSpaces(line, lineEnd);
+        line = lineEnd + 1;
+
+        // Attributes can be interleaved with faces, keep counting for relative indices
+        if (StartsWithToken(p, lineEnd, "v"))
+        {
+            counts.positions++;
+            continue;
+        }
+        if (StartsWithToken(p, lineEnd, "vt"))
+        {
+            counts.texCoords++;
+            continue;
+        }
+        if (StartsWithToken(p, lineEnd, "vn"))
+        {
+            counts.normals++;
+            continue;
+        }
+        if (!StartsWithToken(p, lineEnd, "f"))
+        {
+            continue;
+        }
+
+        corners.clear();
+        bool valid = true;
+        bool hasNormals = true;
+        p += 1;
+        while ((p = SkipSpaces(p, lineEnd)) < lineEnd && !IsSpace(*p))
+        {
+            ObjVertexKey corner = { ParseIndex(p, lineEnd, counts.positions), -1, -1 };
+            if (p < lineEnd && *p == '/')
+            {
+                p++;
+                corner.texCoord = ParseIndex(p, lineEnd, counts.texCoords);
+                if (p < lineEnd && *p == '/')
+                {
+                    p++;
+                    corner.normal = ParseIndex(p, lineEnd, counts.normals);
+                }
+            }
+            // Skip whatever is left of a malformed corner
+            while (p < lineEnd && !IsSpace(*p))
+                p++;
+
+            valid &= corner.position >= 0;
+            hasNormals &= corner.normal >= 0;
+            corners.push_back(corner);
+        }
+        if (!valid || corners.size() < 3)
+        {
+            continue;
+        }
+
+        // Same fallback as objl for faces without normals, such corners can't be welded
+        objl::Vector3 faceNormal;
+        if (!hasNormals)
+        {
+            objl::Vector3 a = positions[corners[0].position] - positions[corners[1].position];
+            objl::Vector3 b = positions[corners[2].position] - positions[corners[1].position];
+            faceNormal = objl::math::CrossV3(a, b);
+        }
+
+        unsigned int faceIndices[3];
+        unsigned int firstIndex = 0;
+        unsigned int previousIndex = 0;
+        for (int i = 0; i < corners.size(); i++)
+        {
+            unsigned int index;
+            auto existing = hasNormals ? welded.find(corners[i]) : welded.end();
+            if (existing != welded.end())
+            {
+                index = existing->second;
+            }
+            else
+            {
+                objl::Vertex vertex;
+                vertex.Position = positions[corners[i].position];
+                vertex.TextureCoordinate = corners[i].texCoord >= 0 ? texCoords[corners[i].texCoord] : objl::Vector2(0.f, 0.f);
+                vertex.Normal = hasNormals ? normals[corners[i].normal] : faceNormal;
+
+                index = mesh.Vertices.size();
+                mesh.Vertices.push_back(vertex);
+                if (hasNormals)
+                {
+                    welded[corners[i]] = index;
+                }
+            }
+
+            // Fan triangulation, fine for the convex polygons exporters produce
+            if (i == 0)
+            {
+                firstIndex = index;
+            }
+            else if (i >= 2)
+            {
+                faceIndices[0] = firstIndex;
+                faceIndices[1] = previousIndex;
+                faceIndices[2] = index;
+                mesh.Indices.insert(mesh.Indices.end(), faceIndices, faceIndices + 3);
+            }
+            previousIndex = index;
+        }
+    }
+}
+
+static bool ReadFile(const char* filepath, std::string& contents)
+{
+    FILE* file = fopen(filepath, "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    contents.resize(size);
+    bool read = size == 0 || fread(&contents[0], 1, size, file) == size;
+    fclose(file);
+
+    return read;
+}
+
+static void LoadMaterials(const std::string& path, std::unordered_map<std::string, objl::Material>& materials)
+{
+    std::string contents;
+    if (!ReadFile(path.c_str(), contents))
+    {
+        LOG_WARN("OBJ loader", "Failed reading material library \"%s\"", path.c_str());
+        return;
+    }
+
+    const char* end = contents.data() + contents.size();
+    objl::Material* material = nullptr;
+    for (const char* line = contents.data(); line < end;)
+    {
+        const char* lineEnd = FindLineEnd(line, end);
+        const char* p = SkipSpaces(line, lineEnd);
+        line = lineEnd + 1;
+
+        if (StartsWithToken(p, lineEnd, "newmtl"))
+        {
+            std::string name = Tail(p, lineEnd, 6);
+            material = &materials[name];
+            material->name = name;
+        }
+        else if (material == nullptr)
+        {
+            continue;
+        }
+        else if (StartsWithToken(p, lineEnd, "map_Kd"))
+        {
+            material->map_Kd = Tail(p, lineEnd, 6);
+        }
+        else if (StartsWithToken(p, lineEnd, "map_Ks"))
+        {
+            material->map_Ks = Tail(p, lineEnd, 6);
+        }
+        else if (StartsWithToken(p, lineEnd, "map_bump") || StartsWithToken(p, lineEnd, "map_Bump"))
+        {
+            material->map_bump = Tail(p, lineEnd, 8);
+        }
+        else if (StartsWithToken(p, lineEnd, "bump"))
+        {
+            material->map_bump = Tail(p, lineEnd, 4);
+        }
+    }
+}
+
+bool LoadObj(const char* filepath, ThreadPool& pool, std::vector<MeshData>& meshes, ObjLoadTimings* timings,
+        std::vector<std::string>* materialLibraries)
+{
+    ObjLoadTimings localTimings;
+    ObjLoadTimings& t = timings != nullptr ? *timings : localTimings;
+    std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+
+    std::chrono::steady_clock::time_point stageStart = std::chrono::steady_clock::now();
+    std::string contents;
+    if (!ReadFile(filepath, contents))
+    {
+        LOG_ERROR("OBJ loader", "Failed reading \"%s\"", filepath);
+        return false;
+    }
+    t.readMs = MsSince(stageStart);
+
+    // Split into newline aligned chunks and count attributes/collect group boundaries per chunk
+    stageStart = std::chrono::steady_clock::now();
+    const char* begin = contents.data();
+    const char* end = begin + contents.size();
+    long chunkCount = std::min((long)(pool.ThreadCount() + 1) * OBJ_CHUNKS_PER_THREAD, (long)contents.size() / OBJ_MIN_CHUNK_SIZE + 1);
+    long chunkSize = contents.size() / chunkCount + 1;
+
+    std::vector<ObjChunk> chunks;
+    for (const char* chunkBegin = begin; chunkBegin < end;)
+    {
+        const char* chunkEnd = chunkBegin + chunkSize < end ? FindLineEnd(chunkBegin + chunkSize, end) : end;
+        chunkEnd = chunkEnd < end ? chunkEnd + 1 : end;
+
+        ObjChunk chunk;
+        chunk.begin = chunkBegin;
+        chunk.end = chunkEnd;
+        chunks.push_back(chunk);
+        chunkBegin = chunkEnd;
+    }
+    pool.ParallelFor(chunks.size(), [&chunks](int i) { ScanChunk(chunks[i]); });
+
+    ObjAttributeCounts totals = { 0, 0, 0 };
+    for (ObjChunk& chunk : chunks)
+    {
+        chunk.offsets = totals;
+        totals = totals + chunk.counts;
+    }
+
+    // Every group or material change starts a new segment
+    std::string objDirectory = filepath;
+    size_t lastSlash = objDirectory.find_last_of('/');
+    objDirectory = lastSlash == std::string::npos ? "" : objDirectory.substr(0, lastSlash + 1);
+
+    std::unordered_map<std::string, objl::Material> materials;
+    std::vector<ObjSegment> segments;
+    segments.push_back({ "unnamed", "", begin, end, { 0, 0, 0 } });
+    for (ObjChunk& chunk : chunks)
+    {
+        for (ObjEvent& event : chunk.events)
+        {
+            if (event.type == ObjEvent::MATERIAL_LIB)
+            {
+                LoadMaterials(objDirectory + event.value, materials);
+                if (materialLibraries != nullptr)
+                {
+                    materialLibraries->push_back(objDirectory + event.value);
+                }
+                continue;
+            }
+
+            ObjSegment segment = segments.back();
+            segments.back().end = event.line;
+            segment.begin = event.line;
+            segment.end = end;
+            segment.countsAtBegin = chunk.offsets + event.countsBefore;
+            if (event.type == ObjEvent::GROUP)
+            {
+                segment.name = event.value.empty() ? "unnamed" : event.value;
+            }
+            else
+            {
+                segment.material = event.value;
+            }
+            segments.push_back(segment);
+        }
+    }
+    t.scanMs = MsSince(stageStart);
+
+    stageStart = std::chrono::steady_clock::now();
+    std::vector<objl::Vector3> positions(totals.positions);
+    std::vector<objl::Vector2> texCoords(totals.texCoords);
+    std::vector<objl::Vector3> normals(totals.normals);
+    pool.ParallelFor(chunks.size(), [&](int i) { ParseChunkAttributes(chunks[i], positions, texCoords, normals); });
+    t.attributesMs = MsSince(stageStart);
+
+    stageStart = std::chrono::steady_clock::now();
+    std::vector<objl::Mesh> objMeshes(segments.size());
+    pool.ParallelFor(segments.size(), [&](int i) { ParseSegmentFaces(segments[i], positions, texCoords, normals, objMeshes[i]); });
+
+    // Drop segments without faces and give the rest unique names, objl style
+    std::unordered_map<std::string, int> nameCounts;
+    std::vector<objl::Mesh*> nonEmptyMeshes;
+    for (int i = 0; i < segments.size(); i++)
+    {
+        objl::Mesh& mesh = objMeshes[i];
+        if (mesh.Indices.empty())
+        {
+            continue;
+        }
+
+        int nameCount = ++nameCounts[segments[i].name];
+        mesh.MeshName = nameCount == 1 ? segments[i].name : segments[i].name + "_" + std::to_string(nameCount);
+
+        auto material = materials.find(segments[i].material);
+        if (material != materials.end())
+        {
+            mesh.MeshMaterial = material->second;
+        }
+        nonEmptyMeshes.push_back(&mesh);
+    }
+    t.facesMs = MsSince(stageStart);
+
+    stageStart = std::chrono::steady_clock::now();
+    int firstMesh = meshes.size();
+    meshes.resize(firstMesh + nonEmptyMeshes.size());
+    pool.ParallelFor(nonEmptyMeshes.size(), [&](int i)
+        {
+            meshes[firstMesh + i] = BuildMeshData(*nonEmptyMeshes[i]);
+            *nonEmptyMeshes[i] = objl::Mesh();
+        });
+    t.tangentsMs = MsSince(stageStart);
+
+    t.totalMs = MsSince(loadStart);
+    LOG_INFO("OBJ loader", "Loaded \"%s\": %lu meshes, %lu chunks on %d threads in %.2fms (read %.2fms, scan %.2fms, attributes %.2fms, faces %.2fms, tangents %.2fms)",
+            filepath, nonEmptyMeshes.size(), chunks.size(), pool.ThreadCount() + 1, t.totalMs,
+            t.readMs, t.scanMs, t.attributesMs, t.facesMs, t.tangentsMs);
+
+    return true;
+}
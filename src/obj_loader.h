@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "mesh_cache.h"
+
+class ThreadPool;
+
+// Wall clock time spent in each loading stage, in milliseconds
+struct ObjLoadTimings
+{
+    double readMs = 0.0;
+    double scanMs = 0.0;
+    double attributesMs = 0.0;
+    double facesMs = 0.0;
+    double tangentsMs = 0.0;
+    double totalMs = 0.0;
+};
+
+// Parallel OBJ/MTL loader. The file is split into newline aligned chunks which are scanned and
+// parsed on the pool, after which every group/material run is turned into a welded, triangulated
+// mesh and gets its tangents generated on the pool as well. Produces CPU side data only, the GL
+// upload is left to the caller. materialLibraries receives the paths of the referenced MTL files, whether they could
+// be read or not.
+bool LoadObj(const char* filepath, ThreadPool& pool, std::vector<MeshData>& meshes, ObjLoadTimings* timings = nullptr,
+        std::vector<std::string>* materialLibraries = nullptr);
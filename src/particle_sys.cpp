@@ -30,15 +30,16 @@ void ParticleSys::Update(float dt, Transform& cameraTransform)
     glm::vec3 spawnCenter = spawnBounds.min + spawnZoneExtents;
     for (auto& particle : particles)
     {
+        Transform transform = particle.mesh.mesh.LocalTransform();
         particle.lifetime -= dt;
 
         if (particle.lifetime <= 0.f)
         {
             particle.lifetime = RandomFloat() * maxParticleLifetime;
-            particle.mesh.mesh.transform.pos = spawnCenter + glm::vec3(spawnZoneExtents.x * (RandomFloat() - 0.5f) * 2.f, 0.f,
+            transform.pos = spawnCenter + glm::vec3(spawnZoneExtents.x * (RandomFloat() - 0.5f) * 2.f, 0.f,
                     spawnZoneExtents.z * (RandomFloat() - 0.5f) * 2.f);
 
-            glm::vec3 fromCenter = (particle.mesh.mesh.transform.pos - spawnCenter) * glm::vec3(RandomFloat(), 1.f, RandomFloat());
+            glm::vec3 fromCenter = (transform.pos - spawnCenter) * glm::vec3(RandomFloat(), 1.f, RandomFloat());
             fromCenter = glm::normalize(fromCenter);
             fromCenter.y += 2.f;
             fromCenter = glm::normalize(fromCenter);
@@ -50,13 +51,15 @@ void ParticleSys::Update(float dt, Transform& cameraTransform)
             float yDt = particle.velocity.y * dt;
             ((TransparentMaterial*)particle.mesh.material)->resourceData.tintAndOpacity.w = particle.lifetime / maxParticleLifetime *
                 particle.initialTransparency;
+            particle.mesh.material->UpdateData();
 
-            particle.mesh.mesh.transform.pos += particle.velocity * dt;
+            transform.pos += particle.velocity * dt;
             particle.velocity.x *= 1.f - dt;
             particle.velocity.y -= yDt * 0.34f;
             particle.velocity.z *= 1.f - dt;
         }
 
-        particle.mesh.mesh.transform.rot = cameraTransform.rot;
+        transform.rot = cameraTransform.rot;
+        particle.mesh.mesh.SetLocalTransform(transform);
     }
 }
@@ -7,7 +7,6 @@
 struct MeshWithMaterial;
 struct ParticleData
 {
-    // Temporary. We should be instancing
     MeshWithMaterial& mesh;
     glm::vec3 velocity;
     float lifetime;
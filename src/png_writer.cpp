@@ -0,0 +1,122 @@
+#include "png_writer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+// Largest payload of a single stored deflate block
+#define PNG_STORED_BLOCK_SIZE 65535
+
+static uint32_t Crc32(const unsigned char* data, size_t size, uint32_t crc = 0)
+{
+    static uint32_t table[256];
+    static bool tableBuilt = false;
+    if (!tableBuilt)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        tableBuilt = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void PushBE32(std::vector<unsigned char>& out, uint32_t value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static bool WriteChunk(FILE* file, const char* type, const std::vector<unsigned char>& payload)
+{
+    std::vector<unsigned char> chunk;
+    chunk.reserve(payload.size() + 12);
+    PushBE32(chunk, payload.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), payload.begin(), payload.end());
+    // CRC covers the type and the payload, not the length
+    PushBE32(chunk, Crc32(chunk.data() + 4, chunk.size() - 4));
+
+    return fwrite(chunk.data(), 1, chunk.size(), file) == chunk.size();
+}
+
+bool WritePng(const char* path, int width, int height, int channels, const unsigned char* pixels)
+{
+    if (width <= 0 || height <= 0 || (channels != 3 && channels != 4))
+    {
+        return false;
+    }
+
+    // Every scanline is prefixed by its filter type, 0 = none
+    size_t rowSize = (size_t)width * channels;
+    std::vector<unsigned char> scanlines;
+    scanlines.reserve((rowSize + 1) * height);
+    for (int y = 0; y < height; y++)
+    {
+        scanlines.push_back(0);
+        scanlines.insert(scanlines.end(), pixels + y * rowSize, pixels + (y + 1) * rowSize);
+    }
+
+    // zlib stream: header, stored deflate blocks, adler32 of the uncompressed data
+    std::vector<unsigned char> idat;
+    idat.reserve(scanlines.size() + scanlines.size() / PNG_STORED_BLOCK_SIZE * 5 + 16);
+    idat.push_back(0x78);
+    idat.push_back(0x01);
+
+    uint32_t adlerA = 1;
+    uint32_t adlerB = 0;
+    size_t offset = 0;
+    do
+    {
+        size_t blockSize = scanlines.size() - offset < PNG_STORED_BLOCK_SIZE ? scanlines.size() - offset : PNG_STORED_BLOCK_SIZE;
+        bool last = offset + blockSize == scanlines.size();
+        idat.push_back(last ? 1 : 0);
+        idat.push_back(blockSize & 0xFF);
+        idat.push_back(blockSize >> 8);
+        idat.push_back(~blockSize & 0xFF);
+        idat.push_back((~blockSize >> 8) & 0xFF);
+        idat.insert(idat.end(), scanlines.begin() + offset, scanlines.begin() + offset + blockSize);
+
+        for (size_t i = offset; i < offset + blockSize; i++)
+        {
+            adlerA = (adlerA + scanlines[i]) % 65521;
+            adlerB = (adlerB + adlerA) % 65521;
+        }
+        offset += blockSize;
+    } while (offset < scanlines.size());
+    PushBE32(idat, (adlerB << 16) | adlerA);
+
+    std::vector<unsigned char> ihdr;
+    PushBE32(ihdr, width);
+    PushBE32(ihdr, height);
+    ihdr.push_back(8);                      // bit depth
+    ihdr.push_back(channels == 4 ? 6 : 2);  // color type, RGBA or RGB
+    ihdr.push_back(0);                      // compression
+    ihdr.push_back(0);                      // filter
+    ihdr.push_back(0);                      // interlace
+
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    bool written = fwrite(signature, 1, sizeof(signature), file) == sizeof(signature) &&
+        WriteChunk(file, "IHDR", ihdr) &&
+        WriteChunk(file, "IDAT", idat) &&
+        WriteChunk(file, "IEND", std::vector<unsigned char>());
+    written &= fclose(file) == 0;
+
+    return written;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Minimal PNG encoder for frame captures. Pixels are 8 bits per channel, rows top to bottom,
+// channels is 3 (RGB) or 4 (RGBA). Image data is written as stored deflate blocks, so files are
+// large but writing is fast and needs no zlib.
+bool WritePng(const char* path, int width, int height, int channels, const unsigned char* pixels);
@@ -2,10 +2,20 @@
 
 #include "random.h"
 
-float RandomFloat()
+std::default_random_engine& RandomEngine()
 {
     static std::random_device rd;
     static std::default_random_engine eng(rd());
-    static std::uniform_real_distribution<> distr(0.f, 1.f);
-    return distr(eng);
+    return eng;
+}
+
+void SeedRandom(unsigned int seed)
+{
+    RandomEngine().seed(seed);
+}
+
+float RandomFloat()
+{
+    std::uniform_real_distribution<> distr(0.f, 1.f);
+    return distr(RandomEngine());
 }
@@ -1,3 +1,9 @@
 #pragma once
 
+#include <random>
+
 float RandomFloat();
+
+// Reseeds the shared engine, everything drawing from it becomes reproducible (e.g. headless runs)
+void SeedRandom(unsigned int seed);
+std::default_random_engine& RandomEngine();
@@ -1,10 +1,16 @@
 #include "render_pipeline.h"
 
+#include <algorithm>
 #include <unordered_map>
 
 #include "log.h"
+#include "depth_pyramid.h"
+#include "gl_state_cache.h"
 #include "hash.h"
+#include "frustum_cull.h"
 #include "scene.h"
+#include "texture_residency.h"
+#include "trace.h"
 
 GLenum ToGLInternalFormat(AttachmentFormat format)
 {
@@ -79,6 +85,7 @@ GLenum ToGLType(AttachmentFormat format)
 }
 
 int RenderpassAttachment::bufferCount = 0;
+unsigned int RenderPipeline::outputFramebuffer = 0;
 /*static*/ RenderpassAttachment RenderpassAttachment::SSBO(const char* name, long size)
 {
     RenderpassAttachment attachment(name, AttachmentFormat::SSBO);
@@ -103,41 +110,37 @@ void PassSettings::Clear()
     if (ignoreClear)
         return;
 
-    glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.a);
+    GLStateCache::Get().ClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.a);
     glClear(clear);
 }
 
 void PassSettings::Apply()
 {
+    GLStateCache& state = GLStateCache::Get();
+    // Even settings that are not applied drop the caps they don't list
     if (ignoreApplication)
+    {
+        state.DisableCapsExcept(enable);
         return;
+    }
 
-    for (int j = 0; j < enable.size(); j++)
-        glEnable(enable[j]);
-    glCullFace(cullFace);
-    glDepthMask(depthMask);
-    glDepthFunc(depthFunc);
-    glBlendEquation(blendEquation);
-    glBlendFunc(srcBlendFactor, dstBlendFactor);
+    state.SetEnabledCaps(enable);
+    state.CullFace(cullFace);
+    state.DepthMask(depthMask);
+    state.DepthFunc(depthFunc);
+    state.BlendEquation(blendEquation);
+    state.BlendFunc(srcBlendFactor, dstBlendFactor);
     for (int i = 0; i < blendFactors.size(); i++)
     {
-        glBlendFunci(i, blendFactors[i].srcFactor, blendFactors[i].dstFactor);
+        state.BlendFunci(i, blendFactors[i].srcFactor, blendFactors[i].dstFactor);
     }
     if (blendFuncSeparate.use)
     {
-        glBlendFuncSeparate(blendFuncSeparate.srcRGB, blendFuncSeparate.dstRGB, blendFuncSeparate.srcAlpha, blendFuncSeparate.dstAlpha);
+        state.BlendFuncSeparate(blendFuncSeparate.srcRGB, blendFuncSeparate.dstRGB, blendFuncSeparate.srcAlpha, blendFuncSeparate.dstAlpha);
     }
     // missing color masking
 }
 
-void PassSettings::Apply(PassSettings& previousSettings)
-{
-    if (ignoreApplication || memcmp(&previousSettings, this, sizeof(PassSettings)) == 0)
-    {
-        return;
-    }
-}
-
 /*static*/ PassSettings PassSettings::DefaultSettings()
 {
     PassSettings settings;
@@ -184,10 +187,11 @@ void PassSettings::Apply(PassSettings& previousSettings)
 // -------------------------------------------------------------------------------------------------
 
 static unsigned int clearBuffer;
-RenderPipeline::RenderPipeline()
+RenderPipeline::RenderPipeline() : drawCommandCount(0), culledMeshCount(0), cullingPass(nullptr), cullObjectCount(0),
+    meshletCulling(true), meshletCullItemCount(0), depthPyramid(nullptr), depthPyramidSubpass(nullptr), occlusionCulling(true),
+    depthPrepassSubpass(nullptr), depthPrepassGeometrySubpass(nullptr), depthPrepass(true), lodErrorPixels(1.f)
 {
-    glGenBuffers(1, &materialUbo);
-    glGenQueries(1, &timeQuery);
+    std::fill(lodMeshCounts, lodMeshCounts + MESH_MAX_LODS, 0);
 
     // TEMP
     std::vector<GLuint> headClear(1920 * 1080, 0xffffffff);
@@ -229,6 +233,108 @@ Renderpass& RenderPipeline::AddOutputPass(ShaderPool& shaders)
     return outputPass;
 }
 
+#define CULLING_WORK_GROUP_SIZE 64
+// Smaller tags are cheaper to cull on the CPU in one flat FrustumCull than to keep a BVH for
+#define CPU_CULLING_BVH_MIN_MESHES 64
+#define FRUSTUM_CULLING_SUBPASS "Frustum culling subpass"
+#define DRAW_COMPACTION_SUBPASS "Draw compaction subpass"
+#define MESHLET_CULLING_SUBPASS "Meshlet culling subpass"
+#define DEPTH_PYRAMID_SUBPASS "Depth pyramid subpass"
+Renderpass& RenderPipeline::AddCullingPass(ShaderPool& shaders)
+{
+    ASSERT(passes.empty());
+
+    // Compute only, nothing to attach, apply or clear
+    Renderpass& pass = AddPass("GPU culling pass", PassSettings::DefaultSubpassSettings());
+    pass.fbo = 0;
+    pass.AddDefine("CULLING_WORK_GROUP_SIZE", CULLING_WORK_GROUP_SIZE);
+
+    // One invocation per CullObject, work group counts are set by BuildDrawCommands
+    Shader& frustumCullingShader = shaders.GetShader(ShaderDescriptor(
+        {
+            ShaderDescriptor::File(SHADER_PATH "frustum_culling.comp", ShaderDescriptor::COMPUTE_SHADER),
+        }, pass.DefineValues()));
+    pass.AddSubpass(FRUSTUM_CULLING_SUBPASS, &frustumCullingShader, COMPUTE, {});
+
+    // One invocation per CullCandidate, moves the ones with surviving instances into their group's DrawCommands
+    Shader& drawCompactionShader = shaders.GetShader(ShaderDescriptor(
+        {
+            ShaderDescriptor::File(SHADER_PATH "draw_compaction.comp", ShaderDescriptor::COMPUTE_SHADER),
+        }, pass.DefineValues()));
+    pass.AddSubpass(DRAW_COMPACTION_SUBPASS, &drawCompactionShader, COMPUTE, {});
+
+    // One invocation per meshlet of the objects split into meshlets, appends the visible ones after the compacted
+    // commands
+    Shader& meshletCullingShader = shaders.GetShader(ShaderDescriptor(
+        {
+            ShaderDescriptor::File(SHADER_PATH "meshlet_culling.comp", ShaderDescriptor::COMPUTE_SHADER),
+        }, pass.DefineValues()));
+    pass.AddSubpass(MESHLET_CULLING_SUBPASS, &meshletCullingShader, COMPUTE, {});
+
+    cullingPass = &pass;
+    return pass;
+}
+
+RenderpassAttachment& RenderPipeline::AddDepthPyramidSubpass(Renderpass& pass, ShaderPool& shaders, RenderpassAttachment& depth,
+        RenderpassAttachment& minDepth)
+{
+    ASSERT(depthPyramid == nullptr);
+
+    // TODO: fix hardcoded resolution, same as the attachments
+    depthPyramid = new DepthPyramid(glm::ivec2(1920, 1080));
+    pass.AddDefine("DEPTH_PYRAMID_WORK_GROUP_SIZE", DEPTH_PYRAMID_WORK_GROUP_SIZE);
+    Shader& depthPyramidShader = shaders.GetShader(ShaderDescriptor(
+        {
+            ShaderDescriptor::File(SHADER_PATH "depth_pyramid.comp", ShaderDescriptor::COMPUTE_SHADER),
+        }, pass.DefineValues()));
+    // Dispatched level by level by DepthPyramid::Build rather than with computeWorkGroups
+    depthPyramidSubpass = &pass.AddSubpass(DEPTH_PYRAMID_SUBPASS, &depthPyramidShader, COMPUTE,
+        {
+            SubpassAttachment(&depth,    SubpassAttachment::AS_TEXTURE, "tex_depth"),
+            SubpassAttachment(&minDepth, SubpassAttachment::AS_TEXTURE, "tex_proxy_depth"),
+        });
+
+    return depthPyramid->attachment;
+}
+
+#define DEPTH_PREPASS_SUBPASS "Depth prepass subpass"
+Subpass& RenderPipeline::AddDepthPrepassSubpass(Renderpass& pass, Subpass& geometrySubpass, ShaderPool& shaders)
+{
+    ASSERT(depthPrepassSubpass == nullptr);
+
+    std::vector<SubpassAttachment> attachments;
+    for (SubpassAttachment& attachment : geometrySubpass.attachments)
+    {
+        if (attachment.type == SubpassAttachment::AS_DEPTH)
+        {
+            attachments.push_back(attachment);
+        }
+    }
+    ASSERT(attachments.size() == 1);
+
+    Shader& depthPrepassShader = shaders.GetShader(ShaderDescriptor(
+        {
+            ShaderDescriptor::File(SHADER_PATH "depth_prepass.vert", ShaderDescriptor::VERTEX_SHADER),
+            ShaderDescriptor::File(SHADER_PATH "empty.frag", ShaderDescriptor::FRAGMENT_SHADER)
+        }, pass.DefineValues()));
+    int index = std::find(pass.subpasses.begin(), pass.subpasses.end(), &geometrySubpass) - pass.subpasses.begin();
+    ASSERT(index < pass.subpasses.size());
+    // No color attachments, nothing but depth is written. Applied, so that the geometry subpass' GL_EQUAL doesn't
+    // carry over.
+    PassSettings prepassSettings = PassSettings::DefaultSubpassSettings();
+    prepassSettings.ignoreApplication = false;
+    depthPrepassSubpass = &pass.InsertSubpass(index, DEPTH_PREPASS_SUBPASS, &depthPrepassShader, geometrySubpass.acceptedMeshTags,
+            attachments, prepassSettings);
+    depthPrepassSubpass->lodBias = geometrySubpass.lodBias;
+
+    // Depth test and writes are switched by Render, never clears the prepass' depth
+    geometrySubpass.settings.ignoreApplication = false;
+    geometrySubpass.settings.ignoreClear = true;
+    depthPrepassGeometrySubpass = &geometrySubpass;
+
+    return *depthPrepassSubpass;
+}
+
 bool ConfigureRenderpassAttachments(Renderpass& pass, bool validateFramebuffer)
 {
     if (pass.fbo == 0)
@@ -492,9 +598,486 @@ std::vector<ShaderDescriptor::Define> Renderpass::DefineValues(std::vector<Shade
     return existingDefines;
 }
 
+// Order independent, unordered_map iteration order differs between maps with the same contents
+// "CullObjects" in frustum_culling.comp
+struct CullObject
+{
+    glm::mat4 model;
+    glm::vec4 aabbMin;
+    glm::vec4 aabbMax;
+    // x - material table index, y - CullCandidate, z - TextureResidency slot, w - frustum only CullCandidate or
+    // NO_CULL_CANDIDATE
+    glm::uvec4 materialAndCandidate;
+    // GeometryArena::Allocation's, the instance's model matrix is model * dequantization
+    glm::vec4 positionOffset;
+    glm::vec4 positionScale;
+};
+
+#define NO_CULL_CANDIDATE 0xFFFFFFFFu
+
+// "CullCandidates" in frustum_culling.comp and draw_compaction.comp. The command's instanceCount is counted up by
+// the culling, its baseInstance reserves room for all of the candidate's objects.
+struct CullCandidate
+{
+    GeometryArena::DrawElementsIndirectCommand command;
+    GLuint drawCountIndex;
+    GLuint firstDrawCommand;
+    // Candidate whose instanceCount the command takes, itself unless it draws another one's instances with a
+    // different LOD
+    GLuint instanceCountCandidate;
+};
+
+// Coarsest LOD whose error, scaled by the model matrix, projects to at most maxErrorPixels on the main camera's
+// screen. Distance is to the nearest point of the world bounds, so meshes around the camera stay at full detail.
+static int SelectLod(const Mesh& mesh, const glm::mat4& model, Scene& scene, float maxErrorPixels)
+{
+    const AABB& bounds = mesh.WorldBounds();
+    glm::vec3 cameraPos = scene.camera.transform.pos;
+    float distance = glm::length(glm::max(glm::max(bounds.min - cameraPos, cameraPos - bounds.max), glm::vec3(0.f)));
+    if (mesh.lods.size() == 1 || distance <= 0.f)
+    {
+        return 0;
+    }
+
+    float scale = glm::max(glm::length(glm::vec3(model[0])), glm::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+    float pixelsPerUnit = scene.sceneParams.viewportHeight * 0.5f * scene.camera.projection[1][1] / distance;
+    int lod = 0;
+    while (lod + 1 < mesh.lods.size() && mesh.lods[lod + 1].error * scale * pixelsPerUnit <= maxErrorPixels)
+    {
+        lod++;
+    }
+    return lod;
+}
+
+std::vector<RenderPipeline::DrawGroup>& RenderPipeline::DrawGroupsFor(MeshTag meshTag, int lodBias)
+{
+    lodBias = std::min(lodBias, MESH_MAX_LODS - 1);
+    if (lodBias > 0)
+    {
+        std::unordered_map<MeshTag, std::vector<DrawGroup>>::iterator biasedGroups = lodBiasedDrawGroups[lodBias].find(meshTag);
+        if (biasedGroups != lodBiasedDrawGroups[lodBias].end() && !biasedGroups->second.empty())
+        {
+            return biasedGroups->second;
+        }
+    }
+    return drawGroups[meshTag];
+}
+
+void RenderPipeline::BuildDrawCommands(Scene& scene)
+{
+    // Visible meshes, or for GPU culled tags the ones that still have to be culled
+    struct VisibleMesh
+    {
+        MeshWithMaterial* meshWithMaterial;
+        glm::mat4 model;
+        int batch;
+        // TextureResidency slot, for residentTextureTags
+        unsigned int textureSet;
+    };
+    // Visible meshes with the same geometry, LOD and textures (unless resident), a single instanced command
+    struct Batch
+    {
+        Mesh* mesh;
+        int lod;
+        int group;
+        int instanceCount;
+        // Into commands, or into candidates if GPU culled
+        int command;
+        // Drawn meshlet by meshlet, the candidate only counts the instances
+        bool meshlets;
+        // GPU culled LOD biased candidate that counts the batch's instances inside the frustum, occluded or not
+        int frustumCandidate;
+    };
+    static std::vector<VisibleMesh> visibleMeshes;
+    static std::vector<Batch> batches;
+    static std::vector<MeshInstance> instanceData;
+    static std::vector<GeometryArena::DrawElementsIndirectCommand> commands;
+    static std::vector<GLuint> drawCountData;
+    static std::vector<CullObject> cullObjectData;
+    static std::vector<CullCandidate> candidates;
+    static std::vector<glm::uvec2> meshletCullItemData;
+    // Lookups within the current tag
+    static std::unordered_map<unsigned long, std::vector<int>> groupsByTextures;
+    static std::unordered_map<long, std::vector<int>> batchesByGeometry;
+    static std::vector<float> groupCameraDistances;
+    // Commands the meshlets of a group's instances may add
+    static std::vector<int> groupMeshletCommands;
+    // CPU culling of the current tag
+    static std::vector<int> meshIndices;
+    static BoundsSoA bounds;
+    static std::vector<uint8_t> visible;
+    FrustumPlanes frustum(scene.camera.projection * scene.camera.View());
+    // Texture sets of all tags, their index is the render key's texture set. 0 is left to residentTextureTags, they
+    // bind no textures.
+    static std::unordered_map<unsigned long, std::vector<std::pair<Mesh*, int>>> textureSetsByHash;
+    int textureSetCount = 1;
+    textureSetsByHash.clear();
+    instanceData.clear();
+    commands.clear();
+    drawCountData.clear();
+    cullObjectData.clear();
+    candidates.clear();
+    meshletCullItemData.clear();
+    culledMeshCount = 0;
+    std::fill(lodMeshCounts, lodMeshCounts + MESH_MAX_LODS, 0);
+
+    // LOD biases some subpass draws with
+    bool lodBiasUsed[MESH_MAX_LODS] = {};
+    for (Renderpass* pass : passes)
+    {
+        for (Subpass* subpass : pass->subpasses)
+        {
+            lodBiasUsed[std::min(subpass->lodBias, MESH_MAX_LODS - 1)] = true;
+        }
+    }
+
+    for (auto& tagMeshes : scene.meshes)
+    {
+        MeshTag meshTag = tagMeshes.first;
+        // Transparent draw order matters and atomics don't keep it, the screen quad is never culled
+        bool gpuCulled = cullingPass != nullptr && meshTag != TRANSPARENT && meshTag != SCREEN_QUAD;
+        bool residentTextures = (meshTag & residentTextureTags) != 0;
+        bool meshletCulled = gpuCulled && meshletCulling;
+        std::vector<DrawGroup>& groups = drawGroups[meshTag];
+        groups.clear();
+        batches.clear();
+        visibleMeshes.clear();
+        groupsByTextures.clear();
+        batchesByGeometry.clear();
+        groupCameraDistances.clear();
+        groupMeshletCommands.clear();
+        bool hasLods = false;
+        bool hasMeshlets = false;
+
+        // Meshes left after CPU culling, in submission order
+        std::vector<MeshWithMaterial>& meshes = tagMeshes.second;
+        bool cpuCulled = !gpuCulled && meshTag != SCREEN_QUAD;
+        meshIndices.clear();
+        if (!cpuCulled)
+        {
+            for (int i = 0; i < meshes.size(); i++)
+            {
+                meshIndices.push_back(i);
+            }
+        }
+        else if (meshes.size() >= CPU_CULLING_BVH_MIN_MESHES)
+        {
+            scene.QueryMeshes(meshTag, frustum, meshIndices);
+            std::sort(meshIndices.begin(), meshIndices.end());
+        }
+        else
+        {
+            bounds.Clear();
+            for (MeshWithMaterial& meshWithMaterial : meshes)
+            {
+                const AABB& worldBounds = meshWithMaterial.mesh.WorldBounds();
+                bounds.Add((worldBounds.min + worldBounds.max) * 0.5f, (worldBounds.max - worldBounds.min) * 0.5f);
+            }
+            visible.resize(meshes.size());
+            FrustumCull(frustum, bounds, visible.data());
+            for (int i = 0; i < meshes.size(); i++)
+            {
+                if (visible[i])
+                {
+                    meshIndices.push_back(i);
+                }
+            }
+        }
+        culledMeshCount += meshes.size() - meshIndices.size();
+
+        for (int meshIndex : meshIndices)
+        {
+            MeshWithMaterial& meshWithMaterial = meshes[meshIndex];
+            Mesh& mesh = meshWithMaterial.mesh;
+            if (mesh.meshTag == PARTICLE && !scene.renderParticles)
+            {
+                continue;
+            }
+
+            glm::mat4 model = mesh.Model();
+            int lod = SelectLod(mesh, model, scene, lodErrorPixels);
+            lodMeshCounts[lod]++;
+            hasLods |= mesh.lods.size() > 1;
+            // Meshlets only split up LOD 0, which is what the geometry key tells apart from the other LODs
+            bool meshlets = meshletCulled && lod == 0 && mesh.meshletCount > 0;
+            hasMeshlets |= meshlets;
+            // LOD index ranges never overlap, their offset tells geometries and their LODs apart
+            long geometryKey = mesh.LodGeometry(lod).IndexByteOffset();
+            GLenum indexType = mesh.geometry.indexType;
+
+            int group = -1;
+            int batch = -1;
+            unsigned long texturesHash = 0;
+            if (residentTextures)
+            {
+                // Textures come with the instance, only the geometry and its index type split up draws
+                for (int candidate = 0; candidate < groups.size(); candidate++)
+                {
+                    if (groups[candidate].indexType == indexType)
+                    {
+                        group = candidate;
+                        break;
+                    }
+                }
+                std::vector<int>& sameGeometry = batchesByGeometry[geometryKey];
+                batch = sameGeometry.empty() ? -1 : sameGeometry[0];
+            }
+            else if (meshTag == TRANSPARENT)
+            {
+                // Can be sorted back to front, only consecutive meshes may share a draw
+                if (!batches.empty() && batches.back().mesh->textures == mesh.textures && groups[batches.back().group].indexType == indexType)
+                {
+                    group = batches.back().group;
+                    if (batches.back().mesh->LodGeometry(batches.back().lod).IndexByteOffset() == geometryKey)
+                    {
+                        batch = batches.size() - 1;
+                    }
+                }
+            }
+            else
+            {
+                texturesHash = TexturesHash(mesh.textures);
+                for (int candidate : groupsByTextures[texturesHash])
+                {
+                    if (groups[candidate].mesh->textures == mesh.textures && groups[candidate].indexType == indexType)
+                    {
+                        group = candidate;
+                        break;
+                    }
+                }
+                for (int candidate : batchesByGeometry[geometryKey])
+                {
+                    if (group != -1 && batches[candidate].group == group)
+                    {
+                        batch = candidate;
+                        break;
+                    }
+                }
+            }
+
+            float cameraDistance = glm::length(glm::vec3(model[3]) - scene.camera.transform.pos);
+            if (group == -1)
+            {
+                group = groups.size();
+                groups.push_back({ &mesh, 0, 0, 0, 0, indexType });
+                groupsByTextures[texturesHash].push_back(group);
+                groupCameraDistances.push_back(cameraDistance);
+                groupMeshletCommands.push_back(0);
+            }
+            groupCameraDistances[group] = std::min(groupCameraDistances[group], cameraDistance);
+            if (batch == -1)
+            {
+                batch = batches.size();
+                batches.push_back({ &mesh, lod, group, 0, -1, meshlets, -1 });
+                batchesByGeometry[geometryKey].push_back(batch);
+                groups[group].commandCount++;
+            }
+            batches[batch].instanceCount++;
+            groupMeshletCommands[group] += meshlets ? mesh.meshletCount : 0;
+            visibleMeshes.push_back({ &meshWithMaterial, model, batch, residentTextures ? mesh.ResidentTextureSet() : 0 });
+        }
+
+        for (int i = 0; i < groups.size(); i++)
+        {
+            if (meshTag == TRANSPARENT)
+            {
+                groups[i].renderKey = MakeOrderedRenderKey(i);
+                continue;
+            }
+            if (residentTextures)
+            {
+                groups[i].renderKey = MakeRenderKey(0, 0, groupCameraDistances[i]);
+                continue;
+            }
+
+            int textureSet = -1;
+            std::vector<std::pair<Mesh*, int>>& sameHash = textureSetsByHash[TexturesHash(groups[i].mesh->textures)];
+            for (std::pair<Mesh*, int>& candidate : sameHash)
+            {
+                if (candidate.first->textures == groups[i].mesh->textures)
+                {
+                    textureSet = candidate.second;
+                    break;
+                }
+            }
+            if (textureSet == -1)
+            {
+                textureSet = textureSetCount++;
+                sameHash.push_back({ groups[i].mesh, textureSet });
+            }
+            // All geometry is in the GeometryArena's vertex array
+            groups[i].renderKey = MakeRenderKey(textureSet, 0, groupCameraDistances[i]);
+        }
+
+        // Commands of a group and instances of a command have to be contiguous
+        for (int i = 0; i < groups.size(); i++)
+        {
+            DrawGroup& group = groups[i];
+            group.firstCommand = commands.size();
+            group.drawCountIndex = drawCountData.size();
+            drawCountData.push_back(gpuCulled ? 0 : group.commandCount);
+            commands.resize(commands.size() + group.commandCount + groupMeshletCommands[i]);
+            group.commandCount = 0;
+        }
+        for (Batch& batch : batches)
+        {
+            DrawGroup& group = groups[batch.group];
+            GeometryArena::DrawElementsIndirectCommand command = GeometryArena::Command(batch.mesh->LodGeometry(batch.lod), 0,
+                    instanceData.size());
+            instanceData.resize(instanceData.size() + batch.instanceCount);
+            if (gpuCulled)
+            {
+                batch.command = candidates.size();
+                // No index count, draw compaction leaves it to the meshlet culling
+                command.count = batch.meshlets ? 0 : command.count;
+                candidates.push_back({ command, (GLuint) group.drawCountIndex, (GLuint) group.firstCommand, (GLuint) batch.command });
+                group.commandCount++;
+            }
+            else
+            {
+                batch.command = group.firstCommand + group.commandCount++;
+                commands[batch.command] = command;
+            }
+        }
+        for (int i = 0; i < groups.size(); i++)
+        {
+            groups[i].commandCount += groupMeshletCommands[i];
+        }
+        int firstCullObject = cullObjectData.size();
+        for (VisibleMesh& visibleMesh : visibleMeshes)
+        {
+            unsigned int material = visibleMesh.meshWithMaterial->material->nonResourceData.tableIndex;
+            if (gpuCulled)
+            {
+                AABB& aabb = visibleMesh.meshWithMaterial->mesh.aabbModelSpace;
+                GeometryArena::Allocation& geometry = visibleMesh.meshWithMaterial->mesh.geometry;
+                if (batches[visibleMesh.batch].meshlets)
+                {
+                    Mesh& mesh = visibleMesh.meshWithMaterial->mesh;
+                    for (int meshlet = mesh.firstMeshlet; meshlet < mesh.firstMeshlet + mesh.meshletCount; meshlet++)
+                    {
+                        meshletCullItemData.push_back(glm::uvec2(cullObjectData.size(), meshlet));
+                    }
+                }
+                cullObjectData.push_back({ visibleMesh.model, glm::vec4(aabb.min, 1.f), glm::vec4(aabb.max, 1.f),
+                        glm::uvec4(material, batches[visibleMesh.batch].command, visibleMesh.textureSet, NO_CULL_CANDIDATE),
+                        glm::vec4(geometry.positionOffset, 0.f), glm::vec4(geometry.positionScale, 0.f) });
+                continue;
+            }
+
+            GeometryArena::DrawElementsIndirectCommand& command = commands[batches[visibleMesh.batch].command];
+            MeshInstance& instance = instanceData[command.baseInstance + command.instanceCount++];
+            // Positions are quantized, the normal matrix is still the model's own
+            instance.model = visibleMesh.model * visibleMesh.meshWithMaterial->mesh.geometry.PositionDequantization();
+            instance.normalMatrix = visibleMesh.meshWithMaterial->mesh.NormalMatrix();
+            instance.material = glm::uvec4(material, visibleMesh.textureSet, 0, 0);
+        }
+
+        // Biased groups share the instances, only their commands' index ranges differ. GPU culled ones draw shadow maps
+        // and proxies, which need what the camera can't see too, so their instances skip the occlusion test. Those are
+        // counted by the first biased candidate of each batch, into instances of their own.
+        for (int lodBias = 1; lodBias < MESH_MAX_LODS; lodBias++)
+        {
+            std::vector<DrawGroup>& biasedGroups = lodBiasedDrawGroups[lodBias][meshTag];
+            biasedGroups.clear();
+            // Without LODs the biased groups still draw the meshlet split meshes whole
+            if (!lodBiasUsed[lodBias] || !(hasLods || hasMeshlets))
+            {
+                continue;
+            }
+
+            biasedGroups = groups;
+            for (int i = 0; i < biasedGroups.size(); i++)
+            {
+                DrawGroup& group = biasedGroups[i];
+                group.commandCount -= groupMeshletCommands[i];
+                group.firstCommand = commands.size();
+                group.drawCountIndex = drawCountData.size();
+                drawCountData.push_back(gpuCulled ? 0 : group.commandCount);
+                commands.resize(commands.size() + group.commandCount);
+            }
+            for (Batch& batch : batches)
+            {
+                GeometryArena::Allocation geometry = batch.mesh->LodGeometry(std::min(batch.lod + lodBias, (int) batch.mesh->lods.size() - 1));
+                DrawGroup& biasedGroup = biasedGroups[batch.group];
+                if (gpuCulled)
+                {
+                    CullCandidate candidate = candidates[batch.command];
+                    candidate.command.count = geometry.indexCount;
+                    candidate.command.firstIndex = geometry.firstIndex;
+                    candidate.drawCountIndex = biasedGroup.drawCountIndex;
+                    candidate.firstDrawCommand = biasedGroup.firstCommand;
+                    if (batch.frustumCandidate == -1)
+                    {
+                        batch.frustumCandidate = candidates.size();
+                        candidate.command.baseInstance = instanceData.size();
+                        instanceData.resize(instanceData.size() + batch.instanceCount);
+                    }
+                    else
+                    {
+                        candidate.command.baseInstance = candidates[batch.frustumCandidate].command.baseInstance;
+                    }
+                    candidate.instanceCountCandidate = batch.frustumCandidate;
+                    candidates.push_back(candidate);
+                }
+                else
+                {
+                    GeometryArena::DrawElementsIndirectCommand command = commands[batch.command];
+                    command.count = geometry.indexCount;
+                    command.firstIndex = geometry.firstIndex;
+                    commands[biasedGroup.firstCommand + batch.command - groups[batch.group].firstCommand] = command;
+                }
+            }
+        }
+        if (gpuCulled)
+        {
+            for (int i = 0; i < visibleMeshes.size(); i++)
+            {
+                int frustumCandidate = batches[visibleMeshes[i].batch].frustumCandidate;
+                cullObjectData[firstCullObject + i].materialAndCandidate.w = frustumCandidate == -1 ? NO_CULL_CANDIDATE : frustumCandidate;
+            }
+        }
+    }
+    drawCommandCount = commands.size();
+    cullObjectCount = cullObjectData.size();
+    meshletCullItemCount = meshletCullItemData.size();
+
+    FrameRingBuffer& ringBuffer = FrameRingBuffer::Get();
+    if (cullingPass != nullptr)
+    {
+        for (Subpass* subpass : cullingPass->subpasses)
+        {
+            int invocationCount = candidates.size();
+            if (strcmp(subpass->name, FRUSTUM_CULLING_SUBPASS) == 0)
+            {
+                invocationCount = cullObjectData.size();
+            }
+            else if (strcmp(subpass->name, MESHLET_CULLING_SUBPASS) == 0)
+            {
+                invocationCount = meshletCullItemData.size();
+            }
+            subpass->settings.computeWorkGroups = glm::ivec3((invocationCount + CULLING_WORK_GROUP_SIZE - 1) / CULLING_WORK_GROUP_SIZE, 1, 1);
+        }
+
+        cullObjects = ringBuffer.Upload(cullObjectData.data(), cullObjectData.size() * sizeof(CullObject));
+        cullCandidates = ringBuffer.Upload(candidates.data(), candidates.size() * sizeof(CullCandidate));
+        meshletCullItems = ringBuffer.Upload(meshletCullItemData.data(), meshletCullItemData.size() * sizeof(glm::uvec2));
+        // Filled in by the frustum culling subpass
+        cullObjectInstances = ringBuffer.Allocate(cullObjectData.size() * sizeof(GLuint));
+    }
+
+    instances = ringBuffer.Upload(instanceData.data(), instanceData.size() * sizeof(MeshInstance));
+    drawCommands = ringBuffer.Upload(commands.data(), commands.size() * sizeof(GeometryArena::DrawElementsIndirectCommand));
+    drawCounts = ringBuffer.Upload(drawCountData.data(), drawCountData.size() * sizeof(GLuint));
+}
+
 void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
 {
-    // TODO: don't really need to do every frame
+    GLStateCache& state = GLStateCache::Get();
+    state.BeginFrame();
+    FrameRingBuffer& ringBuffer = FrameRingBuffer::Get();
+    ringBuffer.BeginFrame();
+
     scene.BindSceneParams();
     // TODO: support for multiple cameras
     scene.BindCameraParams();
@@ -504,13 +1087,31 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
     glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Scene::Lights), &scene.lights, GL_DYNAMIC_DRAW);
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-    glBindBufferBase(GL_UNIFORM_BUFFER, Shader::modelParamBindingPoint, materialUbo);
-
+    long long pipelineCpuBeginUs = TraceTimeUs();
     float pipelineCpuDurationMs = 0.f;
-    float pipelineGpuDurationMs = 0.f;
-    int totalCulled = 0;
+    gpuTimer.BeginFrame();
+    int pipelineGpuBegin = gpuTimer.Timestamp();
+
+    MaterialTable::Upload();
+    BuildDrawCommands(scene);
+    // After BuildDrawCommands, which registers the texture sets of new meshes
+    TextureResidency::Get().Update();
+    state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, Shader::materialTableBindingPoint, MaterialTable::ssbo);
+    FrameRingBuffer::BindRange(GL_SHADER_STORAGE_BUFFER, Shader::instanceDataBindingPoint, instances);
+    if (cullingPass != nullptr)
+    {
+        FrameRingBuffer::BindRange(GL_SHADER_STORAGE_BUFFER, Shader::cullObjectsBindingPoint, cullObjects);
+        FrameRingBuffer::BindRange(GL_SHADER_STORAGE_BUFFER, Shader::cullCandidatesBindingPoint, cullCandidates);
+        FrameRingBuffer::BindRange(GL_SHADER_STORAGE_BUFFER, Shader::meshletCullItemsBindingPoint, meshletCullItems);
+        FrameRingBuffer::BindRange(GL_SHADER_STORAGE_BUFFER, Shader::cullObjectInstancesBindingPoint, cullObjectInstances);
+        state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, Shader::meshletsBindingPoint, GeometryArena::Get().meshletBuffer);
+    }
+    FrameRingBuffer::BindRange(GL_SHADER_STORAGE_BUFFER, Shader::drawCommandsBindingPoint, drawCommands);
+    FrameRingBuffer::BindRange(GL_SHADER_STORAGE_BUFFER, Shader::drawCountsBindingPoint, drawCounts);
+    // Left bound for the subpasses' draws, unbound at the end
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, drawCommands.buffer);
+    glBindBuffer(GL_PARAMETER_BUFFER, drawCounts.buffer);
 
-    static PassSettings previousSettings = PassSettings::DefaultSettings();
     for (int i = 0; i < passes.size(); i++)
     {
         int activatedTextureCount = 0;
@@ -518,36 +1119,18 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
         ASSERT(passes[i] != nullptr);
         Renderpass& renderpass = *passes[i];
 
+        long long renderpassCpuBeginUs = TraceTimeUs();
         float renderpassCpuDurationMs = 0.f;
-        float renderpassGpuDurationMs = 0.f;
-
-        glBindFramebuffer(GL_FRAMEBUFFER, renderpass.fbo);
+        int renderpassGpuBegin = gpuTimer.Timestamp();
 
-        // TODO: srsly?
-        for (int j = 0; j < previousSettings.enable.size(); j++)
-        {
-            bool disable = true;
-            for (int k = 0; k < renderpass.settings.enable.size(); k++)
-            {
-                if (previousSettings.enable[j] == renderpass.settings.enable[k])
-                {
-                    disable = false;
-                    break;
-                }
-            }
+        state.BindFramebuffer(renderpass.fbo == 0 ? outputFramebuffer : renderpass.fbo);
 
-            if (disable)
-            {
-                glDisable(previousSettings.enable[j]);
-            }
-        }
         if (renderpass.fbo != 0)
         {
-            glDrawBuffers(renderpass.allColorAttachmentIndices.size(), renderpass.allColorAttachmentIndices.data());
+            state.DrawBuffers(renderpass.allColorAttachmentIndices.size(), renderpass.allColorAttachmentIndices.data());
         }
         renderpass.settings.Apply();
         renderpass.settings.Clear();
-        previousSettings = renderpass.settings;
 
         // TODO: this duplicates clears and is generally pretty stupid
         {
@@ -555,15 +1138,15 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
             {
                 if (attachment->hasSeparateClearOpts && attachment->attachmentIndex != INVALID_ATTACHMENT_INDEX)
                 {
-                    glDrawBuffers(1, &attachment->attachmentIndex);
-                    glClearColor(attachment->clearOpts.color.x, attachment->clearOpts.color.y, attachment->clearOpts.color.z,
+                    state.DrawBuffers(1, &attachment->attachmentIndex);
+                    state.ClearColor(attachment->clearOpts.color.x, attachment->clearOpts.color.y, attachment->clearOpts.color.z,
                             attachment->clearOpts.color.w);
                     glClear(GL_COLOR_BUFFER_BIT);
                 }
             }
             if (renderpass.fbo != 0)
             {
-                glDrawBuffers(renderpass.allColorAttachmentIndices.size(), renderpass.allColorAttachmentIndices.data());
+                state.DrawBuffers(renderpass.allColorAttachmentIndices.size(), renderpass.allColorAttachmentIndices.data());
             }
         }
 
@@ -577,6 +1160,16 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
             {
                 continue;
             }
+            if (&subpass == depthPrepassSubpass && !depthPrepass)
+            {
+                continue;
+            }
+            if (&subpass == depthPrepassGeometrySubpass)
+            {
+                // Depth is final after the prepass, only the visible fragments get through
+                subpass.settings.depthFunc = depthPrepass ? GL_EQUAL : GL_LESS;
+                subpass.settings.depthMask = depthPrepass ? GL_FALSE : GL_TRUE;
+            }
 
             // TEMP
             if (strcmp(subpass.name, "Composition-lighting subpass") == 0 || strcmp(subpass.name, "sorting subpass") == 0)
@@ -584,8 +1177,8 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
                 glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
             }
 
-            clock_t subpassStartTime = clock();
-            glBeginQuery(GL_TIME_ELAPSED, timeQuery);
+            long long subpassCpuBeginUs = TraceTimeUs();
+            int subpassGpuBegin = gpuTimer.Timestamp();
 
             subpass.shader->Use();
 
@@ -606,9 +1199,8 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
                     case SubpassAttachment::AS_TEXTURE:
                         // TODO: Absolutely idiotic this. Should have a MRU eviction policy cache for texture units
                         // ... maybe MRU is not the best choice? No clue, needs testing
-                        glActiveTexture(GL_TEXTURE0 + activatedTextureCount);
+                        state.BindTexture(activatedTextureCount, GL_TEXTURE_2D, attachmentId);
                         subpass.shader->SetUniform(subpassAttachment.useAs, activatedTextureCount++);
-                        glBindTexture(GL_TEXTURE_2D, attachmentId);
                         break;
                     case SubpassAttachment::AS_IMAGE:
                         // TODO: add ability to make this read/write only
@@ -618,9 +1210,8 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
                         {
                             //LOG_DEBUG("clear", "clearing image");
                             glBindBuffer(GL_PIXEL_UNPACK_BUFFER, clearBuffer);
-                            glBindTexture(GL_TEXTURE_2D, attachmentId);
+                            state.BindTexture(activatedTextureCount, GL_TEXTURE_2D, attachmentId);
                             glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 1920, 1080, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
-                            glBindTexture(GL_TEXTURE_2D, 0);
                             glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
                         }
 
@@ -642,14 +1233,14 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
                                 //LOG_WARN("", "Binding %s to %d in %s", subpassAttachment.renderpassAttachment->name, binding, subpass.name);
                             }
                             //LOG_WARN("", "Binding %s to %d in %s", subpassAttachment.renderpassAttachment->name, binding, subpass.name);
-                            glBindBufferBase(ToGLInternalFormat(subpassAttachment.renderpassAttachment->format), binding, attachmentId);
+                            state.BindBufferBase(ToGLInternalFormat(subpassAttachment.renderpassAttachment->format), binding, attachmentId);
                         }
                         break;
                     case SubpassAttachment::AS_ATOMIC_COUNTER:
                         binding = subpass.shader->GetBinding(subpassAttachment.useAs);
                         if (binding != INVALID_BINDING)
                         {
-                            glBindBufferBase(ToGLInternalFormat(subpassAttachment.renderpassAttachment->format), binding, attachmentId);
+                            state.BindBufferBase(ToGLInternalFormat(subpassAttachment.renderpassAttachment->format), binding, attachmentId);
                         }
 
                         // TEMP clear
@@ -674,46 +1265,42 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
                 }
             }
 
-            // TODO: seriously?
-            for (int k = 0; k < previousSettings.enable.size(); k++)
-            {
-                bool disable = true;
-                for (int l = 0; l < subpass.settings.enable.size(); l++)
-                {
-                    if (previousSettings.enable[k] == subpass.settings.enable[l])
-                    {
-                        disable = false;
-                        break;
-                    }
-                }
-
-                if (disable)
-                {
-                    glDisable(previousSettings.enable[k]);
-                }
-            }
             if (renderpass.fbo != 0)
             {
-                glDrawBuffers(subpass.colorAttachmentsToActivate.size(), subpass.colorAttachmentsToActivate.data());
+                state.DrawBuffers(subpass.colorAttachmentsToActivate.size(), subpass.colorAttachmentsToActivate.data());
             }
             subpass.settings.Apply();
             subpass.settings.Clear();
-            previousSettings = subpass.settings;
             // TODO: this duplicates clears and is generally pretty stupid
             {
                 for (auto& attachment : subpass.attachments)
                 {
                     if (attachment.hasSeparateClearOpts && attachment.renderpassAttachment->attachmentIndex != INVALID_ATTACHMENT_INDEX)
                     {
-                        glDrawBuffers(1, &attachment.renderpassAttachment->attachmentIndex);
-                        glClearColor(attachment.clearOpts.color.x, attachment.clearOpts.color.y, attachment.clearOpts.color.z,
+                        state.DrawBuffers(1, &attachment.renderpassAttachment->attachmentIndex);
+                        state.ClearColor(attachment.clearOpts.color.x, attachment.clearOpts.color.y, attachment.clearOpts.color.z,
                                 attachment.clearOpts.color.w);
                         glClear(GL_COLOR_BUFFER_BIT);
                     }
                 }
                 if (renderpass.fbo != 0)
                 {
-                    glDrawBuffers(subpass.colorAttachmentsToActivate.size(), subpass.colorAttachmentsToActivate.data());
+                    state.DrawBuffers(subpass.colorAttachmentsToActivate.size(), subpass.colorAttachmentsToActivate.data());
+                }
+            }
+
+            bool occlusionCullingSubpass = &renderpass == cullingPass && (strcmp(subpass.name, FRUSTUM_CULLING_SUBPASS) == 0 ||
+                    strcmp(subpass.name, MESHLET_CULLING_SUBPASS) == 0);
+            if (occlusionCullingSubpass)
+            {
+                // The pyramid is only built later in the frame, the previous frame's one is tested against
+                bool useDepthPyramid = occlusionCulling && depthPyramid != nullptr && depthPyramid->built;
+                subpass.shader->SetUniform("occlusionCulling", useDepthPyramid);
+                if (useDepthPyramid)
+                {
+                    state.BindTexture(activatedTextureCount, GL_TEXTURE_2D, depthPyramid->attachment.id);
+                    subpass.shader->SetUniform("tex_depth_pyramid", activatedTextureCount++);
+                    subpass.shader->SetUniform("depthPyramidViewProjection", depthPyramid->viewProjection);
                 }
             }
 
@@ -725,13 +1312,27 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
                 glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
                 glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
                 glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-                glDispatchCompute(subpass.settings.computeWorkGroups.x, subpass.settings.computeWorkGroups.y, subpass.settings.computeWorkGroups.z);
+                if (&subpass == depthPyramidSubpass)
+                {
+                    depthPyramid->Build(*subpass.shader, scene.mainCameraParams.viewProjection);
+                }
+                else
+                {
+                    glDispatchCompute(subpass.settings.computeWorkGroups.x, subpass.settings.computeWorkGroups.y, subpass.settings.computeWorkGroups.z);
+                }
                 glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
                 glMemoryBarrier(GL_ATOMIC_COUNTER_BARRIER_BIT);
                 glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+                // Indirect commands and draw counts written by the culling pass
+                glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
             }
             //glMemoryBarrier(GL_ALL_BARRIER_BITS);
 
+            // Render queue, the groups of every accepted tag sorted by their render keys
+            static std::vector<DrawGroup*> queuedGroups;
+            static std::vector<DrawPacket> packets;
+            queuedGroups.clear();
+            packets.clear();
             for (int i = 0; i < sizeof(subpass.acceptedMeshTags) * 8; i++)
             {
                 MeshTag acceptedMeshTag = (MeshTag)((int)subpass.acceptedMeshTags & (1 << i));
@@ -740,64 +1341,62 @@ void RenderPipeline::Render(Scene& scene, ShaderPool& shaders)
                     continue;
                 }
 
-                for (MeshWithMaterial& meshWithMaterial : scene.meshes[acceptedMeshTag])
+                for (DrawGroup& group : DrawGroupsFor(acceptedMeshTag, subpass.lodBias))
                 {
-                    if (meshWithMaterial.mesh.meshTag == PARTICLE && !scene.renderParticles)
-                    {
-                        continue;
-                    }
-
-                    glm::mat4 model = meshWithMaterial.mesh.transform.Model();
-                    bool fullyOutsideViewFrustum = meshWithMaterial.mesh.aabbModelSpace.ViewFrustumIntersect(scene.camera.MVP(model));
-                    if (fullyOutsideViewFrustum && subpass.acceptedMeshTags != SCREEN_QUAD)
-                    {
-                        totalCulled++;
-                        continue;
-                    }
-                    
-                    // TODO: not necessary if already bound
-                    //       even if bound and changed can only partially update
-                    meshWithMaterial.material->Bind();
-                    
-                    if (meshWithMaterial.mesh.meshTag == PARTICLE)
-                    {
-                        meshWithMaterial.material->UpdateData();
-                    }
-
-                    glBindBuffer(GL_UNIFORM_BUFFER, materialUbo);
-                    glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), &model, GL_STATIC_DRAW);
-                    //glBindBuffer(GL_UNIFORM_BUFFER, 0);
+                    packets.push_back({ group.renderKey, (int) queuedGroups.size() });
+                    queuedGroups.push_back(&group);
+                }
+            }
+            SortDrawPackets(packets);
 
-                    // TODO: Should be reworked - there should be some sort of communication between the shader and model here.
-                    // Shader dictates what textures it needs, the model provides them
-                    meshWithMaterial.mesh.Render(*subpass.shader);
+            subpass.renderQueueStats = {};
+            subpass.renderQueueStats.drawPackets = packets.size();
+            for (int i = 0; i < packets.size(); i++)
+            {
+                DrawGroup& group = *queuedGroups[packets[i].draw];
+                if (i > 0 && RenderKeysShareTextureSet(packets[i].key, packets[i - 1].key))
+                {
+                    subpass.renderQueueStats.textureSetBindsAvoided++;
+                }
+                else
+                {
+                    group.mesh->BindTextures(*subpass.shader);
                 }
+                if (i > 0 && RenderKeyVertexArray(packets[i].key) == RenderKeyVertexArray(packets[i - 1].key))
+                {
+                    subpass.renderQueueStats.vertexArrayBindsAvoided++;
+                }
+                else
+                {
+                    GeometryArena::Get().Bind(subpass.shader->readsPositionsOnly);
+                }
+                glMultiDrawElementsIndirectCount(GL_TRIANGLES, group.indexType,
+                        (void*) (drawCommands.offset + group.firstCommand * sizeof(GeometryArena::DrawElementsIndirectCommand)),
+                        drawCounts.offset + group.drawCountIndex * sizeof(GLuint), group.commandCount, 0);
             }
 
-            clock_t subpassEndTime = clock();
-            clock_t subpassCpuDuration = subpassEndTime - subpassStartTime;
-            float subpassCpuDurationMs = subpassCpuDuration * 1000.f / CLOCKS_PER_SEC;
+            long long subpassCpuEndUs = TraceTimeUs();
+            float subpassCpuDurationMs = (subpassCpuEndUs - subpassCpuBeginUs) / 1000.f;
             subpass.perfData.cpu.AddFrametime(subpassCpuDurationMs);
+            AddTraceEvent("subpass", subpass.name, subpassCpuBeginUs, subpassCpuEndUs);
             renderpassCpuDurationMs += subpassCpuDurationMs;
 
-            glEndQuery(GL_TIME_ELAPSED);
-            bool queryDone = false;
-            while (!queryDone) 
-            {
-                glGetQueryObjectiv(timeQuery, GL_QUERY_RESULT_AVAILABLE, (int*)&queryDone);
-            }
-            long subpassGpuDurationNs;
-            glGetQueryObjecti64v(timeQuery, GL_QUERY_RESULT, &subpassGpuDurationNs);
-            double subpassGpuDurationMs = (double)subpassGpuDurationNs / 1000000.0;
-            renderpassGpuDurationMs += subpassGpuDurationMs;
-            subpass.perfData.gpu.AddFrametime(subpassGpuDurationMs);
+            gpuTimer.AddRange(&subpass.perfData.gpu, subpass.name, subpassGpuBegin, gpuTimer.Timestamp());
         }
         renderpass.perfData.cpu.AddFrametime(renderpassCpuDurationMs);
-        renderpass.perfData.gpu.AddFrametime(renderpassGpuDurationMs);
+        AddTraceEvent("renderpass", renderpass.name, renderpassCpuBeginUs, TraceTimeUs());
+        // Unlike the CPU time this includes the renderpass' clears
+        gpuTimer.AddRange(&renderpass.perfData.gpu, renderpass.name, renderpassGpuBegin, gpuTimer.Timestamp());
 
         pipelineCpuDurationMs += renderpassCpuDurationMs;
-        pipelineGpuDurationMs += renderpassGpuDurationMs;
     }
+    // Code outside the pipeline binds VAOs and expects none to be bound
+    state.BindVertexArray(0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_PARAMETER_BUFFER, 0);
+    ringBuffer.EndFrame();
+
     perfData.cpu.AddFrametime(pipelineCpuDurationMs);
-    perfData.gpu.AddFrametime(pipelineGpuDurationMs);
+    AddTraceEvent("pipeline", "Render", pipelineCpuBeginUs, TraceTimeUs());
+    gpuTimer.AddRange(&perfData.gpu, "Render", pipelineGpuBegin, gpuTimer.Timestamp());
 }
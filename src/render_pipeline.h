@@ -5,8 +5,11 @@
 
 #include "glm/glm.hpp"
 
+#include "frame_ring_buffer.h"
+#include "gpu_timer.h"
 #include "mesh.h"
 #include "perf_data.h"
+#include "render_queue.h"
 
 enum class AttachmentFormat
 {
@@ -99,8 +102,8 @@ struct PassSettings
     glm::ivec3 computeWorkGroups;
 
     void Clear();
+    // Through GLStateCache, only the state that differs from the previously applied settings reaches GL
     void Apply();
-    void Apply(PassSettings& previousSettings);
 
     static PassSettings DefaultSettings();
     static PassSettings DefaultRenderpassSettings();
@@ -142,8 +145,19 @@ struct Subpass
     std::vector<SubpassAttachment> attachments;
     PassSettings settings;
     std::vector<GLenum> colorAttachmentsToActivate;
+    // Draws every mesh this many LODs coarser than the camera picked, e.g. for shadow maps
+    int lodBias;
 
     PerfData perfData;
+
+    // Of the last frame's render queue
+    struct RenderQueueStats
+    {
+        int drawPackets;
+        // Texture set and vertex array binds skipped because the previous packet already bound the same
+        int textureSetBindsAvoided;
+        int vertexArrayBindsAvoided;
+    } renderQueueStats;
 };
 
 struct Renderpass
@@ -176,6 +190,7 @@ struct Renderpass
 };
 
 struct Scene;
+struct DepthPyramid;
 struct RenderPipeline
 {
     std::vector<Renderpass*> passes;
@@ -185,6 +200,18 @@ struct RenderPipeline
 
     Renderpass& AddPass(const char* name, PassSettings passSettings = PassSettings::DefaultRenderpassSettings());
     Renderpass& AddOutputPass(ShaderPool& shaders);
+    // Compute pass that frustum culls the meshes of every tag but TRANSPARENT and SCREEN_QUAD on the GPU, filling
+    // the indirect commands and draw counts. Must be the first pass. Full detail meshes that have meshlets are then
+    // split up into the meshlets that survive, see meshletCulling.
+    Renderpass& AddCullingPass(ShaderPool& shaders);
+    // Compute subpass building the pipeline's DepthPyramid from depth and minDepth (proxy geometry). Returns the
+    // pyramid's attachment for later subpasses to read as a texture.
+    RenderpassAttachment& AddDepthPyramidSubpass(Renderpass& pass, ShaderPool& shaders, RenderpassAttachment& depth,
+            RenderpassAttachment& minDepth);
+
+    // Depth only subpass inserted before geometrySubpass, drawing the same meshes into its depth attachment with a
+    // positions only shader. While depthPrepass is on, geometrySubpass only shades the fragments that end up visible.
+    Subpass& AddDepthPrepassSubpass(Renderpass& pass, Subpass& geometrySubpass, ShaderPool& shaders);
 
     // Configurues all attachment in the order they are attached to the pipeline
     bool ConfigureAttachments(bool validateFramebuffers = true);
@@ -195,6 +222,79 @@ struct RenderPipeline
     int dummyTextureUnit;
     static RenderpassAttachment& DummyAttachment();
 
-    GLuint timeQuery;
-    unsigned int materialUbo;
+    // GPU times reach perfData a few frames late, see GpuTimer
+    GpuTimer gpuTimer;
+
+    // Tags whose shaders read textures through TextureResidency. Their meshes aren't split up by textures, all of a
+    // tag's visible meshes are drawn by a single group.
+    static const int residentTextureTags = OPAQUE;
+
+    // One glMultiDrawElementsIndirectCount per set of textures (or per tag of residentTextureTags). Its commands are
+    // the unique geometries among the group's visible meshes, instanced over the meshes.
+    struct DrawGroup
+    {
+        // Provides the textures
+        Mesh* mesh;
+        int firstCommand;
+        // Upper bound for GPU culled groups, the actual count is drawCounts[drawCountIndex]
+        int commandCount;
+        int drawCountIndex;
+        // Orders the groups of a subpass' render queue
+        RenderKey renderKey;
+        // Of all of the group's geometry, meshes with 16 and 32 bit indices never share a group
+        GLenum indexType;
+    };
+    std::unordered_map<MeshTag, std::vector<DrawGroup>> drawGroups;
+    // The same instances drawn lodBias LODs coarser, indexed by the bias. Only built for the biases subpasses use and
+    // tags that have LODs.
+    std::unordered_map<MeshTag, std::vector<DrawGroup>> lodBiasedDrawGroups[MESH_MAX_LODS];
+    std::vector<DrawGroup>& DrawGroupsFor(MeshTag meshTag, int lodBias);
+    // This frame's data in the FrameRingBuffer
+    FrameRingBuffer::Allocation instances;
+    FrameRingBuffer::Allocation drawCommands;
+    FrameRingBuffer::Allocation drawCounts;
+    int drawCommandCount;
+    int culledMeshCount;
+
+    // Meshes draw the coarsest LOD whose error projects to at most this many pixels from the main camera
+    float lodErrorPixels;
+    // Meshes drawn with each LOD last frame
+    int lodMeshCounts[MESH_MAX_LODS];
+
+    // Inputs of the culling pass, nullptr without one
+    Renderpass* cullingPass;
+    FrameRingBuffer::Allocation cullObjects;
+    FrameRingBuffer::Allocation cullCandidates;
+    int cullObjectCount;
+
+    // GPU culled meshes drawn with LOD 0 are also culled meshlet by meshlet, against the frustum, their normal cones
+    // and the depth pyramid. Each surviving meshlet becomes a command of its own. LOD biased groups (shadow maps,
+    // proxies) still draw the whole meshes.
+    bool meshletCulling;
+    // Meshlet and CullObject pairs tested by the meshlet culling subpass, and the instance each CullObject got
+    FrameRingBuffer::Allocation meshletCullItems;
+    FrameRingBuffer::Allocation cullObjectInstances;
+    int meshletCullItemCount;
+
+    // Built by depthPyramidSubpass, nullptr without one
+    DepthPyramid* depthPyramid;
+    Subpass* depthPyramidSubpass;
+    // The culling pass also rejects meshes hidden behind the previous frame's depth pyramid. Newly disoccluded meshes
+    // show up a frame late. LOD biased groups (shadow maps, proxies) are only frustum culled, casters the camera
+    // can't see still shadow what it can.
+    bool occlusionCulling;
+
+    // Added by AddDepthPrepassSubpass, nullptr without one
+    Subpass* depthPrepassSubpass;
+    Subpass* depthPrepassGeometrySubpass;
+    // Runs the depth prepass, the geometry subpass then tests with GL_EQUAL and leaves depth writes off. Otherwise it
+    // is skipped and the geometry subpass does its own GL_LESS depth testing.
+    bool depthPrepass;
+
+    // Frustum culls (or prepares the culling pass' inputs) and groups the scene's meshes, writes their MeshInstances
+    // and indirect commands into the FrameRingBuffer
+    void BuildDrawCommands(Scene& scene);
+
+    // Framebuffer the output pass (fbo 0) renders into. Default framebuffer unless overridden, e.g. by headless runs.
+    static unsigned int outputFramebuffer;
 };
@@ -0,0 +1,86 @@
+#include "render_queue.h"
+
+#include <cstring>
+
+#include "log.h"
+
+#define RENDER_KEY_ORDERED_BIT (1ull << 63)
+#define RENDER_KEY_TEXTURE_SET_SHIFT 40
+#define RENDER_KEY_VERTEX_ARRAY_SHIFT 32
+
+RenderKey MakeRenderKey(unsigned int textureSet, unsigned int vertexArray, float cameraDistance)
+{
+    ASSERT(textureSet < (1u << RENDER_KEY_TEXTURE_SET_BITS));
+    ASSERT(vertexArray < (1u << RENDER_KEY_VERTEX_ARRAY_BITS));
+
+    // Non-negative IEEE floats order the same as their bits
+    uint32_t distanceBits;
+    cameraDistance = cameraDistance > 0.f ? cameraDistance : 0.f;
+    memcpy(&distanceBits, &cameraDistance, sizeof(distanceBits));
+
+    return ((RenderKey) textureSet << RENDER_KEY_TEXTURE_SET_SHIFT)
+        | ((RenderKey) vertexArray << RENDER_KEY_VERTEX_ARRAY_SHIFT)
+        | distanceBits;
+}
+
+RenderKey MakeOrderedRenderKey(unsigned int submissionOrder)
+{
+    return RENDER_KEY_ORDERED_BIT | submissionOrder;
+}
+
+bool RenderKeysShareTextureSet(RenderKey a, RenderKey b)
+{
+    if ((a & RENDER_KEY_ORDERED_BIT) != 0 || (b & RENDER_KEY_ORDERED_BIT) != 0)
+    {
+        return false;
+    }
+    unsigned int mask = (1u << RENDER_KEY_TEXTURE_SET_BITS) - 1;
+    return ((a >> RENDER_KEY_TEXTURE_SET_SHIFT) & mask) == ((b >> RENDER_KEY_TEXTURE_SET_SHIFT) & mask);
+}
+
+unsigned int RenderKeyVertexArray(RenderKey key)
+{
+    return (key >> RENDER_KEY_VERTEX_ARRAY_SHIFT) & ((1u << RENDER_KEY_VERTEX_ARRAY_BITS) - 1);
+}
+
+void SortDrawPackets(std::vector<DrawPacket>& packets)
+{
+    static std::vector<DrawPacket> scratch;
+    scratch.resize(packets.size());
+
+    DrawPacket* source = packets.data();
+    DrawPacket* destination = scratch.data();
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        int offsets[256] = { 0 };
+        for (int i = 0; i < packets.size(); i++)
+        {
+            offsets[(source[i].key >> shift) & 0xff]++;
+        }
+        if (packets.empty() || offsets[(source[0].key >> shift) & 0xff] == packets.size())
+        {
+            continue;
+        }
+
+        int offset = 0;
+        for (int i = 0; i < 256; i++)
+        {
+            int count = offsets[i];
+            offsets[i] = offset;
+            offset += count;
+        }
+        for (int i = 0; i < packets.size(); i++)
+        {
+            destination[offsets[(source[i].key >> shift) & 0xff]++] = source[i];
+        }
+
+        DrawPacket* swap = source;
+        source = destination;
+        destination = swap;
+    }
+
+    if (source != packets.data())
+    {
+        memcpy(packets.data(), source, packets.size() * sizeof(DrawPacket));
+    }
+}
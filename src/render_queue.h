@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Sort key of a draw packet, most significant bits first:
+//   63      - order dependent packets (transparency), sorted after all others
+//   62..40  - texture set
+//   39..32  - vertex array
+//   31..0   - camera distance, front to back, or the submission order of order dependent packets
+// A subpass draws with a single shader, so the shader is not part of the key. Materials live in the material table
+// and need no binding, so neither are they.
+typedef uint64_t RenderKey;
+
+#define RENDER_KEY_TEXTURE_SET_BITS 23
+#define RENDER_KEY_VERTEX_ARRAY_BITS 8
+
+RenderKey MakeRenderKey(unsigned int textureSet, unsigned int vertexArray, float cameraDistance);
+RenderKey MakeOrderedRenderKey(unsigned int submissionOrder);
+// False for order dependent keys, they don't carry a texture set
+bool RenderKeysShareTextureSet(RenderKey a, RenderKey b);
+// Order dependent keys use vertex array 0
+unsigned int RenderKeyVertexArray(RenderKey key);
+
+struct DrawPacket
+{
+    RenderKey key;
+    // Into the caller's draws
+    int draw;
+};
+
+// Stable LSD radix sort over the keys, 8 bits per pass. Passes in which every key has the same byte are skipped.
+void SortDrawPackets(std::vector<DrawPacket>& packets);
@@ -1,41 +1,122 @@
+#include <cmath>
+
 #include <glm/gtc/type_ptr.hpp>
 
 #include "scene.h"
+#include "frame_ring_buffer.h"
 #include "shader.h"
+#include "transform_store.h"
 
 
 Scene::Scene() : globalAttachments("Global attachment container", PassSettings::DefaultRenderpassSettings())
 {
-    glGenBuffers(1, &sceneParamsUboId);
-    glBindBufferBase(GL_UNIFORM_BUFFER, Shader::sceneParamBindingPoint, sceneParamsUboId);
+}
+
+void Scene::Update(float deltaTime)
+{
+    mainCameraParams.nearFarPlanes = glm::vec4(camera.nearClippingPlane, camera.farClippingPlane, 0.f, 0.f);
+    mainCameraParams.pos = glm::vec4(camera.transform.pos, 0.f);
+    mainCameraParams.view = camera.View();
+    mainCameraParams.projection = camera.projection;
+    mainCameraParams.viewProjection = mainCameraParams.projection * mainCameraParams.view;
+
+    // Move point lights around the centre in an elipse
+    for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+    {
+        float d = sqrt(lights.pointLights[i].pos.x * lights.pointLights[i].pos.x + lights.pointLights[i].pos.z * lights.pointLights[i].pos.z * 4.f);
+        float angle = atan2(lights.pointLights[i].pos.z * 2.f, lights.pointLights[i].pos.x);
+        angle += 0.01;
+        lights.pointLights[i].pos.x = cos(angle) * d;
+        lights.pointLights[i].pos.z = sin(angle) * d / 2.f;
+    }
 
-    glGenBuffers(1, &mainCameraParamsUboId);
-    glBindBufferBase(GL_UNIFORM_BUFFER, Shader::cameraParamBindingPoint, mainCameraParamsUboId);
+    for (auto& particleSys : particleSystems)
+    {
+        particleSys.Update(deltaTime, camera.transform);
+    }
 
-    glGenBuffers(1, &lightingUboId);
-    glBindBufferBase(GL_UNIFORM_BUFFER, Shader::lightingBindingPoint, lightingUboId);
+    // Everything that moves has moved, recompute those in one batch rather than on first read
+    TransformStore::Get().Update();
 }
 
 void Scene::BindSceneParams()
 {
-    // TODO: don't update everytime
-    glBindBuffer(GL_UNIFORM_BUFFER, sceneParamsUboId);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(sceneParams), &sceneParams, GL_STATIC_DRAW);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    FrameRingBuffer::BindRange(GL_UNIFORM_BUFFER, Shader::sceneParamBindingPoint,
+            FrameRingBuffer::Get().Upload(&sceneParams, sizeof(sceneParams)));
 }
 
 void Scene::BindCameraParams()
 {
-    // TODO: don't update everytime
-    glBindBuffer(GL_UNIFORM_BUFFER, mainCameraParamsUboId);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(mainCameraParams), &mainCameraParams, GL_STATIC_DRAW);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    FrameRingBuffer::BindRange(GL_UNIFORM_BUFFER, Shader::cameraParamBindingPoint,
+            FrameRingBuffer::Get().Upload(&mainCameraParams, sizeof(mainCameraParams)));
 }
 
 void Scene::BindLighting()
 {
-    // TODO: don't update everytime
-    glBindBuffer(GL_UNIFORM_BUFFER, lightingUboId);
-    glBufferData(GL_UNIFORM_BUFFER, sizeof(lighting), &lighting, GL_STATIC_DRAW);
-    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    FrameRingBuffer::BindRange(GL_UNIFORM_BUFFER, Shader::lightingBindingPoint,
+            FrameRingBuffer::Get().Upload(&lighting, sizeof(lighting)));
+}
+
+BVH& Scene::MeshBVH(MeshTag meshTag)
+{
+    static std::vector<AABB> worldBounds;
+    TransformStore& transforms = TransformStore::Get();
+    std::vector<MeshWithMaterial>& tagMeshes = meshes[meshTag];
+    MeshHierarchy& hierarchy = meshBVHs[meshTag];
+    BVH& bvh = hierarchy.bvh;
+
+    bool moved = false;
+    if (bvh.ItemCount() == tagMeshes.size())
+    {
+        // Only version checks for meshes that didn't move, their bounds are neither recomputed nor compared
+        for (int i = 0; i < tagMeshes.size(); i++)
+        {
+            int id = tagMeshes[i].mesh.transform.id;
+            if (id != hierarchy.transformIds[i] || transforms.Version(id) != hierarchy.transformVersions[i])
+            {
+                hierarchy.transformIds[i] = id;
+                hierarchy.transformVersions[i] = transforms.Version(id);
+                bvh.SetItemBounds(i, transforms.WorldBounds(id));
+                moved = true;
+            }
+        }
+        if (!moved)
+        {
+            return bvh;
+        }
+
+        bvh.Refit();
+        if (!bvh.NeedsRebuild())
+        {
+            return bvh;
+        }
+    }
+
+    worldBounds.clear();
+    hierarchy.transformIds.clear();
+    hierarchy.transformVersions.clear();
+    for (MeshWithMaterial& meshWithMaterial : tagMeshes)
+    {
+        int id = meshWithMaterial.mesh.transform.id;
+        worldBounds.push_back(transforms.WorldBounds(id));
+        hierarchy.transformIds.push_back(id);
+        hierarchy.transformVersions.push_back(transforms.Version(id));
+    }
+    bvh.Build(worldBounds);
+    return bvh;
+}
+
+void Scene::QueryMeshes(MeshTag meshTag, const FrustumPlanes& frustum, std::vector<int>& meshIndices)
+{
+    MeshBVH(meshTag).Query(frustum, meshIndices);
+}
+
+void Scene::QueryMeshes(MeshTag meshTag, glm::vec3 center, float radius, std::vector<int>& meshIndices)
+{
+    MeshBVH(meshTag).Query(center, radius, meshIndices);
+}
+
+FrustumPlanes Scene::DirectionalLightFrustum() const
+{
+    return FrustumPlanes(directionalLight.viewProjection, true);
 }
@@ -8,18 +8,20 @@
 #include "mesh.h"
 #include "material.h"
 #include "aabb.h"
+#include "bvh.h"
 #include "particle_sys.h"
 #include "render_pipeline.h"
 
-// TODO: future optimization for instancing
-/*
+// Per instance data, the "Instances" SSBO. Vertex shaders index it with gl_BaseInstance + gl_InstanceID.
 struct MeshInstance
 {
-    uint32 meshIndex;
-    Transform *transform;
-    Material material;
+    // The mesh's model matrix times its GeometryArena position dequantization
+    glm::mat4 model;
+    // Of the mesh's own model matrix, columns padded to vec4 like a std430 mat3
+    glm::mat3x4 normalMatrix;
+    // x - index into the material table, y - TextureResidency slot, the rest pads to std430 alignment
+    glm::uvec4 material;
 };
-*/
 
 // TODO: yes this is idiotic
 struct MeshWithMaterial
@@ -47,7 +49,6 @@ struct Scene
         float viewportWidth;
         float viewportHeight;
     } sceneParams;
-    unsigned int sceneParamsUboId;       
     // Separate - no need to pass to shaders
     bool renderParticles = false;
 
@@ -59,7 +60,6 @@ struct Scene
         glm::vec4 pos;
         glm::vec4 nearFarPlanes;
     } mainCameraParams;
-    unsigned int mainCameraParamsUboId;       
 
     struct DirectionalLight
     {
@@ -94,13 +94,35 @@ struct Scene
 
         glm::vec4 directionalBiasAndAngleBias;
     } lighting;
-    unsigned int lightingUboId;
 
     std::vector<ParticleSys> particleSystems;
 
+    // Per tag hierarchies over world space mesh bounds, items are indices into meshes[tag]
+    struct MeshHierarchy
+    {
+        BVH bvh;
+        // TransformStore slot and version of every item as of the last refit
+        std::vector<int> transformIds;
+        std::vector<unsigned int> transformVersions;
+    };
+    std::unordered_map<MeshTag, MeshHierarchy> meshBVHs;
+
     Scene();
 
+    // Per frame simulation step shared by the interactive and headless loops. Expects the camera to be updated already.
+    void Update(float deltaTime);
+
+    // Copy the params into the FrameRingBuffer and bind them there, only valid within a ring buffer frame
     void BindSceneParams();
     void BindCameraParams();
     void BindLighting();
+
+    // The tag's BVH refit to the meshes whose TransformStore slot changed. Rebuilt if meshes were added or removed, or
+    // refits made it too loose.
+    BVH& MeshBVH(MeshTag meshTag);
+    // Append indices into meshes[meshTag] of the meshes whose world space bounds intersect the volume
+    void QueryMeshes(MeshTag meshTag, const FrustumPlanes& frustum, std::vector<int>& meshIndices);
+    void QueryMeshes(MeshTag meshTag, glm::vec3 center, float radius, std::vector<int>& meshIndices);
+    // Volume the directional shadow map covers, for shadow caster queries
+    FrustumPlanes DirectionalLightFrustum() const;
 };
@@ -12,7 +12,9 @@
 #include "log.h"
 
 #include "shader.h"
+#include "gl_state_cache.h"
 #include "hash.h"
+#include "trace.h"
 
 unsigned long ShaderDescriptor::Hash()
 {
@@ -146,6 +148,10 @@ int Shader::GetBinding(const char* resource)
     shader->descriptor = descriptor;
     std::vector<unsigned int> shaderIds;
 
+    char traceName[128];
+    snprintf(traceName, sizeof(traceName), "Compile 0x%lX %s", descriptor.Hash(), descriptor.files.empty() ? "" : descriptor.files[0].filepath);
+    TraceScope traceScope("shader", traceName);
+
     LOG_INFO("Shader", "Compiling 0x%X...", descriptor.Hash());
 
     char* defines = (char*) malloc(sizeof(char) * 256 * descriptor.defines.size());
@@ -271,6 +277,7 @@ int Shader::GetBinding(const char* resource)
     }
 
     LOG_INFO("Shader", "\tSuccessfully compiled 0x%X", descriptor.Hash());
+    shader->Reflect();
     shader->SetupUniformBlockBindings();
     return true;
 }
@@ -355,116 +362,344 @@ void ShaderPool::ReloadChangedShaders()
     }
 }
 
+static bool IsSamplerType(GLenum type)
+{
+    switch (type)
+    {
+    case GL_SAMPLER_1D:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_1D_SHADOW:
+    case GL_SAMPLER_2D_SHADOW:
+    case GL_SAMPLER_1D_ARRAY:
+    case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_CUBE_MAP_ARRAY:
+    case GL_SAMPLER_1D_ARRAY_SHADOW:
+    case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_CUBE_SHADOW:
+    case GL_SAMPLER_CUBE_MAP_ARRAY_SHADOW:
+    case GL_SAMPLER_2D_MULTISAMPLE:
+    case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_SAMPLER_BUFFER:
+    case GL_SAMPLER_2D_RECT:
+    case GL_SAMPLER_2D_RECT_SHADOW:
+    case GL_INT_SAMPLER_1D:
+    case GL_INT_SAMPLER_2D:
+    case GL_INT_SAMPLER_3D:
+    case GL_INT_SAMPLER_CUBE:
+    case GL_INT_SAMPLER_1D_ARRAY:
+    case GL_INT_SAMPLER_2D_ARRAY:
+    case GL_INT_SAMPLER_CUBE_MAP_ARRAY:
+    case GL_INT_SAMPLER_2D_MULTISAMPLE:
+    case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_INT_SAMPLER_BUFFER:
+    case GL_INT_SAMPLER_2D_RECT:
+    case GL_UNSIGNED_INT_SAMPLER_1D:
+    case GL_UNSIGNED_INT_SAMPLER_2D:
+    case GL_UNSIGNED_INT_SAMPLER_3D:
+    case GL_UNSIGNED_INT_SAMPLER_CUBE:
+    case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_CUBE_MAP_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE:
+    case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_BUFFER:
+    case GL_UNSIGNED_INT_SAMPLER_2D_RECT:
+        return true;
+    default:
+        // Images go to image units through their binding layout qualifiers, not to texture units
+        return false;
+    }
+}
+
+void Shader::Reflect()
+{
+    static unsigned int nextReflectionId = 1;
+    reflectionId = nextReflectionId++;
+
+    uniforms.clear();
+    blocks.clear();
+    layoutBoundSamplers = 0;
+
+    char name[256];
+    int count = 0;
+    glGetProgramInterfaceiv(id, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+    int samplerCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const GLenum properties[] = { GL_TYPE, GL_LOCATION };
+        GLint values[2];
+        glGetProgramResourceiv(id, GL_UNIFORM, i, 2, properties, 2, nullptr, values);
+        // Block members, set through their buffers
+        if (values[1] == -1)
+        {
+            continue;
+        }
+
+        glGetProgramResourceName(id, GL_UNIFORM, i, sizeof(name), nullptr, name);
+        char* arraySuffix = strstr(name, "[0]");
+        if (arraySuffix != nullptr)
+        {
+            *arraySuffix = '\0';
+        }
+
+        Uniform uniform;
+        uniform.name = name;
+        uniform.nameHash = Djb2((const unsigned char*)name);
+        uniform.type = values[0];
+        uniform.location = values[1];
+        uniform.samplerIndex = IsSamplerType(uniform.type) && samplerCount < MAX_REFLECTED_SAMPLERS ? samplerCount++ : -1;
+        uniform.samplerUnit = -1;
+        if (uniform.samplerIndex >= 0)
+        {
+            // Unqualified samplers link as unit 0, anything else comes from a binding layout qualifier
+            glGetUniformiv(id, uniform.location, &uniform.samplerUnit);
+            if (uniform.samplerUnit != 0)
+            {
+                layoutBoundSamplers |= 1ull << uniform.samplerIndex;
+            }
+        }
+        uniforms.push_back(uniform);
+    }
+
+    const GLenum blockInterfaces[] = { GL_UNIFORM_BLOCK, GL_SHADER_STORAGE_BLOCK };
+    for (GLenum blockInterface : blockInterfaces)
+    {
+        glGetProgramInterfaceiv(id, blockInterface, GL_ACTIVE_RESOURCES, &count);
+        for (int i = 0; i < count; i++)
+        {
+            glGetProgramResourceName(id, blockInterface, i, sizeof(name), nullptr, name);
+            blocks.push_back({ name, blockInterface, (GLuint)i });
+        }
+    }
+
+    readsPositionsOnly = true;
+    glGetProgramInterfaceiv(id, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &count);
+    for (int i = 0; i < count; i++)
+    {
+        const GLenum property = GL_LOCATION;
+        GLint location;
+        glGetProgramResourceiv(id, GL_PROGRAM_INPUT, i, 1, &property, 1, nullptr, &location);
+        // Built-ins like gl_VertexID have no location
+        if (location > 0)
+        {
+            readsPositionsOnly = false;
+        }
+    }
+
+    boundSamplers = layoutBoundSamplers;
+    boundUniforms.assign(uniforms.size(), false);
+}
+
+int Shader::FindUniform(const char* name) const
+{
+    unsigned long nameHash = Djb2((const unsigned char*)name);
+    for (int i = 0; i < uniforms.size(); i++)
+    {
+        if (uniforms[i].nameHash == nameHash && uniforms[i].name.compare(name) == 0)
+        {
+            return i;
+        }
+    }
+    return INVALID_UNIFORM;
+}
+
+GLuint Shader::FindBlock(const char* name, GLenum interface) const
+{
+    for (const Block& block : blocks)
+    {
+        if (block.interface == interface && block.name.compare(name) == 0)
+        {
+            return block.index;
+        }
+    }
+    return GL_INVALID_INDEX;
+}
+
 void Shader::Use()
 {
-    glUseProgram(id);
-    boundUniforms.clear();
+    GLStateCache::Get().UseProgram(id);
+    boundSamplers = layoutBoundSamplers;
+    boundUniforms.assign(uniforms.size(), false);
 }
 
 GLint Shader::GetUniformLocation(const char* name)
 {
-    GLint location = glGetUniformLocation(id, name);
-    assert(location != GL_INVALID_VALUE);
-    boundUniforms.insert(std::string(name));
+    int uniform = FindUniform(name);
+    if (uniform == INVALID_UNIFORM)
+    {
+        // Optimized out or never declared, GL ignores location -1
+        return -1;
+    }
 
-    return location;
+    boundUniforms[uniform] = true;
+    return uniforms[uniform].location;
 }
 
 void Shader::SetUniform(const char *name, bool data)
 {
-    glUniform1i(GetUniformLocation(name), (int)data); 
+    SetUniform(FindUniform(name), data);
 }
 
 void Shader::SetUniform(const char *name, int data)
 {
-    glUniform1i(GetUniformLocation(name), data); 
+    SetUniform(FindUniform(name), data);
 }
 
 void Shader::SetUniform(const char *name, float data)
 {
-    glUniform1f(GetUniformLocation(name), data); 
+    SetUniform(FindUniform(name), data);
 }
 
 void Shader::SetUniform(const char *name, glm::vec2 data)
 {
-    glUniform2fv(GetUniformLocation(name), 1, &data[0]); 
+    SetUniform(FindUniform(name), data);
 }
 
 void Shader::SetUniform(const char *name, glm::vec3 data)
 {
-    glUniform3fv(GetUniformLocation(name), 1, &data[0]); 
+    SetUniform(FindUniform(name), data);
 }
 
 void Shader::SetUniform(const char *name, glm::vec4 data)
 {
-    glUniform4fv(GetUniformLocation(name), 1, &data[0]); 
+    SetUniform(FindUniform(name), data);
 }
 
 void Shader::SetUniform(const char *name, glm::mat2 data)
 {
-    glUniformMatrix2fv(GetUniformLocation(name), 1, GL_FALSE, &data[0][0]); 
+    SetUniform(FindUniform(name), data);
 }
 
 void Shader::SetUniform(const char *name, glm::mat3 data)
 {
-    glUniformMatrix3fv(GetUniformLocation(name), 1, GL_FALSE, &data[0][0]); 
+    SetUniform(FindUniform(name), data);
 }
 
 void Shader::SetUniform(const char *name, glm::mat4 data)
 {
-    //glUniformMatrix4fv(glGetUniformLocation(id, name), 1, GL_FALSE, &data[0][0]); 
-    glUniformMatrix4fv(GetUniformLocation(name), 1, GL_FALSE, glm::value_ptr(data)); 
+    SetUniform(FindUniform(name), data);
 }
 
-void Shader::AddDummyForUnboundTextures(int dummyTextureUnit)
+void Shader::SetUniform(int uniform, bool data)
 {
-    int unused;
-    GLenum type;
-    char uniformName[128];
+    SetUniform(uniform, (int)data);
+}
 
-    int count = 0;
-    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
-    for (int i = 0; i < count; i++)
+void Shader::SetUniform(int uniform, int data)
+{
+    if (uniform == INVALID_UNIFORM)
+        return;
+
+    Uniform& reflected = uniforms[uniform];
+    boundUniforms[uniform] = true;
+    if (reflected.samplerIndex >= 0)
     {
-        glGetActiveUniform(id, i, sizeof(uniformName), &unused, &unused, &type, uniformName);
+        boundSamplers |= 1ull << reflected.samplerIndex;
+        // Sampler units are program state, most draws keep assigning the same unit
+        if (reflected.samplerUnit == data)
+            return;
+        reflected.samplerUnit = data;
+    }
+    glUniform1i(reflected.location, data); 
+}
+
+void Shader::SetUniform(int uniform, float data)
+{
+    if (uniform == INVALID_UNIFORM)
+        return;
+
+    boundUniforms[uniform] = true;
+    glUniform1f(uniforms[uniform].location, data); 
+}
+
+void Shader::SetUniform(int uniform, glm::vec2 data)
+{
+    if (uniform == INVALID_UNIFORM)
+        return;
+
+    boundUniforms[uniform] = true;
+    glUniform2fv(uniforms[uniform].location, 1, &data[0]); 
+}
+
+void Shader::SetUniform(int uniform, glm::vec3 data)
+{
+    if (uniform == INVALID_UNIFORM)
+        return;
+
+    boundUniforms[uniform] = true;
+    glUniform3fv(uniforms[uniform].location, 1, &data[0]); 
+}
+
+void Shader::SetUniform(int uniform, glm::vec4 data)
+{
+    if (uniform == INVALID_UNIFORM)
+        return;
+
+    boundUniforms[uniform] = true;
+    glUniform4fv(uniforms[uniform].location, 1, &data[0]); 
+}
+
+void Shader::SetUniform(int uniform, glm::mat2 data)
+{
+    if (uniform == INVALID_UNIFORM)
+        return;
 
-        // Definitely not exhaustive...
-        bool isTexture = type == GL_SAMPLER_1D || type == GL_SAMPLER_2D || type == GL_SAMPLER_3D;
-        bool isCubemap = type == GL_SAMPLER_CUBE;
-        if (boundUniforms.find(std::string(uniformName)) == boundUniforms.end())
+    boundUniforms[uniform] = true;
+    glUniformMatrix2fv(uniforms[uniform].location, 1, GL_FALSE, &data[0][0]); 
+}
+
+void Shader::SetUniform(int uniform, glm::mat3 data)
+{
+    if (uniform == INVALID_UNIFORM)
+        return;
+
+    boundUniforms[uniform] = true;
+    glUniformMatrix3fv(uniforms[uniform].location, 1, GL_FALSE, &data[0][0]); 
+}
+
+void Shader::SetUniform(int uniform, glm::mat4 data)
+{
+    if (uniform == INVALID_UNIFORM)
+        return;
+
+    boundUniforms[uniform] = true;
+    glUniformMatrix4fv(uniforms[uniform].location, 1, GL_FALSE, glm::value_ptr(data)); 
+}
+
+void Shader::AddDummyForUnboundTextures(int dummyTextureUnit)
+{
+    for (int i = 0; i < uniforms.size(); i++)
+    {
+        Uniform& uniform = uniforms[i];
+        if (uniform.samplerIndex < 0 || (boundSamplers & (1ull << uniform.samplerIndex)) != 0)
         {
-            if (isTexture)
-            {
-                //LOG_WARN("Shader", "\"%s\". Unbound tex found: %s. Binding dummy texture.", name, uniformName);
-                // Doesn't need activating, we're always keeping our dummy texture unit active
-                SetUniform(uniformName, dummyTextureUnit);
-            }
-            else if (isCubemap)
-            {
-                // TODO
-                //LOG_WARN("Shader", "\"%s\". Unbound cubemap found: %s. Binding dummy cubemap.", name, uniformName);
-                assert(false);
-            }
+            continue;
         }
+
+        if (uniform.type != GL_SAMPLER_2D)
+        {
+            // TODO: dummies for the other sampler types, sampling the 2D one through them is undefined
+            LOG_ERROR("Shader", "Unbound sampler %s of type 0x%X, no dummy texture to bind", uniform.name.c_str(), uniform.type);
+            assert(false);
+            continue;
+        }
+
+        //LOG_WARN("Shader", "\"%s\". Unbound tex found: %s. Binding dummy texture.", name, uniform.name.c_str());
+        // Doesn't need activating, we're always keeping our dummy texture unit active
+        SetUniform(i, dummyTextureUnit);
     }
 }
 
 void Shader::ReportUnboundUniforms()
 {
     // Reports on free floating uniforms. Can't deal with uniform buffers though
-
-    int unused;
-    int count = 0;
-    GLenum type;
-    char name[128];
-    glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
-    for (int i = 0; i < count; i++)
+    for (int i = 0; i < uniforms.size(); i++)
     {
-        glGetActiveUniform(id, (GLuint)i, 128, &unused, &unused, &type, name);
-
-        if (boundUniforms.find(std::string(name)) == boundUniforms.end())
+        if (!boundUniforms[i])
         {
-            LOG_ERROR("Unbound uniform: %s. Type: 0x%X", name, type);
+            LOG_ERROR("Shader", "Unbound uniform: %s. Type: 0x%X", uniforms[i].name.c_str(), uniforms[i].type);
         }
     }
 }
@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include <string>
 #include <functional>
+#include <stdint.h>
 #include <string.h>
 #include <vector>
 
@@ -93,41 +94,106 @@ public:
         SCENE_PARAM_BINDING_POINT = 0,
         CAMERA_PARAM_BINDING_POINT,
         LIGHTING_BINDING_POINT,
-        MATERIAL_PARAM_BINDING_POINT,
-        MODEL_PARAM_BINDING_POINT
+        MATERIAL_TABLE_BINDING_POINT = 8,
+        INSTANCE_DATA_BINDING_POINT
     };
     */
     static const unsigned int sceneParamBindingPoint    = 0;
     static const unsigned int cameraParamBindingPoint   = 1;
     static const unsigned int lightingBindingPoint      = 2;
-    static const unsigned int materialParamBindingPoint = 3;
-    static const unsigned int modelParamBindingPoint    = 4;
+    // Shader storage binding points, above the ones handed out to *_AUTO_BINDING resources
+    static const unsigned int materialTableBindingPoint = 8;
+    static const unsigned int instanceDataBindingPoint  = 9;
+    // GPU culling, see RenderPipeline::AddCullingPass
+    static const unsigned int cullObjectsBindingPoint       = 10;
+    static const unsigned int cullCandidatesBindingPoint    = 11;
+    static const unsigned int drawCommandsBindingPoint      = 12;
+    static const unsigned int drawCountsBindingPoint        = 13;
+    // See TextureResidency
+    static const unsigned int textureSetsBindingPoint       = 14;
+    // Meshlet culling, see RenderPipeline::meshletCulling
+    static const unsigned int meshletsBindingPoint          = 15;
+    static const unsigned int meshletCullItemsBindingPoint  = 16;
+    static const unsigned int cullObjectInstancesBindingPoint = 17;
 
     void SetupUniformBlockBindings()
     {
-        unsigned int sceneParamUniformBlockIndex = glGetUniformBlockIndex(id, "SceneParams");
+        unsigned int sceneParamUniformBlockIndex = FindBlock("SceneParams", GL_UNIFORM_BLOCK);
         if (sceneParamUniformBlockIndex != GL_INVALID_INDEX)
             glUniformBlockBinding(id, sceneParamUniformBlockIndex, sceneParamBindingPoint);
 
-        unsigned int cameraParamUniformBlockIndex = glGetUniformBlockIndex(id, "CameraParams");
+        unsigned int cameraParamUniformBlockIndex = FindBlock("CameraParams", GL_UNIFORM_BLOCK);
         if (cameraParamUniformBlockIndex != GL_INVALID_INDEX)
             glUniformBlockBinding(id, cameraParamUniformBlockIndex, cameraParamBindingPoint);
 
-        unsigned int lightingUniformBlockIndex = glGetUniformBlockIndex(id, "Lighting");
+        unsigned int lightingUniformBlockIndex = FindBlock("Lighting", GL_UNIFORM_BLOCK);
         if (lightingUniformBlockIndex != GL_INVALID_INDEX)
             glUniformBlockBinding(id, lightingUniformBlockIndex, lightingBindingPoint);
 
-        unsigned int materialParamUniformBlockIndex = glGetUniformBlockIndex(id, "MaterialParams");
-        if (materialParamUniformBlockIndex != GL_INVALID_INDEX)
-            glUniformBlockBinding(id, materialParamUniformBlockIndex, materialParamBindingPoint);
-
-        unsigned int modelParamUniformBlockIndex = glGetUniformBlockIndex(id, "ModelParams");
-        if (modelParamUniformBlockIndex != GL_INVALID_INDEX)
-            glUniformBlockBinding(id, modelParamUniformBlockIndex, modelParamBindingPoint);
+        unsigned int materialTableStorageBlockIndex = FindBlock("Materials", GL_SHADER_STORAGE_BLOCK);
+        if (materialTableStorageBlockIndex != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(id, materialTableStorageBlockIndex, materialTableBindingPoint);
+
+        unsigned int instanceDataStorageBlockIndex = FindBlock("Instances", GL_SHADER_STORAGE_BLOCK);
+        if (instanceDataStorageBlockIndex != GL_INVALID_INDEX)
+            glShaderStorageBlockBinding(id, instanceDataStorageBlockIndex, instanceDataBindingPoint);
+
+        const std::pair<const char*, unsigned int> cullingStorageBlocks[] =
+        {
+            { "CullObjects", cullObjectsBindingPoint },
+            { "CullCandidates", cullCandidatesBindingPoint },
+            { "DrawCommands", drawCommandsBindingPoint },
+            { "DrawCounts", drawCountsBindingPoint },
+            { "TextureSets", textureSetsBindingPoint },
+            { "Meshlets", meshletsBindingPoint },
+            { "MeshletCullItems", meshletCullItemsBindingPoint },
+            { "CullObjectInstances", cullObjectInstancesBindingPoint },
+        };
+        for (auto& block : cullingStorageBlocks)
+        {
+            unsigned int storageBlockIndex = FindBlock(block.first, GL_SHADER_STORAGE_BLOCK);
+            if (storageBlockIndex != GL_INVALID_INDEX)
+                glShaderStorageBlockBinding(id, storageBlockIndex, block.second);
+        }
     }
 
-    // Yes mixing and matching is a pain in the ass, but so is calculating a hash of c style string
-    std::unordered_set<std::string> boundUniforms;
+    // Reflected once after linking, the draw loop only looks up handles (indices into uniforms)
+#define INVALID_UNIFORM -1
+#define MAX_REFLECTED_SAMPLERS 64
+    struct Uniform
+    {
+        // Without the "[0]" of arrays
+        std::string name;
+        unsigned long nameHash;
+        GLint location;
+        GLenum type;
+        // Bit in boundSamplers, -1 if not a sampler
+        int samplerIndex;
+        // Texture unit last assigned to a sampler, -1 if not known
+        int samplerUnit;
+    };
+    struct Block
+    {
+        std::string name;
+        // GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK
+        GLenum interface;
+        GLuint index;
+    };
+    std::vector<Uniform> uniforms;
+    std::vector<Block> blocks;
+    // Unique per successful compile, so that callers can cache handles across hot reloads
+    unsigned int reflectionId;
+    // No vertex attribute but location 0 is active, draws can use GeometryArena's positions only VAO
+    bool readsPositionsOnly;
+
+    void Reflect();
+    int FindUniform(const char* name) const;
+    GLuint FindBlock(const char* name, GLenum interface) const;
+
+    // Samplers and uniforms set since the last Use(). Samplers with a binding layout qualifier always count as set.
+    uint64_t boundSamplers;
+    uint64_t layoutBoundSamplers = 0;
+    std::vector<bool> boundUniforms;
 
     void Use();
 
@@ -142,6 +208,17 @@ public:
     void SetUniform(const char *name, glm::mat3 data);
     void SetUniform(const char *name, glm::mat4 data);
 
+    // Handle versions, uniform is the result of FindUniform. INVALID_UNIFORM is ignored.
+    void SetUniform(int uniform, bool data);
+    void SetUniform(int uniform, int data);
+    void SetUniform(int uniform, float data);
+    void SetUniform(int uniform, glm::vec2 data);
+    void SetUniform(int uniform, glm::vec3 data);
+    void SetUniform(int uniform, glm::vec4 data);
+    void SetUniform(int uniform, glm::mat2 data);
+    void SetUniform(int uniform, glm::mat3 data);
+    void SetUniform(int uniform, glm::mat4 data);
+
     void AddDummyForUnboundTextures(int dummyTextureUnit);
     void ReportUnboundUniforms();
 };
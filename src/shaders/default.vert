@@ -1,12 +1,14 @@
-#version 330 core
+#version 460 core
+// Unorm over the mesh's bounds, the instance's model matrix dequantizes them
 layout (location = 0) in vec3 vert_pos;
-layout (location = 1) in vec3 vert_norm;
-layout (location = 2) in vec3 vert_tan;
-layout (location = 3) in vec2 vert_uv;
+// xy - octahedral normal, zw - octahedral tangent
+layout (location = 1) in vec4 vert_norm_tan;
+layout (location = 2) in vec2 vert_uv;
 
 out vec3 Pos;
 out vec3 Normal;
 out vec2 Uv;
+flat out uint MaterialIndex;
 
 layout (std140) uniform CameraParams
 {
@@ -17,18 +19,41 @@ layout (std140) uniform CameraParams
     vec4 nearFarPlanes;
 };
 
-layout (std140) uniform ModelParams
+struct MeshInstance
 {
+    // Mesh model matrix times the GeometryArena position dequantization
     mat4 model;
+    // transpose(inverse(mat3(model))) of the mesh's own model matrix
+    mat3 normalMatrix;
+    uvec4 material;
 };
+layout (std430) readonly buffer Instances
+{
+    MeshInstance instances[];
+};
+
+// GeometryArena::PackedAttributes
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 v = vec3(e, 1.f - abs(e.x) - abs(e.y));
+    if (v.z < 0.f)
+    {
+        v.xy = (1.f - abs(v.yx)) * vec2(v.x >= 0.f ? 1.f : -1.f, v.y >= 0.f ? 1.f : -1.f);
+    }
+    return normalize(v);
+}
 
 void main()
 {
+    MeshInstance instance = instances[gl_BaseInstance + gl_InstanceID];
+    mat4 model = instance.model;
+    MaterialIndex = instance.material.x;
+
     Pos = (model * vec4(vert_pos, 1.f)).xyz;
     Uv = vert_uv;
 
-    mat3 normalRecalculationMatrix = transpose(inverse(mat3(model)));
-    Normal = normalize(normalRecalculationMatrix * vert_norm);
+    mat3 normalRecalculationMatrix = instance.normalMatrix;
+    Normal = normalize(normalRecalculationMatrix * octahedralDecode(vert_norm_tan.xy));
 
     gl_Position = viewProjection * model * vec4(vert_pos, 1.f);
 }
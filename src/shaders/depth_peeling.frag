@@ -1,4 +1,4 @@
-#version 330 core
+#version 430 core
 in vec3 Pos;
 in vec3 Normal;
 in vec2 Uv;
@@ -16,11 +16,16 @@ layout (std140) uniform SceneParams
     float viewportHeight;
 };
 
-layout (std140) uniform MaterialParams
+flat in uint MaterialIndex;
+struct Material
 {
     vec4 tintAndOpacity;
     vec4 specularitySpecularStrDoShadingIsParticle;
 };
+layout (std430) readonly buffer Materials
+{
+    Material materials[];
+};
 uniform sampler2D particle_tex;
 
 uniform sampler2D greater_depth;
@@ -30,6 +35,9 @@ vec3 gammaCorrect(vec3 color, float gamma);
 
 void main()
 {
+    vec4 tintAndOpacity = materials[MaterialIndex].tintAndOpacity;
+    vec4 specularitySpecularStrDoShadingIsParticle = materials[MaterialIndex].specularitySpecularStrDoShadingIsParticle;
+
     vec2 fragmentPos = gl_FragCoord.xy / vec2(viewportWidth, viewportHeight);
     float z = gl_FragCoord.z;
 
@@ -0,0 +1,37 @@
+#version 460 core
+// Only the position, draws fetch just GeometryArena's position stream
+layout (location = 0) in vec3 aPos;
+
+// The geometry subpass tests against this depth with GL_EQUAL, both have to compute the exact same positions
+invariant gl_Position;
+
+layout (std140) uniform CameraParams
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPos;
+    vec4 nearFarPlanes;
+};
+
+struct MeshInstance
+{
+    // Mesh model matrix times the GeometryArena position dequantization
+    mat4 model;
+    // transpose(inverse(mat3(model))) of the mesh's own model matrix
+    mat3 normalMatrix;
+    uvec4 material;
+};
+layout (std430) readonly buffer Instances
+{
+    MeshInstance instances[];
+};
+
+void main()
+{
+    MeshInstance instance = instances[gl_BaseInstance + gl_InstanceID];
+    mat4 model = instance.model;
+
+    // Same expression as geometry_buffer.vert
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
@@ -1,8 +1,6 @@
-#version 330 core
+#version 460 core
+// Only the position, draws fetch just GeometryArena's position stream
 layout (location = 0) in vec3 vert_pos;
-layout (location = 1) in vec3 vert_norm;
-layout (location = 2) in vec3 vert_tan;
-layout (location = 3) in vec2 vert_uv;
 
 out vec3 Pos;
 
@@ -24,13 +22,24 @@ layout (std140) uniform Lighting
     vec4 directionalBiasAndAngleBias;
 };
 
-layout (std140) uniform ModelParams
+struct MeshInstance
 {
+    // Mesh model matrix times the GeometryArena position dequantization
     mat4 model;
+    // transpose(inverse(mat3(model))) of the mesh's own model matrix
+    mat3 normalMatrix;
+    uvec4 material;
+};
+layout (std430) readonly buffer Instances
+{
+    MeshInstance instances[];
 };
 
 void main()
 {
+    MeshInstance instance = instances[gl_BaseInstance + gl_InstanceID];
+    mat4 model = instance.model;
+
     Pos = vec3(directionalLightViewProjection * model * vec4(vert_pos, 1.f));
     gl_Position = directionalLightViewProjection * model * vec4(vert_pos, 1.f);
 }
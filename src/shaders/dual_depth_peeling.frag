@@ -1,4 +1,4 @@
-#version 330 core
+#version 430 core
 layout (location = 0) out vec2 minMaxDepth;
 layout (location = 1) out vec4 frontBlender;
 layout (location = 2) out vec4 tempBackBlender;
@@ -37,11 +37,16 @@ layout (std140) uniform Lighting
 
 uniform sampler2D shadow_map;
 
-layout (std140) uniform MaterialParams
+flat in uint MaterialIndex;
+struct Material
 {
     vec4 tintAndOpacity;
     vec4 specularitySpecularStrDoShadingIsParticle;
 };
+layout (std430) readonly buffer Materials
+{
+    Material materials[];
+};
 
 uniform sampler2D previousDepthBlender;
 uniform sampler2D previousFrontBlender;
@@ -67,6 +72,9 @@ vec4 under(vec4 backColor, vec4 frontColor)
 
 void main()
 {
+    vec4 tintAndOpacity = materials[MaterialIndex].tintAndOpacity;
+    vec4 specularitySpecularStrDoShadingIsParticle = materials[MaterialIndex].specularitySpecularStrDoShadingIsParticle;
+
     float fragDepth = gl_FragCoord.z;
 
     vec2 uv = gl_FragCoord.xy / vec2(viewportWidth, viewportHeight);
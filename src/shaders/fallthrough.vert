@@ -1,13 +1,27 @@
-#version 330 core
+#version 460 core
+// Unorm over the mesh's bounds, the instance's model matrix dequantizes them
 layout (location = 0) in vec3 vert_pos;
-layout (location = 1) in vec3 vert_norm;
-layout (location = 2) in vec3 vert_tan;
-layout (location = 3) in vec2 vert_uv;
+layout (location = 1) in vec4 vert_norm_tan;
+layout (location = 2) in vec2 vert_uv;
 
 out vec2 uv;
 
+struct MeshInstance
+{
+    // Mesh model matrix times the GeometryArena position dequantization
+    mat4 model;
+    // transpose(inverse(mat3(model))) of the mesh's own model matrix
+    mat3 normalMatrix;
+    uvec4 material;
+};
+layout (std430) readonly buffer Instances
+{
+    MeshInstance instances[];
+};
+
 void main()
 {
-    gl_Position = vec4(vert_pos, 1.f);
+    // Screen quads have an identity transform, the model matrix is just the dequantization
+    gl_Position = vec4((instances[gl_BaseInstance + gl_InstanceID].model * vec4(vert_pos, 1.f)).xyz, 1.f);
     uv = vert_uv;
 }
@@ -1,4 +1,4 @@
-#version 330 core
+#version 430 core
 
 out vec4 FragColor;
 
@@ -17,11 +17,16 @@ layout (std140) uniform SceneParams
     float viewportHeight;
 };
 
-layout (std140) uniform MaterialParams
+flat in uint MaterialIndex;
+struct Material
 {
     vec4 tintAndOpacity;
     vec4 specularitySpecularStrDoShadingIsParticle;
 };
+layout (std430) readonly buffer Materials
+{
+    Material materials[];
+};
 uniform sampler2D particle_tex;
 
 vec3 shade(vec3 pos, vec3 color, vec3 normal, float specularity, float specularStrength, vec2 uv);
@@ -29,6 +34,9 @@ vec3 gammaCorrect(vec3 color, float gamma);
 
 void main()
 {
+    vec4 tintAndOpacity = materials[MaterialIndex].tintAndOpacity;
+    vec4 specularitySpecularStrDoShadingIsParticle = materials[MaterialIndex].specularitySpecularStrDoShadingIsParticle;
+
     vec2 fragmentPos = gl_FragCoord.xy / vec2(viewportWidth, viewportHeight);
     
     vec4 color = tintAndOpacity;
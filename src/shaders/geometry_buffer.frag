@@ -1,4 +1,7 @@
-#version 330 core
+#version 460 core
+#if BINDLESS_TEXTURES
+#extension GL_ARB_bindless_texture : require
+#endif
 layout (location = 0) out vec3 gPosition;
 layout (location = 1) out vec3 gNormal;
 layout (location = 2) out vec3 gAlbedo;
@@ -12,15 +15,26 @@ in mat3 Tbn;
 in vec3 Tangent;
 
 in vec3 Barycentric;
-
-uniform bool usingNormalMap;
+flat in uint TextureSetIndex;
 
 uniform bool showModelNormals;
 uniform bool showNonTBNNormals;
 
-uniform sampler2D tex_diffuse;
-uniform sampler2D tex_normal;
-uniform sampler2D tex_specular;
+struct TextureSet
+{
+    // Bindless - diffuse and normal handles, otherwise diffuse and normal texture arrays and layers
+    uvec4 diffuseAndNormal;
+    // xy - specular handle or array and layer, z - using a normal map
+    uvec4 specularAndFlags;
+};
+layout (std430) readonly buffer TextureSets
+{
+    TextureSet textureSets[];
+};
+
+#if !BINDLESS_TEXTURES
+layout (binding = TEXTURE_ARRAY_FIRST_UNIT) uniform sampler2DArray textureArrays[TEXTURE_ARRAY_COUNT];
+#endif
 
 layout (std140) uniform SceneParams
 {
@@ -38,8 +52,33 @@ vec3 fwidth(vec3 vec)
       return abs(dFdx(vec)) + abs(dFdy(vec));
 }
 
+// reference is a bindless handle, or a texture array and layer. Gradients come from uniform control flow.
+vec4 sampleResident(uvec2 reference, vec2 uv, vec2 uvDx, vec2 uvDy)
+{
+#if BINDLESS_TEXTURES
+    return textureGrad(sampler2D(reference), uv, uvDx, uvDy);
+#else
+    // Sampler arrays may only be indexed with constants or dynamically uniform values, the loop index is one.
+    // TEXTURE_ARRAY_COUNT is the number of arrays the scene's textures actually needed, usually a handful
+    vec3 uvLayer = vec3(uv, float(reference.y));
+    for (int i = 0; i < TEXTURE_ARRAY_COUNT - 1; i++)
+    {
+        if (reference.x == uint(i))
+        {
+            return textureGrad(textureArrays[i], uvLayer, uvDx, uvDy);
+        }
+    }
+    return textureGrad(textureArrays[TEXTURE_ARRAY_COUNT - 1], uvLayer, uvDx, uvDy);
+#endif
+}
+
 void main()
 {    
+    vec2 uvDx = dFdx(TexCoords);
+    vec2 uvDy = dFdy(TexCoords);
+    TextureSet textureSet = textureSets[TextureSetIndex];
+    bool usingNormalMap = textureSet.specularAndFlags.z != 0;
+
     float minBary = 1;
     if (wireframe)
     {
@@ -54,12 +93,17 @@ void main()
     vec3 normal;
     if (usingNormalMap && !showModelNormals)
     {
-        normal = texture(tex_normal, TexCoords).rgb;
+        // Only xy are guaranteed to be there (BC5 baked normal maps), reconstruct z
+        vec2 tangentNormal = sampleResident(textureSet.diffuseAndNormal.zw, TexCoords, uvDx, uvDy).rg * 2.f - 1.f;
+        normal = vec3(tangentNormal, sqrt(max(1.f - dot(tangentNormal, tangentNormal), 0.f)));
         if (!showNonTBNNormals)
         {
-            normal = normal * 2.f - 1.f;
             normal = Tbn * normal;
         }
+        else
+        {
+            normal = normal * 0.5f + 0.5f;
+        }
     }
     else
     {
@@ -67,9 +111,9 @@ void main()
     }
 
     gNormal = normalize(normal);
-    gAlbedo = minBary * texture(tex_diffuse, TexCoords).rgb;
+    gAlbedo = minBary * sampleResident(textureSet.diffuseAndNormal.xy, TexCoords, uvDx, uvDy).rgb;
 
-    //gSpec.rgb = texture(tex_specular, TexCoords).rrr;
+    //gSpec.rgb = sampleResident(textureSet.specularAndFlags.xy, TexCoords, uvDx, uvDy).rrr;
     gSpec.rgb = vec3(1.f, 0.f, 0.f);
 }
 
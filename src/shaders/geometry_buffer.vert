@@ -1,8 +1,9 @@
-#version 330 core
+#version 460 core
+// Unorm over the mesh's bounds, the instance's model matrix dequantizes them
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec4 aTangent;
-layout (location = 3) in vec2 aTexCoords;
+// xy - octahedral normal, zw - octahedral tangent with the bitangent sign in z's sign
+layout (location = 1) in vec4 aNormalTangent;
+layout (location = 2) in vec2 aTexCoords;
 
 out vec3 vWorldFragPos;
 out vec4 vFragPos;
@@ -10,8 +11,11 @@ out vec2 vTexCoords;
 out vec3 vNormal;
 out mat3 vTbn;
 out vec3 vTangent;
+flat out uint vMaterialIndex;
+flat out uint vTextureSetIndex;
 
-uniform bool usingNormalMap;
+// Matches depth_prepass.vert's depth exactly, the geometry subpass may test against it with GL_EQUAL
+invariant gl_Position;
 
 uniform bool showModelNormals;
 uniform bool showNonTBNNormals;
@@ -25,22 +29,53 @@ layout (std140) uniform CameraParams
     vec4 nearFarPlanes;
 };
 
-layout (std140) uniform ModelParams
+struct MeshInstance
 {
+    // Mesh model matrix times the GeometryArena position dequantization
     mat4 model;
+    // transpose(inverse(mat3(model))) of the mesh's own model matrix
+    mat3 normalMatrix;
+    uvec4 material;
+};
+layout (std430) readonly buffer Instances
+{
+    MeshInstance instances[];
 };
 
+// GeometryArena::PackedAttributes
+vec3 octahedralDecode(vec2 e)
+{
+    vec3 v = vec3(e, 1.f - abs(e.x) - abs(e.y));
+    if (v.z < 0.f)
+    {
+        v.xy = (1.f - abs(v.yx)) * vec2(v.x >= 0.f ? 1.f : -1.f, v.y >= 0.f ? 1.f : -1.f);
+    }
+    return normalize(v);
+}
+
+vec4 tangentDecode(vec2 e)
+{
+    return vec4(octahedralDecode(vec2(abs(e.x) * 2.f - 1.f, e.y)), e.x < 0.f ? -1.f : 1.f);
+}
+
 void main()
 {
+    MeshInstance instance = instances[gl_BaseInstance + gl_InstanceID];
+    mat4 model = instance.model;
+    vMaterialIndex = instance.material.x;
+    vTextureSetIndex = instance.material.y;
+
     vWorldFragPos = (model * vec4(aPos, 1.0)).xyz;
     vFragPos = projection * view * model * vec4(aPos, 1.0);
     vTexCoords = aTexCoords;
                     
-    mat3 normalRecalculationMatrix = transpose(inverse(mat3(model)));
-    vNormal = normalize(normalRecalculationMatrix * aNormal.xyz);
-    if (usingNormalMap && !showModelNormals)
+    mat3 normalRecalculationMatrix = instance.normalMatrix;
+    vNormal = normalize(normalRecalculationMatrix * octahedralDecode(aNormalTangent.xy));
+    // Whether there's a normal map is up to the fragment shader's texture set
+    if (!showModelNormals)
     {
         vec3 N = vNormal;
+        vec4 aTangent = tangentDecode(aNormalTangent.zw);
         vec3 T = normalize(normalRecalculationMatrix * aTangent.xyz);
         T = normalize(T - dot(T, N) * N);
         vec3 B = cross(N, T) * aTangent.w;
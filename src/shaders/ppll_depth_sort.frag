@@ -39,11 +39,6 @@ struct TransparencyData
     uint nextFragmentIndex;
 };
 
-layout (std140) uniform MaterialParams
-{
-    vec4 tintAndOpacity;
-    vec4 specularitySpecularStrDoShadingIsParticle;
-};
 
 layout (binding = ppllHeads_AUTO_BINDING, r32ui) uniform uimage2D ppllHeads;
 layout (binding = transparentFragmentCount_AUTO_BINDING) uniform atomic_uint transparentFragmentCount;
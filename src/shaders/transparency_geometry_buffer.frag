@@ -39,11 +39,16 @@ struct TransparencyData
     uint nextFragmentIndex;
 };
 
-layout (std140) uniform MaterialParams
+flat in uint MaterialIndex;
+struct Material
 {
     vec4 tintAndOpacity;
     vec4 specularitySpecularStrDoShadingIsParticle;
 };
+layout (std430) readonly buffer Materials
+{
+    Material materials[];
+};
 uniform sampler2D particle_tex;
 
 layout (binding = ppllHeads_AUTO_BINDING, r32ui) uniform uimage2D ppllHeads;
@@ -54,7 +59,10 @@ layout (binding = TransparentFragments_AUTO_BINDING, std430) buffer TransparentF
 };
 
 void main()
-{    
+{
+    vec4 tintAndOpacity = materials[MaterialIndex].tintAndOpacity;
+    vec4 specularitySpecularStrDoShadingIsParticle = materials[MaterialIndex].specularitySpecularStrDoShadingIsParticle;
+
     const int maxTransparencyLayers = 16;
     const int linkedListSize = 1920 * 1080 * maxTransparencyLayers;
     if (atomicCounter(transparentFragmentCount) >= linkedListSize)
@@ -69,12 +77,17 @@ void main()
     vec3 normal;
     if (usingNormalMap && !showModelNormals)
     {
-        normal = texture(tex_normal, TexCoords).rgb;
+        // Only xy are guaranteed to be there (BC5 baked normal maps), reconstruct z
+        vec2 tangentNormal = texture(tex_normal, TexCoords).rg * 2.f - 1.f;
+        normal = vec3(tangentNormal, sqrt(max(1.f - dot(tangentNormal, tangentNormal), 0.f)));
         if (!showNonTBNNormals)
         {
-            normal = normal * 2.f - 1.f;
             normal = Tbn * normal;
         }
+        else
+        {
+            normal = normal * 0.5f + 0.5f;
+        }
     }
     else
     {
@@ -27,11 +27,16 @@ layout (std140) uniform CameraParams
     vec4 nearFarPlanes;
 };
 
-layout (std140) uniform MaterialParams
+flat in uint MaterialIndex;
+struct Material
 {
     vec4 tintAndOpacity;
     vec4 specularitySpecularStrDoShadingIsParticle;
 };
+layout (std430) readonly buffer Materials
+{
+    Material materials[];
+};
 uniform sampler2D particle_tex;
 
 layout (binding = transparencyDepth_AUTO_BINDING, r32ui) uniform uimage2D transparencyDepth;
@@ -41,6 +46,9 @@ float linearizeDepthFromCameraParams(float depth);
 
 void main()
 {
+    vec4 tintAndOpacity = materials[MaterialIndex].tintAndOpacity;
+    vec4 specularitySpecularStrDoShadingIsParticle = materials[MaterialIndex].specularitySpecularStrDoShadingIsParticle;
+
     vec2 fragmentPos = gl_FragCoord.xy / vec2(viewportWidth, viewportHeight);
 
     vec4 particleTextureColor = vec4(1.f);
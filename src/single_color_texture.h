@@ -1,3 +1,5 @@
+#pragma once
+
 #include "texture.h"
 
 class SingleColorTexture 
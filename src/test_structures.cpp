@@ -1,11 +1,15 @@
 #include "test_structures.h"
 
+#include <algorithm>
+#include <string.h>
+
 #include "model.h"
 #include "mesh.h"
 #include "material.h"
 #include "log.h"
 #include "particle_sys.h"
 #include "random.h"
+#include "texture_residency.h"
 
 #define STRINGIFY(x) #x
 #define STRINGIFY_VALUE(x) STRINGIFY(x) 
@@ -14,7 +18,7 @@ void AddModel(Model& model, Transform& transform, MeshTag meshTag, Material* mat
 {
     for (auto& mesh : model.meshes)
     {
-        mesh.transform = transform;
+        mesh.SetLocalTransform(transform);
         scene.meshes[meshTag].push_back({ mesh, material });
     }
 }
@@ -36,6 +40,9 @@ Scene TestScene()
 #define POINT_LIGHTS "PointLights"
     scene.globalAttachments.AddAttachment(RenderpassAttachment::SSBO(POINT_LIGHTS, sizeof(Scene::Lights)));
     scene.globalAttachments.AddDefine(STRINGIFY(MAX_POINT_LIGHTS), STRINGIFY_VALUE(MAX_POINT_LIGHTS));
+    // Where mesh textures come from, see TextureResidency
+    scene.globalAttachments.AddDefine("BINDLESS_TEXTURES", TextureResidency::Get().bindless ? 1 : 0);
+    scene.globalAttachments.AddDefine("TEXTURE_ARRAY_FIRST_UNIT", STRINGIFY_VALUE(TEXTURE_RESIDENCY_FIRST_ARRAY_UNIT));
 #define LIGHT_TILE_CULLING_SUBPASS "Light tile culling subpass"
 #define LIGHT_TILE_CULLING_GROUP_SIZE 16
     scene.globalAttachments.AddDefine("LIGHT_TILE_CULLING_WORK_GROUP_SIZE_X", STRINGIFY_VALUE(LIGHT_TILE_CULLING_GROUP_SIZE));
@@ -89,19 +96,11 @@ Scene TestScene()
     scene.sceneParams.viewportHeight = 1080.f;
 
     Material* proxyMat = new TransparentMaterial(0.f, 1.f, 1.f, 0.2f, 1.f, 1.f);
-    proxyMat->Bind();
-    proxyMat->UpdateData();
 
     Material* opaqueMat = new OpaqueMaterial();
     TransparentMaterial* blueTransparentMat = new TransparentMaterial(0.f, 0.f, 1.f, 0.1f, 256.f, 10.f);
-    blueTransparentMat->Bind();
-    blueTransparentMat->UpdateData();
     TransparentMaterial* greenTransparentMat = new TransparentMaterial(0.f, 1.f, 0.f, 0.2f, 256.f, 10.f);
-    greenTransparentMat->Bind();
-    greenTransparentMat->UpdateData();
     TransparentMaterial* redTransparentMat = new TransparentMaterial(1.f, 0.f, 0.f, 0.4f, 256.f, 10.f);
-    redTransparentMat->Bind();
-    redTransparentMat->UpdateData();
 
     Model dragon = Model("../assets/dragon.obj");
     Model sponza = Model("../assets/sponza/sponza.obj");
@@ -169,12 +168,14 @@ Scene TestScene()
 
 #define PARTICLE_COUNT 300
     std::vector<MeshWithMaterial*> particles;
+    // Shared geometry, particles with the same texture are drawn as one instanced batch
+    Mesh particleQuad = Mesh::ScreenQuadMesh();
     for (int i = 0; i < PARTICLE_COUNT; i++)
     {
-        Mesh mesh = Mesh::ScreenQuadMesh();
+        Mesh mesh = particleQuad;
         mesh.meshTag = PARTICLE;
-        mesh.aabbModelSpace = AABB(glm::vec3(-1.f, -1.f, 0.f), glm::vec3(1.f, 1.f, 0.f));
-        mesh.transform.scale = glm::vec3(300.f);
+        mesh.SetModelSpaceBounds(AABB(glm::vec3(-1.f, -1.f, 0.f), glm::vec3(1.f, 1.f, 0.f)));
+        mesh.SetLocalTransform(Transform(glm::vec3(0.f), glm::quat(glm::vec3(0.f)), glm::vec3(300.f)));
         mesh.textures["particle_tex"] = smokeTextures[i % 10];
         // Only shade particles in one cluster, leave the other unshaded
 
@@ -216,6 +217,21 @@ Scene TestScene()
     particleSystemCenter.scale = glm::vec3(1500.f);
     AddModel(cube, particleSystemCenter, PROXY, opaqueMat, scene);
 
+    // The texture arrays are sized for the textures of every mesh that samples them, before any shader is compiled
+    for (auto& tagMeshes : scene.meshes)
+    {
+        if ((tagMeshes.first & RenderPipeline::residentTextureTags) == 0)
+        {
+            continue;
+        }
+        for (MeshWithMaterial& meshWithMaterial : tagMeshes.second)
+        {
+            meshWithMaterial.mesh.ResidentTextureSet();
+        }
+    }
+    TextureResidency::Get().AllocateArrays();
+    scene.globalAttachments.AddDefine("TEXTURE_ARRAY_COUNT", TextureResidency::Get().ArrayCount());
+
     return scene;
 }
 
@@ -228,6 +244,7 @@ struct PipelineWithShadowmap
 PipelineWithShadowmap UnconfiguredDeferredPipeline(Renderpass& globalAttachments, ShaderPool& shaders)
 {
     RenderPipeline pipeline;
+    pipeline.AddCullingPass(shaders);
 
     Renderpass& directionalShadowmapGenPass = pipeline.AddPass("Directional shadowmap gen pass");
     RenderpassAttachment& shadowmap = directionalShadowmapGenPass.AddAttachment(RenderpassAttachment("shadowmap", AttachmentFormat::DEPTH));
@@ -236,12 +253,14 @@ PipelineWithShadowmap UnconfiguredDeferredPipeline(Renderpass& globalAttachments
             ShaderDescriptor::File(SHADER_PATH "directional_shadowmap_gen.vert", ShaderDescriptor::VERTEX_SHADER),
             ShaderDescriptor::File(SHADER_PATH "empty.frag", ShaderDescriptor::FRAGMENT_SHADER)
         }, globalAttachments.DefineValues()));
-    directionalShadowmapGenPass.AddSubpass("Gen subpass", &directionalShadowmapGenShader, OPAQUE,
+    Subpass& shadowmapGenSubpass = directionalShadowmapGenPass.AddSubpass("Gen subpass", &directionalShadowmapGenShader, OPAQUE,
         {
             // TODO: remove this color attachment
             SubpassAttachment(&directionalShadowmapGenPass.AddAttachment(RenderpassAttachment("unnecessary color", AttachmentFormat::FLOAT_4)), SubpassAttachment::AS_COLOR),
             SubpassAttachment(&shadowmap, SubpassAttachment::AS_DEPTH)
         });
+    // Shadow map texels are larger than screen pixels, coarser LODs don't show
+    shadowmapGenSubpass.lodBias = 1;
 
     // Proxy geometry
     Shader& noShadingShader = shaders.GetShader(
@@ -258,7 +277,8 @@ PipelineWithShadowmap UnconfiguredDeferredPipeline(Renderpass& globalAttachments
             SubpassAttachment(&proxyDepthRenderpass.AddAttachment(RenderpassAttachment("unnecessary color", AttachmentFormat::FLOAT_4)), SubpassAttachment::AS_COLOR),
             SubpassAttachment(&proxyMinDepth, SubpassAttachment::AS_DEPTH)
         });
-
+    // Only a conservative min depth is needed from proxies
+    subpass.lodBias = 2;
 
 #define DEFERRED_PASS "Deferred pass"
     Renderpass& deferredLightingPass = pipeline.AddPass(DEFERRED_PASS);
@@ -275,7 +295,7 @@ PipelineWithShadowmap UnconfiguredDeferredPipeline(Renderpass& globalAttachments
             ShaderDescriptor::File(SHADER_PATH "geometry_buffer.frag", ShaderDescriptor::FRAGMENT_SHADER)
         }, globalAttachments.DefineValues()));
 #define GEOMETRY_SUBPASS "Geometry subpass"
-    deferredLightingPass.AddSubpass(GEOMETRY_SUBPASS, &geometryShader, OPAQUE,
+    Subpass& geometrySubpass = deferredLightingPass.AddSubpass(GEOMETRY_SUBPASS, &geometryShader, OPAQUE,
         {
             SubpassAttachment(&deferredDepth,    SubpassAttachment::AS_DEPTH),
             SubpassAttachment(&deferredPosition, SubpassAttachment::AS_COLOR),
@@ -283,6 +303,12 @@ PipelineWithShadowmap UnconfiguredDeferredPipeline(Renderpass& globalAttachments
             SubpassAttachment(&deferredAlbedo,   SubpassAttachment::AS_COLOR),
             SubpassAttachment(&deferredSpecular, SubpassAttachment::AS_COLOR),
         });
+    // Overdraw only costs depth, rather than the MRT writes and texture fetches of the G-buffer. Toggled at runtime
+    // through RenderPipeline::depthPrepass.
+    pipeline.AddDepthPrepassSubpass(deferredLightingPass, geometrySubpass, shaders);
+
+    // Light tile depth bounds, and occlusion culling for the next frame
+    RenderpassAttachment& depthPyramid = pipeline.AddDepthPyramidSubpass(deferredLightingPass, shaders, deferredDepth, proxyMinDepth);
 
     PassSettings lightTileCullingSettings = PassSettings::DefaultSubpassSettings();
     lightTileCullingSettings.computeWorkGroups = glm::ivec3(LIGHT_TILE_COUNT_X, LIGHT_TILE_COUNT_Y, 1);
@@ -292,8 +318,7 @@ PipelineWithShadowmap UnconfiguredDeferredPipeline(Renderpass& globalAttachments
         }, globalAttachments.DefineValues(deferredLightingPass.DefineValues())));
     deferredLightingPass.AddSubpass(LIGHT_TILE_CULLING_SUBPASS, &lightTileCullingShader, COMPUTE,
         {
-            SubpassAttachment(&deferredDepth,    SubpassAttachment::AS_TEXTURE, "tex_depth"),
-            SubpassAttachment(&proxyMinDepth,    SubpassAttachment::AS_TEXTURE, "tex_proxy_depth"),
+            SubpassAttachment(&depthPyramid,     SubpassAttachment::AS_TEXTURE, "tex_depth_pyramid"),
             SubpassAttachment(&globalAttachments.GetAttachment(POINT_LIGHTS), SubpassAttachment::AS_SSBO, POINT_LIGHTS),
             SubpassAttachment(&globalAttachments.GetAttachment(LIGHT_TILE_DATA), SubpassAttachment::AS_SSBO, LIGHT_TILE_DATA),
             SubpassAttachment(&globalAttachments.GetAttachment(LIGHT_IDS), SubpassAttachment::AS_SSBO, LIGHT_IDS),
@@ -1159,3 +1184,27 @@ std::vector<NamedPipeline> TestPipelines(Renderpass& globalAttachments, ShaderPo
             { "Cluster collapse: PPLL (simple) + depth-weight blended particles", ClusterCollapse(globalAttachments, shaders).pipeline },
         };
 }
+
+void UpdateTransparentMeshOrder(NamedPipeline& pipeline, Scene& scene)
+{
+    static bool requiresShuffle = false;
+    if (strcmp(pipeline.name, "Sorted forward transparency") == 0)
+    {
+        std::vector<MeshWithMaterial>& transparentMeshes = scene.meshes[TRANSPARENT]; 
+        std::sort(transparentMeshes.begin(), transparentMeshes.end(), 
+            [&](const MeshWithMaterial& a, const MeshWithMaterial& b) -> bool
+            {
+                return glm::distance(a.mesh.LocalTransform().pos, scene.camera.transform.pos) > glm::distance(b.mesh.LocalTransform().pos, scene.camera.transform.pos);
+            });
+
+        requiresShuffle = true;
+    }
+    if (strcmp(pipeline.name, "Unsorted forward transparency") == 0 && requiresShuffle)
+    {
+        std::vector<MeshWithMaterial>& transparentMeshes = scene.meshes[TRANSPARENT]; 
+        // Shared engine so that seeded (headless) runs shuffle the same way every time
+        std::shuffle(transparentMeshes.begin(), transparentMeshes.end(), RandomEngine());
+
+        requiresShuffle = false;
+    }
+}
@@ -15,3 +15,6 @@ struct NamedPipeline
     RenderPipeline pipeline;
 };
 std::vector<NamedPipeline> TestPipelines(Renderpass& globalAttachments, ShaderPool& shaders);
+
+// Sorts/shuffles transparent meshes for the forward transparency pipelines, to display issues with unsorted transparency
+void UpdateTransparentMeshOrder(NamedPipeline& pipeline, Scene& scene);
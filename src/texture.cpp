@@ -1,5 +1,6 @@
 #include <stdio.h>
 
+#include "compressed_texture.h"
 #include "texture.h"
 #include "log.h"
 
@@ -41,7 +42,17 @@ bool Texture::Load(bool reload)
 
     glBindTexture(GL_TEXTURE_2D, id);
 
-    if (filepath != "")
+    if (filepath != "" && CompressedTexture::HasUpToDateContainer(filepath))
+    {
+        CompressedTexture compressed;
+        if (!compressed.Read(CompressedTexture::ContainerPath(filepath).c_str()))
+        {
+            return false;
+        }
+
+        UploadCompressed(compressed, compressed.data.data());
+    }
+    else if (filepath != "")
     {
         int _;
 
@@ -92,6 +103,42 @@ bool Texture::Load(bool reload)
     return true;
 }
 
+GLenum ToGLCompressedFormat(BlockFormat format)
+{
+    switch (format)
+    {
+    case BlockFormat::BC1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BlockFormat::BC3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BlockFormat::BC5:
+        return GL_COMPRESSED_RG_RGTC2;
+    }
+    return GL_INVALID_ENUM;
+}
+
+void Texture::UploadCompressed(const CompressedTexture& compressed, const unsigned char* levelData)
+{
+    LOG_INFO("Texture", "Loading compressed texture %s %dx%d %s", filepath, compressed.width, compressed.height, ToString(compressed.format));
+    size = glm::ivec2(compressed.width, compressed.height);
+
+    glBindTexture(GL_TEXTURE_2D, id);
+    GLenum format = ToGLCompressedFormat(compressed.format);
+    for (int i = 0; i < compressed.levels.size(); i++)
+    {
+        const CompressedMipLevel& level = compressed.levels[i];
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0, level.size, levelData + level.offset);
+    }
+
+    // The whole chain is baked, no glGenerateMipmap
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, compressed.levels.size() - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    loaded = true;
+}
+
 void Texture::Activate(GLenum textureNumber) const
 {
     assert(("Cannot bind an unloaded texture", loaded));
@@ -1,10 +1,17 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <stdint.h>
+
 #include <GL/glew.h>
 
 #include "glm/glm.hpp"
 
+struct CompressedTexture;
+enum class BlockFormat : uint32_t;
+
+GLenum ToGLCompressedFormat(BlockFormat format);
+
 class Texture 
 {
 public:
@@ -14,6 +21,9 @@ public:
     virtual ~Texture();
 
     virtual bool Load(bool reload = false);
+    // Uploads every level of a baked container with glCompressedTexImage2D. levelData points to the
+    // container's data in client memory, or is an offset into the bound GL_PIXEL_UNPACK_BUFFER.
+    void UploadCompressed(const CompressedTexture& compressed, const unsigned char* levelData);
 
     void Activate(GLenum textureNumber) const;
     void Bind() const;
@@ -1,13 +1,464 @@
 #include "texture_pool.h"
 
+#include <deque>
+#include <limits.h>
+#include <string.h>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+
+#include "stb_image.h"
+
+#include "compressed_texture.h"
+#include "log.h"
+#include "mpmc_queue.h"
+#include "single_color_texture.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Staging memory for texel uploads, anything larger falls back to a direct client memory upload
+#define TEXTURE_UPLOAD_RING_SIZE (64 * 1024 * 1024)
+#define TEXTURE_UPLOAD_ALIGNMENT 256
+#define DECODED_TEXTURE_QUEUE_CAPACITY 256
+#define TEXTURE_DECODE_THREADS 4
+
+struct DecodedTexture
+{
+    Texture* texture;
+    // Either a baked container or stb decoded pixels
+    CompressedTexture* compressed;
+    unsigned char* pixels;
+    glm::ivec2 size;
+    int componentNum;
+};
+
+// Persistently mapped pixel unpack buffer used as a ring. Every upload fences its region, a region
+// is only reused once the GPU has consumed it.
+struct TextureUploadRing
+{
+    struct Region
+    {
+        long begin;
+        long end;
+        GLsync fence;
+    };
+
+    unsigned int pbo = 0;
+    unsigned char* mapping = nullptr;
+    long head = 0;
+    std::deque<Region> inFlight;
+
+    void Init()
+    {
+        glGenBuffers(1, &pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_PIXEL_UNPACK_BUFFER, TEXTURE_UPLOAD_RING_SIZE, nullptr, flags);
+        mapping = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, TEXTURE_UPLOAD_RING_SIZE, flags);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    void RetireCompleted()
+    {
+        // Regions are fenced in submission order, so the first pending one blocks the rest. Flushes, so that a fence
+        // still sitting in the command stream gets submitted, otherwise FlushTexturePool could wait on it forever.
+        while (!inFlight.empty())
+        {
+            GLenum status = glClientWaitSync(inFlight.front().fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            {
+                break;
+            }
+
+            glDeleteSync(inFlight.front().fence);
+            inFlight.pop_front();
+        }
+    }
+
+    // Returns false if there's no free space right now, try again next frame
+    bool Allocate(long size, long& offset)
+    {
+        RetireCompleted();
+
+        long begin = head + size <= TEXTURE_UPLOAD_RING_SIZE ? head : 0;
+        long end = begin + size;
+        for (Region& region : inFlight)
+        {
+            if (begin < region.end && region.begin < end)
+            {
+                return false;
+            }
+        }
+
+        head = (end + TEXTURE_UPLOAD_ALIGNMENT - 1) / TEXTURE_UPLOAD_ALIGNMENT * TEXTURE_UPLOAD_ALIGNMENT;
+        offset = begin;
+        return true;
+    }
+
+    void Fence(long begin, long size)
+    {
+        inFlight.push_back({ begin, begin + size, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) });
+    }
+};
 
 static std::unordered_map<std::string, Texture> textures;
+static std::unordered_set<Texture*> residentTextures;
+static int pendingTextureCount = 0;
+
+static MpmcQueue<DecodedTexture> decodedTextures(DECODED_TEXTURE_QUEUE_CAPACITY);
+// Never more decodes submitted and not yet popped from decodedTextures than it holds, so that a decode worker can
+// always push its result. Otherwise a worker spinning on a full queue that's no longer drained, e.g. on exit, would
+// block the decode pool's destructor forever.
+static int decodesInFlight = 0;
+static std::deque<Texture*> waitingForDecode;
+// See UploadToArrayLayer
+static std::unordered_map<Texture*, TextureArrayLayer> arrayLayers;
+static std::unordered_set<const Texture*> texturesInArrayLayers;
+// Popped from the queue but didn't fit into the budget/ring yet
+static std::deque<DecodedTexture> waitingForUpload;
+static TextureUploadRing uploadRing;
+
+static ThreadPool& DecodePool()
+{
+    static ThreadPool pool(TEXTURE_DECODE_THREADS);
+    return pool;
+}
+
+static void Decode(Texture* texture)
+{
+    TraceScope traceScope("texture", std::string("Decode ") + texture->filepath);
+    DecodedTexture decoded;
+    decoded.texture = texture;
+    decoded.compressed = nullptr;
+    decoded.pixels = nullptr;
+
+    // Prefer the baked container, nothing to decode there
+    if (CompressedTexture::HasUpToDateContainer(texture->filepath))
+    {
+        decoded.compressed = new CompressedTexture();
+        if (!decoded.compressed->Read(CompressedTexture::ContainerPath(texture->filepath).c_str()))
+        {
+            delete decoded.compressed;
+            decoded.compressed = nullptr;
+        }
+    }
+
+    if (decoded.compressed == nullptr)
+    {
+        stbi_set_flip_vertically_on_load_thread(true);
+        decoded.pixels = stbi_load(texture->filepath, &decoded.size.x, &decoded.size.y, &decoded.componentNum, 0);
+    }
+
+    bool pushed = decodedTextures.TryPush(decoded);
+    ASSERT(pushed);
+    (void)pushed;
+}
+
+static void SubmitDecodes()
+{
+    while (!waitingForDecode.empty() && decodesInFlight < DECODED_TEXTURE_QUEUE_CAPACITY)
+    {
+        Texture* texture = waitingForDecode.front();
+        waitingForDecode.pop_front();
+        decodesInFlight++;
+        DecodePool().Submit([texture]() { Decode(texture); });
+    }
+}
+
+static GLenum UncompressedFormat(int componentNum)
+{
+    switch (componentNum)
+    {
+    case 1:
+        return GL_RED;
+    case 2:
+        return GL_RG;
+    case 3:
+        return GL_RGB;
+    default:
+        return GL_RGBA;
+    }
+}
+
+static GLenum SizedUncompressedFormat(int componentNum)
+{
+    switch (componentNum)
+    {
+    case 1:
+        return GL_R8;
+    case 2:
+        return GL_RG8;
+    case 3:
+        return GL_RGB8;
+    default:
+        return GL_RGBA8;
+    }
+}
+
+// What glGenerateMipmap produces
+static int FullMipChainLevels(glm::ivec2 size)
+{
+    int levels = 1;
+    for (int extent = glm::max(size.x, size.y); extent > 1; extent /= 2)
+    {
+        levels++;
+    }
+    return levels;
+}
+
+static bool MatchesArrayLayer(const DecodedTexture& decoded, const TextureArrayLayer& layer)
+{
+    if (decoded.compressed != nullptr)
+    {
+        const CompressedTexture& compressed = *decoded.compressed;
+        return ToGLCompressedFormat(compressed.format) == layer.internalFormat &&
+            glm::ivec2(compressed.width, compressed.height) == layer.size && compressed.levels.size() == layer.levels;
+    }
+    return SizedUncompressedFormat(decoded.componentNum) == layer.internalFormat && decoded.size == layer.size &&
+        FullMipChainLevels(decoded.size) == layer.levels;
+}
+
+static void UploadToLayer(DecodedTexture& decoded, const TextureArrayLayer& layer, long offset, bool fromRing)
+{
+    Texture* texture = decoded.texture;
+    if (fromRing)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadRing.pbo);
+    }
+
+    if (decoded.compressed != nullptr)
+    {
+        const CompressedTexture& compressed = *decoded.compressed;
+        const unsigned char* levelData = fromRing ? (const unsigned char*)offset : compressed.data.data();
+        for (int i = 0; i < compressed.levels.size(); i++)
+        {
+            const CompressedMipLevel& level = compressed.levels[i];
+            glCompressedTextureSubImage3D(layer.array, i, 0, 0, layer.layer, level.width, level.height, 1,
+                    layer.internalFormat, level.size, levelData + level.offset);
+        }
+    }
+    else
+    {
+        // Rows of RGB textures aren't necessarily 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTextureSubImage3D(layer.array, 0, 0, 0, layer.layer, decoded.size.x, decoded.size.y, 1,
+                UncompressedFormat(decoded.componentNum), GL_UNSIGNED_BYTE, fromRing ? (const void*)offset : decoded.pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    if (fromRing)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // Never bound so far, so the name can still become a view. Per draw binds of the texture keep working.
+    glTextureView(texture->id, GL_TEXTURE_2D, layer.array, layer.internalFormat, 0, layer.levels, layer.layer, 1);
+    if (decoded.compressed == nullptr)
+    {
+        // Only the view's layer
+        glGenerateTextureMipmap(texture->id);
+    }
+    glTextureParameteri(texture->id, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(texture->id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    texture->size = layer.size;
+    texture->loaded = true;
+    texturesInArrayLayers.insert(texture);
+    residentTextures.insert(texture);
+}
+
+static void Upload(DecodedTexture& decoded, long offset, bool fromRing)
+{
+    TraceScope traceScope("texture", std::string("Upload ") + decoded.texture->filepath);
+    Texture* texture = decoded.texture;
+    auto arrayLayer = arrayLayers.find(texture);
+    if (arrayLayer != arrayLayers.end())
+    {
+        if (MatchesArrayLayer(decoded, arrayLayer->second))
+        {
+            UploadToLayer(decoded, arrayLayer->second, offset, fromRing);
+            return;
+        }
+        LOG_WARN("Texture", "%s doesn't match its texture array, uploading it on its own", texture->filepath);
+    }
+
+    if (decoded.compressed != nullptr)
+    {
+        if (fromRing)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadRing.pbo);
+            texture->UploadCompressed(*decoded.compressed, (const unsigned char*)offset);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        else
+        {
+            texture->UploadCompressed(*decoded.compressed, decoded.compressed->data.data());
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        residentTextures.insert(texture);
+        return;
+    }
+
+    texture->size = decoded.size;
+    LOG_INFO("Texture", "Uploading texture %s %dx%d", texture->filepath, decoded.size.x, decoded.size.y);
+
+    GLenum format = UncompressedFormat(decoded.componentNum);
+    glBindTexture(GL_TEXTURE_2D, texture->id);
+    // Rows of RGB textures aren't necessarily 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (fromRing)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, uploadRing.pbo);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, decoded.size.x, decoded.size.y, 0, format, GL_UNSIGNED_BYTE, (void*)offset);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    else
+    {
+        glTexImage2D(GL_TEXTURE_2D, 0, format, decoded.size.x, decoded.size.y, 0, format, GL_UNSIGNED_BYTE, decoded.pixels);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    texture->loaded = true;
+    residentTextures.insert(texture);
+}
 
 Texture *GetTexture(std::string texture_path)
 {
-    if (textures.find(texture_path) == textures.end())
-        textures[texture_path] = Texture(texture_path.c_str(), true);
+    auto it = textures.find(texture_path);
+    if (it == textures.end())
+    {
+        it = textures.emplace(texture_path, Texture()).first;
+        // Keys are never moved, so the texture can keep pointing to it
+        it->second.filepath = it->first.c_str();
+        pendingTextureCount++;
+
+        waitingForDecode.push_back(&it->second);
+        SubmitDecodes();
+    }
+
+    if (residentTextures.find(&it->second) == residentTextures.end())
+    {
+        return &SingleColorTexture::DefaultTexture();
+    }
+
+    return &it->second;
+}
+
+void UpdateTexturePool(long budgetBytes)
+{
+    TraceScope traceScope("texture", "Update texture pool");
+    if (uploadRing.pbo == 0)
+    {
+        uploadRing.Init();
+    }
+    uploadRing.RetireCompleted();
+
+    DecodedTexture decoded;
+    while (decodedTextures.TryPop(decoded))
+    {
+        waitingForUpload.push_back(decoded);
+        decodesInFlight--;
+    }
+    SubmitDecodes();
 
-    return &textures[texture_path];
+    long uploadedBytes = 0;
+    while (!waitingForUpload.empty())
+    {
+        DecodedTexture& next = waitingForUpload.front();
+        if (next.pixels == nullptr && next.compressed == nullptr)
+        {
+            LOG_ERROR("Texture", "stb failed loading %s", next.texture->filepath);
+            pendingTextureCount--;
+            waitingForUpload.pop_front();
+            continue;
+        }
+
+        long size = next.compressed != nullptr ? next.compressed->data.size() : (long)next.size.x * next.size.y * next.componentNum;
+        const unsigned char* data = next.compressed != nullptr ? next.compressed->data.data() : next.pixels;
+        if (uploadedBytes > 0 && uploadedBytes + size > budgetBytes)
+        {
+            break;
+        }
+
+        long offset = 0;
+        bool fromRing = size <= TEXTURE_UPLOAD_RING_SIZE;
+        if (fromRing)
+        {
+            if (!uploadRing.Allocate(size, offset))
+            {
+                break;
+            }
+            memcpy(uploadRing.mapping + offset, data, size);
+        }
+
+        Upload(next, offset, fromRing);
+        if (fromRing)
+        {
+            uploadRing.Fence(offset, size);
+        }
+
+        uploadedBytes += size;
+        pendingTextureCount--;
+        stbi_image_free(next.pixels);
+        delete next.compressed;
+        waitingForUpload.pop_front();
+    }
+}
+
+int PendingTextureCount()
+{
+    return pendingTextureCount;
+}
+
+void FlushTexturePool()
+{
+    while (PendingTextureCount() > 0)
+    {
+        UpdateTexturePool(LONG_MAX);
+        std::this_thread::yield();
+    }
+}
+
+bool PeekTexture(const std::string& texturePath, GLenum& internalFormat, glm::ivec2& size, int& levels)
+{
+    // Same preference as Decode
+    if (CompressedTexture::HasUpToDateContainer(texturePath.c_str()))
+    {
+        CompressedTexture compressed;
+        if (compressed.ReadHeader(CompressedTexture::ContainerPath(texturePath.c_str()).c_str()))
+        {
+            internalFormat = ToGLCompressedFormat(compressed.format);
+            size = glm::ivec2(compressed.width, compressed.height);
+            levels = compressed.levels.size();
+            return true;
+        }
+    }
+
+    int componentNum;
+    if (stbi_info(texturePath.c_str(), &size.x, &size.y, &componentNum) == 0)
+    {
+        return false;
+    }
+    internalFormat = SizedUncompressedFormat(componentNum);
+    levels = FullMipChainLevels(size);
+    return true;
+}
+
+void UploadToArrayLayer(const std::string& texturePath, const TextureArrayLayer& layer)
+{
+    GetTexture(texturePath);
+    Texture* texture = &textures.find(texturePath)->second;
+    ASSERTF(residentTextures.find(texture) == residentTextures.end(), "Texture", "%s is already resident", texturePath.c_str());
+    arrayLayers[texture] = layer;
+}
+
+bool IsInArrayLayer(const Texture& texture)
+{
+    return texturesInArrayLayers.find(&texture) != texturesInArrayLayers.end();
 }
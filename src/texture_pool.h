@@ -4,4 +4,42 @@
 
 #include "texture.h"
 
+// Bytes of texel data uploaded per UpdateTexturePool call by default
+#define TEXTURE_UPLOAD_BUDGET_PER_FRAME (16 * 1024 * 1024)
+
+// Returns the texture for the given path, kicking off an asynchronous load the first time it's
+// requested. Until the texture is resident SingleColorTexture::DefaultTexture() is returned instead.
 Texture *GetTexture(std::string texture_path);
+
+// Uploads textures decoded since the last call through the staging PBO ring, at most budgetBytes
+// worth (always at least one texture so that large ones make progress). Call once per frame on the GL thread.
+void UpdateTexturePool(long budgetBytes = TEXTURE_UPLOAD_BUDGET_PER_FRAME);
+
+// Textures requested but not resident yet
+int PendingTextureCount();
+
+// Blocks until every requested texture is resident. For runs that need the final textures from the
+// first frame on, e.g. headless captures.
+void FlushTexturePool();
+
+// Sized internal format, size and level count the texture will be uploaded with, read from the file headers
+// alone. False if they can't be read.
+bool PeekTexture(const std::string& texturePath, GLenum& internalFormat, glm::ivec2& size, int& levels);
+
+// Layer of a GL_TEXTURE_2D_ARRAY a texture is uploaded into, see TextureResidency
+struct TextureArrayLayer
+{
+    GLuint array;
+    int layer;
+    // What the array was created with
+    GLenum internalFormat;
+    glm::ivec2 size;
+    int levels;
+};
+
+// Uploads the texture straight into the layer, the texture becomes a GL_TEXTURE_2D view of it instead of getting
+// storage of its own. Has to be called before the texture is uploaded. If the decoded texture turns out not to
+// match the array it's uploaded on its own after all.
+void UploadToArrayLayer(const std::string& texturePath, const TextureArrayLayer& layer);
+// True once the texture is resident in the layer given to UploadToArrayLayer
+bool IsInArrayLayer(const Texture& texture);
@@ -0,0 +1,246 @@
+#include "texture_residency.h"
+
+#include "gl_state_cache.h"
+#include "log.h"
+#include "mesh.h"
+#include "shader.h"
+#include "single_color_texture.h"
+#include "texture_pool.h"
+
+static const char* slotTextureNames[] = { "tex_diffuse", "tex_normal", "tex_specular" };
+
+// Unsized formats from glTexImage2D uploads can't be used for texture storage
+static GLenum SizedFormat(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_RED:
+            return GL_R8;
+        case GL_RG:
+            return GL_RG8;
+        case GL_RGB:
+            return GL_RGB8;
+        case GL_RGBA:
+            return GL_RGBA8;
+        default:
+            return internalFormat;
+    }
+}
+
+TextureResidency::TextureResidency() : maxArrayCount(0), ssbo(0), dirty(false)
+{
+    bindless = GLEW_ARB_bindless_texture;
+    LOG_INFO("TextureResidency", "Mesh textures through %s", bindless ? "bindless handles" : "texture arrays");
+
+    // The units below the arrays are left to attachments and per draw textures. Shaders that sample the arrays
+    // sample nothing else, so only the fragment stage's own limit and the combined unit count bound them.
+    GLint fragmentUnits = 0;
+    GLint combinedUnits = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &fragmentUnits);
+    glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &combinedUnits);
+    maxArrayCount = glm::clamp(glm::min((int) fragmentUnits, (int) combinedUnits - TEXTURE_RESIDENCY_FIRST_ARRAY_UNIT), 1,
+            TEXTURE_RESIDENCY_MAX_ARRAYS);
+
+    glCreateBuffers(1, &ssbo);
+}
+
+unsigned int TextureResidency::TextureSetIndex(const std::unordered_map<std::string, std::string>& textures)
+{
+    std::vector<unsigned int>& sameHash = slotsByHash[TexturesHash(textures)];
+    for (unsigned int slot : sameHash)
+    {
+        if (slots[slot].textures == textures)
+        {
+            return slot;
+        }
+    }
+
+    unsigned int slot = slots.size();
+    sameHash.push_back(slot);
+    slots.push_back({ textures, false });
+    textureSets.push_back(TextureSet());
+    Resolve(slot);
+    dirty = true;
+    return slot;
+}
+
+glm::uvec2 TextureResidency::Reference(const Texture& texture)
+{
+    if (!bindless)
+    {
+        return ArrayLayer(texture);
+    }
+
+    auto it = handles.find(texture.id);
+    if (it == handles.end())
+    {
+        GLuint64 handle = glGetTextureHandleARB(texture.id);
+        glMakeTextureHandleResidentARB(handle);
+        it = handles.emplace(texture.id, handle).first;
+    }
+    return glm::uvec2(it->second & 0xffffffff, it->second >> 32);
+}
+
+bool TextureResidency::Resolve(unsigned int slot)
+{
+    Texture* defaultTexture = &SingleColorTexture::DefaultTexture();
+    glm::uvec2 references[3];
+    bool resolved = true;
+    for (int i = 0; i < 3; i++)
+    {
+        auto it = slots[slot].textures.find(slotTextureNames[i]);
+        Texture* texture = it != slots[slot].textures.end() ? GetTexture(it->second) : defaultTexture;
+        resolved = resolved && (texture != defaultTexture || it == slots[slot].textures.end());
+        references[i] = Reference(*texture);
+    }
+
+    bool usingNormalMap = slots[slot].textures.find("tex_normal") != slots[slot].textures.end();
+    TextureSet& textureSet = textureSets[slot];
+    textureSet.diffuseAndNormal = glm::uvec4(references[0], references[1]);
+    textureSet.specularAndFlags = glm::uvec4(references[2], usingNormalMap ? 1 : 0, 0);
+    slots[slot].resolved = resolved;
+    return resolved;
+}
+
+glm::uvec2 TextureResidency::ArrayLayer(const Texture& texture)
+{
+    if (&texture == &SingleColorTexture::DefaultTexture())
+    {
+        return glm::uvec2(0, 0);
+    }
+
+    auto it = arrayLayers.find(texture.filepath);
+    if (it == arrayLayers.end() || !IsInArrayLayer(texture))
+    {
+        LOG_WARN("TextureResidency", "%s isn't in a texture array, using the default texture", texture.filepath);
+        return glm::uvec2(0, 0);
+    }
+    return it->second;
+}
+
+GLuint TextureResidency::CreateArray(const TextureArray& array)
+{
+    GLuint id;
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &id);
+    glTextureStorage3D(id, array.levels, array.internalFormat, array.size.x, array.size.y, array.layerCount);
+    glTextureParameteri(id, GL_TEXTURE_MIN_FILTER, array.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTextureParameteri(id, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(id, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(id, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    return id;
+}
+
+void TextureResidency::AllocateArrays()
+{
+    if (bindless || !arrays.empty())
+    {
+        return;
+    }
+
+    // The default texture is tiny, copying it is cheaper than special casing it in the shaders
+    Texture& defaultTexture = SingleColorTexture::DefaultTexture();
+    GLint defaultFormat;
+    glGetTextureLevelParameteriv(defaultTexture.id, 0, GL_TEXTURE_INTERNAL_FORMAT, &defaultFormat);
+    TextureArray defaultArray = { 0, SizedFormat(defaultFormat), defaultTexture.size, 1, 1 };
+    defaultArray.id = CreateArray(defaultArray);
+    glCopyImageSubData(defaultTexture.id, GL_TEXTURE_2D, 0, 0, 0, 0, defaultArray.id, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+            defaultArray.size.x, defaultArray.size.y, 1);
+    arrays.push_back(defaultArray);
+
+    // Counted first, so that every array is created once with exactly the layers it needs
+    for (const Slot& slot : slots)
+    {
+        for (const char* textureName : slotTextureNames)
+        {
+            auto it = slot.textures.find(textureName);
+            if (it == slot.textures.end() || arrayLayers.find(it->second) != arrayLayers.end())
+            {
+                continue;
+            }
+
+            TextureArray key = { 0, GL_NONE, glm::ivec2(0), 0, 0 };
+            if (!PeekTexture(it->second, key.internalFormat, key.size, key.levels))
+            {
+                continue;
+            }
+
+            int arrayIndex = -1;
+            for (int i = 1; i < arrays.size(); i++)
+            {
+                if (arrays[i].internalFormat == key.internalFormat && arrays[i].size == key.size && arrays[i].levels == key.levels)
+                {
+                    arrayIndex = i;
+                    break;
+                }
+            }
+            if (arrayIndex == -1)
+            {
+                if (arrays.size() == maxArrayCount)
+                {
+                    LOG_ERROR("TextureResidency", "Out of texture arrays for %dx%d 0x%X with %d levels, using the default texture",
+                            key.size.x, key.size.y, key.internalFormat, key.levels);
+                    continue;
+                }
+                arrayIndex = arrays.size();
+                arrays.push_back(key);
+            }
+            arrayLayers[it->second] = glm::uvec2(arrayIndex, arrays[arrayIndex].layerCount++);
+        }
+    }
+
+    for (int i = 1; i < arrays.size(); i++)
+    {
+        TextureArray& array = arrays[i];
+        array.id = CreateArray(array);
+        LOG_INFO("TextureResidency", "Texture array %d: %d layers of %dx%d 0x%X with %d levels", i, array.layerCount,
+                array.size.x, array.size.y, array.internalFormat, array.levels);
+    }
+
+    for (auto& pathToLayer : arrayLayers)
+    {
+        const TextureArray& array = arrays[pathToLayer.second.x];
+        UploadToArrayLayer(pathToLayer.first, { array.id, (int) pathToLayer.second.y, array.internalFormat, array.size, array.levels });
+    }
+}
+
+int TextureResidency::ArrayCount() const
+{
+    return glm::max((int) arrays.size(), 1);
+}
+
+void TextureResidency::Update()
+{
+    // Nothing to do once allocated, only covers scenes that never called it
+    AllocateArrays();
+
+    for (unsigned int slot = 0; slot < slots.size(); slot++)
+    {
+        if (!slots[slot].resolved)
+        {
+            TextureSet previous = textureSets[slot];
+            Resolve(slot);
+            dirty = dirty || previous.diffuseAndNormal != textureSets[slot].diffuseAndNormal
+                || previous.specularAndFlags != textureSets[slot].specularAndFlags;
+        }
+    }
+
+    if (dirty)
+    {
+        glNamedBufferData(ssbo, textureSets.size() * sizeof(TextureSet), textureSets.data(), GL_DYNAMIC_DRAW);
+        dirty = false;
+    }
+
+    GLStateCache& state = GLStateCache::Get();
+    state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, Shader::textureSetsBindingPoint, ssbo);
+    for (int i = 0; i < arrays.size(); i++)
+    {
+        state.BindTexture(TEXTURE_RESIDENCY_FIRST_ARRAY_UNIT + i, GL_TEXTURE_2D_ARRAY, arrays[i].id);
+    }
+}
+
+/*static*/ TextureResidency& TextureResidency::Get()
+{
+    // Created on first use, which is after the GL context
+    static TextureResidency residency;
+    return residency;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "glm/glm.hpp"
+
+class Texture;
+
+// Texture arrays of the fallback path are bound to consecutive units starting here ("textureArrays" in shaders)
+#define TEXTURE_RESIDENCY_FIRST_ARRAY_UNIT 16
+// Upper bound, the GL limits may allow fewer, see maxArrayCount
+#define TEXTURE_RESIDENCY_MAX_ARRAYS 64
+
+// Makes mesh textures reachable from shaders without binding them per draw. Every distinct set of mesh textures
+// (diffuse, normal, specular) gets a slot in the "TextureSets" SSBO, instances reference it through
+// MeshInstance::material.y. With ARB_bindless_texture a slot holds resident texture handles, otherwise textures are
+// uploaded into GL_TEXTURE_2D_ARRAYs, one per size/format/mip count class, and a slot holds array and layer indices.
+// Shaders pick the path with the BINDLESS_TEXTURES define.
+struct TextureResidency
+{
+    // std430 "TextureSet"
+    struct TextureSet
+    {
+        // Bindless: diffuse handle in xy, normal handle in zw
+        // Arrays: diffuse array and layer in xy, normal array and layer in zw
+        glm::uvec4 diffuseAndNormal;
+        // xy - specular handle or array and layer, z - using a normal map
+        glm::uvec4 specularAndFlags;
+    };
+
+    bool bindless;
+    // Texture arrays the fallback path may create, every unit from TEXTURE_RESIDENCY_FIRST_ARRAY_UNIT up that the
+    // fragment stage can sample
+    int maxArrayCount;
+
+    // Slot for a mesh's textures, registered on first use. Textures still loading resolve to the default texture
+    // until they become resident.
+    unsigned int TextureSetIndex(const std::unordered_map<std::string, std::string>& textures);
+
+    // Resolves the textures that became resident since the last call and re-uploads the changed slots. Binds the
+    // SSBO and, without bindless, the texture arrays.
+    void Update();
+
+    // Array path: creates one array per class of the textures of every slot registered so far, sized for exactly
+    // those textures from their file headers, and has the texture pool upload them straight into their layers.
+    // Textures of slots registered later aren't in any array and resolve to the default texture. Call once the
+    // scene's meshes are registered and before compiling the shaders that sample the arrays.
+    void AllocateArrays();
+    // Arrays created by AllocateArrays ("TEXTURE_ARRAY_COUNT" in shaders), at least 1
+    int ArrayCount() const;
+
+    static TextureResidency& Get();
+
+private:
+    struct Slot
+    {
+        std::unordered_map<std::string, std::string> textures;
+        // All textures were resident when last resolved
+        bool resolved;
+    };
+    std::vector<Slot> slots;
+    std::vector<TextureSet> textureSets;
+    std::unordered_map<unsigned long, std::vector<unsigned int>> slotsByHash;
+    unsigned int ssbo;
+    bool dirty;
+
+    // Bindless path, by texture id
+    std::unordered_map<GLuint, GLuint64> handles;
+
+    // Array path. Array 0 holds just the default texture, what unresolved references point to.
+    struct TextureArray
+    {
+        GLuint id;
+        GLenum internalFormat;
+        glm::ivec2 size;
+        int levels;
+        int layerCount;
+    };
+    std::vector<TextureArray> arrays;
+    // Texture path to array and layer
+    std::unordered_map<std::string, glm::uvec2> arrayLayers;
+
+    TextureResidency();
+    // Returns false if a texture of the slot isn't resident yet
+    bool Resolve(unsigned int slot);
+    glm::uvec2 Reference(const Texture& texture);
+    glm::uvec2 ArrayLayer(const Texture& texture);
+    GLuint CreateArray(const TextureArray& array);
+};
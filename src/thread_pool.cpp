@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int threadCount) : stopping(false)
+{
+    if (threadCount <= 0)
+    {
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+    }
+
+    for (int i = 0; i < threadCount; i++)
+    {
+        workers.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        stopping = true;
+    }
+    jobsAvailable.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(jobsMutex);
+        jobs.push_back(std::move(job));
+    }
+    jobsAvailable.notify_one();
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& fn)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // Shared, since helpers that get scheduled late may outlive this call
+    struct Batch
+    {
+        std::atomic<int> nextIndex;
+        std::atomic<int> remaining;
+        std::mutex doneMutex;
+        std::condition_variable done;
+    };
+    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+    batch->nextIndex = 0;
+    batch->remaining = count;
+
+    // Indices are pulled dynamically, so uneven work (e.g. differently sized sub-meshes) balances itself
+    const std::function<void(int)>* work = &fn;
+    auto drain = [batch, work, count]()
+    {
+        int i;
+        while ((i = batch->nextIndex.fetch_add(1)) < count)
+        {
+            (*work)(i);
+            if (batch->remaining.fetch_sub(1) == 1)
+            {
+                std::lock_guard<std::mutex> lock(batch->doneMutex);
+                batch->done.notify_all();
+            }
+        }
+    };
+
+    int helperCount = std::min((int)workers.size(), count - 1);
+    for (int i = 0; i < helperCount; i++)
+    {
+        Submit(drain);
+    }
+    drain();
+
+    std::unique_lock<std::mutex> lock(batch->doneMutex);
+    batch->done.wait(lock, [&batch]() { return batch->remaining == 0; });
+}
+
+int ThreadPool::ThreadCount() const
+{
+    return workers.size();
+}
+
+/*static*/ ThreadPool& ThreadPool::Shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(jobsMutex);
+            jobsAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping && jobs.empty())
+            {
+                return;
+            }
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+
+        job();
+    }
+}
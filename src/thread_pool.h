@@ -0,0 +1,39 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads for CPU side asset processing. Never touches GL, anything
+// that needs the context has to be handed back to the main thread.
+class ThreadPool
+{
+public:
+    // 0 picks one thread less than there are hardware threads, the caller is expected to help out
+    ThreadPool(int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void Submit(std::function<void()> job);
+
+    // Runs fn(i) for every i in [0, count) on the workers and the calling thread. Blocks until all are done.
+    void ParallelFor(int count, const std::function<void(int)>& fn);
+
+    int ThreadCount() const;
+
+    static ThreadPool& Shared();
+
+private:
+    void WorkerLoop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex jobsMutex;
+    std::condition_variable jobsAvailable;
+    bool stopping;
+};
@@ -0,0 +1,204 @@
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <vector>
+
+#include "gpu_timer.h"
+#include "log.h"
+
+#define TRACE_GPU_THREAD_ID 0
+
+struct TraceEvent
+{
+    std::string name;
+    const char* category;
+    long long beginUs;
+    long long durationUs;
+    int threadId;
+};
+
+enum class TraceState
+{
+    IDLE,
+    RECORDING,
+    // CPU recording stopped, waiting for the GPU ranges of the recorded frames to resolve
+    DRAINING,
+};
+
+static std::mutex traceMutex;
+static std::vector<TraceEvent> traceEvents;
+static std::atomic<TraceState> traceState(TraceState::IDLE);
+static std::string tracePath;
+static int traceFramesLeft = 0;
+static long long traceStartUs = 0;
+static long long traceStopUs = 0;
+// GL timestamp + offset = CPU trace time, both in ns
+static long long gpuToCpuOffsetNs = 0;
+
+static int TraceThreadId()
+{
+    static std::atomic<int> nextThreadId(TRACE_GPU_THREAD_ID + 1);
+    thread_local int threadId = nextThreadId++;
+    return threadId;
+}
+
+static std::string JsonEscaped(const std::string& str)
+{
+    std::string escaped;
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+long long TraceTimeUs()
+{
+    static std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void StartTrace(const char* path, int frameCount)
+{
+    if (traceState != TraceState::IDLE)
+    {
+        LOG_WARN("Trace", "Already recording to %s", tracePath.c_str());
+        return;
+    }
+
+    GLint64 gpuNowNs;
+    glGetInteger64v(GL_TIMESTAMP, &gpuNowNs);
+    traceStartUs = TraceTimeUs();
+    gpuToCpuOffsetNs = traceStartUs * 1000 - gpuNowNs;
+
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        traceEvents.clear();
+    }
+    tracePath = path;
+    traceFramesLeft = frameCount;
+    traceState = TraceState::RECORDING;
+    if (frameCount > 0)
+    {
+        LOG_INFO("Trace", "Recording %d frames to %s", frameCount, path);
+    }
+    else
+    {
+        LOG_INFO("Trace", "Recording to %s until stopped", path);
+    }
+}
+
+void StopTrace()
+{
+    if (traceState != TraceState::RECORDING)
+    {
+        return;
+    }
+
+    traceStopUs = TraceTimeUs();
+    traceFramesLeft = GPU_TIMER_FRAMES_IN_FLIGHT;
+    traceState = TraceState::DRAINING;
+}
+
+void FlushTrace()
+{
+    if (traceState == TraceState::IDLE)
+    {
+        return;
+    }
+    traceState = TraceState::IDLE;
+
+    std::vector<TraceEvent> events;
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        events.swap(traceEvents);
+    }
+
+    FILE* file = fopen(tracePath.c_str(), "w");
+    if (file == nullptr)
+    {
+        LOG_ERROR("Trace", "Cannot open %s", tracePath.c_str());
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"GPU\"}}", TRACE_GPU_THREAD_ID);
+    for (TraceEvent& event : events)
+    {
+        fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                JsonEscaped(event.name).c_str(), event.category, event.threadId, event.beginUs, event.durationUs);
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    LOG_INFO("Trace", "Wrote %lu events to %s", events.size(), tracePath.c_str());
+}
+
+bool IsTraceRecording()
+{
+    return traceState == TraceState::RECORDING;
+}
+
+void TraceFrameBoundary()
+{
+    if (traceState == TraceState::IDLE || traceFramesLeft == 0)
+    {
+        return;
+    }
+
+    if (--traceFramesLeft == 0)
+    {
+        if (traceState == TraceState::RECORDING)
+        {
+            StopTrace();
+        }
+        else
+        {
+            FlushTrace();
+        }
+    }
+}
+
+void AddTraceEvent(const char* category, const char* name, long long beginUs, long long endUs)
+{
+    if (traceState != TraceState::RECORDING)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceEvents.push_back({ name, category, beginUs, endUs - beginUs, TraceThreadId() });
+}
+
+void AddGpuTraceEvent(const char* name, GLuint64 beginNs, GLuint64 endNs)
+{
+    if (traceState == TraceState::IDLE)
+    {
+        return;
+    }
+
+    long long beginUs = ((long long)beginNs + gpuToCpuOffsetNs) / 1000;
+    long long endUs = ((long long)endNs + gpuToCpuOffsetNs) / 1000;
+    // Ranges submitted before the recording started resolve during it
+    if (beginUs < traceStartUs || (traceState == TraceState::DRAINING && beginUs > traceStopUs))
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(traceMutex);
+    traceEvents.push_back({ name, "gpu", beginUs, endUs - beginUs, TRACE_GPU_THREAD_ID });
+}
+
+TraceScope::TraceScope(const char* category, std::string name) : category(category), name(name), beginUs(TraceTimeUs())
+{
+}
+
+TraceScope::~TraceScope()
+{
+    AddTraceEvent(category, name.c_str(), beginUs, TraceTimeUs());
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+
+#include <GL/glew.h>
+
+// Chrome trace-event recorder (chrome://tracing, ui.perfetto.dev). CPU scopes come from any
+// thread, GPU ranges from GpuTimer once they resolve. A recording covers a fixed number of frames or
+// runs until StopTrace(), after which it keeps collecting the GPU ranges still in flight for a few
+// frames and then writes the file.
+
+// Microseconds on the clock all CPU trace events use
+long long TraceTimeUs();
+
+// frameCount 0 records until StopTrace(). Needs the GL thread, GPU timestamps are mapped onto the CPU clock here.
+void StartTrace(const char* path, int frameCount = 0);
+void StopTrace();
+// Writes the file right away, dropping GPU ranges still in flight
+void FlushTrace();
+bool IsTraceRecording();
+// Call once per frame on the GL thread, drives fixed frame windows and writing the file
+void TraceFrameBoundary();
+
+void AddTraceEvent(const char* category, const char* name, long long beginUs, long long endUs);
+// Timestamps as returned by GL_TIMESTAMP queries
+void AddGpuTraceEvent(const char* name, GLuint64 beginNs, GLuint64 endNs);
+
+// Records its lifetime as a CPU event
+struct TraceScope
+{
+    const char* category;
+    std::string name;
+    long long beginUs;
+
+    TraceScope(const char* category, std::string name);
+    ~TraceScope();
+};
@@ -0,0 +1,210 @@
+#include "transform_store.h"
+
+#include "log.h"
+#include "thread_pool.h"
+
+TransformStore::TransformStore()
+    : lastUpdateCount(0), recomputedCount(0)
+{
+}
+
+int TransformStore::Allocate()
+{
+    int id;
+    if (!freeIds.empty())
+    {
+        id = freeIds.back();
+        freeIds.pop_back();
+        locals[id] = Transform();
+        modelSpaceBounds[id] = AABB();
+    }
+    else
+    {
+        id = locals.size();
+        locals.push_back(Transform());
+        modelSpaceBounds.push_back(AABB());
+        models.push_back(glm::mat4(1.f));
+        normalMatrices.push_back(glm::mat3x4(1.f));
+        worldBounds.push_back(AABB());
+        versions.push_back(0);
+        dirty.push_back(0);
+    }
+    MarkDirty(id);
+    return id;
+}
+
+int TransformStore::Duplicate(int id)
+{
+    int duplicate = Allocate();
+    Copy(duplicate, id);
+    return duplicate;
+}
+
+void TransformStore::Free(int id)
+{
+    ASSERT(id >= 0 && id < locals.size());
+    // Left dirty if it was, Update recomputes it for nothing rather than searching the dirty list
+    freeIds.push_back(id);
+}
+
+void TransformStore::Copy(int destination, int source)
+{
+    if (destination == source)
+        return;
+
+    locals[destination] = locals[source];
+    modelSpaceBounds[destination] = modelSpaceBounds[source];
+    if (dirty[source])
+    {
+        MarkDirty(destination);
+        return;
+    }
+
+    models[destination] = models[source];
+    normalMatrices[destination] = normalMatrices[source];
+    worldBounds[destination] = worldBounds[source];
+    versions[destination]++;
+    // Still in the dirty list if it was marked, Update skips it
+    dirty[destination] = 0;
+}
+
+void TransformStore::SetLocal(int id, const Transform& local)
+{
+    locals[id] = local;
+    MarkDirty(id);
+}
+
+void TransformStore::SetModelSpaceBounds(int id, const AABB& bounds)
+{
+    modelSpaceBounds[id] = bounds;
+    MarkDirty(id);
+}
+
+const Transform& TransformStore::Local(int id) const
+{
+    return locals[id];
+}
+
+const glm::mat4& TransformStore::Model(int id)
+{
+    if (dirty[id])
+    {
+        Recompute(id);
+        recomputedCount++;
+    }
+    return models[id];
+}
+
+const glm::mat3x4& TransformStore::NormalMatrix(int id)
+{
+    if (dirty[id])
+    {
+        Recompute(id);
+        recomputedCount++;
+    }
+    return normalMatrices[id];
+}
+
+const AABB& TransformStore::WorldBounds(int id)
+{
+    if (dirty[id])
+    {
+        Recompute(id);
+        recomputedCount++;
+    }
+    return worldBounds[id];
+}
+
+unsigned int TransformStore::Version(int id) const
+{
+    return versions[id];
+}
+
+void TransformStore::Update()
+{
+    // Drop the slots that were recomputed on read or copied over since they were marked, and ones listed twice
+    // because they were cleaned and marked again
+    int dirtyCount = 0;
+    for (int id : dirtyIds)
+    {
+        if (dirty[id] == 1)
+        {
+            dirty[id] = 2;
+            dirtyIds[dirtyCount++] = id;
+        }
+    }
+    dirtyIds.resize(dirtyCount);
+
+    if (dirtyCount < TRANSFORM_STORE_PARALLEL_THRESHOLD)
+    {
+        for (int id : dirtyIds)
+        {
+            Recompute(id);
+        }
+    }
+    else
+    {
+        // Every slot is in the list once now, so chunks never write the same slot
+        int chunkCount = (dirtyCount + TRANSFORM_STORE_CHUNK_SIZE - 1) / TRANSFORM_STORE_CHUNK_SIZE;
+        ThreadPool::Shared().ParallelFor(chunkCount, [&](int chunk)
+        {
+            int begin = chunk * TRANSFORM_STORE_CHUNK_SIZE;
+            int end = begin + TRANSFORM_STORE_CHUNK_SIZE < dirtyCount ? begin + TRANSFORM_STORE_CHUNK_SIZE : dirtyCount;
+            for (int i = begin; i < end; i++)
+            {
+                Recompute(dirtyIds[i]);
+            }
+        });
+    }
+
+    lastUpdateCount = dirtyCount + recomputedCount;
+    recomputedCount = 0;
+    dirtyIds.clear();
+}
+
+void TransformStore::MarkDirty(int id)
+{
+    versions[id]++;
+    if (!dirty[id])
+    {
+        dirty[id] = 1;
+        dirtyIds.push_back(id);
+    }
+}
+
+void TransformStore::Recompute(int id)
+{
+    glm::mat4 model = locals[id].Model();
+    models[id] = model;
+    normalMatrices[id] = glm::mat3x4(glm::transpose(glm::inverse(glm::mat3(model))));
+    worldBounds[id] = modelSpaceBounds[id].Transformed(model);
+    dirty[id] = 0;
+}
+
+/*static*/ TransformStore& TransformStore::Get()
+{
+    // Created on first use and never destroyed, meshes of other statics may outlive it
+    static TransformStore* store = new TransformStore();
+    return *store;
+}
+
+TransformHandle::TransformHandle()
+    : id(TransformStore::Get().Allocate())
+{
+}
+
+TransformHandle::TransformHandle(const TransformHandle& other)
+    : id(TransformStore::Get().Duplicate(other.id))
+{
+}
+
+TransformHandle& TransformHandle::operator=(const TransformHandle& other)
+{
+    TransformStore::Get().Copy(id, other.id);
+    return *this;
+}
+
+TransformHandle::~TransformHandle()
+{
+    TransformStore::Get().Free(id);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+#include "aabb.h"
+#include "transform.h"
+
+// Dirty slots are recomputed on the shared ThreadPool once there are this many, in chunks of the second
+#define TRANSFORM_STORE_PARALLEL_THRESHOLD 4096
+#define TRANSFORM_STORE_CHUNK_SIZE 1024
+
+// Mesh transforms with their model matrices, normal matrices and world space bounds cached in contiguous arrays.
+// Writes only mark a slot dirty, Update recomputes the dirty slots in one batch, reads of a dirty slot recompute
+// just that one. Nothing that didn't move is recomputed, a static scene costs nothing per frame.
+struct TransformStore
+{
+    // Identity transform and empty bounds
+    int Allocate();
+    // Same transform, bounds and cached matrices as another slot
+    int Duplicate(int id);
+    void Free(int id);
+    // Overwrites the destination with the source's transform, bounds and cached matrices
+    void Copy(int destination, int source);
+
+    void SetLocal(int id, const Transform& local);
+    void SetModelSpaceBounds(int id, const AABB& bounds);
+    const Transform& Local(int id) const;
+
+    const glm::mat4& Model(int id);
+    // transpose(inverse(mat3(model))), columns padded to vec4 like a std430 mat3
+    const glm::mat3x4& NormalMatrix(int id);
+    const AABB& WorldBounds(int id);
+    // Changes whenever the slot's transform or bounds do, for caches of the world space data
+    unsigned int Version(int id) const;
+
+    // Recomputes every dirty slot, in parallel for large batches
+    void Update();
+    // Slots recomputed since the last Update, including ones read while dirty
+    int lastUpdateCount;
+
+    static TransformStore& Get();
+
+private:
+    std::vector<Transform> locals;
+    std::vector<AABB> modelSpaceBounds;
+    std::vector<glm::mat4> models;
+    std::vector<glm::mat3x4> normalMatrices;
+    std::vector<AABB> worldBounds;
+    std::vector<unsigned int> versions;
+    std::vector<uint8_t> dirty;
+    std::vector<int> dirtyIds;
+    std::vector<int> freeIds;
+    int recomputedCount;
+
+    TransformStore();
+
+    void MarkDirty(int id);
+    void Recompute(int id);
+};
+
+// Owning reference to a TransformStore slot. Copies get a slot of their own with the same contents, so copied meshes
+// move independently.
+struct TransformHandle
+{
+    int id;
+
+    TransformHandle();
+    TransformHandle(const TransformHandle& other);
+    TransformHandle& operator=(const TransformHandle& other);
+    ~TransformHandle();
+};
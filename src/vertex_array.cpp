@@ -2,6 +2,7 @@
 #include <assert.h>
 
 #include "vertex_array.h"
+#include "gl_state_cache.h"
 
 VertexArray::VertexArray()
 {
@@ -20,12 +21,12 @@ VertexArray::VertexArray(VertexBuffer vertexBuffer, IndexBuffer indexBuffer,
 
 void VertexArray::Bind() const 
 {
-    glBindVertexArray(id);
+    GLStateCache::Get().BindVertexArray(id);
 }
 
 void VertexArray::Unbind() const
 {
-    glBindVertexArray(0);
+    GLStateCache::Get().BindVertexArray(0);
 }
 
 void VertexArray::AddVertexBuffer(VertexBuffer vertexBuffer) 
@@ -51,9 +52,12 @@ void VertexArray::SetBufferLayout(BufferLayout bufferLayout)
     int attributeIndex = 0;
     for (BufferLayout::ConstIterator it = bufferLayout.Begin(); it != bufferLayout.End(); it++) 
     {
+        // glVertexAttribPointer reads from whichever buffer is bound, one per stream
+        assert(it->stream < vertexBuffers.size());
+        vertexBuffers[it->stream].Bind();
         glEnableVertexArrayAttrib(id, attributeIndex);
         glVertexAttribPointer(attributeIndex, it->vectorElementCount, it->glType,
-                it->normalized ? GL_TRUE : GL_FALSE, bufferLayout.Stride(),
+                it->normalized ? GL_TRUE : GL_FALSE, bufferLayout.Stride(it->stream),
                 (void*) bufferLayout.Offset(attributeIndex));
 
         /*
@@ -70,3 +74,8 @@ int VertexArray::GetIndexCount() const
 {
     return indexBuffer.Size();
 }
+
+unsigned int VertexArray::GetId() const
+{
+    return id;
+}
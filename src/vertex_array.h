@@ -22,6 +22,7 @@ public:
     void SetBufferLayout(BufferLayout bufferLayout);
 
     int GetIndexCount() const;
+    unsigned int GetId() const;
 
 private:
     std::vector<VertexBuffer> vertexBuffers;
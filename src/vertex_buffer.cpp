@@ -10,7 +10,7 @@ VertexBuffer::VertexBuffer()
 {
 }
 
-VertexBuffer::VertexBuffer(float *vertices, int size)
+VertexBuffer::VertexBuffer(const float *vertices, int size)
     : size(size), loaded(true)
 {
     glGenBuffers(1, &id);
@@ -26,7 +26,7 @@ VertexBuffer::VertexBuffer(float *vertices, int size)
         printf("[post vertex buffer buffer data] OpenGL error: %04x\n", err);
 }
 
-VertexBuffer::VertexBuffer(float *vertices, int size, unsigned int id)
+VertexBuffer::VertexBuffer(const float *vertices, int size, unsigned int id)
     : id(id), size(size), loaded(true)
 {
     Bind();
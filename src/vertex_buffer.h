@@ -5,8 +5,8 @@ class VertexBuffer
 {
 public:
     VertexBuffer();
-    VertexBuffer(float *vertices, int size);
-    VertexBuffer(float *vertices, int size, unsigned int id);
+    VertexBuffer(const float *vertices, int size);
+    VertexBuffer(const float *vertices, int size, unsigned int id);
 
     void Bind() const;
     void Unbind() const;
@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "camera_path.h"
+#include "headless.h"
+#include "log.h"
+#include "random.h"
+#include "scene.h"
+#include "test_structures.h"
+
+// Runs every TestPipelines entry over fixed camera paths and reports CPU/GPU percentiles for each
+// pipeline, renderpass and subpass:
+//   ignoramus_bench [--warmup N] [--frames M] [--camera-path file]... [--pipeline name]... [--output prefix]
+// Results are written to <prefix>.json and <prefix>.csv.
+
+void GLLog(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* message, const void* userParam);
+
+struct BenchOptions
+{
+    int warmupFrames = 30;
+    int measuredFrames = 300;
+    unsigned int seed = 1337;
+    std::string outputPrefix = "bench_results";
+    std::vector<std::string> cameraPaths;
+    std::vector<std::string> pipelineFilters;
+    bool useEgl = false;
+};
+
+// One row of the report: a pipeline, renderpass or subpass on one camera path
+struct TimingSeries
+{
+    std::string pipeline;
+    std::string cameraPath;
+    // Empty for the pipeline/renderpass totals
+    std::string renderpass;
+    std::string subpass;
+
+    std::vector<float> cpu;
+    std::vector<float> gpu;
+};
+
+struct Percentiles
+{
+    float p50;
+    float p95;
+    float p99;
+    float min;
+    float max;
+    float mean;
+};
+
+static bool ParseBenchOptions(int argc, char** argv, BenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--warmup") == 0 && hasValue)
+            options.warmupFrames = std::max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--frames") == 0 && hasValue)
+            options.measuredFrames = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        else if (strcmp(argv[i], "--output") == 0 && hasValue)
+            options.outputPrefix = argv[++i];
+        else if (strcmp(argv[i], "--camera-path") == 0 && hasValue)
+            options.cameraPaths.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--pipeline") == 0 && hasValue)
+            options.pipelineFilters.push_back(argv[++i]);
+        else if (strcmp(argv[i], "--egl") == 0)
+            options.useEgl = true;
+        else
+        {
+            fprintf(stderr, "Usage: %s [--warmup N] [--frames M] [--seed S] [--camera-path file]... [--pipeline name]... [--output prefix] [--egl]\n", argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool SelectedPipeline(const BenchOptions& options, const char* name)
+{
+    if (options.pipelineFilters.empty())
+    {
+        return true;
+    }
+
+    for (const std::string& filter : options.pipelineFilters)
+    {
+        if (strstr(name, filter.c_str()) != nullptr)
+            return true;
+    }
+    return false;
+}
+
+// Nearest rank percentiles
+static Percentiles ComputePercentiles(std::vector<float> samples)
+{
+    Percentiles percentiles = {};
+    if (samples.empty())
+    {
+        return percentiles;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto rank = [&](float p) -> float
+    {
+        int index = (int)ceilf(p * samples.size()) - 1;
+        return samples[std::min(std::max(index, 0), (int)samples.size() - 1)];
+    };
+
+    percentiles.p50 = rank(0.50f);
+    percentiles.p95 = rank(0.95f);
+    percentiles.p99 = rank(0.99f);
+    percentiles.min = samples.front();
+    percentiles.max = samples.back();
+    double sum = 0.0;
+    for (float sample : samples)
+        sum += sample;
+    percentiles.mean = sum / samples.size();
+
+    return percentiles;
+}
+
+static float Latest(FrametimePerfData& perfData)
+{
+    return perfData.data[perfData.latestIndex];
+}
+
+// Series are laid out pipeline total, then each renderpass followed by its subpasses
+static void AddSeries(std::vector<TimingSeries>& series, NamedPipeline& namedPipeline, const std::string& cameraPath)
+{
+    TimingSeries total;
+    total.pipeline = namedPipeline.name;
+    total.cameraPath = cameraPath;
+    series.push_back(total);
+
+    for (Renderpass* renderpass : namedPipeline.pipeline.passes)
+    {
+        TimingSeries renderpassSeries = total;
+        renderpassSeries.renderpass = renderpass->name;
+        series.push_back(renderpassSeries);
+
+        for (Subpass* subpass : renderpass->subpasses)
+        {
+            TimingSeries subpassSeries = renderpassSeries;
+            subpassSeries.subpass = subpass->name;
+            series.push_back(subpassSeries);
+        }
+    }
+}
+
+static void RecordFrame(TimingSeries* series, NamedPipeline& namedPipeline)
+{
+    series->cpu.push_back(Latest(namedPipeline.pipeline.perfData.cpu));
+    series->gpu.push_back(Latest(namedPipeline.pipeline.perfData.gpu));
+    series++;
+
+    for (Renderpass* renderpass : namedPipeline.pipeline.passes)
+    {
+        series->cpu.push_back(Latest(renderpass->perfData.cpu));
+        series->gpu.push_back(Latest(renderpass->perfData.gpu));
+        series++;
+
+        for (Subpass* subpass : renderpass->subpasses)
+        {
+            series->cpu.push_back(Latest(subpass->perfData.cpu));
+            series->gpu.push_back(Latest(subpass->perfData.gpu));
+            series++;
+        }
+    }
+}
+
+static std::string JsonEscaped(const std::string& str)
+{
+    std::string escaped;
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+static bool WriteJson(const char* path, const BenchOptions& options, const std::vector<TimingSeries>& series)
+{
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    fprintf(file, "{\n  \"warmupFrames\": %d,\n  \"measuredFrames\": %d,\n  \"seed\": %u,\n  \"results\": [\n",
+            options.warmupFrames, options.measuredFrames, options.seed);
+    for (int i = 0; i < series.size(); i++)
+    {
+        const TimingSeries& s = series[i];
+        Percentiles cpu = ComputePercentiles(s.cpu);
+        Percentiles gpu = ComputePercentiles(s.gpu);
+        fprintf(file, "    { \"pipeline\": \"%s\", \"cameraPath\": \"%s\", \"renderpass\": \"%s\", \"subpass\": \"%s\",\n",
+                JsonEscaped(s.pipeline).c_str(), JsonEscaped(s.cameraPath).c_str(), JsonEscaped(s.renderpass).c_str(), JsonEscaped(s.subpass).c_str());
+        fprintf(file, "      \"cpuMs\": { \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"min\": %.4f, \"max\": %.4f, \"mean\": %.4f },\n",
+                cpu.p50, cpu.p95, cpu.p99, cpu.min, cpu.max, cpu.mean);
+        fprintf(file, "      \"gpuMs\": { \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"min\": %.4f, \"max\": %.4f, \"mean\": %.4f } }%s\n",
+                gpu.p50, gpu.p95, gpu.p99, gpu.min, gpu.max, gpu.mean, i + 1 < series.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    return fclose(file) == 0;
+}
+
+static bool WriteCsv(const char* path, const std::vector<TimingSeries>& series)
+{
+    FILE* file = fopen(path, "w");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    fprintf(file, "pipeline,camera_path,renderpass,subpass,cpu_p50_ms,cpu_p95_ms,cpu_p99_ms,gpu_p50_ms,gpu_p95_ms,gpu_p99_ms\n");
+    for (const TimingSeries& s : series)
+    {
+        Percentiles cpu = ComputePercentiles(s.cpu);
+        Percentiles gpu = ComputePercentiles(s.gpu);
+        fprintf(file, "\"%s\",\"%s\",\"%s\",\"%s\",%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", s.pipeline.c_str(), s.cameraPath.c_str(),
+                s.renderpass.c_str(), s.subpass.c_str(), cpu.p50, cpu.p95, cpu.p99, gpu.p50, gpu.p95, gpu.p99);
+    }
+
+    return fclose(file) == 0;
+}
+
+// Needs a current context, everything GL side is released again before returning
+static bool RunBench(const BenchOptions& options, std::vector<std::pair<std::string, CameraPath>>& cameraPaths,
+        std::vector<TimingSeries>& series)
+{
+    SeedRandom(options.seed);
+    ShaderPool shaders;
+    Scene scene = TestScene();
+    std::vector<NamedPipeline> pipelines = TestPipelines(scene.globalAttachments, shaders);
+
+    OffscreenTarget target;
+    if (!target.Init(scene.sceneParams.viewportWidth, scene.sceneParams.viewportHeight))
+    {
+        LOG_ERROR("Bench", "Offscreen framebuffer is incomplete");
+        return false;
+    }
+    RenderPipeline::outputFramebuffer = target.fbo;
+
+    SceneSnapshot initialState;
+    initialState.Capture(scene);
+
+    for (NamedPipeline& namedPipeline : pipelines)
+    {
+        if (!SelectedPipeline(options, namedPipeline.name))
+        {
+            continue;
+        }
+
+        for (auto& cameraPath : cameraPaths)
+        {
+            LOG_INFO("Bench", "\"%s\" along %s: %d warmup + %d measured frames", namedPipeline.name, cameraPath.first.c_str(),
+                    options.warmupFrames, options.measuredFrames);
+
+            WarmUpPipeline(namedPipeline, scene, shaders, cameraPath.second);
+            initialState.Restore(scene, options.seed);
+
+            int firstSeries = series.size();
+            AddSeries(series, namedPipeline, cameraPath.first);
+
+            int frameCount = options.warmupFrames + options.measuredFrames;
+            for (int frame = 0; frame < frameCount; frame++)
+            {
+                // Warmup frames walk the path too, so measured frames always cover the same part of it
+                float t = frameCount > 1 ? (float)frame / (frameCount - 1) : 0.f;
+                cameraPath.second.Apply(cameraPath.second.keys.front().time + t * cameraPath.second.Duration(), scene.camera);
+                scene.Update(0.016f);
+                UpdateTransparentMeshOrder(namedPipeline, scene);
+
+                glBindFramebuffer(GL_FRAMEBUFFER, target.fbo);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                namedPipeline.pipeline.Render(scene, shaders);
+                // Blocks, so that RecordFrame's GPU times are this frame's and never a repeat or a previous run's
+                namedPipeline.pipeline.gpuTimer.Drain();
+
+                if (frame >= options.warmupFrames)
+                {
+                    RecordFrame(&series[firstSeries], namedPipeline);
+                }
+            }
+
+            Percentiles cpu = ComputePercentiles(series[firstSeries].cpu);
+            Percentiles gpu = ComputePercentiles(series[firstSeries].gpu);
+            LOG_INFO("Bench", "CPU p50/p95/p99 %.3f/%.3f/%.3f ms, GPU p50/p95/p99 %.3f/%.3f/%.3f ms",
+                    cpu.p50, cpu.p95, cpu.p99, gpu.p50, gpu.p95, gpu.p99);
+        }
+    }
+
+    RenderPipeline::outputFramebuffer = 0;
+    target.Deinit();
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    BenchOptions options;
+    if (!ParseBenchOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, CameraPath>> cameraPaths;
+    if (options.cameraPaths.empty())
+    {
+        cameraPaths.push_back(std::make_pair(std::string("default"), CameraPath::DefaultPath()));
+    }
+    for (std::string& path : options.cameraPaths)
+    {
+        CameraPath cameraPath;
+        if (!cameraPath.Load(path.c_str()))
+        {
+            return 1;
+        }
+        cameraPaths.push_back(std::make_pair(path, cameraPath));
+    }
+
+    if (!glfwInit())
+    {
+        return 1;
+    }
+
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    if (options.useEgl)
+    {
+        glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+    }
+
+    GLFWwindow* window = glfwCreateWindow(1920, 1080, "Ignoramus bench", NULL, NULL);
+    if (!window)
+    {
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    // Never wait for vsync, frames go to an offscreen target anyway
+    glfwSwapInterval(0);
+
+    if (glewInit() != GLEW_OK)
+    {
+        fprintf(stderr, "Failed initializing glew\n");
+        glfwTerminate();
+        return 1;
+    }
+
+    glEnable(GL_DEBUG_OUTPUT);
+    glDebugMessageCallback(GLLog, 0);
+
+    std::vector<TimingSeries> series;
+    bool ran = RunBench(options, cameraPaths, series);
+    glfwTerminate();
+    if (!ran)
+    {
+        return 1;
+    }
+
+    std::string jsonPath = options.outputPrefix + ".json";
+    std::string csvPath = options.outputPrefix + ".csv";
+    if (!WriteJson(jsonPath.c_str(), options, series) || !WriteCsv(csvPath.c_str(), series))
+    {
+        LOG_ERROR("Bench", "Failed writing %s/.csv", jsonPath.c_str());
+        return 1;
+    }
+    LOG_INFO("Bench", "Results written to %s and %s", jsonPath.c_str(), csvPath.c_str());
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "aabb.h"
+#include "bvh.h"
+#include "frustum_cull.h"
+
+// Times frustum culling of random boxes with AABB::ViewFrustumIntersect against the FrustumCull kernels and a BVH
+// query, and checks that they agree:
+//   ignoramus_cull_bench [--count N] [--repetitions R] [--seed S]
+
+struct CullBenchOptions
+{
+    int count = 100000;
+    int repetitions = 50;
+    unsigned int seed = 1337;
+};
+
+static bool ParseCullBenchOptions(int argc, char** argv, CullBenchOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        bool hasValue = i + 1 < argc;
+        if (strcmp(argv[i], "--count") == 0 && hasValue)
+            options.count = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--repetitions") == 0 && hasValue)
+            options.repetitions = std::max(atoi(argv[++i]), 1);
+        else if (strcmp(argv[i], "--seed") == 0 && hasValue)
+            options.seed = strtoul(argv[++i], nullptr, 10);
+        else
+        {
+            fprintf(stderr, "Usage: %s [--count N] [--repetitions R] [--seed S]\n", argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Best and median of the repetitions in ms
+static void Time(const char* name, int repetitions, const std::function<void()>& fn)
+{
+    std::vector<double> samples;
+    for (int i = 0; i < repetitions; i++)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        fn();
+        samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    printf("%-24s best %8.3f ms  median %8.3f ms\n", name, samples.front(), samples[samples.size() / 2]);
+}
+
+static int Mismatches(const std::vector<uint8_t>& expected, const std::vector<uint8_t>& actual)
+{
+    int mismatches = 0;
+    for (int i = 0; i < expected.size(); i++)
+    {
+        mismatches += expected[i] != actual[i];
+    }
+    return mismatches;
+}
+
+int main(int argc, char** argv)
+{
+    CullBenchOptions options;
+    if (!ParseCullBenchOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    // Camera at the origin looking down -z, boxes scattered around it so that roughly a sixth is visible
+    glm::mat4 projection = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 500.f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.f), glm::vec3(0.f, 0.f, -1.f), glm::vec3(0.f, 1.f, 0.f));
+    glm::mat4 viewProjection = projection * view;
+
+    std::mt19937 engine(options.seed);
+    std::uniform_real_distribution<float> position(-400.f, 400.f);
+    std::uniform_real_distribution<float> size(0.1f, 10.f);
+    std::vector<AABB> boxes;
+    BoundsSoA bounds;
+    boxes.reserve(options.count);
+    bounds.Reserve(options.count);
+    for (int i = 0; i < options.count; i++)
+    {
+        glm::vec3 center(position(engine), position(engine) * 0.25f, position(engine));
+        glm::vec3 extent(size(engine), size(engine), size(engine));
+        boxes.push_back(AABB(center - extent, center + extent));
+        bounds.Add(center, extent);
+    }
+
+    printf("%d boxes, %d repetitions, widest kernel %s\n", options.count, options.repetitions,
+            CullKernelName(CullKernel::AUTO));
+
+    std::vector<uint8_t> expected(options.count);
+    Time("ViewFrustumIntersect", options.repetitions, [&]()
+    {
+        for (int i = 0; i < boxes.size(); i++)
+        {
+            expected[i] = boxes[i].ViewFrustumIntersect(viewProjection) ? 0 : 1;
+        }
+    });
+
+    int visibleCount = 0;
+    for (uint8_t visible : expected)
+    {
+        visibleCount += visible;
+    }
+    printf("%d visible\n", visibleCount);
+
+    FrustumPlanes frustum(viewProjection);
+    std::vector<uint8_t> visible(options.count);
+    int totalMismatches = 0;
+    struct Run
+    {
+        const char* name;
+        CullKernel kernel;
+        bool parallel;
+    };
+    Run runs[] =
+    {
+        { "FrustumCull scalar", CullKernel::SCALAR, false },
+        { "FrustumCull SSE", CullKernel::SSE, false },
+        { "FrustumCull AVX2", CullKernel::AVX2, false },
+        { "FrustumCull parallel", CullKernel::AUTO, true },
+    };
+    for (Run& run : runs)
+    {
+        std::fill(visible.begin(), visible.end(), 0);
+        Time(run.name, options.repetitions, [&]()
+        {
+            FrustumCull(frustum, bounds, visible.data(), run.kernel, run.parallel);
+        });
+
+        int mismatches = Mismatches(expected, visible);
+        if (mismatches > 0)
+        {
+            printf("  %d results differ from ViewFrustumIntersect\n", mismatches);
+        }
+        totalMismatches += mismatches;
+    }
+
+    BVH bvh;
+    Time("BVH build", 1, [&]()
+    {
+        bvh.Build(boxes);
+    });
+    std::vector<int> items;
+    Time("BVH query", options.repetitions, [&]()
+    {
+        items.clear();
+        bvh.Query(frustum, items);
+    });
+    printf("  %d nodes, %d visited, SAH cost %.1f\n", (int)bvh.nodes.size(), bvh.visitedNodeCount, bvh.Cost());
+    std::fill(visible.begin(), visible.end(), 0);
+    for (int item : items)
+    {
+        visible[item] = 1;
+    }
+    int mismatches = Mismatches(expected, visible);
+    if (mismatches > 0)
+    {
+        printf("  %d results differ from ViewFrustumIntersect\n", mismatches);
+    }
+    totalMismatches += mismatches;
+
+    // Move every tenth box like a frame of animation would
+    std::uniform_real_distribution<float> offset(-2.f, 2.f);
+    for (int i = 0; i < boxes.size(); i += 10)
+    {
+        glm::vec3 delta(offset(engine), offset(engine), offset(engine));
+        boxes[i] = AABB(boxes[i].min + delta, boxes[i].max + delta);
+    }
+    Time("BVH refit 10%", 1, [&]()
+    {
+        for (int i = 0; i < boxes.size(); i += 10)
+        {
+            bvh.SetItemBounds(i, boxes[i]);
+        }
+        bvh.Refit();
+    });
+    printf("  SAH cost %.1f\n", bvh.Cost());
+    items.clear();
+    bvh.Query(frustum, items);
+    std::vector<uint8_t> movedExpected(options.count);
+    for (int i = 0; i < boxes.size(); i++)
+    {
+        movedExpected[i] = boxes[i].ViewFrustumIntersect(viewProjection) ? 0 : 1;
+    }
+    std::fill(visible.begin(), visible.end(), 0);
+    for (int item : items)
+    {
+        visible[item] = 1;
+    }
+    mismatches = Mismatches(movedExpected, visible);
+    if (mismatches > 0)
+    {
+        printf("  %d results differ from ViewFrustumIntersect after the refit\n", mismatches);
+    }
+    totalMismatches += mismatches;
+
+    return totalMismatches > 0 ? 1 : 0;
+}
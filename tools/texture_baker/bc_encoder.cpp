@@ -0,0 +1,226 @@
+#include "bc_encoder.h"
+
+#include <math.h>
+#include <string.h>
+
+static uint16_t To565(const float* color)
+{
+    int r = (int)(fminf(fmaxf(color[0], 0.f), 255.f) * 31.f / 255.f + 0.5f);
+    int g = (int)(fminf(fmaxf(color[1], 0.f), 255.f) * 63.f / 255.f + 0.5f);
+    int b = (int)(fminf(fmaxf(color[2], 0.f), 255.f) * 31.f / 255.f + 0.5f);
+    return (r << 11) | (g << 5) | b;
+}
+
+static void From565(uint16_t packed, float* color)
+{
+    int r = (packed >> 11) & 31;
+    int g = (packed >> 5) & 63;
+    int b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+static void WriteLE16(unsigned char* out, uint16_t value)
+{
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+void EncodeBC1Block(const unsigned char* rgba, unsigned char* out)
+{
+    // Endpoints are picked along the principal axis of the block's colors
+    float mean[3] = { 0.f, 0.f, 0.f };
+    for (int i = 0; i < 16; i++)
+        for (int c = 0; c < 3; c++)
+            mean[c] += rgba[i * 4 + c] / 16.f;
+
+    float covariance[6] = { 0.f };
+    for (int i = 0; i < 16; i++)
+    {
+        float d[3] = { rgba[i * 4 + 0] - mean[0], rgba[i * 4 + 1] - mean[1], rgba[i * 4 + 2] - mean[2] };
+        covariance[0] += d[0] * d[0];
+        covariance[1] += d[0] * d[1];
+        covariance[2] += d[0] * d[2];
+        covariance[3] += d[1] * d[1];
+        covariance[4] += d[1] * d[2];
+        covariance[5] += d[2] * d[2];
+    }
+
+    // A few power iterations are plenty for a 3x3 matrix
+    float axis[3] = { 1.f, 1.f, 1.f };
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+        float next[3] = {
+            covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+            covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+            covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2],
+        };
+        float length = fmaxf(fabsf(next[0]), fmaxf(fabsf(next[1]), fabsf(next[2])));
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+            axis[c] = next[c] / length;
+    }
+
+    float minProjection = INFINITY;
+    float maxProjection = -INFINITY;
+    int minIndex = 0;
+    int maxIndex = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        float projection = rgba[i * 4 + 0] * axis[0] + rgba[i * 4 + 1] * axis[1] + rgba[i * 4 + 2] * axis[2];
+        if (projection < minProjection)
+        {
+            minProjection = projection;
+            minIndex = i;
+        }
+        if (projection > maxProjection)
+        {
+            maxProjection = projection;
+            maxIndex = i;
+        }
+    }
+
+    float maxColor[3] = { (float)rgba[maxIndex * 4 + 0], (float)rgba[maxIndex * 4 + 1], (float)rgba[maxIndex * 4 + 2] };
+    float minColor[3] = { (float)rgba[minIndex * 4 + 0], (float)rgba[minIndex * 4 + 1], (float)rgba[minIndex * 4 + 2] };
+    uint16_t color0 = To565(maxColor);
+    uint16_t color1 = To565(minColor);
+    // color0 > color1 selects the 4 color mode
+    if (color0 < color1)
+    {
+        uint16_t tmp = color0;
+        color0 = color1;
+        color1 = tmp;
+    }
+
+    float palette[4][3];
+    From565(color0, palette[0]);
+    From565(color1, palette[1]);
+    for (int c = 0; c < 3; c++)
+    {
+        palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+        palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+    }
+
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float bestDistance = INFINITY;
+            for (int p = 0; p < 4; p++)
+            {
+                float distance = 0.f;
+                for (int c = 0; c < 3; c++)
+                {
+                    float d = rgba[i * 4 + c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= best << (i * 2);
+        }
+    }
+
+    WriteLE16(out + 0, color0);
+    WriteLE16(out + 2, color1);
+    for (int i = 0; i < 4; i++)
+        out[4 + i] = (indices >> (i * 8)) & 0xFF;
+}
+
+void EncodeBC4Block(const unsigned char* rgba, int channel, unsigned char* out)
+{
+    int maxValue = 0;
+    int minValue = 255;
+    for (int i = 0; i < 16; i++)
+    {
+        int value = rgba[i * 4 + channel];
+        maxValue = value > maxValue ? value : maxValue;
+        minValue = value < minValue ? value : minValue;
+    }
+
+    // value0 > value1 selects the 8 value interpolation mode
+    float palette[8];
+    palette[0] = maxValue;
+    palette[1] = minValue;
+    for (int k = 1; k <= 6; k++)
+        palette[k + 1] = ((7 - k) * maxValue + k * minValue) / 7.f;
+
+    uint64_t indices = 0;
+    if (maxValue != minValue)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0;
+            float bestDistance = INFINITY;
+            for (int p = 0; p < 8; p++)
+            {
+                float distance = fabsf(rgba[i * 4 + channel] - palette[p]);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= (uint64_t)best << (i * 3);
+        }
+    }
+
+    out[0] = maxValue;
+    out[1] = minValue;
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (indices >> (i * 8)) & 0xFF;
+}
+
+void EncodeBC3Block(const unsigned char* rgba, unsigned char* out)
+{
+    EncodeBC4Block(rgba, 3, out);
+    EncodeBC1Block(rgba, out + 8);
+}
+
+void EncodeBC5Block(const unsigned char* rgba, unsigned char* out)
+{
+    EncodeBC4Block(rgba, 0, out);
+    EncodeBC4Block(rgba, 1, out + 8);
+}
+
+void EncodeImage(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out)
+{
+    int blockSize = BlockSize(format);
+    unsigned char block[16 * 4];
+    for (int by = 0; by < height; by += 4)
+    {
+        for (int bx = 0; bx < width; bx += 4)
+        {
+            for (int y = 0; y < 4; y++)
+            {
+                int sy = by + y < height ? by + y : height - 1;
+                for (int x = 0; x < 4; x++)
+                {
+                    int sx = bx + x < width ? bx + x : width - 1;
+                    memcpy(&block[(y * 4 + x) * 4], &rgba[((long)sy * width + sx) * 4], 4);
+                }
+            }
+
+            switch (format)
+            {
+            case BlockFormat::BC1:
+                EncodeBC1Block(block, out);
+                break;
+            case BlockFormat::BC3:
+                EncodeBC3Block(block, out);
+                break;
+            case BlockFormat::BC5:
+                EncodeBC5Block(block, out);
+                break;
+            }
+            out += blockSize;
+        }
+    }
+}
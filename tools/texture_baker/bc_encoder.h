@@ -0,0 +1,14 @@
+#pragma once
+
+#include "compressed_texture.h"
+
+// Block compression encoders. Each takes a 4x4 block of RGBA8 texels in row major order.
+void EncodeBC1Block(const unsigned char* rgba, unsigned char* out);
+void EncodeBC3Block(const unsigned char* rgba, unsigned char* out);
+void EncodeBC5Block(const unsigned char* rgba, unsigned char* out);
+// Single channel block built from the given channel of rgba
+void EncodeBC4Block(const unsigned char* rgba, int channel, unsigned char* out);
+
+// Encodes a whole RGBA8 image into out, which has to hold CompressedTexture::LevelSize(format, width, height)
+// bytes. Partial blocks at the edges are padded by clamping to the last row/column.
+void EncodeImage(BlockFormat format, const unsigned char* rgba, int width, int height, unsigned char* out);
@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctype.h>
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "bc_encoder.h"
+#include "compressed_texture.h"
+#include "thread_pool.h"
+
+// Bakes every image under the given directories into a <image>.ctex container next to it. The
+// runtime texture pool picks the container up instead of decoding the source image.
+
+static std::string ToLower(std::string str)
+{
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return tolower(c); });
+    return str;
+}
+
+static bool IsBakeableImage(const std::string& path)
+{
+    static const char* extensions[] = { ".tga", ".png", ".jpg", ".jpeg", ".bmp" };
+
+    std::string lowerPath = ToLower(path);
+    for (const char* extension : extensions)
+    {
+        int length = strlen(extension);
+        if (lowerPath.size() > length && lowerPath.compare(lowerPath.size() - length, length, extension) == 0)
+            return true;
+    }
+    return false;
+}
+
+static void CollectImages(const std::string& directory, std::vector<std::string>& images)
+{
+    DIR* dir = opendir(directory.c_str());
+    if (dir == nullptr)
+    {
+        fprintf(stderr, "Cannot open directory %s\n", directory.c_str());
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+
+        std::string path = directory + "/" + entry->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            CollectImages(path, images);
+        else if (IsBakeableImage(path))
+            images.push_back(path);
+    }
+    closedir(dir);
+}
+
+static BlockFormat ChooseFormat(const std::string& path, const unsigned char* rgba, int width, int height)
+{
+    // Normal maps only keep xy, the shaders reconstruct z
+    std::string lowerPath = ToLower(path);
+    size_t nameStart = lowerPath.find_last_of('/');
+    if (lowerPath.find("normal", nameStart == std::string::npos ? 0 : nameStart) != std::string::npos)
+        return BlockFormat::BC5;
+
+    for (long i = 0; i < (long)width * height; i++)
+    {
+        if (rgba[i * 4 + 3] != 255)
+            return BlockFormat::BC3;
+    }
+
+    return BlockFormat::BC1;
+}
+
+// 2x2 box filter, odd dimensions clamp to the last row/column
+static void Downsample(const unsigned char* src, int width, int height, unsigned char* dst, bool normalMap)
+{
+    int dstWidth = std::max(width / 2, 1);
+    int dstHeight = std::max(height / 2, 1);
+    for (int y = 0; y < dstHeight; y++)
+    {
+        for (int x = 0; x < dstWidth; x++)
+        {
+            int x0 = std::min(x * 2, width - 1);
+            int x1 = std::min(x * 2 + 1, width - 1);
+            int y0 = std::min(y * 2, height - 1);
+            int y1 = std::min(y * 2 + 1, height - 1);
+
+            float sum[4];
+            for (int c = 0; c < 4; c++)
+            {
+                sum[c] = (src[((long)y0 * width + x0) * 4 + c] + src[((long)y0 * width + x1) * 4 + c] +
+                    src[((long)y1 * width + x0) * 4 + c] + src[((long)y1 * width + x1) * 4 + c]) / 4.f;
+            }
+
+            // Averaged normals get shorter, push them back onto the unit sphere
+            if (normalMap)
+            {
+                float n[3] = { sum[0] / 127.5f - 1.f, sum[1] / 127.5f - 1.f, sum[2] / 127.5f - 1.f };
+                float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (length > 1e-6f)
+                {
+                    for (int c = 0; c < 3; c++)
+                        sum[c] = (n[c] / length + 1.f) * 127.5f;
+                }
+            }
+
+            for (int c = 0; c < 4; c++)
+                dst[((long)y * dstWidth + x) * 4 + c] = (unsigned char)std::min(std::max(sum[c] + 0.5f, 0.f), 255.f);
+        }
+    }
+}
+
+static bool Bake(const std::string& source, const std::string& container, long& sourceBytes, long& bakedBytes)
+{
+    int width;
+    int height;
+    int componentNum;
+    // Same orientation as the runtime stb path
+    stbi_set_flip_vertically_on_load_thread(true);
+    unsigned char* pixels = stbi_load(source.c_str(), &width, &height, &componentNum, 4);
+    if (pixels == nullptr)
+    {
+        fprintf(stderr, "Failed loading %s: %s\n", source.c_str(), stbi_failure_reason());
+        return false;
+    }
+
+    CompressedTexture texture;
+    texture.format = ChooseFormat(source, pixels, width, height);
+    texture.width = width;
+    texture.height = height;
+
+    std::vector<unsigned char> level(pixels, pixels + (long)width * height * 4);
+    std::vector<unsigned char> nextLevel;
+    stbi_image_free(pixels);
+
+    int levelWidth = width;
+    int levelHeight = height;
+    while (true)
+    {
+        CompressedMipLevel mip;
+        mip.width = levelWidth;
+        mip.height = levelHeight;
+        mip.offset = texture.data.size();
+        mip.size = CompressedTexture::LevelSize(texture.format, levelWidth, levelHeight);
+        texture.levels.push_back(mip);
+
+        texture.data.resize(mip.offset + mip.size);
+        EncodeImage(texture.format, level.data(), levelWidth, levelHeight, texture.data.data() + mip.offset);
+
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+
+        nextLevel.resize((long)std::max(levelWidth / 2, 1) * std::max(levelHeight / 2, 1) * 4);
+        Downsample(level.data(), levelWidth, levelHeight, nextLevel.data(), texture.format == BlockFormat::BC5);
+        level.swap(nextLevel);
+        levelWidth = std::max(levelWidth / 2, 1);
+        levelHeight = std::max(levelHeight / 2, 1);
+    }
+
+    if (!texture.Write(container.c_str()))
+    {
+        fprintf(stderr, "Failed writing %s\n", container.c_str());
+        return false;
+    }
+
+    // What the runtime used to keep resident: source channels plus a third for the generated mips
+    sourceBytes = (long)width * height * componentNum * 4 / 3;
+    bakedBytes = texture.data.size();
+    printf("%s: %dx%d %s, %lu levels, %.2f MB -> %.2f MB\n", source.c_str(), width, height, ToString(texture.format),
+            texture.levels.size(), sourceBytes / (1024.f * 1024.f), bakedBytes / (1024.f * 1024.f));
+
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool force = false;
+    std::vector<std::string> directories;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--force") == 0)
+            force = true;
+        else
+            directories.push_back(argv[i]);
+    }
+
+    if (directories.empty())
+    {
+        fprintf(stderr, "Usage: %s [--force] <directory>...\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> images;
+    for (std::string& directory : directories)
+    {
+        CollectImages(directory, images);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::atomic<long> totalSourceBytes(0);
+    std::atomic<long> totalBakedBytes(0);
+    std::atomic<int> baked(0);
+    std::atomic<int> failed(0);
+    ThreadPool pool;
+    pool.ParallelFor(images.size(), [&](int i)
+        {
+            if (!force && CompressedTexture::HasUpToDateContainer(images[i].c_str()))
+                return;
+            std::string container = CompressedTexture::ContainerPath(images[i].c_str());
+
+            long sourceBytes = 0;
+            long bakedBytes = 0;
+            if (Bake(images[i], container, sourceBytes, bakedBytes))
+            {
+                baked++;
+                totalSourceBytes += sourceBytes;
+                totalBakedBytes += bakedBytes;
+            }
+            else
+            {
+                failed++;
+            }
+        });
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("Baked %d of %lu images (%d failed) in %.2fs, %.2f MB -> %.2f MB\n", baked.load(), images.size(), failed.load(), seconds,
+            totalSourceBytes / (1024.f * 1024.f), totalBakedBytes / (1024.f * 1024.f));
+
+    return failed > 0 ? 1 : 0;
+}